@@ -0,0 +1,116 @@
+#pragma once
+
+#ifndef LETC_BENCH_HEADLESS_HH
+#define LETC_BENCH_HEADLESS_HH
+
+#include "pch.hh"
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Device.hh"
+#include "Image.hh"
+#include "Instance.hh"
+
+namespace letc::bench
+{
+    // instance, device and allocator without a window system, everything renders offscreen
+    struct HeadlessContext
+    {
+        std::unique_ptr<Instance> instance;
+        std::unique_ptr<Device> device;
+        std::unique_ptr<Allocator> allocator;
+
+        HeadlessContext()
+        {
+            VULKAN_HPP_DEFAULT_DISPATCHER.init();
+            instance = std::make_unique<Instance>(InstanceBuilder{}.setHeadless(true));
+            VULKAN_HPP_DEFAULT_DISPATCHER.init(instance->instance);
+            device = std::make_unique<Device>(*instance, true);
+            VULKAN_HPP_DEFAULT_DISPATCHER.init(device->device);
+            allocator = std::make_unique<Allocator>(*instance, *device);
+        }
+
+        // bytes VMA currently has allocated from every heap, and what the heaps allow
+        std::pair<uint64_t, uint64_t> memoryUsage() const
+        {
+            uint64_t usage = 0;
+            uint64_t budget = 0;
+            for (const VmaBudget &heap : allocator->budgets())
+            {
+                usage += heap.statistics.allocationBytes;
+                budget += heap.budget;
+            }
+            return {usage, budget};
+        }
+
+        ~HeadlessContext()
+        {
+            device->flushDeletions();
+        }
+    };
+
+    // color + depth images to render into in place of a swapchain
+    struct OffscreenTarget
+    {
+        static constexpr vk::Format colorFormat = vk::Format::eR8G8B8A8Unorm;
+        static constexpr vk::Format depthFormat = vk::Format::eD32Sfloat;
+
+        vk::Extent2D extent;
+        std::unique_ptr<Image> color;
+        std::unique_ptr<Image> depth;
+
+        OffscreenTarget(const Allocator &allocator, const vk::Extent2D &extent) : extent(extent)
+        {
+            ImageDesc colorDesc;
+            colorDesc.extent = extent;
+            colorDesc.format = colorFormat;
+            colorDesc.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+            color = std::make_unique<Image>(allocator, colorDesc);
+
+            ImageDesc depthDesc;
+            depthDesc.extent = extent;
+            depthDesc.format = depthFormat;
+            depthDesc.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+            depth = std::make_unique<Image>(allocator, depthDesc);
+        }
+
+        // transition both attachments (contents discarded) and begin rendering into them
+        void begin(const vk::CommandBuffer &commandBuffer)
+        {
+            std::vector<vk::ImageMemoryBarrier2> barriers;
+            color->transition(barriers, ImageState::colorAttachment(), std::nullopt, true);
+            depth->transition(barriers, ImageState::depthAttachment(), std::nullopt, true);
+            commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(barriers));
+
+            vk::RenderingAttachmentInfo colorAttachment{};
+            colorAttachment.setImageView(color->view);
+            colorAttachment.setImageLayout(vk::ImageLayout::eColorAttachmentOptimal);
+            colorAttachment.setLoadOp(vk::AttachmentLoadOp::eClear);
+            colorAttachment.setStoreOp(vk::AttachmentStoreOp::eStore);
+            colorAttachment.setClearValue(vk::ClearValue{}.setColor(vk::ClearColorValue{}.setFloat32({0, 0, 0, 1})));
+
+            vk::RenderingAttachmentInfo depthAttachment{};
+            depthAttachment.setImageView(depth->view);
+            depthAttachment.setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+            depthAttachment.setLoadOp(vk::AttachmentLoadOp::eClear);
+            depthAttachment.setStoreOp(vk::AttachmentStoreOp::eDontCare);
+            depthAttachment.setClearValue(vk::ClearDepthStencilValue{1.0f, 0});
+
+            commandBuffer.beginRendering(vk::RenderingInfo{}
+                                             .setRenderArea(vk::Rect2D{{0, 0}, extent})
+                                             .setLayerCount(1)
+                                             .setColorAttachments(colorAttachment)
+                                             .setPDepthAttachment(&depthAttachment));
+        }
+
+        // new sizes reuse the attachments' memory when they fit
+        void resize(const vk::Extent2D &newExtent)
+        {
+            extent = newExtent;
+            color->resize(extent);
+            depth->resize(extent);
+        }
+    };
+}; // namespace letc::bench
+
+#endif // LETC_BENCH_HEADLESS_HH
@@ -0,0 +1,250 @@
+#pragma once
+
+#ifndef LETC_BENCH_MICRO_HH
+#define LETC_BENCH_MICRO_HH
+
+#include "pch.hh"
+
+#include <chrono>
+#include <numeric>
+
+#include "JobSystem.hh"
+#include "Material.hh"
+#include "Model.hh"
+#include "PipelineVariants.hh"
+
+#include "Headless.hh"
+#include "Report.hh"
+#include "SyntheticScene.hh"
+
+namespace letc::bench
+{
+    // run function a few times untimed, then time every one of iterations runs in microseconds
+    template <typename F> std::vector<double> sample(const uint32_t &iterations, const F &function)
+    {
+        for (uint32_t i = 0; i < std::min(iterations, 3u); i++)
+        {
+            function();
+        }
+
+        std::vector<double> samples;
+        samples.reserve(iterations);
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            function();
+            samples.push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        return samples;
+    }
+
+    // the cpu side hot paths on their own, each reported as the median of its samples
+    struct Micro
+    {
+        HeadlessContext &context;
+
+        Micro(HeadlessContext &context) : context(context)
+        {
+        }
+
+        void run(Report &report)
+        {
+            modelImport(report);
+            bufferCopy(report);
+            descriptorUpdates(report);
+            pipelineCreation(report);
+            jobScaling(report);
+            jobStress(report);
+        }
+
+        void modelImport(Report &report)
+        {
+            std::filesystem::path resources(LETC_RESOURCE_DIR);
+            for (const char *name : {"Box.glb", "pointy.glb"})
+            {
+                std::vector<double> samples =
+                    sample(20, [&] { Model model(*context.allocator, resources / name); });
+                std::string metric = std::filesystem::path(name).stem().string();
+                report.add("import_" + metric + "_us", percentile(samples, 50.0));
+            }
+        }
+
+        void bufferCopy(Report &report)
+        {
+            for (vk::DeviceSize size : {vk::DeviceSize{4} << 10, vk::DeviceSize{256} << 10, vk::DeviceSize{4} << 20})
+            {
+                Buffer buffer(*context.allocator, size, vk::BufferUsageFlagBits::eStorageBuffer,
+                              VMA_MEMORY_USAGE_CPU_TO_GPU);
+                std::vector<char> data(size, 1);
+                std::vector<double> samples = sample(200, [&] { buffer.cpy(data.data(), size); });
+
+                double us = percentile(samples, 50.0);
+                std::string metric = std::format("buffer_cpy_{}k", size >> 10);
+                report.add(metric + "_us", us);
+                report.add(metric + "_mb_s", size / us);
+            }
+        }
+
+        void descriptorUpdates(Report &report)
+        {
+            const Device &device = *context.device;
+            auto layout = pbrDescriptorLayout(device);
+            Material material(device, *context.allocator, *layout);
+            Buffer buffer(*context.allocator, 1 << 16,
+                          vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+                          VMA_MEMORY_USAGE_GPU_ONLY);
+            for (uint32_t binding = 0; binding < 4; binding++)
+            {
+                material.updateDescriptorBufferInfo(0, binding, buffer, 0, 256);
+            }
+
+            std::vector<double> samples = sample(1000, [&] { material.updateDescriptorSets(); });
+            report.add("descriptor_update_us", percentile(samples, 50.0));
+        }
+
+        // every variant is a fresh compile since the cache is thrown away each iteration
+        void pipelineCreation(Report &report)
+        {
+            const Device &device = *context.device;
+            auto layout = pbrDescriptorLayout(device);
+            GraphicsPipelineBuilder gpb = pbrPipelineBuilder(device, *layout);
+
+            std::vector<double> samples = sample(10,
+                                                 [&]
+                                                 {
+                                                     PipelineVariants variants(device, gpb);
+                                                     PipelinePermutation permutation{};
+                                                     permutation.attributeMask = (1u << LETC_ATTRIBUTE_COUNT) - 1;
+                                                     permutation.maxLights = 4;
+                                                     variants.get(permutation);
+                                                 });
+            report.add("pipeline_create_us", percentile(samples, 50.0));
+        }
+
+        // the same fixed amount of math split over 1, 2, 4 ... hardware threads
+        void jobScaling(Report &report)
+        {
+            constexpr size_t count = 1 << 20;
+            std::vector<float> values(count);
+            std::iota(values.begin(), values.end(), 0.0f);
+
+            double singleUs = 0.0;
+            uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+            for (uint32_t threads = 1; threads <= hardware; threads *= 2)
+            {
+                JobSystem jobs(threads);
+                std::vector<double> samples =
+                    sample(20,
+                           [&]
+                           {
+                               jobs.parallelFor(count, 4096,
+                                                [&](size_t begin, size_t end)
+                                                {
+                                                    for (size_t i = begin; i < end; i++)
+                                                    {
+                                                        values[i] = std::sqrt(values[i] * values[i] + 1.0f);
+                                                    }
+                                                });
+                           });
+
+                double us = percentile(samples, 50.0);
+                if (threads == 1)
+                {
+                    singleUs = us;
+                }
+                report.add(std::format("parallel_for_{}t_us", threads), us);
+                report.add(std::format("parallel_for_{}t_speedup", threads), singleUs / us);
+            }
+        }
+
+        // nested submits and waits, submitAfter() chains and throwing jobs mixed on every thread. every job
+        // has to run exactly once, a chain in order, and every exception has to come out of the wait() for
+        // its own counter. anything else throws and fails the run
+        void jobStress(Report &report)
+        {
+            constexpr uint32_t roots = 64;
+            constexpr uint32_t children = 16;
+            constexpr uint32_t links = 8;
+            constexpr uint32_t throwing = 8;
+            JobSystem jobs(std::max(2u, std::thread::hardware_concurrency()));
+
+            std::vector<double> samples = sample(
+                20,
+                [&]
+                {
+                    std::atomic<uint32_t> ran{0};
+                    JobCounter tree;
+                    for (uint32_t r = 0; r < roots; r++)
+                    {
+                        jobs.submit(
+                            [&]
+                            {
+                                JobCounter nested;
+                                for (uint32_t c = 0; c < children; c++)
+                                {
+                                    jobs.submit([&] { ran.fetch_add(1, std::memory_order_relaxed); }, &nested);
+                                }
+                                jobs.wait(nested);
+                                ran.fetch_add(1, std::memory_order_relaxed);
+                            },
+                            &tree);
+                    }
+
+                    std::array<JobCounter, links> chain;
+                    std::atomic<uint32_t> stage{0};
+                    for (uint32_t i = 0; i < links; i++)
+                    {
+                        auto link = [&stage, i]
+                        {
+                            assertThrow(stage.load() == i, "submitAfter chain ran out of order");
+                            stage.store(i + 1);
+                        };
+                        if (i == 0)
+                        {
+                            jobs.submit(link, &chain[0]);
+                        }
+                        else
+                        {
+                            jobs.submitAfter(chain[i - 1], link, &chain[i]);
+                        }
+                    }
+
+                    JobCounter failing;
+                    for (uint32_t i = 0; i < throwing; i++)
+                    {
+                        jobs.submit([] { throw std::runtime_error("expected"); }, &failing);
+                    }
+
+                    jobs.wait(tree);
+                    jobs.wait(chain[links - 1]);
+                    bool caught = false;
+                    try
+                    {
+                        jobs.wait(failing);
+                    }
+                    catch (const std::runtime_error &)
+                    {
+                        caught = true;
+                    }
+                    assertThrow(caught, "a throwing job's exception never reached its wait");
+                    assertThrow(ran.load() == roots * (children + 1), "a nested job was lost or ran twice");
+                    assertThrow(stage.load() == links, "a submitAfter chain didn't finish");
+                });
+            report.add("job_stress_us", percentile(samples, 50.0));
+
+            // jobs without a counter are reported, not rethrown into whichever thread happened to run them
+            for (uint32_t i = 0; i < 2; i++)
+            {
+                jobs.submit([] { throw std::runtime_error("expected uncounted job failure"); });
+            }
+            while (jobs.uncountedFailures.load() < 2)
+            {
+                std::this_thread::yield();
+            }
+            assertThrow(jobs.takeError() && !jobs.takeError(), "uncounted job failures weren't kept");
+        }
+    };
+}; // namespace letc::bench
+
+#endif // LETC_BENCH_MICRO_HH
@@ -0,0 +1,171 @@
+#pragma once
+
+#ifndef LETC_BENCH_REPORT_HH
+#define LETC_BENCH_REPORT_HH
+
+#include "pch.hh"
+
+#include <regex>
+
+namespace letc::bench
+{
+    // nearest rank percentile, p in [0, 100]
+    inline double percentile(std::vector<double> samples, const double &p)
+    {
+        if (samples.empty())
+        {
+            return 0.0;
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    }
+
+    inline double mean(const std::vector<double> &samples)
+    {
+        if (samples.empty())
+        {
+            return 0.0;
+        }
+        double sum = 0.0;
+        for (double sample : samples)
+        {
+            sum += sample;
+        }
+        return sum / samples.size();
+    }
+
+    // metrics whose name ends like this get better as they grow, everything else is a cost
+    inline bool higherIsBetter(const std::string &metric)
+    {
+        return metric.ends_with("_per_sec") || metric.ends_with("_mb_s") || metric.ends_with("_speedup");
+    }
+
+    struct Comparison
+    {
+        std::string metric;
+        double baseline;
+        double current;
+        double deltaPercent; // positive is worse
+        bool regressed;
+    };
+
+    // flat name -> value metrics plus free form info, written as json so runs can be diffed and
+    // fed back in as a baseline
+    struct Report
+    {
+        std::vector<std::pair<std::string, std::string>> info;
+        std::vector<std::pair<std::string, double>> metrics;
+        std::vector<Comparison> comparisons;
+
+        Report &addInfo(const std::string &key, const std::string &value)
+        {
+            info.push_back({key, value});
+            return *this;
+        }
+
+        Report &add(const std::string &metric, const double &value)
+        {
+            metrics.push_back({metric, value});
+            return *this;
+        }
+
+        // add _p50/_p90/_p99/_max/_avg for a set of samples
+        Report &addDistribution(const std::string &metric, const std::vector<double> &samples)
+        {
+            add(metric + "_avg", mean(samples));
+            add(metric + "_p50", percentile(samples, 50.0));
+            add(metric + "_p90", percentile(samples, 90.0));
+            add(metric + "_p99", percentile(samples, 99.0));
+            add(metric + "_max", percentile(samples, 100.0));
+            return *this;
+        }
+
+        // compare against the "metrics" object of an earlier report, returns false on any regression
+        // beyond thresholdPercent
+        bool compare(const std::map<std::string, double> &baseline, const double &thresholdPercent)
+        {
+            bool ok = true;
+            for (const auto &[metric, value] : metrics)
+            {
+                auto found = baseline.find(metric);
+                if (found == baseline.end() || found->second == 0.0)
+                {
+                    continue;
+                }
+
+                double delta = (value - found->second) / std::abs(found->second) * 100.0;
+                if (higherIsBetter(metric))
+                {
+                    delta = -delta;
+                }
+                bool regressed = delta > thresholdPercent;
+                comparisons.push_back(Comparison{metric, found->second, value, delta, regressed});
+                ok = ok && !regressed;
+            }
+            return ok;
+        }
+
+        std::string json() const
+        {
+            std::string text = "{\n  \"info\": {";
+            for (size_t i = 0; i < info.size(); i++)
+            {
+                text += std::format("{}\n    \"{}\": \"{}\"", i ? "," : "", info[i].first, info[i].second);
+            }
+            text += "\n  },\n  \"metrics\": {";
+            for (size_t i = 0; i < metrics.size(); i++)
+            {
+                text += std::format("{}\n    \"{}\": {:.6g}", i ? "," : "", metrics[i].first, metrics[i].second);
+            }
+            text += "\n  }";
+            if (!comparisons.empty())
+            {
+                text += ",\n  \"comparison\": {";
+                for (size_t i = 0; i < comparisons.size(); i++)
+                {
+                    const Comparison &c = comparisons[i];
+                    text += std::format(
+                        "{}\n    \"{}\": {{\"baseline\": {:.6g}, \"current\": {:.6g}, \"delta_pct\": {:.2f}, "
+                        "\"regressed\": {}}}",
+                        i ? "," : "", c.metric, c.baseline, c.current, c.deltaPercent, c.regressed);
+                }
+                text += "\n  }";
+            }
+            text += "\n}\n";
+            return text;
+        }
+
+        void write(const std::filesystem::path &path) const
+        {
+            std::ofstream file(path);
+            assertThrow(file, "failed to open report file: " + path.string());
+            file << json();
+        }
+
+        // only the flat "metrics" object of a previously written report is read back
+        static std::map<std::string, double> readMetrics(const std::filesystem::path &path)
+        {
+            std::vector<char> bytes = readFile(path);
+            std::string text(bytes.begin(), bytes.end());
+
+            size_t start = text.find("\"metrics\"");
+            assertThrow(start != std::string::npos, "baseline has no metrics: " + path.string());
+            start = text.find('{', start);
+            size_t end = text.find('}', start);
+            assertThrow(start != std::string::npos && end != std::string::npos,
+                        "baseline metrics are malformed: " + path.string());
+
+            std::map<std::string, double> metrics;
+            std::string body = text.substr(start + 1, end - start - 1);
+            std::regex pair(R"re("([^"]+)"\s*:\s*(-?[0-9.]+(?:[eE][-+]?[0-9]+)?))re");
+            for (auto it = std::sregex_iterator(body.begin(), body.end(), pair); it != std::sregex_iterator(); ++it)
+            {
+                metrics[(*it)[1].str()] = std::stod((*it)[2].str());
+            }
+            return metrics;
+        }
+    };
+}; // namespace letc::bench
+
+#endif // LETC_BENCH_REPORT_HH
@@ -0,0 +1,463 @@
+#pragma once
+
+#ifndef LETC_BENCH_SYNTHETICSCENE_HH
+#define LETC_BENCH_SYNTHETICSCENE_HH
+
+#include "pch.hh"
+
+#include <chrono>
+#include <numbers>
+
+#include "Camera.hh"
+#include "Descriptor.hh"
+#include "GpuProfiler.hh"
+#include "Layout.hh"
+#include "Material.hh"
+#include "Model.hh"
+#include "Pipeline.hh"
+#include "PipelineVariants.hh"
+#include "SceneBuffer.hh"
+#include "StaticBatcher.hh"
+#include "Stats.hh"
+#include "Texture.hh"
+
+#include "Headless.hh"
+#include "Report.hh"
+
+namespace letc::bench
+{
+    struct SceneConfig
+    {
+        uint32_t instances = 1000;
+        uint32_t lights = 4;
+        uint32_t materials = 4;
+        uint32_t frames = 600;
+        uint32_t warmupFrames = 60;
+        float animatedFraction = 0.05f; // share of instances moved (and re-uploaded) every frame
+        vk::Extent2D extent{1280, 720};
+        // merge the instances that never move into a draw per model, material and cell. the animated share
+        // is then a fixed set of instances, unbatched, instead of changing every frame
+        bool staticBatching = false;
+        float batchCellSize = 24.0f;
+    };
+
+    // the pbr pass exactly as the app sets it up, only rendering into the offscreen formats
+    inline GraphicsPipelineBuilder pbrPipelineBuilder(const Device &device, const DescriptorLayout &layout)
+    {
+        std::filesystem::path shaders(LETC_SHADER_DIR);
+
+        GraphicsPipelineBuilder gpb;
+        gpb.addShaderStage(readFile(shaders / "pbr.vert.spv"), vk::ShaderStageFlagBits::eVertex);
+        gpb.addShaderStage(readFile(shaders / "pbr.frag.spv"), vk::ShaderStageFlagBits::eFragment);
+        gpb.addVertexInputBinding(0, sizeof(glm::vec4), vk::VertexInputRate::eVertex); // Position
+        gpb.addVertexInputAttribute(0, 0, vk::Format::eR32G32B32A32Sfloat, 0);
+        gpb.addVertexInputBinding(1, sizeof(glm::vec4), vk::VertexInputRate::eVertex); // Normal
+        gpb.addVertexInputAttribute(1, 1, vk::Format::eR32G32B32A32Sfloat, 0);
+        gpb.addVertexInputBinding(2, sizeof(glm::vec4), vk::VertexInputRate::eVertex); // Tangent
+        gpb.addVertexInputAttribute(2, 2, vk::Format::eR32G32B32A32Sfloat, 0);
+        gpb.addVertexInputBinding(3, sizeof(glm::vec2), vk::VertexInputRate::eVertex); // UV
+        gpb.addVertexInputAttribute(3, 3, vk::Format::eR32G32Sfloat, 0);
+        gpb.setLayout(&layout);
+        gpb.addPushConstantRange(
+            vk::PushConstantRange{}
+                .setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment)
+                .setOffset(0)
+                .setSize(sizeof(gpu::DrawRecord)));
+        gpb.renderingInfo.setColorAttachmentCount(1);
+        gpb.renderingInfo.setPColorAttachmentFormats(&OffscreenTarget::colorFormat);
+        gpb.renderingInfo.setDepthAttachmentFormat(OffscreenTarget::depthFormat);
+        gpb.setRasterization(gpb.rasterizationInfo.setCullMode(vk::CullModeFlagBits::eNone));
+        gpb.setDynamicRenderState(device);
+        gpb.setShaderObjects(device.capabilities.shaderObject);
+        return gpb;
+    }
+
+    inline std::unique_ptr<DescriptorLayout> pbrDescriptorLayout(const Device &device)
+    {
+        auto layout = std::make_unique<DescriptorLayout>(device);
+        layout->addBinding(0, 0, vk::DescriptorType::eUniformBuffer,
+                           vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 1);
+        layout->addBinding(0, 1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eFragment, 1);
+        layout->addBinding(0, 2, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex, 1);
+        layout->addBinding(0, 3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eVertex, 1);
+        layout->addBinding(1, 0, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eFragment, 1);
+        layout->generateLayouts();
+        return layout;
+    }
+
+    // a grid of Box.glb / pointy.glb instances lit by a ring of lights, flown over by a camera on a
+    // fixed path so two runs with the same config draw exactly the same frames
+    struct SyntheticScene
+    {
+        HeadlessContext &context;
+        SceneConfig config;
+
+        std::vector<std::unique_ptr<Model>> models;
+        std::unique_ptr<Buffer> globals;
+        std::unique_ptr<Camera> camera;
+        std::unique_ptr<SceneBuffer<gpu::Light>> lights;
+        std::unique_ptr<SceneBuffer<gpu::InstanceData>> instances;
+        std::vector<glm::vec3> basePositions;
+        // level each instance was drawn at last frame
+        std::vector<uint32_t> instanceLods;
+        // with config.staticBatching, batches are drawn with the identity instance after the real ones
+        std::vector<std::shared_ptr<const MeshData>> meshData;
+        std::unique_ptr<StaticBatcher> batcher;
+        std::vector<StaticBatcher::ObjectId> batchObjects;
+        uint32_t identitySlot = 0;
+
+        std::unique_ptr<DescriptorLayout> layout;
+        std::unique_ptr<SamplerCache> samplers;
+        std::unique_ptr<Texture> white;
+        std::vector<std::unique_ptr<Material>> materials;
+        std::unique_ptr<PipelineVariants> variants;
+        RenderState renderState;
+        std::unique_ptr<OffscreenTarget> target;
+
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+        std::unique_ptr<GpuProfiler> profiler;
+        float sceneRadius = 1.0f;
+
+        SyntheticScene(HeadlessContext &context, const SceneConfig &config) : context(context), config(config)
+        {
+            const Allocator &allocator = *context.allocator;
+            const Device &device = *context.device;
+
+            std::filesystem::path resources(LETC_RESOURCE_DIR);
+            for (const char *name : {"Box.glb", "pointy.glb"})
+            {
+                MeshData mesh = importMesh(resources / name);
+                if (config.staticBatching)
+                {
+                    meshData.push_back(std::make_shared<const MeshData>(mesh));
+                }
+                models.push_back(std::make_unique<Model>(allocator, std::move(mesh)));
+            }
+            for (auto &model : models)
+            {
+                model->cpyAttributes();
+            }
+
+            globals = std::make_unique<Buffer>(allocator, sizeof(gpu::GlobalUniforms),
+                                               vk::BufferUsageFlagBits::eUniformBuffer, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            camera = std::make_unique<Camera>(allocator, glm::vec4(0, 0, 10, 1), glm::vec4(0, 0, 0, 1),
+                                              glm::vec4(0, 1, 0, 0), 60.0f,
+                                              static_cast<float>(config.extent.width) / config.extent.height);
+
+            // cube grid with 3 units between instances
+            uint32_t side = std::max(1u, static_cast<uint32_t>(std::ceil(std::cbrt(config.instances))));
+            sceneRadius = side * 3.0f;
+            std::vector<gpu::InstanceData> initialInstances(config.instances);
+            for (uint32_t i = 0; i < config.instances; i++)
+            {
+                glm::vec3 position = glm::vec3(i % side, (i / side) % side, i / (side * side)) * 3.0f -
+                                     glm::vec3(side * 1.5f);
+                basePositions.push_back(position);
+                initialInstances[i] = instanceAt(position, 0.0f);
+            }
+            instanceLods.resize(config.instances, 0);
+            if (config.staticBatching)
+            {
+                identitySlot = config.instances;
+                initialInstances.push_back({glm::mat4(1.0f), glm::mat4(1.0f)});
+                batcher = std::make_unique<StaticBatcher>(allocator, config.batchCellSize);
+                for (uint32_t i = 0; i < config.instances; i++)
+                {
+                    const uint32_t modelIndex = i % static_cast<uint32_t>(models.size());
+                    batchObjects.push_back(
+                        batcher->add(meshData[modelIndex], initialInstances[i].model, batchKey(i)));
+                }
+                // the animated share starts moving right away
+                for (uint32_t i = 0; i < animatedCount(); i++)
+                {
+                    batcher->unbatch(batchObjects[animatedInstance(i, 0)]);
+                }
+            }
+            instances = std::make_unique<SceneBuffer<gpu::InstanceData>>(
+                allocator, initialInstances, vk::BufferUsageFlagBits::eStorageBuffer,
+                vk::PipelineStageFlagBits::eVertexShader, vk::AccessFlagBits::eShaderRead);
+
+            std::vector<gpu::Light> initialLights(std::max(1u, config.lights));
+            for (uint32_t i = 0; i < initialLights.size(); i++)
+            {
+                float angle = 2.0f * std::numbers::pi_v<float> * i / initialLights.size();
+                initialLights[i].position = glm::vec4(std::cos(angle) * sceneRadius, sceneRadius * 0.5f,
+                                                      std::sin(angle) * sceneRadius, 1.0f);
+                initialLights[i].color = glm::vec4(glm::vec3(1.0f / initialLights.size()), 1.0f);
+            }
+            lights = std::make_unique<SceneBuffer<gpu::Light>>(allocator, initialLights,
+                                                               vk::BufferUsageFlagBits::eStorageBuffer,
+                                                               vk::PipelineStageFlagBits::eFragmentShader,
+                                                               vk::AccessFlagBits::eShaderRead);
+
+            // every material is its own descriptor set, draws are grouped so each is bound once
+            layout = pbrDescriptorLayout(device);
+            samplers = std::make_unique<SamplerCache>(device);
+            TextureData whiteData = solidTextureData(255, 255, 255);
+            white = std::make_unique<Texture>(allocator, whiteData, false);
+            white->uploadNow(whiteData);
+            for (uint32_t i = 0; i < std::max(1u, config.materials); i++)
+            {
+                auto material = std::make_unique<Material>(device, allocator, *layout);
+                material->updateDescriptorBufferInfo(0, 0, globals->buffer, 0, sizeof(gpu::GlobalUniforms));
+                material->updateDescriptorBufferInfo(0, 1, *lights, 0, lights->sizeBytes());
+                material->updateDescriptorBufferInfo(0, 2, camera->buffer->buffer, 0, sizeof(Camera::Uniform));
+                material->updateDescriptorBufferInfo(0, 3, *instances, 0, instances->sizeBytes());
+                material->updateDescriptorImageInfo(1, 0, *white, samplers->get());
+                material->updateDescriptorSets();
+                materials.push_back(std::move(material));
+            }
+
+            target = std::make_unique<OffscreenTarget>(allocator, config.extent);
+            variants = std::make_unique<PipelineVariants>(device, pbrPipelineBuilder(device, *layout));
+            renderState.cullMode = vk::CullModeFlagBits::eNone;
+            renderState.setExtent(config.extent);
+
+            commandPool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(device.graphicsQueueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+            commandBuffer = device.device
+                                .allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+                                                            .setCommandPool(commandPool)
+                                                            .setCommandBufferCount(1)
+                                                            .setLevel(vk::CommandBufferLevel::ePrimary))
+                                .at(0);
+            profiler = std::make_unique<GpuProfiler>(device, *device.graphicsTimeline);
+        }
+
+        PipelinePermutation permutation(const Model &model) const
+        {
+            PipelinePermutation result{};
+            result.attributeMask = model.attributeMask;
+            result.maxLights = static_cast<uint32_t>(lights->size());
+            return result;
+        }
+
+        // instance i draws model i % models with material (i / models) % materials
+        uint64_t batchKey(const uint32_t &instance) const
+        {
+            const uint32_t modelCount = static_cast<uint32_t>(models.size());
+            const uint32_t material = (instance / modelCount) % std::max(1u, config.materials);
+            return material * modelCount + instance % modelCount;
+        }
+
+        uint32_t animatedCount() const
+        {
+            return static_cast<uint32_t>(config.instances * config.animatedFraction);
+        }
+
+        // the i-th instance moved on frame, always the same ones when static batching
+        uint32_t animatedInstance(const uint32_t &i, const uint32_t &frame) const
+        {
+            return (i * 7919u + (config.staticBatching ? 0 : frame)) % config.instances;
+        }
+
+        gpu::InstanceData instanceAt(const glm::vec3 &position, const float &angle) const
+        {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), position) *
+                              glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+            return gpu::InstanceData{model, glm::inverseTranspose(model)};
+        }
+
+        // records and submits frames back to back with one in flight, like the app does
+        void run(Report &report)
+        {
+            const Device &device = *context.device;
+            Timeline &timeline = *device.graphicsTimeline;
+            uint32_t totalFrames = config.warmupFrames + config.frames;
+            uint32_t animated = animatedCount();
+
+            std::vector<double> cpuFrameMs;
+            std::vector<double> recordMs;
+            uint64_t frameValue = 0;
+            uint64_t draws = 0;
+            StatsRegistry &stats = StatsRegistry::get();
+            StatValues statsAtStart{};
+
+            auto runStart = std::chrono::steady_clock::now();
+            for (uint32_t frame = 0; frame < totalFrames; frame++)
+            {
+                if (frame == config.warmupFrames)
+                {
+                    runStart = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < statCount; i++)
+                    {
+                        statsAtStart[i] = stats.total(static_cast<Stat>(i));
+                    }
+                }
+                auto frameStart = std::chrono::steady_clock::now();
+
+                timeline.waitUntil(frameValue);
+                device.collectGarbage();
+
+                // camera circles the grid once over the measured frames while bobbing up and down
+                float t = static_cast<float>(frame) / std::max(1u, config.frames);
+                float angle = 2.0f * std::numbers::pi_v<float> * t;
+                camera->eye = glm::vec4(std::cos(angle) * sceneRadius * 1.5f,
+                                        std::sin(angle * 3.0f) * sceneRadius * 0.5f,
+                                        std::sin(angle) * sceneRadius * 1.5f, 1.0f);
+                camera->updateView();
+                camera->cpy();
+                gpu::GlobalUniforms globalUniforms{static_cast<float>(frame) / 60.0f, static_cast<float>(frame), 0, 0};
+                globals->cpy(&globalUniforms, sizeof(globalUniforms));
+
+                for (uint32_t i = 0; i < animated; i++)
+                {
+                    uint32_t index = animatedInstance(i, frame);
+                    instances->set(index, instanceAt(basePositions[index], frame * 0.02f));
+                }
+
+                auto recordStart = std::chrono::steady_clock::now();
+                commandBuffer.reset();
+                commandBuffer.begin(
+                    vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+                profiler->beginFrame(commandBuffer);
+                {
+                    LETC_GPU_ZONE(*profiler, commandBuffer, "frame");
+                    lights->upload(commandBuffer);
+                    instances->upload(commandBuffer);
+                    if (batcher)
+                    {
+                        batcher->build(commandBuffer);
+                    }
+
+                    target->begin(commandBuffer);
+                    draws += recordDraws(frame >= config.warmupFrames);
+                    commandBuffer.endRendering();
+                }
+                commandBuffer.end();
+                double recorded = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                            recordStart)
+                                      .count();
+
+                frameValue = timeline.submit({commandBuffer});
+                profiler->endFrame(frameValue);
+                stats.endFrame();
+
+                if (frame >= config.warmupFrames)
+                {
+                    recordMs.push_back(recorded);
+                    cpuFrameMs.push_back(
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart)
+                            .count());
+                }
+            }
+            timeline.waitIdle();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+            profiler->resolveAll();
+
+            std::vector<double> gpuFrameMs;
+            for (const auto &event : profiler->events)
+            {
+                if (event.category == "gpu" && event.name == "frame" && !event.args.empty() &&
+                    event.args[0].second >= config.warmupFrames)
+                {
+                    gpuFrameMs.push_back(event.durationUs / 1000.0);
+                }
+            }
+
+            auto [memoryUsage, memoryBudget] = context.memoryUsage();
+            report.addDistribution("frame_cpu_ms", cpuFrameMs);
+            report.addDistribution("record_cpu_ms", recordMs);
+            report.addDistribution("frame_gpu_ms", gpuFrameMs);
+            report.add("frames_per_sec", config.frames / seconds);
+            report.add("draws_per_sec", draws / seconds);
+            for (size_t i = 0; i < statCount; i++)
+            {
+                uint64_t measured = stats.total(static_cast<Stat>(i)) - statsAtStart[i];
+                report.add(std::string(statNames[i]) + "_per_frame", static_cast<double>(measured) / config.frames);
+            }
+            report.add("gpu_memory_mb", memoryUsage / (1024.0 * 1024.0));
+            for (size_t i = 0; i < memoryCategoryCount; i++)
+            {
+                std::string category = memoryCategoryNames[i];
+                std::replace(category.begin(), category.end(), ' ', '_');
+                report.add(category + "_memory_mb", context.allocator->categoryBytes[i].load() / (1024.0 * 1024.0));
+            }
+            report.addInfo("gpu_memory_budget_mb", std::format("{:.1f}", memoryBudget / (1024.0 * 1024.0)));
+            report.addInfo("gpu_frames_resolved", std::to_string(gpuFrameMs.size()));
+            if (batcher)
+            {
+                report.addInfo("static_batches", std::to_string(batcher->batchCount()));
+                report.addInfo("static_batched_instances", std::to_string(batcher->batchedCount()));
+            }
+        }
+
+        ~SyntheticScene()
+        {
+            context.device->graphicsTimeline->waitIdle();
+            context.device->device.destroyCommandPool(commandPool);
+        }
+
+      private:
+        // grouped by material then model so state only changes between groups
+        uint64_t recordDraws(const bool &measured)
+        {
+            uint64_t draws = 0;
+            GraphicsPipeline *boundPipeline = nullptr;
+            for (uint32_t m = 0; m < materials.size(); m++)
+            {
+                bool materialBound = false;
+                for (uint32_t modelIndex = 0; modelIndex < models.size(); modelIndex++)
+                {
+                    Model &model = *models[modelIndex];
+                    GraphicsPipeline &pipeline = variants->get(permutation(model));
+                    if (&pipeline != boundPipeline)
+                    {
+                        pipeline.bind(commandBuffer);
+                        pipeline.setRenderState(commandBuffer, renderState);
+                        boundPipeline = &pipeline;
+                        materialBound = false;
+                    }
+                    if (!materialBound)
+                    {
+                        materials[m]->bind(commandBuffer, pipeline);
+                        materialBound = true;
+                    }
+
+                    // instance i draws model i % models with material (i / models) % materials
+                    uint32_t stride = static_cast<uint32_t>(models.size() * materials.size());
+                    uint32_t first = m * static_cast<uint32_t>(models.size()) + modelIndex;
+                    for (uint32_t i = first; i < config.instances; i += stride)
+                    {
+                        if (batcher && batcher->objects[batchObjects[i]].batched)
+                        {
+                            continue;
+                        }
+                        gpu::DrawRecord draw{};
+                        draw.transformIndex = i;
+                        draw.materialIndex = m;
+                        pipeline.push(commandBuffer, draw);
+                        instanceLods[i] = model.selectLod(instances->data[i].model, *camera,
+                                                          static_cast<float>(config.extent.height), instanceLods[i]);
+                        model.draw(commandBuffer, instanceLods[i]);
+                        draws++;
+                    }
+
+                    if (batcher)
+                    {
+                        gpu::DrawRecord draw{};
+                        draw.transformIndex = identitySlot;
+                        draw.materialIndex = m;
+                        pipeline.push(commandBuffer, draw);
+                        batcher->forEachBatch(m * models.size() + modelIndex,
+                                              [&](Model &batch, const Texture *)
+                                              {
+                                                  // vertices are already in world space
+                                                  batch.draw(commandBuffer,
+                                                             batch.selectLod(glm::mat4(1.0f), *camera,
+                                                                             static_cast<float>(config.extent.height),
+                                                                             0));
+                                                  draws++;
+                                              });
+                    }
+                }
+            }
+            return measured ? draws : 0;
+        }
+    };
+}; // namespace letc::bench
+
+#endif // LETC_BENCH_SYNTHETICSCENE_HH
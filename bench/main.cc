@@ -0,0 +1,148 @@
+#include "pch.hh"
+
+#include <optional>
+
+#include "Headless.hh"
+#include "Micro.hh"
+#include "Report.hh"
+#include "SyntheticScene.hh"
+
+namespace
+{
+    struct Options
+    {
+        letc::bench::SceneConfig scene;
+        std::filesystem::path output = "letc_bench.json";
+        std::optional<std::filesystem::path> baseline;
+        double thresholdPercent = 5.0;
+        bool micro = true;
+    };
+
+    void usage()
+    {
+        std::cout << "usage: letc_bench [--instances n] [--lights n] [--materials n] [--frames n] [--warmup n]\n"
+                     "                  [--output report.json] [--baseline report.json] [--threshold percent]\n"
+                     "                  [--static-batching] [--batch-cell size] [--no-micro]\n";
+    }
+
+    Options parse(int argc, char **argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                assertThrow(i + 1 < argc, "missing value for " + arg);
+                return argv[++i];
+            };
+
+            if (arg == "--instances")
+            {
+                options.scene.instances = std::stoul(value());
+            }
+            else if (arg == "--lights")
+            {
+                options.scene.lights = std::stoul(value());
+            }
+            else if (arg == "--materials")
+            {
+                options.scene.materials = std::stoul(value());
+            }
+            else if (arg == "--frames")
+            {
+                options.scene.frames = std::stoul(value());
+            }
+            else if (arg == "--warmup")
+            {
+                options.scene.warmupFrames = std::stoul(value());
+            }
+            else if (arg == "--output")
+            {
+                options.output = value();
+            }
+            else if (arg == "--baseline")
+            {
+                options.baseline = value();
+            }
+            else if (arg == "--threshold")
+            {
+                options.thresholdPercent = std::stod(value());
+            }
+            else if (arg == "--static-batching")
+            {
+                options.scene.staticBatching = true;
+            }
+            else if (arg == "--batch-cell")
+            {
+                options.scene.batchCellSize = std::stof(value());
+            }
+            else if (arg == "--no-micro")
+            {
+                options.micro = false;
+            }
+            else
+            {
+                usage();
+                assertThrow(false, "unknown argument: " + arg);
+            }
+        }
+        assertThrow(options.scene.instances > 0 && options.scene.frames > 0, "need at least one instance and frame");
+        return options;
+    }
+}; // namespace
+
+// exit code 1 when a metric regressed past the threshold against --baseline, 2 on errors
+int main(int argc, char **argv)
+{
+    try
+    {
+        Options options = parse(argc, argv);
+        letc::bench::Report report;
+        bool ok = true;
+        {
+            letc::bench::HeadlessContext context;
+            vk::PhysicalDeviceProperties properties = context.device->physicalDevice.getProperties();
+            report.addInfo("device", properties.deviceName.data());
+            report.addInfo("driver_version", std::to_string(properties.driverVersion));
+            report.addInfo("instances", std::to_string(options.scene.instances));
+            report.addInfo("lights", std::to_string(options.scene.lights));
+            report.addInfo("materials", std::to_string(options.scene.materials));
+            report.addInfo("frames", std::to_string(options.scene.frames));
+            report.addInfo("warmup", std::to_string(options.scene.warmupFrames));
+            report.addInfo("static_batching", options.scene.staticBatching ? "on" : "off");
+
+            {
+                letc::bench::SyntheticScene scene(context, options.scene);
+                scene.run(report);
+            }
+            if (options.micro)
+            {
+                letc::bench::Micro micro(context);
+                micro.run(report);
+            }
+        }
+
+        if (options.baseline)
+        {
+            ok = report.compare(letc::bench::Report::readMetrics(*options.baseline), options.thresholdPercent);
+            for (const auto &c : report.comparisons)
+            {
+                if (c.regressed)
+                {
+                    std::cout << std::format("REGRESSED {:<32} {:>12.4g} -> {:>12.4g} ({:+.1f}%)\n", c.metric,
+                                             c.baseline, c.current, c.deltaPercent);
+                }
+            }
+        }
+
+        report.write(options.output);
+        std::cout << report.json();
+        return ok ? 0 : 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,88 @@
+#version 450
+#pragma shader_stage(compute)
+
+#extension GL_GOOGLE_include_directive : require
+
+#include "layout.h"
+
+// one invocation per meshlet
+layout(local_size_x = 64) in;
+
+// shared by every dispatch of the frame
+layout(set = 0, binding = 0, std430) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+// the index buffer the surviving triangles are drawn from
+layout(set = 0, binding = 1, std430) writeonly buffer Indices {
+    uint indices[];
+};
+
+layout(set = 0, binding = 2, std430) buffer Commands {
+    DrawIndexedCommand commands[];
+};
+
+// the model's meshlets
+layout(set = 1, binding = 0, std430) readonly buffer Meshlets {
+    Meshlet meshlets[];
+};
+
+layout(set = 1, binding = 1, std430) readonly buffer MeshletVertices {
+    uint meshletVertices[];
+};
+
+layout(set = 1, binding = 2, std430) readonly buffer MeshletTriangles {
+    uint meshletTriangles[];
+};
+
+layout(push_constant, std430) uniform CullBlock {
+    MeshletCullRecord uCull;
+};
+
+// sphere against the six planes of viewProj, gribb/hartmann with a [0, 1] depth range
+bool inFrustum(vec3 center, float radius) {
+    mat4 rows = transpose(uCull.viewProj);
+    vec4 planes[6] = vec4[6](rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2],
+                             rows[3] - rows[2]);
+    for (int i = 0; i < 6; i++) {
+        vec4 plane = planes[i] / length(planes[i].xyz);
+        if (dot(plane.xyz, center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void main() {
+    uint local = gl_GlobalInvocationID.x;
+    if (local >= uCull.meshletCount) {
+        return;
+    }
+    Meshlet meshlet = meshlets[uCull.firstMeshlet + local];
+    InstanceData instance = instances[uCull.transformIndex];
+
+    vec3 center = (instance.model * vec4(meshlet.bounds.xyz, 1.0)).xyz;
+    float scale = max(max(length(instance.model[0].xyz), length(instance.model[1].xyz)),
+                      length(instance.model[2].xyz));
+    float radius = meshlet.bounds.w * scale;
+
+    if ((uCull.flags & LETC_CULL_FRUSTUM) != 0u && !inFrustum(center, radius)) {
+        return;
+    }
+    if ((uCull.flags & LETC_CULL_CONE) != 0u && meshlet.cone.w < 1.0) {
+        vec3 axis = normalize((instance.modelInvTranspose * vec4(meshlet.cone.xyz, 0.0)).xyz);
+        vec3 view = center - uCull.eye.xyz;
+        if (dot(view, axis) >= meshlet.cone.w * length(view) + radius) {
+            return;
+        }
+    }
+
+    uint base = atomicAdd(commands[uCull.drawIndex].indexCount, meshlet.triangleCount * 3u);
+    uint first = commands[uCull.drawIndex].firstIndex + base;
+    for (uint i = 0u; i < meshlet.triangleCount; i++) {
+        uint triangle = meshletTriangles[meshlet.triangleOffset + i];
+        indices[first + i * 3u] = meshletVertices[meshlet.vertexOffset + (triangle & 0xffu)];
+        indices[first + i * 3u + 1u] = meshletVertices[meshlet.vertexOffset + ((triangle >> 8) & 0xffu)];
+        indices[first + i * 3u + 2u] = meshletVertices[meshlet.vertexOffset + ((triangle >> 16) & 0xffu)];
+    }
+}
@@ -0,0 +1,112 @@
+// Shared between the GLSL shaders and src/Layout.hh, every struct in here is
+// compiled by both languages so the two sides can't drift apart.
+// Only use types that map 1:1 (uint, float, vec2, vec4, uvec4, mat4), vec3 is
+// left out on purpose since std140/std430 pad it to 16 bytes and C++ doesn't.
+#ifndef LETC_LAYOUT_H
+#define LETC_LAYOUT_H
+
+// vertex streams, bit n is vertex input binding n and location n
+#define LETC_ATTRIBUTE_POSITION (1u << 0)
+#define LETC_ATTRIBUTE_NORMAL (1u << 1)
+#define LETC_ATTRIBUTE_TANGENT (1u << 2)
+#define LETC_ATTRIBUTE_UV (1u << 3)
+#define LETC_ATTRIBUTE_COUNT 4
+
+// feature toggles baked into a pipeline permutation
+#define LETC_FEATURE_LIGHTING (1u << 0)
+#define LETC_FEATURE_DEBUG_NORMALS (1u << 1)
+
+// specialization constant ids shared by every stage
+#define LETC_SPEC_ATTRIBUTE_MASK 0
+#define LETC_SPEC_MAX_LIGHTS 1
+#define LETC_SPEC_FEATURES 2
+
+// meshlet limits, local indices are packed three bytes to a uint so vertices can't go past 256
+#define LETC_MESHLET_MAX_VERTICES 64
+#define LETC_MESHLET_MAX_TRIANGLES 124
+
+// tests the culling pass runs on each meshlet
+#define LETC_CULL_FRUSTUM (1u << 0)
+#define LETC_CULL_CONE (1u << 1)
+
+// uniform, std140
+struct GlobalUniforms
+{
+    float time;
+    float frame;
+    float padding0;
+    float padding1;
+};
+
+// uniform, std140
+struct CameraUniforms
+{
+    mat4 view;
+    mat4 proj;
+};
+
+// storage, std430
+struct Light
+{
+    vec4 position;
+    vec4 color;
+};
+
+// storage, std430, one per drawn instance
+struct InstanceData
+{
+    mat4 model;
+    mat4 modelInvTranspose;
+};
+
+// push constant, std430, everything a single draw needs to find its data
+struct DrawRecord
+{
+    uint transformIndex;
+    uint materialIndex;
+    uint padding0;
+    uint padding1;
+};
+
+// storage, std430, a cluster of one level's triangles
+struct Meshlet
+{
+    // model space sphere, xyz center and w radius
+    vec4 bounds;
+    // model space normal cone, xyz axis and w the sine of its spread. the meshlet faces away from any
+    // camera with dot(normalize(center - eye), axis) >= w, 1 or more never does
+    vec4 cone;
+    // into the meshlet vertex (global vertex indices) and triangle (three packed local indices) arrays
+    uint vertexOffset;
+    uint triangleOffset;
+    uint vertexCount;
+    uint triangleCount;
+};
+
+// storage, std430, same layout as VkDrawIndexedIndirectCommand
+struct DrawIndexedCommand
+{
+    uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    uint vertexOffset;
+    uint firstInstance;
+};
+
+// push constant, std430, one culling dispatch over a range of a model's meshlets
+struct MeshletCullRecord
+{
+    mat4 viewProj;
+    vec4 eye;
+    uint transformIndex;
+    uint firstMeshlet;
+    uint meshletCount;
+    // the command the survivors are appended to
+    uint drawIndex;
+    uint flags;
+    uint padding0;
+    uint padding1;
+    uint padding2;
+};
+
+#endif // LETC_LAYOUT_H
@@ -2,39 +2,39 @@
 #pragma shader_stage(fragment)
 
 // #extension GL_EXT_debug_printf : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "layout.h"
+
+// baked per pipeline permutation, branches on these fold away at pipeline creation
+layout(constant_id = LETC_SPEC_MAX_LIGHTS) const uint MAX_LIGHTS = 4u;
+layout(constant_id = LETC_SPEC_FEATURES) const uint FEATURES = LETC_FEATURE_LIGHTING;
 
 layout(location = 0) in vec4 vPosition;
 layout(location = 1) in vec4 vNormal;
 // layout(location = 2) in vec4 vTangent;
-// layout(location = 3) in vec2 vTexCoord;
+layout(location = 3) in vec2 vTexCoord;
 // layout(location = 4) in vec4 vColor;
 
 // updated once per frame
-layout(set = 0, binding = 0) uniform GlobalUniforms {
-    float time;
-    float frame;
-} uGlobal;
-
-struct Light {
-    vec4 position;
-    vec4 color;
+layout(set = 0, binding = 0, std140) uniform GlobalBlock {
+    GlobalUniforms uGlobal;
 };
 
-layout(set = 0, binding = 1) buffer Lights {
+layout(set = 0, binding = 1, std430) readonly buffer Lights {
     Light lights[];
 };
 
-layout(set = 0, binding = 2) uniform CameraUniforms {
-    mat4 view;
-    mat4 proj;
-} uCamera;
+layout(set = 0, binding = 2, std140) uniform CameraBlock {
+    CameraUniforms uCamera;
+};
+
+layout(push_constant, std430) uniform DrawBlock {
+    DrawRecord uDraw;
+};
 
-layout(set = 1, binding = 0) uniform ModelUniforms {
-    mat4 model;
-    mat4 modelInvTranspose;
-    vec4 attributeFlags1;
-    vec4 attributeFlags2;
-} uModel;
+// per material, untextured draws bind a 1x1 white texture
+layout(set = 1, binding = 0) uniform sampler2D uBaseColor;
 
 // layout(set = 2, binding = 0) uniform MaterialUniforms {
 //     vec4 baseColor;
@@ -48,9 +48,21 @@ layout(location = 0) out vec4 fragColor;
 void main() {
     fragColor = vec4(0.0, 0.0, 0.0, 1.0);
 
-    for (int i = 0; i < lights.length(); i++) {
+    if ((FEATURES & LETC_FEATURE_DEBUG_NORMALS) != 0u) {
+        fragColor.rgb = normalize(vNormal.xyz) * 0.5 + 0.5;
+        return;
+    }
+
+    vec3 baseColor = texture(uBaseColor, vTexCoord).rgb;
+    if ((FEATURES & LETC_FEATURE_LIGHTING) == 0u) {
+        fragColor.rgb = baseColor;
+        return;
+    }
+
+    // constant trip count, the lights buffer always holds MAX_LIGHTS entries
+    for (uint i = 0u; i < MAX_LIGHTS; i++) {
         vec3 lightDir = normalize(lights[i].position.xyz - vPosition.xyz);
         float NdotL = max(dot(vNormal.xyz, lightDir), 0.0);
-        fragColor.rgb += NdotL * lights[i].color.rgb;
+        fragColor.rgb += NdotL * lights[i].color.rgb * baseColor;
     }
 }
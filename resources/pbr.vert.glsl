@@ -2,6 +2,13 @@
 #pragma shader_stage(vertex)
 
 #extension GL_EXT_debug_printf : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "layout.h"
+
+// baked per pipeline permutation, branches on these fold away at pipeline creation
+layout(constant_id = LETC_SPEC_ATTRIBUTE_MASK) const uint ATTRIBUTE_MASK = LETC_ATTRIBUTE_POSITION;
+layout(constant_id = LETC_SPEC_FEATURES) const uint FEATURES = LETC_FEATURE_LIGHTING;
 
 layout(location = 0) in vec4 aPosition;
 layout(location = 1) in vec4 aNormal;
@@ -12,31 +19,26 @@ layout(location = 3) in vec2 aTexCoord;
 // layout(location = 6) in vec4 aWeights;
 
 // updated once per frame
-layout(set = 0, binding = 0) uniform GlobalUniforms {
-    float time;
-    float frame;
-} uGlobal;
-
-struct Light {
-    vec4 position;
-    vec4 color;
+layout(set = 0, binding = 0, std140) uniform GlobalBlock {
+    GlobalUniforms uGlobal;
 };
 
-layout(set = 0, binding = 1) buffer Lights {
+layout(set = 0, binding = 1, std430) readonly buffer Lights {
     Light lights[];
 };
 
-layout(set = 0, binding = 2) uniform CameraUniforms {
-    mat4 view;
-    mat4 proj;
-} uCamera;
+layout(set = 0, binding = 2, std140) uniform CameraBlock {
+    CameraUniforms uCamera;
+};
+
+layout(set = 0, binding = 3, std430) readonly buffer Instances {
+    InstanceData instances[];
+};
 
-layout(set = 1, binding = 0) uniform ModelUniforms {
-    mat4 model;
-    mat4 modelInvTranspose;
-    vec4 attributeFlags1;
-    vec4 attributeFlags2;
-} uModel;
+// per draw, replaces the dynamic uniform rebind
+layout(push_constant, std430) uniform DrawBlock {
+    DrawRecord uDraw;
+};
 
 // layout(set = 2, binding = 0) uniform MaterialUniforms {
 //     vec4 baseColor;
@@ -49,11 +51,21 @@ layout(set = 1, binding = 0) uniform ModelUniforms {
 layout(location = 0) out vec4 vPosition;
 layout(location = 1) out vec4 vNormal;
 // layout(location = 2) out vec4 vTangent;
-// layout(location = 3) out vec2 vTexCoord;
+layout(location = 3) out vec2 vTexCoord;
 // layout(location = 4) out vec4 vColor;
 
 void main() {
-    vPosition = uModel.model * aPosition;
-    vNormal = uModel.modelInvTranspose * aNormal;
+    InstanceData instance = instances[uDraw.transformIndex];
+    vPosition = instance.model * aPosition;
+    if ((ATTRIBUTE_MASK & LETC_ATTRIBUTE_NORMAL) != 0u) {
+        vNormal = instance.modelInvTranspose * aNormal;
+    } else {
+        vNormal = vec4(0.0, 1.0, 0.0, 0.0);
+    }
+    if ((ATTRIBUTE_MASK & LETC_ATTRIBUTE_UV) != 0u) {
+        vTexCoord = aTexCoord;
+    } else {
+        vTexCoord = vec2(0.0);
+    }
     gl_Position = uCamera.proj * uCamera.view * vPosition;
 }
@@ -6,11 +6,74 @@
 
 #include "pch.hh"
 
+#include <atomic>
+#include <functional>
+#include <mutex>
+
 #include "Device.hh"
 #include "Instance.hh"
+#include "Zones.hh"
 
 namespace letc
 {
+    struct Buffer;
+
+    // what an allocation is for, stored as the allocation's user data and used to pick its pool
+    enum class MemoryCategory : uint32_t
+    {
+        Geometry,      // device local vertex, index and scene storage buffers
+        Uniforms,      // host written uniform buffers
+        RenderTargets, // attachments
+        Textures,      // sampled images
+        Staging,       // host only transfer sources
+        Other,
+        Count
+    };
+
+    constexpr size_t memoryCategoryCount = static_cast<size_t>(MemoryCategory::Count);
+
+    constexpr std::array<const char *, memoryCategoryCount> memoryCategoryNames = {
+        "geometry", "uniforms", "render targets", "textures", "staging", "other"};
+
+    inline MemoryCategory categorize(const vk::BufferUsageFlags &usage, const VmaMemoryUsage &memoryUsage)
+    {
+        if (memoryUsage == VMA_MEMORY_USAGE_CPU_ONLY)
+        {
+            return MemoryCategory::Staging;
+        }
+        if (usage & vk::BufferUsageFlagBits::eUniformBuffer)
+        {
+            return MemoryCategory::Uniforms;
+        }
+        if (memoryUsage == VMA_MEMORY_USAGE_GPU_ONLY &&
+            (usage & (vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+                      vk::BufferUsageFlagBits::eStorageBuffer)))
+        {
+            return MemoryCategory::Geometry;
+        }
+        return MemoryCategory::Other;
+    }
+
+    inline MemoryCategory categorize(const vk::ImageUsageFlags &usage)
+    {
+        if (usage & (vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment))
+        {
+            return MemoryCategory::RenderTargets;
+        }
+        if (usage & vk::ImageUsageFlagBits::eSampled)
+        {
+            return MemoryCategory::Textures;
+        }
+        return MemoryCategory::Other;
+    }
+
+    // called with the heap index and its budget whenever usage sits above threshold * budget
+    struct MemoryPressureCallback
+    {
+        float threshold;
+        std::function<void(uint32_t, const VmaBudget &)> callback;
+    };
+
     struct Allocator
     {
         const Instance &instance;
@@ -19,15 +82,47 @@ namespace letc
         VmaAllocator allocator;
         vk::DescriptorPool descriptorPool;
 
+        // one pool per category that has a fixed memory usage, allocations asking for a different
+        // usage (or a memory type the pool can't serve) fall back to vma's default pools
+        std::array<VmaPool, memoryCategoryCount> pools{};
+        std::array<VmaMemoryUsage, memoryCategoryCount> poolUsage{};
+
+        // live bytes and allocations per category
+        mutable std::array<std::atomic<uint64_t>, memoryCategoryCount> categoryBytes{};
+        mutable std::array<std::atomic<uint64_t>, memoryCategoryCount> categoryAllocations{};
+
+        std::mutex pressureMutex;
+        std::vector<MemoryPressureCallback> pressureCallbacks;
+
+        // buffers the defragmenter may move, and whoever caches their handles and has to be told
+        mutable std::mutex relocationMutex;
+        mutable std::unordered_map<VmaAllocation, Buffer *> movableBuffers;
+        mutable std::map<uint64_t, std::function<void(const vk::Buffer &, const vk::Buffer &)>> relocationListeners;
+        mutable uint64_t nextRelocationListener = 0;
+
         Allocator(const Instance &instance, Device &device)
             : instance(instance), device(device)
         {
+            LETC_ZONE("Allocator::Allocator");
             VmaAllocatorCreateInfo allocatorInfo{};
             allocatorInfo.instance = instance.instance;
             allocatorInfo.physicalDevice = device.physicalDevice;
             allocatorInfo.device = device.device;
             allocatorInfo.vulkanApiVersion = instance.instanceBuilder.applicationInfo.apiVersion;
-            assertThrow(vmaCreateAllocator(&allocatorInfo, &allocator) || true, "failed to create allocator");
+            if (device.capabilities.memoryBudget)
+            {
+                allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+            }
+            assertThrow(vmaCreateAllocator(&allocatorInfo, &allocator) == VK_SUCCESS, "failed to create allocator");
+
+            createBufferPool(MemoryCategory::Geometry,
+                             vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer |
+                                 vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                             VMA_MEMORY_USAGE_GPU_ONLY);
+            createBufferPool(MemoryCategory::Uniforms, vk::BufferUsageFlagBits::eUniformBuffer,
+                             VMA_MEMORY_USAGE_CPU_TO_GPU);
+            createBufferPool(MemoryCategory::Staging, vk::BufferUsageFlagBits::eTransferSrc, VMA_MEMORY_USAGE_CPU_ONLY);
+            createImagePool(MemoryCategory::RenderTargets);
 
             // stupid amounts that I should not be reaching anytime soon
             std::vector<vk::DescriptorPoolSize> descriptorPoolSizes;
@@ -45,11 +140,279 @@ namespace letc
             descriptorPool = device.device.createDescriptorPool(descriptorPoolInfo);
         }
 
+        // vmaCreateBuffer through the category's pool, tagged and counted
+        VkResult createBuffer(const vk::BufferCreateInfo &bufferInfo, const VmaMemoryUsage &memoryUsage,
+                              const MemoryCategory &category, vk::Buffer &buffer, VmaAllocation &allocation) const
+        {
+            VmaAllocationCreateInfo allocationInfo = allocationCreateInfo(memoryUsage, category);
+            VkResult result = vmaCreateBuffer(allocator, reinterpret_cast<const VkBufferCreateInfo *>(&bufferInfo),
+                                              &allocationInfo, reinterpret_cast<VkBuffer *>(&buffer), &allocation,
+                                              nullptr);
+            if (result != VK_SUCCESS && allocationInfo.pool)
+            {
+                allocationInfo.pool = VK_NULL_HANDLE;
+                result = vmaCreateBuffer(allocator, reinterpret_cast<const VkBufferCreateInfo *>(&bufferInfo),
+                                         &allocationInfo, reinterpret_cast<VkBuffer *>(&buffer), &allocation, nullptr);
+            }
+            if (result == VK_SUCCESS)
+            {
+                track(allocation, category);
+            }
+            return result;
+        }
+
+        VkResult createImage(const vk::ImageCreateInfo &imageInfo, const VmaMemoryUsage &memoryUsage,
+                             const MemoryCategory &category, vk::Image &image, VmaAllocation &allocation,
+                             const VmaAllocationCreateFlags &flags = 0) const
+        {
+            VmaAllocationCreateInfo allocationInfo = allocationCreateInfo(memoryUsage, category);
+            allocationInfo.flags |= flags;
+            VkResult result = vmaCreateImage(allocator, reinterpret_cast<const VkImageCreateInfo *>(&imageInfo),
+                                             &allocationInfo, reinterpret_cast<VkImage *>(&image), &allocation,
+                                             nullptr);
+            if (result != VK_SUCCESS && allocationInfo.pool)
+            {
+                allocationInfo.pool = VK_NULL_HANDLE;
+                result = vmaCreateImage(allocator, reinterpret_cast<const VkImageCreateInfo *>(&imageInfo),
+                                        &allocationInfo, reinterpret_cast<VkImage *>(&image), &allocation, nullptr);
+            }
+            if (result == VK_SUCCESS)
+            {
+                track(allocation, category);
+            }
+            return result;
+        }
+
+        // take an allocation out of the accounting, call right before it is destroyed
+        void untrack(const VmaAllocation &allocation) const
+        {
+            VmaAllocationInfo info{};
+            vmaGetAllocationInfo(allocator, allocation, &info);
+            size_t category = reinterpret_cast<uintptr_t>(info.pUserData);
+            categoryBytes[category] -= info.size;
+            categoryAllocations[category]--;
+        }
+
+        MemoryCategory categoryOf(const VmaAllocation &allocation) const
+        {
+            VmaAllocationInfo info{};
+            vmaGetAllocationInfo(allocator, allocation, &info);
+            return static_cast<MemoryCategory>(reinterpret_cast<uintptr_t>(info.pUserData));
+        }
+
+        void registerMovable(const VmaAllocation &allocation, Buffer *buffer) const
+        {
+            std::lock_guard lock(relocationMutex);
+            movableBuffers[allocation] = buffer;
+        }
+
+        void unregisterMovable(const VmaAllocation &allocation) const
+        {
+            std::lock_guard lock(relocationMutex);
+            movableBuffers.erase(allocation);
+        }
+
+        Buffer *findMovable(const VmaAllocation &allocation) const
+        {
+            std::lock_guard lock(relocationMutex);
+            auto found = movableBuffers.find(allocation);
+            return found == movableBuffers.end() ? nullptr : found->second;
+        }
+
+        // listener(oldBuffer, newBuffer) runs on the thread driving the defragmenter, right after the
+        // frame's timeline wait, so descriptor sets can be rewritten in place. returns an id for removal
+        uint64_t addRelocationListener(std::function<void(const vk::Buffer &, const vk::Buffer &)> listener) const
+        {
+            std::lock_guard lock(relocationMutex);
+            relocationListeners[nextRelocationListener] = std::move(listener);
+            return nextRelocationListener++;
+        }
+
+        void removeRelocationListener(const uint64_t &id) const
+        {
+            std::lock_guard lock(relocationMutex);
+            relocationListeners.erase(id);
+        }
+
+        void notifyRelocated(const vk::Buffer &oldBuffer, const vk::Buffer &newBuffer) const
+        {
+            std::lock_guard lock(relocationMutex);
+            for (const auto &[id, listener] : relocationListeners)
+            {
+                listener(oldBuffer, newBuffer);
+            }
+        }
+
+        // usage and budget of every memory heap, exact with VK_EXT_memory_budget, estimated otherwise
+        std::vector<VmaBudget> budgets() const
+        {
+            std::vector<VmaBudget> heaps(device.physicalDevice.getMemoryProperties().memoryHeapCount);
+            vmaGetHeapBudgets(allocator, heaps.data());
+            return heaps;
+        }
+
+        // e.g. threshold 0.9 to hear about any heap that is more than 90% used
+        void addPressureCallback(const float &threshold, std::function<void(uint32_t, const VmaBudget &)> callback)
+        {
+            std::lock_guard lock(pressureMutex);
+            pressureCallbacks.push_back(MemoryPressureCallback{threshold, std::move(callback)});
+        }
+
+        // once a frame, advances vma's frame index (budgets are refreshed from the driver on it) and
+        // lets whoever registered evict when a heap gets close to its budget
+        void checkBudget(const uint32_t &frameIndex)
+        {
+            vmaSetCurrentFrameIndex(allocator, frameIndex);
+
+            std::lock_guard lock(pressureMutex);
+            if (pressureCallbacks.empty())
+            {
+                return;
+            }
+            std::vector<VmaBudget> heaps = budgets();
+            for (uint32_t heap = 0; heap < heaps.size(); heap++)
+            {
+                if (heaps[heap].budget == 0)
+                {
+                    continue;
+                }
+                double used = static_cast<double>(heaps[heap].usage) / heaps[heap].budget;
+                for (const auto &pressure : pressureCallbacks)
+                {
+                    if (used >= pressure.threshold)
+                    {
+                        pressure.callback(heap, heaps[heap]);
+                    }
+                }
+            }
+        }
+
+        // vma's own json dump, the detailed map lists every allocation with its category name
+        std::string statsJson(const bool &detailed = true) const
+        {
+            char *json = nullptr;
+            vmaBuildStatsString(allocator, &json, detailed);
+            std::string text(json);
+            vmaFreeStatsString(allocator, json);
+            return text;
+        }
+
+        void dumpStats(const std::filesystem::path &path, const bool &detailed = true) const
+        {
+            std::ofstream file(path);
+            assertThrow(file, "failed to open memory stats file: " + path.string());
+            file << statsJson(detailed);
+        }
+
+        // live bytes per category followed by every heap's usage against its budget
+        std::string summary() const
+        {
+            std::string text = std::format("{:<16} {:>8} {:>12}\n", "memory", "count", "MiB");
+            for (size_t i = 0; i < memoryCategoryCount; i++)
+            {
+                text += std::format("{:<16} {:>8} {:>12.2f}\n", memoryCategoryNames[i], categoryAllocations[i].load(),
+                                    categoryBytes[i].load() / (1024.0 * 1024.0));
+            }
+            std::vector<VmaBudget> heaps = budgets();
+            for (uint32_t heap = 0; heap < heaps.size(); heap++)
+            {
+                text += std::format("heap {:<11} {:>8} {:>12.2f} / {:.2f} MiB budget\n", heap,
+                                    heaps[heap].statistics.allocationCount, heaps[heap].usage / (1024.0 * 1024.0),
+                                    heaps[heap].budget / (1024.0 * 1024.0));
+            }
+            return text;
+        }
+
         ~Allocator()
         {
+            // deferred buffers and descriptor sets still point into the allocator and pool
+            device.flushDeletions();
             device.device.destroyDescriptorPool(descriptorPool);
+            for (VmaPool pool : pools)
+            {
+                if (pool)
+                {
+                    vmaDestroyPool(allocator, pool);
+                }
+            }
             vmaDestroyAllocator(allocator);
         }
+
+      private:
+        VmaAllocationCreateInfo allocationCreateInfo(const VmaMemoryUsage &memoryUsage,
+                                                     const MemoryCategory &category) const
+        {
+            size_t index = static_cast<size_t>(category);
+            VmaAllocationCreateInfo allocationInfo{};
+            allocationInfo.usage = memoryUsage;
+            allocationInfo.pUserData = reinterpret_cast<void *>(static_cast<uintptr_t>(index));
+            if (pools[index] && poolUsage[index] == memoryUsage)
+            {
+                allocationInfo.pool = pools[index];
+            }
+            return allocationInfo;
+        }
+
+        void track(const VmaAllocation &allocation, const MemoryCategory &category) const
+        {
+            size_t index = static_cast<size_t>(category);
+            VmaAllocationInfo info{};
+            vmaGetAllocationInfo(allocator, allocation, &info);
+            vmaSetAllocationName(allocator, allocation, memoryCategoryNames[index]);
+            categoryBytes[index] += info.size;
+            categoryAllocations[index]++;
+        }
+
+        void createBufferPool(const MemoryCategory &category, const vk::BufferUsageFlags &usage,
+                              const VmaMemoryUsage &memoryUsage)
+        {
+            vk::BufferCreateInfo bufferInfo{};
+            bufferInfo.setSize(1024).setUsage(usage);
+            VmaAllocationCreateInfo allocationInfo{};
+            allocationInfo.usage = memoryUsage;
+
+            VmaPoolCreateInfo poolInfo{};
+            if (vmaFindMemoryTypeIndexForBufferInfo(allocator,
+                                                    reinterpret_cast<const VkBufferCreateInfo *>(&bufferInfo),
+                                                    &allocationInfo, &poolInfo.memoryTypeIndex) != VK_SUCCESS)
+            {
+                return;
+            }
+            createPool(category, poolInfo, memoryUsage);
+        }
+
+        void createImagePool(const MemoryCategory &category)
+        {
+            vk::ImageCreateInfo imageInfo{};
+            imageInfo.setImageType(vk::ImageType::e2D)
+                .setFormat(vk::Format::eR8G8B8A8Unorm)
+                .setExtent({1, 1, 1})
+                .setMipLevels(1)
+                .setArrayLayers(1)
+                .setSamples(vk::SampleCountFlagBits::e1)
+                .setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled);
+            VmaAllocationCreateInfo allocationInfo{};
+            allocationInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+            VmaPoolCreateInfo poolInfo{};
+            if (vmaFindMemoryTypeIndexForImageInfo(allocator, reinterpret_cast<const VkImageCreateInfo *>(&imageInfo),
+                                                   &allocationInfo, &poolInfo.memoryTypeIndex) != VK_SUCCESS)
+            {
+                return;
+            }
+            createPool(category, poolInfo, VMA_MEMORY_USAGE_GPU_ONLY);
+        }
+
+        void createPool(const MemoryCategory &category, const VmaPoolCreateInfo &poolInfo,
+                        const VmaMemoryUsage &memoryUsage)
+        {
+            size_t index = static_cast<size_t>(category);
+            if (vmaCreatePool(allocator, &poolInfo, &pools[index]) == VK_SUCCESS)
+            {
+                poolUsage[index] = memoryUsage;
+                vmaSetPoolName(allocator, pools[index], memoryCategoryNames[index]);
+            }
+        }
     };
 }; // namespace letc
 
@@ -0,0 +1,639 @@
+#pragma once
+
+#ifndef LETC_ASSETSTREAMER_HH
+#define LETC_ASSETSTREAMER_HH
+
+#include "pch.hh"
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Device.hh"
+#include "JobSystem.hh"
+#include "Model.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    using MeshHandle = uint32_t;
+
+    // models requested by path and loaded in the background. files are parsed on the job system,
+    // then copied into device local memory on the transfer queue a few per frame, highest priority
+    // first. until then resolve() hands out a placeholder so the renderer never waits on a file.
+    //
+    // resident meshes are kept under residencyBudget by evicting the ones resolved least recently, so meshes the
+    // renderer stops drawing age out first. an evicted mesh is imported again (from the mesh cache when there is
+    // one) the next time it is resolved, and draws the placeholder until it is back.
+    //
+    // per frame on the main thread: update() -> record graphics -> acquire() -> handoff() in the submit waits
+    struct AssetStreamer
+    {
+        enum class State
+        {
+            Queued,    // waiting for a worker
+            Importing, // being parsed on a worker
+            Imported,  // parsed, waiting for upload budget
+            Resident,  // uploaded, drawable from the next graphics submit on
+            Evicted,   // dropped to stay in budget, queued again by the next resolve()
+            Failed
+        };
+
+        struct Slot
+        {
+            std::filesystem::path path;
+            float priority = 0.0f; // higher loads sooner
+            State state = State::Queued;
+            MeshData mesh;
+            std::unique_ptr<Model> model;
+            std::string error;
+            double importMs = 0.0;
+            uint64_t lastUsed = 0;           // frame of the last resolve()
+            vk::DeviceSize residentBytes = 0; // device memory of the model, counted from upload to eviction
+            // the import's MeshData::cacheBefore and cacheAfter, kept once mesh is handed to the model
+            VertexCacheStats cacheBefore;
+            VertexCacheStats cacheAfter;
+            uint32_t verticesBefore = 0;
+            uint32_t verticesAfter = 0;
+        };
+
+        // staging memory and the command buffer of one transfer submit, freed once the queue passes value
+        struct Upload
+        {
+            vk::CommandBuffer commandBuffer;
+            std::vector<std::unique_ptr<Buffer>> staging;
+            uint64_t value = 0;
+        };
+
+        const Device &device;
+        const Allocator &allocator;
+        JobSystem &jobs;
+
+        // slot state is shared with the workers, models and everything vulkan stay on the main thread
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Slot>> slots;
+        JobCounter importing;
+        uint32_t maxImports; // imports in flight at once
+
+        // bytes copied per frame, a file bigger than this still goes alone
+        vk::DeviceSize uploadBudget = 16ull << 20;
+
+        vk::CommandPool commandPool;
+        std::vector<Upload> uploads;
+        std::vector<vk::CommandBuffer> freeCommandBuffers;
+
+        // copies submitted by update() that the next graphics submit picks up
+        std::vector<vk::BufferMemoryBarrier2> pendingAcquires;
+        std::vector<vk::ImageMemoryBarrier2> pendingImageAcquires;
+        std::vector<Texture *> pendingMips;
+        std::vector<MeshHandle> pendingResident;
+        uint64_t submitted = 0;
+        bool handedOff = true;
+
+        std::unique_ptr<Model> placeholder;
+
+        // runs on the worker after a successful import, e.g. to build the pipeline the mesh will need
+        std::function<void(const MeshData &)> onImported;
+
+        // how the workers cook textures, set before the first update() and left alone after
+        TextureCookConfig textureCooking;
+
+        // device memory the streamed geometry and textures may hold, half the device local heap by default.
+        // meshes resolved in the last keepFrames frames are never evicted, the budget is exceeded instead
+        vk::DeviceSize residencyBudget;
+        uint64_t keepFrames = 3;
+        vk::DeviceSize residentBytes = 0;
+        // extra bytes to free on the next update(), asked for by relieve()
+        vk::DeviceSize pressureBytes = 0;
+        uint64_t frame = 0;
+
+        // runs on the main thread just before an evicted model is destroyed, to drop whatever refers to it
+        std::function<void(const Model &)> onEvicted;
+
+        vk::DeviceSize totalBytesUploaded = 0;
+        uint32_t evictions = 0;
+
+        AssetStreamer(const Device &device, const Allocator &allocator, JobSystem &jobs)
+            : device(device), allocator(allocator), jobs(jobs), maxImports(std::max(1u, jobs.threadCount() - 1))
+        {
+            commandPool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(device.transferQueueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+
+            placeholder = std::make_unique<Model>(allocator, placeholderMesh());
+            placeholder->cpyAttributes();
+            residencyBudget = defaultBudget();
+        }
+
+        AssetStreamer(const AssetStreamer &) = delete;
+        AssetStreamer &operator=(const AssetStreamer &) = delete;
+
+        bool crossFamily() const
+        {
+            return device.transferQueueFamilyIndex != device.graphicsQueueFamilyIndex;
+        }
+
+        // queue a file, the handle is valid immediately and draws the placeholder until resident
+        MeshHandle request(const std::filesystem::path &path, const float &priority = 0.0f)
+        {
+            std::lock_guard lock(mutex);
+            auto slot = std::make_unique<Slot>();
+            slot->path = path;
+            slot->priority = priority;
+            slots.push_back(std::move(slot));
+            return static_cast<MeshHandle>(slots.size() - 1);
+        }
+
+        // only matters while the mesh is still queued or waiting for upload
+        void setPriority(const MeshHandle &handle, const float &priority)
+        {
+            std::lock_guard lock(mutex);
+            slots.at(handle)->priority = priority;
+        }
+
+        State state(const MeshHandle &handle)
+        {
+            std::lock_guard lock(mutex);
+            return slots.at(handle)->state;
+        }
+
+        // the resident model, nullptr while it is still loading, evicted or failed. does not count as a use
+        Model *get(const MeshHandle &handle)
+        {
+            std::lock_guard lock(mutex);
+            const Slot &slot = *slots.at(handle);
+            return slot.state == State::Resident ? slot.model.get() : nullptr;
+        }
+
+        // the model to draw this frame, marks it used and brings it back if it was evicted
+        Model &resolve(const MeshHandle &handle)
+        {
+            std::lock_guard lock(mutex);
+            Slot &slot = *slots.at(handle);
+            slot.lastUsed = frame;
+            if (slot.state == State::Evicted)
+            {
+                slot.state = State::Queued;
+            }
+            return slot.state == State::Resident ? *slot.model : *placeholder;
+        }
+
+        // free at least bytes more than the budget asks for on the next update(), e.g. from a memory pressure
+        // callback
+        void relieve(const vk::DeviceSize &bytes)
+        {
+            pressureBytes = std::max(pressureBytes, bytes);
+        }
+
+        // call once a frame after the graphics timeline wait, starts imports and submits uploads
+        void update()
+        {
+            LETC_ZONE("AssetStreamer::update");
+            frame++;
+            retireUploads();
+            evict();
+            dispatchImports();
+            submitUploads();
+        }
+
+        // record the acquire half of this frame's uploads and the texture mip chains into the graphics
+        // command buffer, the meshes are drawable from here on
+        void acquire(const vk::CommandBuffer &graphicsCommandBuffer)
+        {
+            if (!pendingAcquires.empty() || !pendingImageAcquires.empty())
+            {
+                graphicsCommandBuffer.pipelineBarrier2(vk::DependencyInfo{}
+                                                           .setBufferMemoryBarriers(pendingAcquires)
+                                                           .setImageMemoryBarriers(pendingImageAcquires));
+                pendingAcquires.clear();
+                pendingImageAcquires.clear();
+            }
+            for (Texture *texture : pendingMips)
+            {
+                texture->recordMips(graphicsCommandBuffer);
+            }
+            pendingMips.clear();
+
+            std::lock_guard lock(mutex);
+            for (const MeshHandle &handle : pendingResident)
+            {
+                slots[handle]->state = State::Resident;
+            }
+            pendingResident.clear();
+        }
+
+        // semaphore the next graphics submit has to wait on, empty if nothing new was uploaded
+        std::optional<SemaphoreWait> handoff(const vk::PipelineStageFlags2 &stages =
+                                                 vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                                                 vk::PipelineStageFlagBits2::eIndexInput |
+                                                 vk::PipelineStageFlagBits2::eComputeShader |
+                                                 vk::PipelineStageFlagBits2::eTransfer)
+        {
+            if (handedOff)
+            {
+                return std::nullopt;
+            }
+            handedOff = true;
+            return device.transferTimeline->at(submitted, stages);
+        }
+
+        // nothing left queued, importing or waiting for upload
+        bool idle()
+        {
+            std::lock_guard lock(mutex);
+            return std::all_of(slots.begin(), slots.end(),
+                               [](const std::unique_ptr<Slot> &slot)
+                               {
+                                   return slot->state == State::Resident || slot->state == State::Evicted ||
+                                          slot->state == State::Failed;
+                               });
+        }
+
+        std::string summary()
+        {
+            std::lock_guard lock(mutex);
+            uint32_t resident = 0;
+            double importMs = 0.0;
+            std::string failures;
+            // averaged over every mesh imported so far, resident or not
+            uint32_t optimized = 0;
+            VertexCacheStats before, after;
+            uint64_t verticesBefore = 0, verticesAfter = 0;
+            for (const auto &slot : slots)
+            {
+                if (slot->verticesBefore > 0)
+                {
+                    optimized++;
+                    before.acmr += slot->cacheBefore.acmr, before.atvr += slot->cacheBefore.atvr;
+                    after.acmr += slot->cacheAfter.acmr, after.atvr += slot->cacheAfter.atvr;
+                    verticesBefore += slot->verticesBefore;
+                    verticesAfter += slot->verticesAfter;
+                }
+                if (slot->state == State::Resident)
+                {
+                    resident++;
+                    importMs += slot->importMs;
+                }
+                else if (slot->state == State::Failed)
+                {
+                    failures += std::format("  {}: {}\n", slot->path.string(), slot->error);
+                }
+            }
+            std::string cache;
+            if (optimized)
+            {
+                cache = std::format("vertex cache: acmr {:.3f} -> {:.3f}, atvr {:.3f} -> {:.3f}, {} -> {} vertices "
+                                    "over {} meshes\n",
+                                    before.acmr / optimized, after.acmr / optimized, before.atvr / optimized,
+                                    after.atvr / optimized, verticesBefore, verticesAfter, optimized);
+            }
+            return std::format("streaming: {}/{} meshes resident, {:.2f} MiB uploaded, {:.1f} ms avg import\n"
+                               "residency: {:.2f} / {:.2f} MiB budget, {} evictions\n{}{}",
+                               resident, slots.size(), totalBytesUploaded / (1024.0 * 1024.0),
+                               resident ? importMs / resident : 0.0, residentBytes / (1024.0 * 1024.0),
+                               residencyBudget / (1024.0 * 1024.0), evictions, cache, failures);
+        }
+
+        ~AssetStreamer()
+        {
+            jobs.wait(importing);
+            device.transferTimeline->waitUntil(submitted);
+            uploads.clear();
+            device.device.destroyCommandPool(commandPool);
+        }
+
+      private:
+        // half the budget of the largest device local heap, the rest is left to render targets, scene buffers
+        // and everything else. on cpu implementations that heap is host memory
+        vk::DeviceSize defaultBudget() const
+        {
+            vk::PhysicalDeviceMemoryProperties properties = device.physicalDevice.getMemoryProperties();
+            std::vector<VmaBudget> heaps = allocator.budgets();
+            vk::DeviceSize budget = 0;
+            for (uint32_t heap = 0; heap < properties.memoryHeapCount; heap++)
+            {
+                if (properties.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+                {
+                    budget = std::max(budget, heaps[heap].budget / 2);
+                }
+            }
+            return budget;
+        }
+
+        // drop the least recently resolved resident models until the rest fit in the budget (less whatever
+        // relieve() asked for). their memory goes back through the device's deferred destruction once the
+        // frames still using them are done
+        void evict()
+        {
+            vk::DeviceSize target = residencyBudget;
+            if (pressureBytes)
+            {
+                target = std::min(target, residentBytes - std::min(residentBytes, pressureBytes));
+                pressureBytes = 0;
+            }
+            if (residentBytes <= target)
+            {
+                return;
+            }
+
+            LETC_ZONE("AssetStreamer::evict");
+            std::vector<std::unique_ptr<Model>> evicted;
+            {
+                std::lock_guard lock(mutex);
+                std::vector<Slot *> idle;
+                for (const auto &slot : slots)
+                {
+                    if (slot->state == State::Resident && frame - slot->lastUsed >= keepFrames)
+                    {
+                        idle.push_back(slot.get());
+                    }
+                }
+                std::sort(idle.begin(), idle.end(),
+                          [](const Slot *a, const Slot *b) { return a->lastUsed < b->lastUsed; });
+                for (Slot *slot : idle)
+                {
+                    if (residentBytes <= target)
+                    {
+                        break;
+                    }
+                    residentBytes -= slot->residentBytes;
+                    slot->residentBytes = 0;
+                    slot->state = State::Evicted;
+                    evicted.push_back(std::move(slot->model));
+                }
+            }
+            evictions += static_cast<uint32_t>(evicted.size());
+            for (const auto &model : evicted)
+            {
+                if (onEvicted)
+                {
+                    onEvicted(*model);
+                }
+            }
+        }
+
+        // unit cube with flat normals, only position and normal streams
+        static MeshData placeholderMesh()
+        {
+            MeshData mesh;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (float side : {-1.0f, 1.0f})
+                {
+                    glm::vec3 normal(0.0f);
+                    normal[axis] = side;
+                    glm::vec3 u(0.0f);
+                    glm::vec3 v(0.0f);
+                    u[(axis + 1) % 3] = 0.5f;
+                    v[(axis + 2) % 3] = 0.5f * side;
+
+                    unsigned base = static_cast<unsigned>(mesh.position.size());
+                    glm::vec3 center = normal * 0.5f;
+                    for (glm::vec2 corner : {glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1)})
+                    {
+                        mesh.position.push_back(glm::vec4(center + corner.x * u + corner.y * v, 1.0f));
+                        mesh.normal.push_back(glm::vec4(normal, 1.0f));
+                    }
+                    mesh.index.insert(mesh.index.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+                }
+            }
+            mesh.attributeMask = LETC_ATTRIBUTE_POSITION | LETC_ATTRIBUTE_NORMAL;
+            return mesh;
+        }
+
+        // hand the most urgent queued files to the workers
+        void dispatchImports()
+        {
+            std::vector<Slot *> queued;
+            uint32_t inFlight = 0;
+            {
+                std::lock_guard lock(mutex);
+                for (const auto &slot : slots)
+                {
+                    inFlight += slot->state == State::Importing;
+                    if (slot->state == State::Queued)
+                    {
+                        queued.push_back(slot.get());
+                    }
+                }
+                std::sort(queued.begin(), queued.end(),
+                          [](const Slot *a, const Slot *b) { return a->priority > b->priority; });
+                queued.resize(std::min<size_t>(queued.size(), maxImports - std::min(maxImports, inFlight)));
+                for (Slot *slot : queued)
+                {
+                    slot->state = State::Importing;
+                }
+            }
+
+            for (Slot *slot : queued)
+            {
+                // nobody would steal it without workers
+                if (jobs.threadCount() == 1)
+                {
+                    import(*slot);
+                    continue;
+                }
+                // slots are never freed while the streamer lives, the destructor waits on importing
+                jobs.submit([this, slot] { import(*slot); }, &importing);
+            }
+        }
+
+        void import(Slot &slot)
+        {
+            LETC_ZONE("AssetStreamer::import");
+            auto begin = std::chrono::steady_clock::now();
+            MeshData mesh;
+            std::string error;
+            try
+            {
+                mesh = importMesh(slot.path, textureCooking);
+                if (onImported)
+                {
+                    onImported(mesh);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+
+            std::lock_guard lock(mutex);
+            slot.importMs = elapsed.count();
+            if (error.empty())
+            {
+                slot.cacheBefore = mesh.cacheBefore;
+                slot.cacheAfter = mesh.cacheAfter;
+                slot.verticesBefore = mesh.verticesBefore;
+                slot.verticesAfter = static_cast<uint32_t>(mesh.position.size());
+                slot.mesh = std::move(mesh);
+                slot.state = State::Imported;
+            }
+            else
+            {
+                slot.error = error;
+                slot.state = State::Failed;
+            }
+        }
+
+        // create device local models for the most urgent imported meshes and copy them on the transfer queue
+        void submitUploads()
+        {
+            std::vector<std::pair<MeshHandle, MeshData>> ready;
+            {
+                std::lock_guard lock(mutex);
+                std::vector<MeshHandle> imported;
+                for (MeshHandle handle = 0; handle < slots.size(); handle++)
+                {
+                    if (slots[handle]->state == State::Imported)
+                    {
+                        imported.push_back(handle);
+                    }
+                }
+                std::sort(imported.begin(), imported.end(), [this](const MeshHandle &a, const MeshHandle &b)
+                          { return slots[a]->priority > slots[b]->priority; });
+                for (const MeshHandle &handle : imported)
+                {
+                    ready.push_back({handle, std::move(slots[handle]->mesh)});
+                    slots[handle]->mesh = {};
+                }
+            }
+            if (ready.empty())
+            {
+                return;
+            }
+
+            Upload upload;
+            upload.commandBuffer = nextCommandBuffer();
+            upload.commandBuffer.begin(
+                vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+            vk::DeviceSize bytes = 0;
+            std::vector<vk::BufferMemoryBarrier2> releases;
+            std::vector<vk::ImageMemoryBarrier2> imageReleases;
+            std::vector<std::pair<MeshHandle, std::unique_ptr<Model>>> uploaded;
+            size_t next = 0;
+            for (; next < ready.size() && (bytes == 0 || bytes < uploadBudget); next++)
+            {
+                auto &[handle, mesh] = ready[next];
+                auto model = std::make_unique<Model>(allocator, std::move(mesh), VMA_MEMORY_USAGE_GPU_ONLY);
+                vk::DeviceSize size = model->stagingSize();
+                upload.staging.push_back(std::make_unique<Buffer>(allocator, size,
+                                                                  vk::BufferUsageFlagBits::eTransferSrc,
+                                                                  VMA_MEMORY_USAGE_CPU_ONLY));
+                for (const vk::Buffer &buffer : model->recordUpload(upload.commandBuffer, *upload.staging.back()))
+                {
+                    vk::BufferMemoryBarrier2 barrier{};
+                    barrier.setBuffer(buffer).setOffset(0).setSize(VK_WHOLE_SIZE);
+                    barrier.setSrcQueueFamilyIndex(device.transferQueueFamilyIndex);
+                    barrier.setDstQueueFamilyIndex(device.graphicsQueueFamilyIndex);
+                    releases.push_back(barrier);
+                }
+                if (model->baseColor)
+                {
+                    if (crossFamily())
+                    {
+                        vk::ImageMemoryBarrier2 barrier = model->baseColor->ownershipBarrier(
+                            device.transferQueueFamilyIndex, device.graphicsQueueFamilyIndex);
+                        imageReleases.push_back(vk::ImageMemoryBarrier2(barrier)
+                                                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                                                    .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite));
+                        pendingImageAcquires.push_back(
+                            barrier.setDstStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                                .setDstAccessMask(vk::AccessFlagBits2::eTransferRead |
+                                                  vk::AccessFlagBits2::eTransferWrite));
+                    }
+                    // blits need a graphics queue
+                    pendingMips.push_back(model->baseColor.get());
+                }
+                bytes += size;
+                uploaded.push_back({handle, std::move(model)});
+            }
+
+            // across families the copies are released here and acquired by the graphics queue, on a shared
+            // family the semaphore wait in handoff() already makes them visible
+            if (crossFamily())
+            {
+                for (vk::BufferMemoryBarrier2 &barrier : releases)
+                {
+                    vk::BufferMemoryBarrier2 acquireBarrier = barrier;
+                    // meshlet buffers are read by the culling pass
+                    acquireBarrier.setDstStageMask(vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                                                   vk::PipelineStageFlagBits2::eIndexInput |
+                                                   vk::PipelineStageFlagBits2::eComputeShader);
+                    acquireBarrier.setDstAccessMask(vk::AccessFlagBits2::eVertexAttributeRead |
+                                                    vk::AccessFlagBits2::eIndexRead |
+                                                    vk::AccessFlagBits2::eShaderStorageRead);
+                    pendingAcquires.push_back(acquireBarrier);
+
+                    barrier.setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer);
+                    barrier.setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite);
+                }
+                upload.commandBuffer.pipelineBarrier2(
+                    vk::DependencyInfo{}.setBufferMemoryBarriers(releases).setImageMemoryBarriers(imageReleases));
+            }
+            upload.commandBuffer.end();
+
+            upload.value = device.transferTimeline->submit({upload.commandBuffer});
+            for (auto &staging : upload.staging)
+            {
+                staging->usedUntil(*device.transferTimeline, upload.value);
+            }
+            submitted = upload.value;
+            handedOff = false;
+            totalBytesUploaded += bytes;
+            uploads.push_back(std::move(upload));
+
+            std::lock_guard lock(mutex);
+            for (auto &[handle, model] : uploaded)
+            {
+                slots[handle]->residentBytes = model->residentBytes();
+                residentBytes += slots[handle]->residentBytes;
+                slots[handle]->model = std::move(model);
+                pendingResident.push_back(handle);
+            }
+            // whatever did not fit goes back for the next frame
+            for (; next < ready.size(); next++)
+            {
+                slots[ready[next].first]->mesh = std::move(ready[next].second);
+            }
+        }
+
+        // free the staging memory of copies the transfer queue has finished
+        void retireUploads()
+        {
+            for (auto upload = uploads.begin(); upload != uploads.end();)
+            {
+                if (!device.transferTimeline->reached(upload->value))
+                {
+                    ++upload;
+                    continue;
+                }
+                freeCommandBuffers.push_back(upload->commandBuffer);
+                upload = uploads.erase(upload);
+            }
+        }
+
+        vk::CommandBuffer nextCommandBuffer()
+        {
+            if (freeCommandBuffers.empty())
+            {
+                return device.device
+                    .allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+                                                .setCommandPool(commandPool)
+                                                .setCommandBufferCount(1)
+                                                .setLevel(vk::CommandBufferLevel::ePrimary))
+                    .at(0);
+            }
+            vk::CommandBuffer commandBuffer = freeCommandBuffers.back();
+            freeCommandBuffers.pop_back();
+            commandBuffer.reset();
+            return commandBuffer;
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_ASSETSTREAMER_HH
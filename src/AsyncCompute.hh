@@ -0,0 +1,234 @@
+#pragma once
+
+#ifndef LETC_ASYNCCOMPUTE_HH
+#define LETC_ASYNCCOMPUTE_HH
+
+#include "pch.hh"
+
+#include <array>
+#include <optional>
+
+#include "Device.hh"
+#include "Timeline.hh"
+
+namespace letc
+{
+    // compute work for frame N recorded and submitted on the compute queue before the cpu waits on
+    // frame N-1, so it runs alongside the tail of the previous frame's graphics work.
+    // graphics picks the results up through handoff() and acquire().
+    //
+    // graphics N-1 may still be reading what compute wrote for it, so every output graphics reads is
+    // double buffered: a pass writes the copy for slot() and the submit waits for the graphics frame
+    // that last read that copy, which is normally long done.
+    //
+    // begin() -> record into slot() -> release() outputs -> submit()
+    // graphics: acquire() after begin, handoff() in the submit waits, consumed() with the submitted value
+    struct AsyncCompute
+    {
+        static constexpr uint32_t slotCount = 2;
+
+        const Device &device;
+
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+        uint64_t submitted = 0;       // compute timeline value of the last submit
+        uint64_t submits = 0;
+        bool handedOff = true;        // graphics already waits on submitted
+
+        // graphics timeline value of the last frame that read each slot's outputs
+        std::array<uint64_t, slotCount> slotReaders{};
+        std::optional<uint32_t> pendingReader; // slot handed off to the graphics submit being made
+
+        // matching halves of queue family ownership transfers, recorded on the graphics side
+        std::vector<vk::BufferMemoryBarrier2> pendingAcquires;
+
+        // gpu time of the compute submits, measured on the compute queue alone. timestamps from different
+        // queues share no timebase, so overlap with graphics can't be read off them
+        vk::QueryPool queryPool;
+        bool timestamps = false;
+        bool pendingTimestamps = false;
+        double timestampPeriod = 0.0; // ns per tick
+        double lastComputeMs = 0.0;
+        double totalComputeMs = 0.0;
+        uint64_t timedSubmits = 0;
+
+        AsyncCompute(const Device &device) : device(device)
+        {
+            commandPool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(device.computeQueueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+            commandBuffer = device.device
+                                .allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+                                                            .setCommandPool(commandPool)
+                                                            .setCommandBufferCount(1)
+                                                            .setLevel(vk::CommandBufferLevel::ePrimary))
+                                .at(0);
+
+            auto properties = device.physicalDevice.getProperties();
+            timestamps = device.queueFamilies[device.computeQueueFamilyIndex].timestampValidBits > 0;
+            timestampPeriod = properties.limits.timestampPeriod;
+            if (timestamps)
+            {
+                queryPool = device.device.createQueryPool(
+                    vk::QueryPoolCreateInfo{}.setQueryType(vk::QueryType::eTimestamp).setQueryCount(2));
+            }
+        }
+
+        bool crossFamily() const
+        {
+            return device.hasAsyncCompute();
+        }
+
+        // which copy of its double buffered outputs the work recorded now writes, graphics reads the same
+        // copy this frame
+        uint32_t slot() const
+        {
+            return static_cast<uint32_t>(submits % slotCount);
+        }
+
+        // wait for the previous compute submit to retire and start recording this frame's work
+        const vk::CommandBuffer &begin()
+        {
+            device.computeTimeline->waitUntil(submitted);
+            resolveTimestamps();
+            commandBuffer.reset();
+            commandBuffer.begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            if (timestamps)
+            {
+                commandBuffer.resetQueryPool(queryPool, 0, 2);
+                commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eNone, queryPool, 0);
+            }
+            return commandBuffer;
+        }
+
+        // hand a buffer written by this frame's compute work over to the graphics queue. across families
+        // this records the release here and queues the acquire for acquire(), on a shared family the
+        // semaphore wait already orders and makes the writes visible. graphics never gives it back,
+        // compute overwrites the whole buffer each frame so its old contents may be discarded.
+        void release(const vk::Buffer &buffer, const vk::PipelineStageFlags2 &srcStages,
+                     const vk::AccessFlags2 &srcAccess, const vk::PipelineStageFlags2 &dstStages,
+                     const vk::AccessFlags2 &dstAccess, const vk::DeviceSize &offset = 0,
+                     const vk::DeviceSize &size = VK_WHOLE_SIZE)
+        {
+            if (!crossFamily())
+            {
+                return;
+            }
+
+            vk::BufferMemoryBarrier2 barrier{};
+            barrier.setBuffer(buffer).setOffset(offset).setSize(size);
+            barrier.setSrcQueueFamilyIndex(device.computeQueueFamilyIndex);
+            barrier.setDstQueueFamilyIndex(device.graphicsQueueFamilyIndex);
+
+            vk::BufferMemoryBarrier2 releaseBarrier = barrier;
+            releaseBarrier.setSrcStageMask(srcStages).setSrcAccessMask(srcAccess);
+            commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(releaseBarrier));
+
+            vk::BufferMemoryBarrier2 acquireBarrier = barrier;
+            acquireBarrier.setDstStageMask(dstStages).setDstAccessMask(dstAccess);
+            pendingAcquires.push_back(acquireBarrier);
+        }
+
+        // the slot's outputs are only overwritten once the graphics frame that last read them is done,
+        // waits adds whatever else the recorded work depends on
+        uint64_t submit(std::vector<SemaphoreWait> waits = {})
+        {
+            if (timestamps)
+            {
+                commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, queryPool, 1);
+                pendingTimestamps = true;
+            }
+            commandBuffer.end();
+
+            if (slotReaders[slot()] > 0)
+            {
+                waits.push_back(device.graphicsTimeline->at(slotReaders[slot()]));
+            }
+            pendingReader = slot();
+            submitted = device.computeTimeline->submit({commandBuffer}, waits);
+            submits++;
+            handedOff = false;
+            return submitted;
+        }
+
+        // record the acquire half of every release() into the graphics command buffer
+        void acquire(const vk::CommandBuffer &graphicsCommandBuffer)
+        {
+            if (pendingAcquires.empty())
+            {
+                return;
+            }
+            graphicsCommandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setBufferMemoryBarriers(pendingAcquires));
+            pendingAcquires.clear();
+        }
+
+        // semaphore the next graphics submit has to wait on, empty if nothing new was submitted
+        std::optional<SemaphoreWait> handoff(
+            const vk::PipelineStageFlags2 &stages = vk::PipelineStageFlagBits2::eAllCommands)
+        {
+            if (handedOff)
+            {
+                return std::nullopt;
+            }
+            handedOff = true;
+            return device.computeTimeline->at(submitted, stages);
+        }
+
+        // the graphics submit that waited on handoff() went out as graphicsValue, it reads the slot until then
+        void consumed(const uint64_t &graphicsValue)
+        {
+            if (pendingReader)
+            {
+                slotReaders[*pendingReader] = graphicsValue;
+                pendingReader.reset();
+            }
+        }
+
+        // empty when nothing ever ran on the compute queue
+        std::string summary()
+        {
+            if (submits == 0)
+            {
+                return {};
+            }
+            device.computeTimeline->waitUntil(submitted);
+            resolveTimestamps();
+            return std::format("async compute: {} submits, {:.3f} ms avg gpu time\n", submits,
+                               timedSubmits ? totalComputeMs / timedSubmits : 0.0);
+        }
+
+        ~AsyncCompute()
+        {
+            device.computeTimeline->waitUntil(submitted);
+            if (queryPool)
+            {
+                device.device.destroyQueryPool(queryPool);
+            }
+            device.device.destroyCommandPool(commandPool);
+        }
+
+      private:
+        // the previous submit has retired whenever this runs, so its two queries are available
+        void resolveTimestamps()
+        {
+            if (!pendingTimestamps)
+            {
+                return;
+            }
+            pendingTimestamps = false;
+
+            std::array<uint64_t, 2> compute{};
+            if (device.device.getQueryPoolResults(queryPool, 0, 2, sizeof(compute), compute.data(), sizeof(uint64_t),
+                                                  vk::QueryResultFlagBits::e64) != vk::Result::eSuccess)
+            {
+                return;
+            }
+            lastComputeMs = static_cast<double>(compute[1] - compute[0]) * timestampPeriod / 1e6;
+            totalComputeMs += lastComputeMs;
+            timedSubmits++;
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_ASYNCCOMPUTE_HH
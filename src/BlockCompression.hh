@@ -0,0 +1,568 @@
+#pragma once
+
+#ifndef LETC_BLOCKCOMPRESSION_HH
+#define LETC_BLOCKCOMPRESSION_HH
+
+#include "pch.hh"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace letc
+{
+    // the bc formats the texture cooker writes. every one packs a 4x4 texel block into 8 or 16 bytes:
+    //   BC1 rgb, 4 bpp
+    //   BC3 rgb + interpolated alpha, 8 bpp
+    //   BC5 two independent channels (tangent space normals, roughness/metal), 8 bpp
+    //   BC7 rgba at higher quality than BC3 for the same size, 8 bpp
+    enum class BlockFormat
+    {
+        BC1,
+        BC3,
+        BC5,
+        BC7
+    };
+
+    inline uint32_t blockBytes(const BlockFormat &format)
+    {
+        return format == BlockFormat::BC1 ? 8 : 16;
+    }
+
+    inline const char *blockFormatName(const BlockFormat &format)
+    {
+        constexpr std::array names = {"BC1", "BC3", "BC5", "BC7"};
+        return names[static_cast<size_t>(format)];
+    }
+
+    namespace bc
+    {
+        // a block as 16 rgba8 texels, row major
+        using Texels = std::array<uint8_t, 64>;
+
+        // little endian bit packing for the index fields and bc7's unaligned endpoints
+        inline void writeBits(uint8_t *block, uint32_t &position, const uint32_t &count, const uint32_t &value)
+        {
+            for (uint32_t i = 0; i < count; i++, position++)
+            {
+                if (value >> i & 1)
+                {
+                    block[position / 8] |= static_cast<uint8_t>(1u << (position % 8));
+                }
+            }
+        }
+
+        inline uint32_t readBits(const uint8_t *block, uint32_t &position, const uint32_t &count)
+        {
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < count; i++, position++)
+            {
+                value |= static_cast<uint32_t>(block[position / 8] >> (position % 8) & 1) << i;
+            }
+            return value;
+        }
+
+        // dominant direction of the texels in the first n channels, by power iteration on the covariance.
+        // endpoints along it fit a block's colors far better than the per channel bounding box
+        template <int N> void principalAxis(const Texels &texels, float (&mean)[N], float (&axis)[N])
+        {
+            for (int c = 0; c < N; c++)
+            {
+                mean[c] = 0.0f;
+                for (int i = 0; i < 16; i++)
+                {
+                    mean[c] += texels[i * 4 + c];
+                }
+                mean[c] /= 16.0f;
+            }
+
+            float covariance[N][N] = {};
+            for (int i = 0; i < 16; i++)
+            {
+                float d[N];
+                for (int c = 0; c < N; c++)
+                {
+                    d[c] = texels[i * 4 + c] - mean[c];
+                }
+                for (int a = 0; a < N; a++)
+                {
+                    for (int b = 0; b < N; b++)
+                    {
+                        covariance[a][b] += d[a] * d[b];
+                    }
+                }
+            }
+
+            for (int c = 0; c < N; c++)
+            {
+                axis[c] = 1.0f;
+            }
+            for (int iteration = 0; iteration < 8; iteration++)
+            {
+                float next[N] = {};
+                float length = 0.0f;
+                for (int a = 0; a < N; a++)
+                {
+                    for (int b = 0; b < N; b++)
+                    {
+                        next[a] += covariance[a][b] * axis[b];
+                    }
+                    length = std::max(length, std::abs(next[a]));
+                }
+                // flat block, any direction works
+                if (length < 1e-6f)
+                {
+                    return;
+                }
+                for (int c = 0; c < N; c++)
+                {
+                    axis[c] = next[c] / length;
+                }
+            }
+        }
+
+        // the extremes of the texels projected onto the principal axis
+        template <int N> void fitEndpoints(const Texels &texels, float (&low)[N], float (&high)[N])
+        {
+            float mean[N];
+            float axis[N];
+            principalAxis<N>(texels, mean, axis);
+
+            float axisLength = 0.0f;
+            for (int c = 0; c < N; c++)
+            {
+                axisLength += axis[c] * axis[c];
+            }
+            float minProjection = 0.0f;
+            float maxProjection = 0.0f;
+            for (int i = 0; i < 16; i++)
+            {
+                float projection = 0.0f;
+                for (int c = 0; c < N; c++)
+                {
+                    projection += (texels[i * 4 + c] - mean[c]) * axis[c];
+                }
+                minProjection = std::min(minProjection, projection);
+                maxProjection = std::max(maxProjection, projection);
+            }
+            for (int c = 0; c < N; c++)
+            {
+                low[c] = std::clamp(mean[c] + axis[c] * minProjection / axisLength, 0.0f, 255.0f);
+                high[c] = std::clamp(mean[c] + axis[c] * maxProjection / axisLength, 0.0f, 255.0f);
+            }
+        }
+
+        // palette entry closest to each texel in the first n channels
+        template <int N, size_t P>
+        void nearestIndices(const Texels &texels, const std::array<std::array<int, 4>, P> &palette,
+                            std::array<uint32_t, 16> &indices)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                int bestError = INT32_MAX;
+                for (uint32_t p = 0; p < P; p++)
+                {
+                    int error = 0;
+                    for (int c = 0; c < N; c++)
+                    {
+                        int d = texels[i * 4 + c] - palette[p][c];
+                        error += d * d;
+                    }
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        indices[i] = p;
+                    }
+                }
+            }
+        }
+
+        inline uint16_t packRgb565(const float (&color)[3])
+        {
+            uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+            uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+            uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+            return static_cast<uint16_t>(r << 11 | g << 5 | b);
+        }
+
+        inline std::array<int, 4> unpackRgb565(const uint16_t &color)
+        {
+            int r = color >> 11 & 31;
+            int g = color >> 5 & 63;
+            int b = color & 31;
+            return {r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255};
+        }
+
+        // bc1 palette, the 3 color + transparent black mode when color0 <= color1 unless forced to 4 colors
+        inline std::array<std::array<int, 4>, 4> bc1Palette(const uint16_t &color0, const uint16_t &color1,
+                                                             const bool &fourColors)
+        {
+            std::array<std::array<int, 4>, 4> palette{unpackRgb565(color0), unpackRgb565(color1)};
+            const auto &a = palette[0];
+            const auto &b = palette[1];
+            for (int c = 0; c < 3; c++)
+            {
+                if (fourColors || color0 > color1)
+                {
+                    palette[2][c] = (2 * a[c] + b[c]) / 3;
+                    palette[3][c] = (a[c] + 2 * b[c]) / 3;
+                }
+                else
+                {
+                    palette[2][c] = (a[c] + b[c]) / 2;
+                    palette[3][c] = 0;
+                }
+            }
+            palette[2][3] = 255;
+            palette[3][3] = fourColors || color0 > color1 ? 255 : 0;
+            return palette;
+        }
+
+        // 8 bytes, rgb only, always in 4 color mode so the block is opaque
+        inline void encodeBC1(const Texels &texels, uint8_t *block)
+        {
+            float low[3];
+            float high[3];
+            fitEndpoints<3>(texels, low, high);
+            uint16_t color0 = packRgb565(high);
+            uint16_t color1 = packRgb565(low);
+            if (color0 < color1)
+            {
+                std::swap(color0, color1);
+            }
+
+            std::array<uint32_t, 16> indices{};
+            // equal endpoints would select the 3 color mode, every texel is color0 anyway
+            if (color0 != color1)
+            {
+                nearestIndices<3>(texels, bc1Palette(color0, color1, true), indices);
+            }
+
+            std::memset(block, 0, 8);
+            std::memcpy(block, &color0, 2);
+            std::memcpy(block + 2, &color1, 2);
+            uint32_t position = 32;
+            for (const uint32_t &index : indices)
+            {
+                writeBits(block, position, 2, index);
+            }
+        }
+
+        inline void decodeBC1(const uint8_t *block, Texels &texels, const bool &fourColors = false)
+        {
+            uint16_t color0;
+            uint16_t color1;
+            std::memcpy(&color0, block, 2);
+            std::memcpy(&color1, block + 2, 2);
+            auto palette = bc1Palette(color0, color1, fourColors);
+            uint32_t position = 32;
+            for (int i = 0; i < 16; i++)
+            {
+                const auto &color = palette[readBits(block, position, 2)];
+                for (int c = 0; c < 4; c++)
+                {
+                    texels[i * 4 + c] = static_cast<uint8_t>(color[c]);
+                }
+            }
+        }
+
+        inline std::array<std::array<int, 4>, 8> bc4Palette(const uint8_t &value0, const uint8_t &value1)
+        {
+            std::array<std::array<int, 4>, 8> palette{};
+            palette[0][0] = value0;
+            palette[1][0] = value1;
+            if (value0 > value1)
+            {
+                for (int i = 1; i < 7; i++)
+                {
+                    palette[i + 1][0] = ((7 - i) * value0 + i * value1) / 7;
+                }
+            }
+            else
+            {
+                for (int i = 1; i < 5; i++)
+                {
+                    palette[i + 1][0] = ((5 - i) * value0 + i * value1) / 5;
+                }
+                palette[6][0] = 0;
+                palette[7][0] = 255;
+            }
+            return palette;
+        }
+
+        // 8 bytes, one channel of the texels with 8 interpolated levels between its extremes
+        inline void encodeBC4(const Texels &texels, const int &channel, uint8_t *block)
+        {
+            Texels single{};
+            uint8_t low = 255;
+            uint8_t high = 0;
+            for (int i = 0; i < 16; i++)
+            {
+                single[i * 4] = texels[i * 4 + channel];
+                low = std::min(low, single[i * 4]);
+                high = std::max(high, single[i * 4]);
+            }
+
+            std::array<uint32_t, 16> indices{};
+            if (high != low)
+            {
+                nearestIndices<1>(single, bc4Palette(high, low), indices);
+            }
+
+            std::memset(block, 0, 8);
+            block[0] = high;
+            block[1] = low;
+            uint32_t position = 16;
+            for (const uint32_t &index : indices)
+            {
+                writeBits(block, position, 3, index);
+            }
+        }
+
+        inline void decodeBC4(const uint8_t *block, const int &channel, Texels &texels)
+        {
+            auto palette = bc4Palette(block[0], block[1]);
+            uint32_t position = 16;
+            for (int i = 0; i < 16; i++)
+            {
+                texels[i * 4 + channel] = static_cast<uint8_t>(palette[readBits(block, position, 3)][0]);
+            }
+        }
+
+        // bc4 alpha followed by a bc1 color block that is always read in 4 color mode
+        inline void encodeBC3(const Texels &texels, uint8_t *block)
+        {
+            encodeBC4(texels, 3, block);
+            encodeBC1(texels, block + 8);
+        }
+
+        inline void decodeBC3(const uint8_t *block, Texels &texels)
+        {
+            decodeBC1(block + 8, texels, true);
+            decodeBC4(block, 3, texels);
+        }
+
+        // red and green as two bc4 blocks
+        inline void encodeBC5(const Texels &texels, uint8_t *block)
+        {
+            encodeBC4(texels, 0, block);
+            encodeBC4(texels, 1, block + 8);
+        }
+
+        inline void decodeBC5(const uint8_t *block, Texels &texels)
+        {
+            texels.fill(0);
+            decodeBC4(block, 0, texels);
+            decodeBC4(block + 8, 1, texels);
+            for (int i = 0; i < 16; i++)
+            {
+                texels[i * 4 + 3] = 255;
+            }
+        }
+
+        constexpr std::array<int, 16> bc7Weights4 = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+        // the 7 bit value and p bit that land closest to v once expanded to (value << 1 | p)
+        inline void quantizeBC7Endpoint(const float (&endpoint)[4], uint32_t (&value)[4], uint32_t &pBit)
+        {
+            float bestError = INFINITY;
+            for (uint32_t p = 0; p < 2; p++)
+            {
+                uint32_t candidate[4];
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++)
+                {
+                    candidate[c] = static_cast<uint32_t>(std::clamp(std::lround((endpoint[c] - p) / 2.0f), 0l, 127l));
+                    float d = static_cast<float>(candidate[c] << 1 | p) - endpoint[c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    pBit = p;
+                    std::copy(std::begin(candidate), std::end(candidate), std::begin(value));
+                }
+            }
+        }
+
+        inline std::array<std::array<int, 4>, 16> bc7Palette(const int (&endpoint0)[4], const int (&endpoint1)[4])
+        {
+            std::array<std::array<int, 4>, 16> palette{};
+            for (int i = 0; i < 16; i++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    palette[i][c] = ((64 - bc7Weights4[i]) * endpoint0[c] + bc7Weights4[i] * endpoint1[c] + 32) >> 6;
+                }
+            }
+            return palette;
+        }
+
+        // 16 bytes in mode 6 only: one subset, rgba endpoints with a p bit each and 4 bit indices.
+        // the partitioned modes would fit multi colored blocks better but need an expensive search
+        inline void encodeBC7(const Texels &texels, uint8_t *block)
+        {
+            float low[4];
+            float high[4];
+            fitEndpoints<4>(texels, low, high);
+
+            uint32_t value[2][4];
+            uint32_t pBits[2] = {};
+            quantizeBC7Endpoint(low, value[0], pBits[0]);
+            quantizeBC7Endpoint(high, value[1], pBits[1]);
+            int endpoints[2][4];
+            for (int e = 0; e < 2; e++)
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    endpoints[e][c] = static_cast<int>(value[e][c] << 1 | pBits[e]);
+                }
+            }
+
+            std::array<uint32_t, 16> indices{};
+            nearestIndices<4>(texels, bc7Palette(endpoints[0], endpoints[1]), indices);
+            // the first index is stored without its top bit, so it has to be below 8
+            if (indices[0] & 8)
+            {
+                std::swap(value[0], value[1]);
+                std::swap(pBits[0], pBits[1]);
+                for (uint32_t &index : indices)
+                {
+                    index = 15 - index;
+                }
+            }
+
+            std::memset(block, 0, 16);
+            uint32_t position = 0;
+            writeBits(block, position, 7, 1u << 6);
+            for (int c = 0; c < 4; c++)
+            {
+                writeBits(block, position, 7, value[0][c]);
+                writeBits(block, position, 7, value[1][c]);
+            }
+            writeBits(block, position, 1, pBits[0]);
+            writeBits(block, position, 1, pBits[1]);
+            for (int i = 0; i < 16; i++)
+            {
+                writeBits(block, position, i == 0 ? 3 : 4, indices[i]);
+            }
+        }
+
+        // mode 6 blocks as written by encodeBC7(), blocks in the other modes throw and the texture is left to
+        // the gpu decoder or dropped
+        inline void decodeBC7(const uint8_t *block, Texels &texels)
+        {
+            assertThrow((block[0] & 0x7f) == 1u << 6, "bc7 fallback decoding only handles mode 6 blocks");
+            uint32_t position = 7;
+            int endpoints[2][4];
+            for (int c = 0; c < 4; c++)
+            {
+                endpoints[0][c] = static_cast<int>(readBits(block, position, 7));
+                endpoints[1][c] = static_cast<int>(readBits(block, position, 7));
+            }
+            for (int e = 0; e < 2; e++)
+            {
+                uint32_t pBit = readBits(block, position, 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    endpoints[e][c] = endpoints[e][c] << 1 | static_cast<int>(pBit);
+                }
+            }
+            auto palette = bc7Palette(endpoints[0], endpoints[1]);
+            for (int i = 0; i < 16; i++)
+            {
+                const auto &color = palette[readBits(block, position, i == 0 ? 3 : 4)];
+                for (int c = 0; c < 4; c++)
+                {
+                    texels[i * 4 + c] = static_cast<uint8_t>(color[c]);
+                }
+            }
+        }
+    }; // namespace bc
+
+    // rgba8 image to blocks, row by row. edge blocks of sizes that aren't a multiple of 4 repeat the last texel
+    inline std::vector<uint8_t> compressImage(const uint8_t *rgba, const uint32_t &width, const uint32_t &height,
+                                              const BlockFormat &format)
+    {
+        const uint32_t blocksX = (width + 3) / 4;
+        const uint32_t blocksY = (height + 3) / 4;
+        std::vector<uint8_t> blocks(static_cast<size_t>(blocksX) * blocksY * blockBytes(format));
+        uint8_t *out = blocks.data();
+        bc::Texels texels;
+        for (uint32_t by = 0; by < blocksY; by++)
+        {
+            for (uint32_t bx = 0; bx < blocksX; bx++)
+            {
+                for (uint32_t i = 0; i < 16; i++)
+                {
+                    uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+                    uint32_t y = std::min(by * 4 + i / 4, height - 1);
+                    std::memcpy(&texels[i * 4], rgba + (static_cast<size_t>(y) * width + x) * 4, 4);
+                }
+                switch (format)
+                {
+                case BlockFormat::BC1:
+                    bc::encodeBC1(texels, out);
+                    break;
+                case BlockFormat::BC3:
+                    bc::encodeBC3(texels, out);
+                    break;
+                case BlockFormat::BC5:
+                    bc::encodeBC5(texels, out);
+                    break;
+                case BlockFormat::BC7:
+                    bc::encodeBC7(texels, out);
+                    break;
+                }
+                out += blockBytes(format);
+            }
+        }
+        return blocks;
+    }
+
+    // blocks back to rgba8, for devices that can't sample the format
+    inline std::vector<uint8_t> decompressImage(const uint8_t *blocks, const uint32_t &width, const uint32_t &height,
+                                                const BlockFormat &format)
+    {
+        const uint32_t blocksX = (width + 3) / 4;
+        const uint32_t blocksY = (height + 3) / 4;
+        std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+        const uint8_t *in = blocks;
+        bc::Texels texels;
+        for (uint32_t by = 0; by < blocksY; by++)
+        {
+            for (uint32_t bx = 0; bx < blocksX; bx++)
+            {
+                switch (format)
+                {
+                case BlockFormat::BC1:
+                    bc::decodeBC1(in, texels);
+                    break;
+                case BlockFormat::BC3:
+                    bc::decodeBC3(in, texels);
+                    break;
+                case BlockFormat::BC5:
+                    bc::decodeBC5(in, texels);
+                    break;
+                case BlockFormat::BC7:
+                    bc::decodeBC7(in, texels);
+                    break;
+                }
+                in += blockBytes(format);
+
+                for (uint32_t i = 0; i < 16; i++)
+                {
+                    uint32_t x = bx * 4 + i % 4;
+                    uint32_t y = by * 4 + i / 4;
+                    if (x < width && y < height)
+                    {
+                        std::memcpy(rgba.data() + (static_cast<size_t>(y) * width + x) * 4, &texels[i * 4], 4);
+                    }
+                }
+            }
+        }
+        return rgba;
+    }
+}; // namespace letc
+
+#endif // LETC_BLOCKCOMPRESSION_HH
@@ -6,6 +6,8 @@
 #include "pch.hh"
 
 #include "Allocator.hh"
+#include "Stats.hh"
+#include "Zones.hh"
 
 namespace letc
 {
@@ -14,96 +16,105 @@ namespace letc
         const Allocator &allocator;
         vk::Buffer buffer;
         VmaAllocation allocation;
-
-        Buffer(const Allocator &allocator, const vk::DeviceSize &size, const vk::BufferUsageFlagBits &bufferUsage,
+        void *mapped = nullptr;
+        vk::BufferCreateInfo createInfo; // kept so the defragmenter can recreate the buffer elsewhere
+        MemoryCategory category;
+        // set when only one queue ever uses the buffer, its memory is then freed once that queue passes the
+        // value instead of waiting on every queue
+        const Timeline *lastUseTimeline = nullptr;
+        uint64_t lastUseValue = 0;
+
+        Buffer(const Allocator &allocator, const vk::DeviceSize &size, const vk::BufferUsageFlags &bufferUsage,
                const VmaMemoryUsage &memoryUsage, const vk::SharingMode shareMode = vk::SharingMode::eExclusive)
-            : allocator(allocator)
+            : allocator(allocator), category(categorize(bufferUsage, memoryUsage))
         {
             vk::BufferCreateInfo bufferCreateInfo{};
             bufferCreateInfo.size = size;
             bufferCreateInfo.usage = bufferUsage;
             bufferCreateInfo.sharingMode = shareMode;
 
-            VmaAllocationCreateInfo allocCreateInfo = {};
-            allocCreateInfo.usage = memoryUsage;
+            // device local geometry is never mapped, so it can be moved with a gpu copy
+            if (category == MemoryCategory::Geometry)
+            {
+                bufferCreateInfo.usage |= vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+            }
+            createInfo = bufferCreateInfo;
 
-            assertThrow(vmaCreateBuffer(allocator.allocator, reinterpret_cast<VkBufferCreateInfo *>(&bufferCreateInfo),
-                                        &allocCreateInfo, reinterpret_cast<VkBuffer *>(&buffer), &allocation,
-                                        nullptr) == VK_SUCCESS,
+            assertThrow(allocator.createBuffer(bufferCreateInfo, memoryUsage, category, buffer, allocation) ==
+                            VK_SUCCESS,
                         "failed to create buffer");
+            if (category == MemoryCategory::Geometry)
+            {
+                allocator.registerMovable(allocation, this);
+            }
+            addStat(Stat::Allocations);
         }
 
         void cpy(const void *data, const vk::DeviceSize &size, const vk::DeviceSize offset = 0)
         {
+            LETC_ZONE("Buffer::cpy");
+            addStat(Stat::BytesUploaded, size);
             void *gpuPtr;
             vmaMapMemory(allocator.allocator, allocation, &gpuPtr);
             std::memcpy(static_cast<char *>(gpuPtr) + offset, data, size);
             vmaUnmapMemory(allocator.allocator, allocation);
         }
 
-        ~Buffer()
+        // keep the buffer mapped so hot paths can write straight into it
+        void *map()
         {
-            vmaDestroyBuffer(allocator.allocator, buffer, allocation);
+            if (!mapped)
+            {
+                assertThrow(vmaMapMemory(allocator.allocator, allocation, &mapped) == VK_SUCCESS,
+                            "failed to map buffer");
+            }
+            return mapped;
         }
-    };
-
-    template <typename T> struct ImageBuffer
-    {
-        std::vector<T> m_cpuBuffer;
-        vk::Image m_gpuImage;
-        vk::ImageUsageFlags m_usage;
-        vk::Format m_format;
-        uint32_t m_width, m_height;
-        vk::ImageTiling m_tiling;
-        const VmaAllocator &m_allocator;
-        VmaAllocation m_allocation;
 
-        ImageBuffer(const VmaAllocator &allocator, uint32_t width, uint32_t height, vk::Format format,
-                    const std::vector<T> &cpuBuffer, vk::ImageUsageFlags usage,
-                    vk::ImageTiling tiling = vk::ImageTiling::eOptimal)
-            : m_cpuBuffer(cpuBuffer), m_usage(usage), m_format(format), m_width(width), m_height(height),
-              m_tiling(tiling), m_allocator(allocator)
+        // make writes through map() visible, a no-op on host coherent memory
+        void flush(const vk::DeviceSize &offset = 0, const vk::DeviceSize &size = VK_WHOLE_SIZE)
         {
-            vk::ImageCreateInfo imageCreateInfo{};
-            imageCreateInfo.imageType = vk::ImageType::e2D;
-            imageCreateInfo.extent = vk::Extent3D{width, height, 1};
-            imageCreateInfo.mipLevels = 1;
-            imageCreateInfo.arrayLayers = 1;
-            imageCreateInfo.format = format;
-            imageCreateInfo.tiling = tiling;
-            imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
-            imageCreateInfo.usage = usage;
-            imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
-            imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
-
-            VmaAllocationCreateInfo allocCreateInfo = {};
-            // If the image is created with linear tiling, we allow CPU mapping.
-            // Otherwise (optimal tiling), use GPU-only memory.
-            allocCreateInfo.usage =
-                (tiling == vk::ImageTiling::eLinear) ? VMA_MEMORY_USAGE_CPU_TO_GPU : VMA_MEMORY_USAGE_GPU_ONLY;
+            vmaFlushAllocation(allocator.allocator, allocation, offset, size);
+        }
 
-            assertThrow(vmaCreateImage(m_allocator, reinterpret_cast<VkImageCreateInfo *>(&imageCreateInfo),
-                                       &allocCreateInfo, reinterpret_cast<VkImage *>(&m_gpuImage), &m_allocation,
-                                       nullptr) == VK_SUCCESS,
-                        "failed to create image");
+        void usedUntil(const Timeline &timeline, const uint64_t &value)
+        {
+            lastUseTimeline = &timeline;
+            lastUseValue = value;
         }
 
-        void syncImage()
+        void unmap()
         {
-            assertThrow(m_tiling == vk::ImageTiling::eLinear, "syncImage only supported for linear tiled images");
-            void *gpuPtr;
-            vmaMapMemory(m_allocator, m_allocation, &gpuPtr);
-            std::memcpy(gpuPtr, m_cpuBuffer.data(), m_cpuBuffer.size() * sizeof(T));
-            vmaUnmapMemory(m_allocator, m_allocation);
+            if (mapped)
+            {
+                vmaUnmapMemory(allocator.allocator, allocation);
+                mapped = nullptr;
+            }
         }
 
-        ~ImageBuffer()
+        ~Buffer()
         {
-            vmaDestroyImage(m_allocator, m_gpuImage, m_allocation);
+            unmap();
+            if (category == MemoryCategory::Geometry)
+            {
+                allocator.unregisterMovable(allocation);
+            }
+            allocator.untrack(allocation);
+            addStat(Stat::Frees);
+            auto destroy = [vma = allocator.allocator, buffer = buffer, allocation = allocation]
+            { vmaDestroyBuffer(vma, buffer, allocation); };
+            if (lastUseTimeline)
+            {
+                allocator.device.defer(*lastUseTimeline, lastUseValue, destroy);
+            }
+            else
+            {
+                allocator.device.defer(destroy);
+            }
         }
 
-        ImageBuffer(const ImageBuffer &other) = delete;
-        ImageBuffer &operator=(const ImageBuffer &other) = delete;
+        Buffer(const Buffer &other) = delete;
+        Buffer &operator=(const Buffer &other) = delete;
     };
 }; // namespace letc
 
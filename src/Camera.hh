@@ -6,6 +6,7 @@
 
 #include "Allocator.hh"
 #include "Buffer.hh"
+#include "Layout.hh"
 
 namespace letc
 {
@@ -20,11 +21,7 @@ namespace letc
         float near;
         float far;
 
-        struct Uniform
-        {
-            glm::mat4 view;
-            glm::mat4 proj;
-        };
+        using Uniform = gpu::CameraUniforms;
         Uniform uniform;
         std::unique_ptr<Buffer> buffer;
 
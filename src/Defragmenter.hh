@@ -0,0 +1,265 @@
+#pragma once
+
+#ifndef LETC_DEFRAGMENTER_HH
+#define LETC_DEFRAGMENTER_HH
+
+#include "pch.hh"
+
+#include <chrono>
+#include <optional>
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Device.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // compacts the device local geometry pool a little every frame. each pass recreates the moved
+    // buffers in their new place, copies them on the graphics queue and swaps the handles right away,
+    // rewriting any descriptor set that points at them. a pass only starts while no queue has work in
+    // flight, later graphics submits are ordered after the copy and other queues wait on handoff().
+    // the old memory is only released by vma once the copy has finished on the gpu
+    struct Defragmenter
+    {
+        const Device &device;
+        const Allocator &allocator;
+
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+
+        VmaDefragmentationContext context = VK_NULL_HANDLE;
+        VmaDefragmentationPassMoveInfo pass{};
+        bool passOpen = false;
+        uint64_t passValue = 0; // graphics timeline value of the pass's copies
+
+        // limits for a single pass, a pass is started at most once a frame
+        vk::DeviceSize maxBytesPerPass = 32ull << 20;
+        uint32_t maxMovesPerPass = 256;
+
+        // totals of the running (or last finished) defragmentation
+        VmaDefragmentationStats result{};
+        uint32_t blocksBefore = 0;
+        uint32_t blocksAfter = 0;
+        uint32_t passes = 0;
+        uint32_t skipped = 0; // moves handed back because the budget ran out or nothing owned them
+
+        Defragmenter(const Device &device, const Allocator &allocator) : device(device), allocator(allocator)
+        {
+            commandPool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(device.graphicsQueueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+            commandBuffer = device.device
+                                .allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+                                                            .setCommandPool(commandPool)
+                                                            .setCommandBufferCount(1)
+                                                            .setLevel(vk::CommandBufferLevel::ePrimary))
+                                .at(0);
+        }
+
+        VmaPool pool() const
+        {
+            return allocator.pools[static_cast<size_t>(MemoryCategory::Geometry)];
+        }
+
+        bool running() const
+        {
+            return context != VK_NULL_HANDLE;
+        }
+
+        // share of the pool's block memory that sits unused between allocations
+        double fragmentation() const
+        {
+            if (!pool())
+            {
+                return 0.0;
+            }
+            VmaDetailedStatistics statistics{};
+            vmaCalculatePoolStatistics(allocator.allocator, pool(), &statistics);
+            if (statistics.statistics.blockCount < 2 || statistics.statistics.blockBytes == 0)
+            {
+                return 0.0;
+            }
+            return 1.0 - static_cast<double>(statistics.statistics.allocationBytes) /
+                             statistics.statistics.blockBytes;
+        }
+
+        // begin a defragmentation, does nothing if one is running or there is no pool to compact
+        void start()
+        {
+            if (running() || !pool())
+            {
+                return;
+            }
+
+            VmaDefragmentationInfo info{};
+            info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+            info.pool = pool();
+            info.maxBytesPerPass = maxBytesPerPass;
+            info.maxAllocationsPerPass = maxMovesPerPass;
+            assertThrow(vmaBeginDefragmentation(allocator.allocator, &info, &context) == VK_SUCCESS,
+                        "failed to begin defragmentation");
+
+            result = {};
+            passes = 0;
+            skipped = 0;
+            blocksBefore = blockCount();
+        }
+
+        // call once a frame right after the frame's timeline wait and before collectGarbage(), spends
+        // at most budget recreating buffers. returns true when a defragmentation finished this call
+        bool step(const std::chrono::microseconds &budget = std::chrono::microseconds(500))
+        {
+            if (!running())
+            {
+                return false;
+            }
+            LETC_ZONE("Defragmenter::step");
+
+            if (passOpen)
+            {
+                if (!device.graphicsTimeline->reached(passValue))
+                {
+                    return false;
+                }
+                passOpen = false;
+                if (vmaEndDefragmentationPass(allocator.allocator, context, &pass) == VK_SUCCESS)
+                {
+                    return finish();
+                }
+            }
+
+            // command buffers in flight on any queue may still hold the old handles or the descriptor sets
+            // about to be rewritten, the pass waits for a frame where everything has drained
+            if (!idle())
+            {
+                return false;
+            }
+
+            if (vmaBeginDefragmentationPass(allocator.allocator, context, &pass) == VK_SUCCESS)
+            {
+                return finish();
+            }
+            passOpen = true;
+            passes++;
+
+            auto deadline = std::chrono::steady_clock::now() + budget;
+            commandBuffer.reset();
+            commandBuffer.begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(
+                vk::MemoryBarrier2{}
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eMemoryWrite)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setDstAccessMask(vk::AccessFlagBits2::eTransferRead)));
+
+            std::vector<std::pair<vk::Buffer, vk::Buffer>> moved;
+            for (uint32_t i = 0; i < pass.moveCount; i++)
+            {
+                VmaDefragmentationMove &move = pass.pMoves[i];
+                Buffer *buffer = allocator.findMovable(move.srcAllocation);
+                if (!buffer || std::chrono::steady_clock::now() > deadline)
+                {
+                    move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                    skipped++;
+                    continue;
+                }
+
+                vk::Buffer relocated = device.device.createBuffer(buffer->createInfo);
+                if (vmaBindBufferMemory(allocator.allocator, move.dstTmpAllocation, relocated) != VK_SUCCESS)
+                {
+                    device.device.destroyBuffer(relocated);
+                    move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                    skipped++;
+                    continue;
+                }
+                commandBuffer.copyBuffer(buffer->buffer, relocated, vk::BufferCopy{0, 0, buffer->createInfo.size});
+                moved.push_back({buffer->buffer, relocated});
+                buffer->buffer = relocated;
+            }
+
+            commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(
+                vk::MemoryBarrier2{}
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands)
+                    .setDstAccessMask(vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite)));
+            commandBuffer.end();
+            passValue = device.graphicsTimeline->submit({commandBuffer});
+
+            // old handles are still read by the copy, they are destroyed once every queue is past it and
+            // their memory goes back to vma at the end of the pass
+            for (const auto &[oldBuffer, newBuffer] : moved)
+            {
+                allocator.notifyRelocated(oldBuffer, newBuffer);
+                device.defer([device = device.device, oldBuffer = oldBuffer] { device.destroyBuffer(oldBuffer); });
+            }
+            return false;
+        }
+
+        // semaphore a submit on another queue has to wait on before it may read a moved buffer, empty once
+        // the copy has finished
+        std::optional<SemaphoreWait> handoff() const
+        {
+            if (!passOpen || device.graphicsTimeline->reached(passValue))
+            {
+                return std::nullopt;
+            }
+            return device.graphicsTimeline->at(passValue);
+        }
+
+        // empty when no defragmentation ever ran
+        std::string summary() const
+        {
+            if (passes == 0)
+            {
+                return {};
+            }
+            return std::format("defragmentation: {} passes, moved {} allocations ({:.2f} MiB), freed {} blocks "
+                               "({:.2f} MiB), {} -> {} blocks, {} moves skipped\n",
+                               passes, result.allocationsMoved, result.bytesMoved / (1024.0 * 1024.0),
+                               result.deviceMemoryBlocksFreed, result.bytesFreed / (1024.0 * 1024.0), blocksBefore,
+                               blocksAfter, skipped);
+        }
+
+        ~Defragmenter()
+        {
+            if (running())
+            {
+                if (passOpen)
+                {
+                    device.graphicsTimeline->waitUntil(passValue);
+                    vmaEndDefragmentationPass(allocator.allocator, context, &pass);
+                }
+                vmaEndDefragmentation(allocator.allocator, context, &result);
+            }
+            device.graphicsTimeline->waitUntil(passValue);
+            device.device.destroyCommandPool(commandPool);
+        }
+
+      private:
+        bool idle() const
+        {
+            return std::all_of(device.timelines.begin(), device.timelines.end(),
+                               [](const auto &timeline) { return timeline->reached(timeline->submitted.load()); });
+        }
+
+        uint32_t blockCount() const
+        {
+            VmaDetailedStatistics statistics{};
+            vmaCalculatePoolStatistics(allocator.allocator, pool(), &statistics);
+            return statistics.statistics.blockCount;
+        }
+
+        bool finish()
+        {
+            vmaEndDefragmentation(allocator.allocator, context, &result);
+            context = VK_NULL_HANDLE;
+            blocksAfter = blockCount();
+            return true;
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_DEFRAGMENTER_HH
@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef LETC_DELETIONQUEUE_HH
+#define LETC_DELETIONQUEUE_HH
+
+#include "pch.hh"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "Timeline.hh"
+
+namespace letc
+{
+    // destruction that has to wait until the gpu is done with a handle, each entry is tagged with the
+    // value on every timeline that could still use it and runs once all of them have completed
+    struct DeletionQueue
+    {
+        struct Entry
+        {
+            std::vector<std::pair<const Timeline *, uint64_t>> after;
+            std::function<void()> destroy;
+        };
+
+        std::mutex mutex;
+        std::deque<Entry> entries;
+
+        void push(std::vector<std::pair<const Timeline *, uint64_t>> after, std::function<void()> destroy)
+        {
+            std::lock_guard lock(mutex);
+            entries.push_back(Entry{std::move(after), std::move(destroy)});
+        }
+
+        // run everything whose timelines have all been passed, returns how many handles were released
+        size_t collect()
+        {
+            // each timeline is read once per collect, entries keyed on different queues finish out of order
+            std::vector<std::pair<const Timeline *, uint64_t>> completed;
+            auto reached = [&](const std::pair<const Timeline *, uint64_t> &point)
+            {
+                auto found = std::find_if(completed.begin(), completed.end(),
+                                          [&](const auto &known) { return known.first == point.first; });
+                if (found == completed.end())
+                {
+                    found = completed.emplace(completed.end(), point.first, point.first->completed());
+                }
+                return found->second >= point.second;
+            };
+            return collectIf([&](const Entry &entry)
+                             { return std::all_of(entry.after.begin(), entry.after.end(), reached); });
+        }
+
+        // release everything regardless of value, only valid once the device is idle
+        void flush()
+        {
+            while (collectIf([](const Entry &) { return true; }) > 0)
+            {
+            }
+        }
+
+        size_t size()
+        {
+            std::lock_guard lock(mutex);
+            return entries.size();
+        }
+
+      private:
+        template <typename F> size_t collectIf(const F &done)
+        {
+            std::vector<std::function<void()>> ready;
+            {
+                std::lock_guard lock(mutex);
+                auto kept = std::stable_partition(entries.begin(), entries.end(),
+                                                  [&](const Entry &entry) { return !done(entry); });
+                for (auto entry = kept; entry != entries.end(); ++entry)
+                {
+                    ready.push_back(std::move(entry->destroy));
+                }
+                entries.erase(kept, entries.end());
+            }
+
+            // destroy outside the lock, a destructor may well defer something else
+            for (auto &destroy : ready)
+            {
+                destroy();
+            }
+            return ready.size();
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_DELETIONQUEUE_HH
@@ -6,6 +6,9 @@
 
 #include "pch.hh"
 
+#include "DeletionQueue.hh"
+#include "Timeline.hh"
+
 // custom hash for the queue flags
 namespace std
 {
@@ -24,22 +27,69 @@ namespace letc
     {
         vk::PhysicalDevice physicalDevice;
         vk::Device device;
+        std::vector<vk::QueueFamilyProperties> queueFamilies;
+
+        // compute and transfer prefer dedicated families, without one they fall back to the next
+        // most capable family (transfer -> compute -> graphics) and share its queue and timeline
         uint32_t graphicsQueueFamilyIndex;
+        uint32_t computeQueueFamilyIndex;
+        uint32_t transferQueueFamilyIndex;
+        vk::Queue graphicsQueue;
+        vk::Queue computeQueue;
+        vk::Queue transferQueue;
+
+        // one timeline per created queue, every submit goes through these so frame pacing, uploads
+        // and deferred destruction all compare against their values
+        std::vector<std::unique_ptr<Timeline>> timelines;
+        Timeline *graphicsTimeline = nullptr;
+        Timeline *computeTimeline = nullptr;
+        Timeline *transferTimeline = nullptr;
+
+        // handles released by destructors, freed once the graphics timeline passes them
+        mutable DeletionQueue deletionQueue;
+
+        // optional features the renderer can take advantage of when they are there
+        struct Capabilities
+        {
+            bool extendedDynamicState = false;   // cull, front face, topology, depth state (core in 1.3)
+            bool dynamicPolygonMode = false;     // VK_EXT_extended_dynamic_state3
+            bool shaderObject = false;           // VK_EXT_shader_object
+            bool pipelineStatistics = false;     // vertex/fragment/clipping counts for the gpu profiler
+            bool memoryBudget = false;           // VK_EXT_memory_budget, real per heap usage and budget
+            bool samplerAnisotropy = false;      // anisotropic filtering for minified textures
+            bool textureCompressionBC = false;   // bc1-7 sampled images, cooked textures fall back to rgba8
+        };
+        Capabilities capabilities;
 
         operator const vk::Device &()
         {
             return device;
         }
+
+        bool hasAsyncCompute() const
+        {
+            return computeQueueFamilyIndex != graphicsQueueFamilyIndex;
+        }
+
+        bool hasTransferQueue() const
+        {
+            return transferQueueFamilyIndex != graphicsQueueFamilyIndex &&
+                   transferQueueFamilyIndex != computeQueueFamilyIndex;
+        }
         operator const vk::PhysicalDevice &() const
         {
             return physicalDevice;
         }
 
-        Device(const vk::Instance &instance)
+        // headless devices skip the swapchain extension and can run without a window system
+        Device(const vk::Instance &instance, const bool &headless = false)
         {
             std::vector<const char *> deviceExtensions{};
             deviceExtensions.push_back(vk::KHRDynamicRenderingExtensionName);
-            deviceExtensions.push_back(vk::KHRSwapchainExtensionName);
+            if (!headless)
+            {
+                deviceExtensions.push_back(vk::KHRSwapchainExtensionName);
+            }
 
             /*
                 Physical Device
@@ -71,6 +121,11 @@ namespace letc
                 {
                     continue;
                 }
+                // beginRendering and the dynamic state used by the renderer are core 1.3 entry points
+                if (pd.getProperties().apiVersion < vk::ApiVersion13)
+                {
+                    continue;
+                }
 
                 auto queueFamilies = pd.getQueueFamilyProperties();
                 for (uint32_t i = 0; i < queueFamilies.size(); i++)
@@ -89,30 +144,179 @@ namespace letc
 
             assertThrow(found, "no suitable physical device found");
 
+            /*
+                Queues
+            */
+            queueFamilies = physicalDevice.getQueueFamilyProperties();
+            auto findFamily = [this](const vk::QueueFlags &wanted, const vk::QueueFlags &unwanted) -> int64_t
+            {
+                for (uint32_t i = 0; i < queueFamilies.size(); i++)
+                {
+                    if ((queueFamilies[i].queueFlags & wanted) == wanted && !(queueFamilies[i].queueFlags & unwanted) &&
+                        queueFamilies[i].queueCount > 0)
+                    {
+                        return i;
+                    }
+                }
+                return -1;
+            };
+
+            int64_t computeFamily = findFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics);
+            computeQueueFamilyIndex = computeFamily >= 0 ? computeFamily : graphicsQueueFamilyIndex;
+
+            int64_t transferFamily = findFamily(vk::QueueFlagBits::eTransfer,
+                                                vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
+            transferQueueFamilyIndex = transferFamily >= 0 ? transferFamily : computeQueueFamilyIndex;
+
+            std::vector<uint32_t> uniqueFamilies{graphicsQueueFamilyIndex};
+            for (uint32_t family : {computeQueueFamilyIndex, transferQueueFamilyIndex})
+            {
+                if (std::find(uniqueFamilies.begin(), uniqueFamilies.end(), family) == uniqueFamilies.end())
+                {
+                    uniqueFamilies.push_back(family);
+                }
+            }
+
             float queuePriority = 1.0f;
-            vk::DeviceQueueCreateInfo queueCreateInfo{};
-            queueCreateInfo.setQueueFamilyIndex(graphicsQueueFamilyIndex);
-            queueCreateInfo.setQueueCount(1);
-            queueCreateInfo.setPQueuePriorities(&queuePriority);
+            std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+            for (uint32_t family : uniqueFamilies)
+            {
+                vk::DeviceQueueCreateInfo queueCreateInfo{};
+                queueCreateInfo.setQueueFamilyIndex(family);
+                queueCreateInfo.setQueueCount(1);
+                queueCreateInfo.setPQueuePriorities(&queuePriority);
+                queueCreateInfos.push_back(queueCreateInfo);
+            }
 
-            vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{};
-            dynamicRenderingFeatures.setDynamicRendering(true);
-            vk::PhysicalDeviceFeatures deviceFeatures{};
-            deviceFeatures.setFillModeNonSolid(true);
+            /*
+                Optional extensions and features
+            */
+            auto hasExtension = [available = physicalDevice.enumerateDeviceExtensionProperties()](const char *name)
+            {
+                return std::any_of(available.begin(), available.end(), [name](const vk::ExtensionProperties &ext)
+                                   { return std::strcmp(ext.extensionName, name) == 0; });
+            };
+
+            vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features,
+                               vk::PhysicalDeviceVulkan13Features,
+                               vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT,
+                               vk::PhysicalDeviceShaderObjectFeaturesEXT>
+                enabled{};
+            enabled.get<vk::PhysicalDeviceFeatures2>().features.setFillModeNonSolid(true);
+            capabilities.pipelineStatistics = physicalDevice.getFeatures().pipelineStatisticsQuery;
+            enabled.get<vk::PhysicalDeviceFeatures2>().features.setPipelineStatisticsQuery(
+                capabilities.pipelineStatistics);
+            capabilities.samplerAnisotropy = physicalDevice.getFeatures().samplerAnisotropy;
+            enabled.get<vk::PhysicalDeviceFeatures2>().features.setSamplerAnisotropy(capabilities.samplerAnisotropy);
+            capabilities.textureCompressionBC = physicalDevice.getFeatures().textureCompressionBC;
+            enabled.get<vk::PhysicalDeviceFeatures2>().features.setTextureCompressionBC(
+                capabilities.textureCompressionBC);
+            enabled.get<vk::PhysicalDeviceVulkan12Features>().setTimelineSemaphore(true);
+            enabled.get<vk::PhysicalDeviceVulkan13Features>().setDynamicRendering(true);
+            enabled.get<vk::PhysicalDeviceVulkan13Features>().setSynchronization2(true);
+            capabilities.extendedDynamicState = true;
+
+            // extension feature structs are only queried when the extension exists at all
+            if (hasExtension(vk::EXTExtendedDynamicState3ExtensionName) &&
+                physicalDevice
+                    .getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>()
+                    .get<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>()
+                    .extendedDynamicState3PolygonMode)
+            {
+                deviceExtensions.push_back(vk::EXTExtendedDynamicState3ExtensionName);
+                enabled.get<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>().setExtendedDynamicState3PolygonMode(
+                    true);
+                capabilities.dynamicPolygonMode = true;
+            }
+            else
+            {
+                enabled.unlink<vk::PhysicalDeviceExtendedDynamicState3FeaturesEXT>();
+            }
+
+            if (hasExtension(vk::EXTShaderObjectExtensionName) &&
+                physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceShaderObjectFeaturesEXT>()
+                    .get<vk::PhysicalDeviceShaderObjectFeaturesEXT>()
+                    .shaderObject)
+            {
+                deviceExtensions.push_back(vk::EXTShaderObjectExtensionName);
+                enabled.get<vk::PhysicalDeviceShaderObjectFeaturesEXT>().setShaderObject(true);
+                capabilities.shaderObject = true;
+            }
+            else
+            {
+                enabled.unlink<vk::PhysicalDeviceShaderObjectFeaturesEXT>();
+            }
+
+            // without it vma can only estimate the budget from heap sizes
+            if (hasExtension(vk::EXTMemoryBudgetExtensionName))
+            {
+                deviceExtensions.push_back(vk::EXTMemoryBudgetExtensionName);
+                capabilities.memoryBudget = true;
+            }
 
             vk::DeviceCreateInfo deviceCreateInfo{};
-            deviceCreateInfo.setQueueCreateInfoCount(1);
-            deviceCreateInfo.setPQueueCreateInfos(&queueCreateInfo);
+            deviceCreateInfo.setQueueCreateInfos(queueCreateInfos);
             deviceCreateInfo.setPEnabledExtensionNames(deviceExtensions);
-            deviceCreateInfo.setPEnabledFeatures(&deviceFeatures);
-            deviceCreateInfo.setPNext(&dynamicRenderingFeatures);
+            deviceCreateInfo.setPNext(&enabled.get<vk::PhysicalDeviceFeatures2>());
 
             // Create the logical device.
             device = physicalDevice.createDevice(deviceCreateInfo);
+
+            // families that fell back share the queue, and so must share the timeline
+            std::unordered_map<uint32_t, Timeline *> familyTimelines;
+            for (uint32_t family : uniqueFamilies)
+            {
+                timelines.push_back(std::make_unique<Timeline>(device, device.getQueue(family, 0), family));
+                familyTimelines[family] = timelines.back().get();
+            }
+            graphicsTimeline = familyTimelines.at(graphicsQueueFamilyIndex);
+            computeTimeline = familyTimelines.at(computeQueueFamilyIndex);
+            transferTimeline = familyTimelines.at(transferQueueFamilyIndex);
+            graphicsQueue = graphicsTimeline->queue;
+            computeQueue = computeTimeline->queue;
+            transferQueue = transferTimeline->queue;
+        }
+
+        // destroy a handle once no queue can still use it: the graphics submit recorded next, which is
+        // the one a frame being recorded right now ends up in, and whatever compute and transfer have
+        // already been handed. handles only one queue touches can be keyed on it with the overload below
+        void defer(std::function<void()> destroy) const
+        {
+            std::vector<std::pair<const Timeline *, uint64_t>> after;
+            for (const auto &timeline : timelines)
+            {
+                uint64_t value = timeline->submitted.load() + (timeline.get() == graphicsTimeline ? 1 : 0);
+                if (value > 0)
+                {
+                    after.emplace_back(timeline.get(), value);
+                }
+            }
+            deletionQueue.push(std::move(after), std::move(destroy));
+        }
+
+        // destroy a handle once timeline passes value, for work that only ever ran on that queue
+        void defer(const Timeline &timeline, const uint64_t &value, std::function<void()> destroy) const
+        {
+            deletionQueue.push({{&timeline, value}}, std::move(destroy));
+        }
+
+        // release whatever the gpu has finished with, called once a frame
+        size_t collectGarbage() const
+        {
+            return deletionQueue.collect();
+        }
+
+        // wait for the gpu and release everything still queued
+        void flushDeletions() const
+        {
+            device.waitIdle();
+            deletionQueue.flush();
         }
 
         ~Device()
         {
+            flushDeletions();
+            timelines.clear();
             device.destroy();
         }
     };
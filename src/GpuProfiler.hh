@@ -0,0 +1,406 @@
+#pragma once
+
+#ifndef LETC_GPUPROFILER_HH
+#define LETC_GPUPROFILER_HH
+
+#include "pch.hh"
+
+#include "Device.hh"
+#include "Timeline.hh"
+#include "Trace.hh"
+
+namespace letc
+{
+    // named timestamp (and optionally pipeline statistics) scopes inside a frame's command buffer.
+    // results are read back frameSlots frames later once the timeline says they are done, so nothing
+    // here ever waits on the gpu.
+    struct GpuProfiler
+    {
+        static constexpr uint32_t frameSlots = 3;
+        static constexpr uint32_t maxScopes = 64;
+        static constexpr uint32_t historySize = 120;
+        static constexpr size_t maxTraceEvents = 1 << 16;
+
+        // results come back in flag bit order: vertex invocations, clipping invocations,
+        // clipping primitives, fragment invocations
+        static constexpr uint32_t statisticCount = 4;
+        static constexpr vk::QueryPipelineStatisticFlags statisticFlags =
+            vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations |
+            vk::QueryPipelineStatisticFlagBits::eClippingInvocations |
+            vk::QueryPipelineStatisticFlagBits::eClippingPrimitives |
+            vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+        struct ScopeRecord
+        {
+            std::string name;
+            uint32_t depth;
+            uint32_t statisticsIndex; // UINT32_MAX without statistics
+            double cpuBeginUs;
+            double cpuEndUs;
+        };
+
+        struct FrameSlot
+        {
+            std::vector<ScopeRecord> scopes;
+            uint32_t statisticsUsed = 0;
+            uint64_t timelineValue = 0;
+            uint64_t frame = 0;
+            bool pending = false;
+        };
+
+        // rolling window of gpu milliseconds plus the last statistics seen for a scope
+        struct ScopeStats
+        {
+            std::array<double, historySize> samples{};
+            uint32_t count = 0;
+            uint32_t next = 0;
+            std::array<uint64_t, statisticCount> statistics{};
+
+            void add(const double &ms)
+            {
+                samples[next] = ms;
+                next = (next + 1) % historySize;
+                count = std::min(count + 1, historySize);
+            }
+
+            double min() const
+            {
+                return count ? *std::min_element(samples.begin(), samples.begin() + count) : 0.0;
+            }
+
+            double max() const
+            {
+                return count ? *std::max_element(samples.begin(), samples.begin() + count) : 0.0;
+            }
+
+            double avg() const
+            {
+                double sum = 0.0;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    sum += samples[i];
+                }
+                return count ? sum / count : 0.0;
+            }
+        };
+
+        const Device &device;
+        Timeline &timeline;
+
+        bool enabled = false;
+        bool statisticsEnabled = false;
+        vk::QueryPool timestampPool;
+        vk::QueryPool statisticsPool;
+        double timestampPeriod = 0.0; // ns per tick
+        uint64_t timestampMask = ~0ull;
+        double gpuOffsetUs = 0.0;     // gpu tick time -> traceNowUs()
+
+        std::array<FrameSlot, frameSlots> slots;
+        uint32_t current = 0;
+        uint64_t frameCount = 0;
+        uint64_t droppedFrames = 0; // slots that came round again before the gpu finished them
+        std::vector<uint32_t> openScopes;
+        bool statisticsActive = false;
+
+        std::map<std::string, ScopeStats> stats;
+        std::vector<TraceEvent> events;
+
+        GpuProfiler(const Device &device, Timeline &timeline) : device(device), timeline(timeline)
+        {
+            uint32_t validBits = device.queueFamilies[timeline.queueFamilyIndex].timestampValidBits;
+            enabled = validBits > 0;
+            if (!enabled)
+            {
+                return;
+            }
+            timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+            timestampPeriod = device.physicalDevice.getProperties().limits.timestampPeriod;
+
+            timestampPool = device.device.createQueryPool(vk::QueryPoolCreateInfo{}
+                                                              .setQueryType(vk::QueryType::eTimestamp)
+                                                              .setQueryCount(frameSlots * maxScopes * 2));
+            statisticsEnabled = device.capabilities.pipelineStatistics;
+            if (statisticsEnabled)
+            {
+                statisticsPool = device.device.createQueryPool(vk::QueryPoolCreateInfo{}
+                                                                   .setQueryType(vk::QueryType::ePipelineStatistics)
+                                                                   .setQueryCount(frameSlots * maxScopes)
+                                                                   .setPipelineStatistics(statisticFlags));
+            }
+
+            calibrate();
+        }
+
+        // reset this frame's queries, the slot being reused is read back first
+        void beginFrame(const vk::CommandBuffer &commandBuffer)
+        {
+            if (!enabled)
+            {
+                return;
+            }
+
+            current = static_cast<uint32_t>(frameCount % frameSlots);
+            resolve(slots[current]);
+
+            FrameSlot &slot = slots[current];
+            slot.scopes.clear();
+            slot.statisticsUsed = 0;
+            slot.frame = frameCount;
+            openScopes.clear();
+
+            commandBuffer.resetQueryPool(timestampPool, current * maxScopes * 2, maxScopes * 2);
+            if (statisticsEnabled)
+            {
+                commandBuffer.resetQueryPool(statisticsPool, current * maxScopes, maxScopes);
+            }
+        }
+
+        // statistics queries can't nest, a scope asking for them inside another one only gets timestamps
+        uint32_t begin(const vk::CommandBuffer &commandBuffer, const std::string &name, const bool &withStatistics)
+        {
+            FrameSlot &slot = slots[current];
+            if (!enabled || slot.scopes.size() >= maxScopes)
+            {
+                return UINT32_MAX;
+            }
+
+            uint32_t index = static_cast<uint32_t>(slot.scopes.size());
+            ScopeRecord record{name, static_cast<uint32_t>(openScopes.size()), UINT32_MAX, traceNowUs(), 0.0};
+            commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eNone, timestampPool, timestampQuery(index));
+
+            if (withStatistics && statisticsEnabled && !statisticsActive)
+            {
+                record.statisticsIndex = slot.statisticsUsed++;
+                commandBuffer.beginQuery(statisticsPool, current * maxScopes + record.statisticsIndex, {});
+                statisticsActive = true;
+            }
+
+            slot.scopes.push_back(std::move(record));
+            openScopes.push_back(index);
+            return index;
+        }
+
+        void end(const vk::CommandBuffer &commandBuffer, const uint32_t &index)
+        {
+            if (index == UINT32_MAX)
+            {
+                return;
+            }
+
+            ScopeRecord &record = slots[current].scopes[index];
+            if (record.statisticsIndex != UINT32_MAX)
+            {
+                commandBuffer.endQuery(statisticsPool, current * maxScopes + record.statisticsIndex);
+                statisticsActive = false;
+            }
+            commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, timestampPool,
+                                          timestampQuery(index) + 1);
+            record.cpuEndUs = traceNowUs();
+            openScopes.pop_back();
+        }
+
+        // the timeline value of the submit carrying this frame's command buffer
+        void endFrame(const uint64_t &timelineValue)
+        {
+            if (!enabled)
+            {
+                return;
+            }
+            assertThrow(openScopes.empty(), "gpu profiler scope left open at end of frame");
+            slots[current].timelineValue = timelineValue;
+            slots[current].pending = true;
+            frameCount++;
+        }
+
+        // read back whatever is done, call after the queue went idle to get the last frames too
+        void resolveAll()
+        {
+            for (uint32_t i = 1; i <= frameSlots; i++)
+            {
+                resolve(slots[(current + i) % frameSlots]);
+            }
+        }
+
+        std::string summary() const
+        {
+            std::string text = std::format("{:<24} {:>9} {:>9} {:>9}\n", "gpu scope (ms)", "min", "avg", "max");
+            for (const auto &[name, scope] : stats)
+            {
+                text += std::format("{:<24} {:>9.3f} {:>9.3f} {:>9.3f}", name, scope.min(), scope.avg(), scope.max());
+                if (scope.statistics[0] || scope.statistics[3])
+                {
+                    text += std::format("  vs {} clip {}/{} fs {}", scope.statistics[0], scope.statistics[2],
+                                        scope.statistics[1], scope.statistics[3]);
+                }
+                text += "\n";
+            }
+            return text;
+        }
+
+        // gpu scopes on their own lane next to the cpu time spent recording them, plus anything
+        // else the caller wants in the same trace
+        void writeChromeTrace(const std::filesystem::path &path, const std::vector<TraceEvent> &extraEvents = {},
+                              const TraceThreadNames &extraThreadNames = {}) const
+        {
+            std::vector<TraceEvent> all = events;
+            all.insert(all.end(), extraEvents.begin(), extraEvents.end());
+            TraceThreadNames threadNames = extraThreadNames;
+            threadNames[{0, 0}] = "command recording";
+            threadNames[{1, 0}] = "graphics queue";
+            letc::writeChromeTrace(path, all, {{0, "CPU"}, {1, "GPU"}}, threadNames);
+        }
+
+        ~GpuProfiler()
+        {
+            if (timestampPool)
+            {
+                device.device.destroyQueryPool(timestampPool);
+            }
+            if (statisticsPool)
+            {
+                device.device.destroyQueryPool(statisticsPool);
+            }
+        }
+
+        // ends the scope when it goes out of scope, see LETC_GPU_ZONE
+        struct Zone
+        {
+            GpuProfiler &profiler;
+            const vk::CommandBuffer &commandBuffer;
+            uint32_t index;
+
+            Zone(GpuProfiler &profiler, const vk::CommandBuffer &commandBuffer, const std::string &name,
+                 const bool &withStatistics = false)
+                : profiler(profiler), commandBuffer(commandBuffer),
+                  index(profiler.begin(commandBuffer, name, withStatistics))
+            {
+            }
+
+            ~Zone()
+            {
+                profiler.end(commandBuffer, index);
+            }
+
+            Zone(const Zone &) = delete;
+            Zone &operator=(const Zone &) = delete;
+        };
+
+      private:
+        uint32_t timestampQuery(const uint32_t &scope) const
+        {
+            return (current * maxScopes + scope) * 2;
+        }
+
+        double toUs(const uint64_t &ticks) const
+        {
+            return static_cast<double>(ticks & timestampMask) * timestampPeriod / 1000.0;
+        }
+
+        // a single timestamp read right after the queue goes idle pins gpu ticks to the cpu trace clock,
+        // good to within the submit latency which is plenty to line the lanes up
+        void calibrate()
+        {
+            vk::CommandPool pool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(timeline.queueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eTransient));
+            vk::CommandBufferAllocateInfo allocateInfo{};
+            allocateInfo.setCommandPool(pool).setCommandBufferCount(1).setLevel(vk::CommandBufferLevel::ePrimary);
+            vk::CommandBuffer commandBuffer = device.device.allocateCommandBuffers(allocateInfo).at(0);
+
+            commandBuffer.begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            commandBuffer.resetQueryPool(timestampPool, 0, 1);
+            commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, timestampPool, 0);
+            commandBuffer.end();
+
+            timeline.waitUntil(timeline.submit({commandBuffer}));
+            double cpuUs = traceNowUs();
+
+            uint64_t ticks = 0;
+            if (device.device.getQueryPoolResults(timestampPool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks),
+                                                  vk::QueryResultFlagBits::e64) == vk::Result::eSuccess)
+            {
+                gpuOffsetUs = cpuUs - toUs(ticks);
+            }
+            device.device.destroyCommandPool(pool);
+        }
+
+        void resolve(FrameSlot &slot)
+        {
+            if (!slot.pending)
+            {
+                return;
+            }
+            slot.pending = false;
+            if (!timeline.reached(slot.timelineValue))
+            {
+                droppedFrames++;
+                return;
+            }
+
+            uint32_t slotIndex = static_cast<uint32_t>(&slot - slots.data());
+            std::vector<uint64_t> ticks(slot.scopes.size() * 2);
+            if (!ticks.empty() &&
+                device.device.getQueryPoolResults(timestampPool, slotIndex * maxScopes * 2,
+                                                  static_cast<uint32_t>(ticks.size()), ticks.size() * sizeof(uint64_t),
+                                                  ticks.data(), sizeof(uint64_t),
+                                                  vk::QueryResultFlagBits::e64) != vk::Result::eSuccess)
+            {
+                droppedFrames++;
+                return;
+            }
+
+            std::vector<uint64_t> statistics(slot.statisticsUsed * statisticCount);
+            if (!statistics.empty() &&
+                device.device.getQueryPoolResults(statisticsPool, slotIndex * maxScopes, slot.statisticsUsed,
+                                                  statistics.size() * sizeof(uint64_t), statistics.data(),
+                                                  statisticCount * sizeof(uint64_t),
+                                                  vk::QueryResultFlagBits::e64) != vk::Result::eSuccess)
+            {
+                statistics.clear();
+            }
+
+            for (size_t i = 0; i < slot.scopes.size(); i++)
+            {
+                const ScopeRecord &record = slot.scopes[i];
+                double beginUs = toUs(ticks[i * 2]);
+                double endUs = toUs(ticks[i * 2 + 1]);
+
+                ScopeStats &scope = stats[record.name];
+                scope.add((endUs - beginUs) / 1000.0);
+
+                TraceEvent gpuEvent{record.name, "gpu", 1, 0, beginUs + gpuOffsetUs, endUs - beginUs, {}};
+                gpuEvent.args.push_back({"frame", slot.frame});
+                if (record.statisticsIndex != UINT32_MAX && !statistics.empty())
+                {
+                    const uint64_t *values = statistics.data() + record.statisticsIndex * statisticCount;
+                    scope.statistics = {values[0], values[1], values[2], values[3]};
+                    gpuEvent.args.push_back({"vertexInvocations", scope.statistics[0]});
+                    gpuEvent.args.push_back({"clippingInvocations", scope.statistics[1]});
+                    gpuEvent.args.push_back({"clippingPrimitives", scope.statistics[2]});
+                    gpuEvent.args.push_back({"fragmentInvocations", scope.statistics[3]});
+                }
+
+                if (events.size() + 2 <= maxTraceEvents)
+                {
+                    events.push_back(std::move(gpuEvent));
+                    events.push_back(TraceEvent{record.name, "record", 0, 0, record.cpuBeginUs,
+                                                record.cpuEndUs - record.cpuBeginUs, {}});
+                }
+            }
+        }
+    };
+}; // namespace letc
+
+#define LETC_GPU_ZONE_CONCAT_(a, b) a##b
+#define LETC_GPU_ZONE_CONCAT(a, b) LETC_GPU_ZONE_CONCAT_(a, b)
+
+// time the rest of the enclosing block on the gpu under name
+#define LETC_GPU_ZONE(profiler, commandBuffer, name)                                                                   \
+    letc::GpuProfiler::Zone LETC_GPU_ZONE_CONCAT(letcGpuZone, __LINE__)((profiler), (commandBuffer), (name))
+
+// same, plus vertex/fragment/clipping counts, statistics scopes must not nest
+#define LETC_GPU_ZONE_STATS(profiler, commandBuffer, name)                                                             \
+    letc::GpuProfiler::Zone LETC_GPU_ZONE_CONCAT(letcGpuZone, __LINE__)((profiler), (commandBuffer), (name), true)
+
+#endif // LETC_GPUPROFILER_HH
@@ -0,0 +1,404 @@
+#pragma once
+
+#ifndef LETC_IMAGE_HH
+#define LETC_IMAGE_HH
+
+#include "pch.hh"
+
+#include <optional>
+#include <tuple>
+
+#include "Allocator.hh"
+#include "Device.hh"
+#include "Stats.hh"
+
+namespace letc
+{
+    // everything needed to (re)create an image, 2d only: arrays, cubemaps and multisampled targets
+    struct ImageDesc
+    {
+        vk::Extent2D extent;
+        vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        vk::ImageUsageFlags usage;
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1; // a multiple of 6 for cubemaps, each 6 is one cube
+        bool cube = false;
+        vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+        vk::ImageTiling tiling = vk::ImageTiling::eOptimal;
+        VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY;
+    };
+
+    // the layout a subresource is in and the stages/accesses that last touched it, which is the src half
+    // of the next barrier. the named states cover the usual attachment, sampling, copy and present uses
+    struct ImageState
+    {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags2 stage = vk::PipelineStageFlagBits2::eNone;
+        vk::AccessFlags2 access = vk::AccessFlagBits2::eNone;
+
+        bool operator==(const ImageState &other) const = default;
+
+        static ImageState colorAttachment()
+        {
+            return {vk::ImageLayout::eColorAttachmentOptimal, vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                    vk::AccessFlagBits2::eColorAttachmentRead | vk::AccessFlagBits2::eColorAttachmentWrite};
+        }
+
+        static ImageState depthAttachment()
+        {
+            return {vk::ImageLayout::eDepthStencilAttachmentOptimal,
+                    vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+                    vk::AccessFlagBits2::eDepthStencilAttachmentRead |
+                        vk::AccessFlagBits2::eDepthStencilAttachmentWrite};
+        }
+
+        static ImageState shaderRead(const vk::PipelineStageFlags2 &stage = vk::PipelineStageFlagBits2::eFragmentShader)
+        {
+            return {vk::ImageLayout::eShaderReadOnlyOptimal, stage, vk::AccessFlagBits2::eShaderSampledRead};
+        }
+
+        static ImageState transferSrc()
+        {
+            return {vk::ImageLayout::eTransferSrcOptimal, vk::PipelineStageFlagBits2::eTransfer,
+                    vk::AccessFlagBits2::eTransferRead};
+        }
+
+        static ImageState transferDst()
+        {
+            return {vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits2::eTransfer,
+                    vk::AccessFlagBits2::eTransferWrite};
+        }
+
+        // presentation waits on a semaphore, the barrier only has to finish the layout change before it
+        static ImageState present()
+        {
+            return {vk::ImageLayout::ePresentSrcKHR, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone};
+        }
+    };
+
+    inline vk::ImageAspectFlags formatAspect(const vk::Format &format)
+    {
+        switch (format)
+        {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat:
+            return vk::ImageAspectFlagBits::eDepth;
+        case vk::Format::eS8Uint:
+            return vk::ImageAspectFlagBits::eStencil;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+            return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+        default:
+            return vk::ImageAspectFlagBits::eColor;
+        }
+    }
+
+    // a device image with no cpu copy. it owns every view made of it and tracks the state of each
+    // mip/layer so transition() can build the barriers from what the image was last used for
+    struct Image
+    {
+        const Allocator &allocator;
+        ImageDesc desc;
+        vk::Image image;
+        VmaAllocation allocation;
+        // the whole image: every mip and layer, the format's aspects, 2d/array/cube as the desc says
+        vk::ImageView view;
+
+        Image(const Allocator &allocator, const ImageDesc &desc) : allocator(allocator), desc(desc)
+        {
+            create();
+        }
+
+        Image(const Image &) = delete;
+        Image &operator=(const Image &) = delete;
+
+        vk::ImageAspectFlags aspect() const
+        {
+            return formatAspect(desc.format);
+        }
+
+        vk::ImageSubresourceRange fullRange() const
+        {
+            return {aspect(), 0, desc.mipLevels, 0, desc.arrayLayers};
+        }
+
+        // a view of part of the image, made on first use and kept until the image goes away or is recreated.
+        // type defaults to 2d for one layer and 2d array for several
+        vk::ImageView subresourceView(const vk::ImageSubresourceRange &range,
+                                      const std::optional<vk::ImageViewType> &type = std::nullopt)
+        {
+            vk::ImageViewType viewType =
+                type.value_or(range.layerCount == 1 ? vk::ImageViewType::e2D : vk::ImageViewType::e2DArray);
+            auto key = std::make_tuple(static_cast<uint32_t>(range.aspectMask), range.baseMipLevel, range.levelCount,
+                                       range.baseArrayLayer, range.layerCount, static_cast<uint32_t>(viewType));
+            auto found = views.find(key);
+            if (found != views.end())
+            {
+                return found->second;
+            }
+            vk::ImageView created = allocator.device.device.createImageView(vk::ImageViewCreateInfo{}
+                                                                                 .setImage(image)
+                                                                                 .setViewType(viewType)
+                                                                                 .setFormat(desc.format)
+                                                                                 .setSubresourceRange(range));
+            views.emplace(key, created);
+            return created;
+        }
+
+        // one mip of every layer, e.g. to render into a level or read it in a downsample pass
+        vk::ImageView mipView(const uint32_t &level)
+        {
+            return subresourceView({aspect(), level, 1, 0, desc.arrayLayers});
+        }
+
+        // one layer (or cube face) with all its mips
+        vk::ImageView layerView(const uint32_t &layer)
+        {
+            return subresourceView({aspect(), 0, desc.mipLevels, layer, 1});
+        }
+
+        // depth or stencil on its own out of a combined format, for sampling one of them
+        vk::ImageView aspectView(const vk::ImageAspectFlags &aspectMask)
+        {
+            return subresourceView({aspectMask, 0, desc.mipLevels, 0, desc.arrayLayers}, defaultViewType());
+        }
+
+        const ImageState &state(const uint32_t &level = 0, const uint32_t &layer = 0) const
+        {
+            return states[level * desc.arrayLayers + layer];
+        }
+
+        // barriers taking range (the whole image by default) from its tracked state to next, appended so
+        // several images can go in one pipelineBarrier2. discard drops the contents with an undefined old layout.
+        // subresources already in next are left out, ones that share a state share a barrier
+        void transition(std::vector<vk::ImageMemoryBarrier2> &barriers, const ImageState &next,
+                        const std::optional<vk::ImageSubresourceRange> &range = std::nullopt,
+                        const bool &discard = false)
+        {
+            vk::ImageSubresourceRange subresources = range.value_or(fullRange());
+            if (subresources.levelCount == VK_REMAINING_MIP_LEVELS)
+            {
+                subresources.levelCount = desc.mipLevels - subresources.baseMipLevel;
+            }
+            if (subresources.layerCount == VK_REMAINING_ARRAY_LAYERS)
+            {
+                subresources.layerCount = desc.arrayLayers - subresources.baseArrayLayer;
+            }
+
+            auto barrierFrom = [&](const ImageState &previous, const vk::ImageSubresourceRange &barrierRange)
+            {
+                return vk::ImageMemoryBarrier2{}
+                    .setSrcStageMask(previous.stage)
+                    .setSrcAccessMask(previous.access)
+                    .setDstStageMask(next.stage)
+                    .setDstAccessMask(next.access)
+                    .setOldLayout(discard ? vk::ImageLayout::eUndefined : previous.layout)
+                    .setNewLayout(next.layout)
+                    .setImage(image)
+                    .setSubresourceRange(barrierRange);
+            };
+
+            const ImageState &first = state(subresources.baseMipLevel, subresources.baseArrayLayer);
+            bool uniform = true;
+            forEachSubresource(subresources, [&](ImageState &current, const uint32_t &, const uint32_t &)
+                               { uniform &= current == first; });
+            if (uniform)
+            {
+                if (!(first == next) || discard)
+                {
+                    barriers.push_back(barrierFrom(first, subresources));
+                }
+            }
+            else
+            {
+                // one barrier per run of layers in a mip that were left in the same state
+                forEachSubresource(
+                    subresources,
+                    [&](ImageState &current, const uint32_t &level, const uint32_t &layer)
+                    {
+                        if (current == next && !discard)
+                        {
+                            return;
+                        }
+                        vk::ImageSubresourceRange single{subresources.aspectMask, level, 1, layer, 1};
+                        if (!barriers.empty() && barriers.back().image == image &&
+                            barriers.back().subresourceRange.baseMipLevel == level &&
+                            barriers.back().subresourceRange.baseArrayLayer +
+                                    barriers.back().subresourceRange.layerCount ==
+                                layer &&
+                            barriers.back().srcStageMask == current.stage &&
+                            barriers.back().srcAccessMask == current.access &&
+                            barriers.back().oldLayout == (discard ? vk::ImageLayout::eUndefined : current.layout))
+                        {
+                            barriers.back().subresourceRange.layerCount++;
+                            return;
+                        }
+                        barriers.push_back(barrierFrom(current, single));
+                    });
+            }
+            forEachSubresource(subresources,
+                               [&](ImageState &current, const uint32_t &, const uint32_t &) { current = next; });
+        }
+
+        // record the barriers for one image right away
+        void transition(const vk::CommandBuffer &commandBuffer, const ImageState &next,
+                        const std::optional<vk::ImageSubresourceRange> &range = std::nullopt,
+                        const bool &discard = false)
+        {
+            std::vector<vk::ImageMemoryBarrier2> barriers;
+            transition(barriers, next, range, discard);
+            if (!barriers.empty())
+            {
+                commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setImageMemoryBarriers(barriers));
+            }
+        }
+
+        // for layout changes recorded outside transition(), e.g. by a render pass or another queue
+        void setState(const ImageState &next)
+        {
+            std::fill(states.begin(), states.end(), next);
+        }
+
+        // same desc at a new size, see recreate()
+        void resize(const vk::Extent2D &extent)
+        {
+            ImageDesc resized = desc;
+            resized.extent = extent;
+            recreate(resized);
+        }
+
+        // a new image in place of this one. the memory is kept when the new image fits in it, so a window
+        // resize that shrinks or keeps its render targets allocates nothing. the caller makes sure nothing
+        // uses the old image's contents afterwards, the first barrier of the new one waits on its last use
+        void recreate(const ImageDesc &newDesc)
+        {
+            ImageState lastUse;
+            for (const ImageState &current : states)
+            {
+                lastUse.stage |= current.stage;
+                lastUse.access |= current.access;
+            }
+            destroyViews();
+            vk::Image oldImage = image;
+
+            desc = newDesc;
+            vk::ImageCreateInfo createInfo = imageCreateInfo();
+            vk::Image candidate = allocator.device.device.createImage(createInfo);
+            vk::MemoryRequirements requirements = allocator.device.device.getImageMemoryRequirements(candidate);
+            VmaAllocationInfo info{};
+            vmaGetAllocationInfo(allocator.allocator, allocation, &info);
+            if (requirements.size <= info.size && info.offset % requirements.alignment == 0 &&
+                (requirements.memoryTypeBits & (1u << info.memoryType)) &&
+                vmaBindImageMemory(allocator.allocator, allocation, candidate) == VK_SUCCESS)
+            {
+                allocator.device.defer([device = allocator.device.device, oldImage]
+                                       { device.destroyImage(oldImage); });
+                image = candidate;
+                createViews();
+                // contents are undefined but the memory may still be in use by the old image's last pass
+                states.assign(static_cast<size_t>(desc.mipLevels) * desc.arrayLayers,
+                              ImageState{vk::ImageLayout::eUndefined, lastUse.stage, lastUse.access});
+                return;
+            }
+
+            allocator.device.device.destroyImage(candidate);
+            destroyImage();
+            create();
+        }
+
+        ~Image()
+        {
+            destroyViews();
+            destroyImage();
+        }
+
+      private:
+        std::vector<ImageState> states;
+        std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t>, vk::ImageView> views;
+
+        vk::ImageViewType defaultViewType() const
+        {
+            if (desc.cube)
+            {
+                return desc.arrayLayers > 6 ? vk::ImageViewType::eCubeArray : vk::ImageViewType::eCube;
+            }
+            return desc.arrayLayers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D;
+        }
+
+        vk::ImageCreateInfo imageCreateInfo() const
+        {
+            assertThrow(!desc.cube || desc.arrayLayers % 6 == 0, "cubemaps need a multiple of 6 layers");
+            assertThrow(desc.samples == vk::SampleCountFlagBits::e1 || desc.mipLevels == 1,
+                        "multisampled images can't have mips");
+            vk::ImageCreateInfo createInfo{};
+            createInfo.imageType = vk::ImageType::e2D;
+            createInfo.extent = vk::Extent3D{desc.extent.width, desc.extent.height, 1};
+            createInfo.mipLevels = desc.mipLevels;
+            createInfo.arrayLayers = desc.arrayLayers;
+            createInfo.format = desc.format;
+            createInfo.tiling = desc.tiling;
+            createInfo.initialLayout = vk::ImageLayout::eUndefined;
+            createInfo.usage = desc.usage;
+            createInfo.sharingMode = vk::SharingMode::eExclusive;
+            createInfo.samples = desc.samples;
+            if (desc.cube)
+            {
+                createInfo.flags = vk::ImageCreateFlagBits::eCubeCompatible;
+            }
+            return createInfo;
+        }
+
+        void create()
+        {
+            // aliasable so recreate() may bind a different image to the same memory
+            assertThrow(allocator.createImage(imageCreateInfo(), desc.memoryUsage, categorize(desc.usage), image,
+                                              allocation, VMA_ALLOCATION_CREATE_CAN_ALIAS_BIT) == VK_SUCCESS,
+                        "failed to create image");
+            addStat(Stat::Allocations);
+            createViews();
+            states.assign(static_cast<size_t>(desc.mipLevels) * desc.arrayLayers, ImageState{});
+        }
+
+        void createViews()
+        {
+            view = subresourceView(fullRange(), defaultViewType());
+        }
+
+        void destroyViews()
+        {
+            allocator.device.defer(
+                [device = allocator.device.device, views = views]
+                {
+                    for (const auto &[key, view] : views)
+                    {
+                        device.destroyImageView(view);
+                    }
+                });
+            views.clear();
+            view = nullptr;
+        }
+
+        void destroyImage()
+        {
+            allocator.untrack(allocation);
+            addStat(Stat::Frees);
+            allocator.device.defer([vma = allocator.allocator, image = image, allocation = allocation]
+                                   { vmaDestroyImage(vma, image, allocation); });
+        }
+
+        template <typename F> void forEachSubresource(const vk::ImageSubresourceRange &range, const F &function)
+        {
+            for (uint32_t level = range.baseMipLevel; level < range.baseMipLevel + range.levelCount; level++)
+            {
+                for (uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + range.layerCount; layer++)
+                {
+                    function(states[level * desc.arrayLayers + layer], level, layer);
+                }
+            }
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_IMAGE_HH
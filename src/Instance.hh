@@ -50,6 +50,7 @@ namespace letc
     struct InstanceBuilder
     {
         bool debug;
+        bool headless;
         vk::ApplicationInfo applicationInfo;
         std::vector<const char *> instanceExtensions;
         std::vector<const char *> validationLayers;
@@ -60,6 +61,7 @@ namespace letc
         InstanceBuilder()
         {
             debug = false;
+            headless = false;
 
             /*
                 Application Information
@@ -103,6 +105,22 @@ namespace letc
             return *this;
         }
 
+        // no window system, drops the surface extensions for offscreen tools like the benchmark
+        InstanceBuilder &setHeadless(const bool &headless)
+        {
+            this->headless = headless;
+            if (headless)
+            {
+                std::erase_if(instanceExtensions,
+                              [](const char *extension)
+                              {
+                                  return std::strcmp(extension, vk::KHRSurfaceExtensionName) == 0 ||
+                                         std::strcmp(extension, vk::KHRGetSurfaceCapabilities2ExtensionName) == 0;
+                              });
+            }
+            return *this;
+        }
+
         InstanceBuilder &setApplicationInfo(const vk::ApplicationInfo &applicationInfo)
         {
             this->applicationInfo = applicationInfo;
@@ -152,9 +170,12 @@ namespace letc
 
         Instance(InstanceBuilder ib) : instanceBuilder(ib)
         {
-            std::span<const char *> requiredExtensions = vkfw::getRequiredInstanceExtensions();
-            ib.instanceExtensions.insert(ib.instanceExtensions.end(), requiredExtensions.begin(),
-                                         requiredExtensions.end());
+            if (!ib.headless)
+            {
+                std::span<const char *> requiredExtensions = vkfw::getRequiredInstanceExtensions();
+                ib.instanceExtensions.insert(ib.instanceExtensions.end(), requiredExtensions.begin(),
+                                             requiredExtensions.end());
+            }
 
             /*
                 InstanceCreate
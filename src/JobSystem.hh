@@ -0,0 +1,424 @@
+#pragma once
+
+#ifndef LETC_JOBSYSTEM_HH
+#define LETC_JOBSYSTEM_HH
+
+#include "pch.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+
+#include "Zones.hh"
+
+namespace letc
+{
+    struct JobSystem;
+
+    // tracks outstanding jobs, wait() on it to join a batch or use it as a
+    // dependency with submitAfter()
+    struct JobCounter
+    {
+        std::atomic<uint32_t> pending{0};
+
+        std::mutex mutex;
+        std::vector<std::function<void()>> continuations;
+        std::exception_ptr error;
+
+        bool done() const
+        {
+            return pending.load(std::memory_order_acquire) == 0;
+        }
+    };
+
+    struct Job
+    {
+        std::function<void()> function;
+        JobCounter *counter = nullptr;
+    };
+
+    struct JobSystem
+    {
+        // one deque per core, the owner pushes and pops at the back and
+        // thieves take from the front so they grab the oldest (biggest) work
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers; // workers[0] belongs to the main thread
+        std::vector<std::thread> threads;
+        std::thread::id mainThread;
+
+        std::atomic<bool> running{true};
+        std::atomic<uint32_t> queued{0};
+        std::mutex sleepMutex;
+        std::condition_variable sleepCondition;
+
+        // work that has to run on the main thread (GLFW, presentation)
+        std::mutex mainMutex;
+        std::vector<Job> mainJobs;
+
+        // jobs without a counter have nobody to rethrow to, their failures are logged and the first one is
+        // kept here until takeError()
+        std::mutex errorMutex;
+        std::exception_ptr uncountedError;
+        std::atomic<uint32_t> uncountedFailures{0};
+
+        static inline thread_local uint32_t workerIndex = 0;
+        static inline thread_local JobSystem *owner = nullptr;
+
+        JobSystem(uint32_t threadCount = 0)
+        {
+            if (threadCount == 0)
+            {
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            mainThread = std::this_thread::get_id();
+            owner = this;
+            workerIndex = 0;
+
+            for (uint32_t i = 0; i < threadCount; i++)
+            {
+                workers.push_back(std::make_unique<Worker>());
+            }
+            for (uint32_t i = 1; i < threadCount; i++)
+            {
+                threads.emplace_back([this, i] { workerLoop(i); });
+            }
+        }
+
+        ~JobSystem()
+        {
+            {
+                std::lock_guard lock(sleepMutex);
+                running = false;
+            }
+            sleepCondition.notify_all();
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+            if (owner == this)
+            {
+                owner = nullptr;
+            }
+        }
+
+        JobSystem(const JobSystem &) = delete;
+        JobSystem &operator=(const JobSystem &) = delete;
+
+        uint32_t threadCount() const
+        {
+            return static_cast<uint32_t>(workers.size());
+        }
+
+        bool isMainThread() const
+        {
+            return std::this_thread::get_id() == mainThread;
+        }
+
+        // queue a job on the calling thread's deque, idle workers will steal it
+        void submit(std::function<void()> function, JobCounter *counter = nullptr)
+        {
+            if (counter)
+            {
+                counter->pending.fetch_add(1, std::memory_order_relaxed);
+            }
+            push(Job{std::move(function), counter});
+        }
+
+        // queue a job once every job tracked by dependency has finished
+        void submitAfter(JobCounter &dependency, std::function<void()> function, JobCounter *counter = nullptr)
+        {
+            if (counter)
+            {
+                counter->pending.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Job job{std::move(function), counter};
+            {
+                std::lock_guard lock(dependency.mutex);
+                if (!dependency.done())
+                {
+                    dependency.continuations.push_back([this, job = std::move(job)]() mutable { push(std::move(job)); });
+                    return;
+                }
+            }
+            push(std::move(job));
+        }
+
+        // queue a job that is only ever run by pumpMainThread()
+        void submitMain(std::function<void()> function, JobCounter *counter = nullptr)
+        {
+            if (counter)
+            {
+                counter->pending.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::lock_guard lock(mainMutex);
+            mainJobs.push_back(Job{std::move(function), counter});
+        }
+
+        // run the main thread queue, call this once per frame next to vkfw::pollEvents
+        void pumpMainThread()
+        {
+            assertThrow(isMainThread(), "pumpMainThread called off the main thread");
+
+            std::vector<Job> jobs;
+            {
+                std::lock_guard lock(mainMutex);
+                jobs.swap(mainJobs);
+            }
+            for (auto &job : jobs)
+            {
+                execute(job);
+            }
+        }
+
+        // help out with queued work until the counter drains, rethrows the first job exception
+        void wait(JobCounter &counter)
+        {
+            while (!counter.done())
+            {
+                if (isMainThread())
+                {
+                    pumpMainThread();
+                }
+                if (!runOne())
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            // the last job drops to zero while holding the mutex, taking it here makes
+            // sure it has let go before the caller is free to destroy the counter
+            std::exception_ptr error;
+            {
+                std::lock_guard lock(counter.mutex);
+                error = counter.error;
+                counter.error = nullptr;
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+        // the first exception a job without a counter threw since the last call, null if none did
+        std::exception_ptr takeError()
+        {
+            std::lock_guard lock(errorMutex);
+            return std::exchange(uncountedError, nullptr);
+        }
+
+        // calls function(begin, end) over [0, count) in chunks of grain and waits for all of them
+        template <typename F> void parallelFor(const size_t &count, const size_t &grain, const F &function)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+            if (count <= grain || workers.size() == 1)
+            {
+                function(size_t{0}, count);
+                return;
+            }
+
+            JobCounter counter;
+            for (size_t begin = grain; begin < count; begin += grain)
+            {
+                size_t end = std::min(begin + grain, count);
+                submit([&function, begin, end] { function(begin, end); }, &counter);
+            }
+
+            // the calling thread takes the first chunk itself instead of idling
+            try
+            {
+                function(size_t{0}, std::min(grain, count));
+            }
+            catch (...)
+            {
+                wait(counter);
+                throw;
+            }
+            wait(counter);
+        }
+
+        // calls function(item) on every element of the span
+        template <typename T, typename F>
+        void parallelFor(std::span<T> items, const F &function, const size_t &grain = 64)
+        {
+            parallelFor(items.size(), grain,
+                        [&items, &function](size_t begin, size_t end)
+                        {
+                            for (size_t i = begin; i < end; i++)
+                            {
+                                function(items[i]);
+                            }
+                        });
+        }
+
+      private:
+        uint32_t currentWorker() const
+        {
+            return owner == this ? workerIndex : 0;
+        }
+
+        void push(Job job)
+        {
+            Worker &worker = *workers[currentWorker()];
+            {
+                std::lock_guard lock(worker.mutex);
+                worker.jobs.push_back(std::move(job));
+            }
+            queued.fetch_add(1, std::memory_order_release);
+            {
+                // pairs with the predicate check in workerLoop so the wakeup can't slip in between
+                std::lock_guard lock(sleepMutex);
+            }
+            sleepCondition.notify_one();
+        }
+
+        bool pop(Job &job)
+        {
+            uint32_t self = currentWorker();
+
+            {
+                Worker &worker = *workers[self];
+                std::lock_guard lock(worker.mutex);
+                if (!worker.jobs.empty())
+                {
+                    job = std::move(worker.jobs.back());
+                    worker.jobs.pop_back();
+                    queued.fetch_sub(1, std::memory_order_acq_rel);
+                    return true;
+                }
+            }
+
+            // steal, starting from a random victim so thieves spread out
+            static thread_local std::minstd_rand random{std::random_device{}()};
+            uint32_t start = static_cast<uint32_t>(random() % workers.size());
+            for (uint32_t i = 0; i < workers.size(); i++)
+            {
+                uint32_t victim = (start + i) % workers.size();
+                if (victim == self)
+                {
+                    continue;
+                }
+
+                Worker &worker = *workers[victim];
+                std::unique_lock lock(worker.mutex, std::try_to_lock);
+                if (lock.owns_lock() && !worker.jobs.empty())
+                {
+                    job = std::move(worker.jobs.front());
+                    worker.jobs.pop_front();
+                    queued.fetch_sub(1, std::memory_order_acq_rel);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool runOne()
+        {
+            Job job;
+            if (!pop(job))
+            {
+                return false;
+            }
+            execute(job);
+            return true;
+        }
+
+        void execute(Job &job)
+        {
+            std::exception_ptr error;
+            try
+            {
+                LETC_ZONE("job");
+                job.function();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            JobCounter *counter = job.counter;
+            if (!counter)
+            {
+                // never rethrown, that would end a worker or surface in some unrelated wait()
+                if (error)
+                {
+                    reportUncounted(error);
+                }
+                return;
+            }
+
+            std::vector<std::function<void()>> continuations;
+            {
+                std::lock_guard lock(counter->mutex);
+                if (error && !counter->error)
+                {
+                    counter->error = error;
+                }
+                if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    continuations.swap(counter->continuations);
+                }
+            }
+            for (auto &continuation : continuations)
+            {
+                continuation();
+            }
+        }
+
+        void reportUncounted(const std::exception_ptr &error)
+        {
+            uncountedFailures.fetch_add(1, std::memory_order_relaxed);
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "job failed: " << e.what() << std::endl;
+            }
+            catch (...)
+            {
+                std::cerr << "job failed with an unknown exception" << std::endl;
+            }
+            std::lock_guard lock(errorMutex);
+            if (!uncountedError)
+            {
+                uncountedError = error;
+            }
+        }
+
+        void workerLoop(const uint32_t &index)
+        {
+            owner = this;
+            workerIndex = index;
+            LETC_ZONE_THREAD(std::format("worker {}", index));
+
+            while (running)
+            {
+                if (runOne())
+                {
+                    continue;
+                }
+
+                std::unique_lock lock(sleepMutex);
+                sleepCondition.wait(lock, [this] { return !running || queued.load(std::memory_order_acquire) > 0; });
+            }
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_JOBSYSTEM_HH
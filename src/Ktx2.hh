@@ -0,0 +1,341 @@
+#pragma once
+
+#ifndef LETC_KTX2_HH
+#define LETC_KTX2_HH
+
+#include "pch.hh"
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace letc
+{
+    // a read only view of a whole file. mapped where the os allows it so level data is paged straight
+    // into the staging copy instead of being read into a heap buffer first
+    struct MappedFile
+    {
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+
+        MappedFile(const std::filesystem::path &path)
+        {
+#ifdef _WIN32
+            std::vector<char> file = readFile(path);
+            fallback.assign(file.begin(), file.end());
+            data = fallback.data();
+            size = fallback.size();
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            assertThrow(fd >= 0, "failed to open file: " + path.string());
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size <= 0)
+            {
+                close(fd);
+                throw std::runtime_error("failed to determine file size: " + path.string());
+            }
+            size = static_cast<size_t>(info.st_size);
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            // the mapping keeps its own reference to the file
+            close(fd);
+            assertThrow(mapping != MAP_FAILED, "failed to map file: " + path.string());
+            data = static_cast<const uint8_t *>(mapping);
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        std::span<const uint8_t> bytes() const
+        {
+            return {data, size};
+        }
+
+        ~MappedFile()
+        {
+#ifndef _WIN32
+            munmap(const_cast<uint8_t *>(data), size);
+#endif
+        }
+
+      private:
+#ifdef _WIN32
+        std::vector<uint8_t> fallback;
+#endif
+    };
+
+    // written to a temporary next to path and renamed over it, so readers on other threads or
+    // processes see either the old file or the whole new one
+    inline void writeFileAtomically(const std::filesystem::path &path, const std::span<const uint8_t> &bytes)
+    {
+        std::filesystem::path temporary = path;
+        temporary += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            assertThrow(out, "failed to open " + temporary.string());
+            out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            assertThrow(out, "failed to write " + temporary.string());
+        }
+        std::filesystem::rename(temporary, path);
+    }
+
+    // texels per block edge and bytes per block of the formats textures are stored in
+    struct FormatBlock
+    {
+        uint32_t extent = 1;
+        uint32_t bytes = 4;
+    };
+
+    inline FormatBlock formatBlock(const vk::Format &format)
+    {
+        switch (format)
+        {
+        case vk::Format::eR8G8B8A8Unorm:
+        case vk::Format::eR8G8B8A8Srgb:
+            return {1, 4};
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc1RgbSrgbBlock:
+            return {4, 8};
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc3SrgbBlock:
+        case vk::Format::eBc5UnormBlock:
+        case vk::Format::eBc7UnormBlock:
+        case vk::Format::eBc7SrgbBlock:
+            return {4, 16};
+        default:
+            throw std::runtime_error("unsupported texture format: " + vk::to_string(format));
+        }
+    }
+
+    // tightly packed bytes of a level, whole blocks at the edges
+    inline size_t levelSize(const vk::Format &format, const uint32_t &width, const uint32_t &height)
+    {
+        FormatBlock block = formatBlock(format);
+        return static_cast<size_t>((width + block.extent - 1) / block.extent) *
+               ((height + block.extent - 1) / block.extent) * block.bytes;
+    }
+
+    inline bool isSrgb(const vk::Format &format)
+    {
+        return format == vk::Format::eR8G8B8A8Srgb || format == vk::Format::eBc1RgbSrgbBlock ||
+               format == vk::Format::eBc3SrgbBlock || format == vk::Format::eBc7SrgbBlock;
+    }
+
+    // the subset of ktx2 the engine reads and writes: one 2d image, no array layers, cube faces or
+    // supercompression, every mip level present and stored in the format it is sampled in.
+    // https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+    namespace ktx2
+    {
+        constexpr std::array<uint8_t, 12> identifier = {0xAB, 'K', 'T', 'X', ' ', '2',
+                                                        '0',  0xBB, '\r', '\n', 0x1A, '\n'};
+
+        struct Header
+        {
+            std::array<uint8_t, 12> identifier;
+            uint32_t vkFormat;
+            uint32_t typeSize;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t layerCount;
+            uint32_t faceCount;
+            uint32_t levelCount;
+            uint32_t supercompressionScheme;
+            uint32_t dfdByteOffset;
+            uint32_t dfdByteLength;
+            uint32_t kvdByteOffset;
+            uint32_t kvdByteLength;
+            uint64_t sgdByteOffset;
+            uint64_t sgdByteLength;
+        };
+        static_assert(sizeof(Header) == 80);
+
+        struct LevelIndex
+        {
+            uint64_t byteOffset;
+            uint64_t byteLength;
+            uint64_t uncompressedByteLength;
+        };
+
+        // khr data format descriptor, the basic block describing how a texel block's bits map to channels
+        inline std::vector<uint32_t> dataFormatDescriptor(const vk::Format &format)
+        {
+            constexpr uint8_t modelRgbsda = 1;
+            constexpr uint8_t modelBc1a = 128;
+            constexpr uint8_t modelBc3 = 130;
+            constexpr uint8_t modelBc5 = 132;
+            constexpr uint8_t modelBc7 = 134;
+            constexpr uint8_t channelAlpha = 15;
+            constexpr uint8_t qualifierLinear = 0x10;
+
+            // {bitOffset, bitLength - 1, channel}
+            std::vector<std::array<uint32_t, 3>> samples;
+            uint8_t model = modelRgbsda;
+            switch (format)
+            {
+            case vk::Format::eR8G8B8A8Unorm:
+            case vk::Format::eR8G8B8A8Srgb:
+                samples = {{0, 7, 0}, {8, 7, 1}, {16, 7, 2}, {24, 7, channelAlpha}};
+                break;
+            case vk::Format::eBc1RgbUnormBlock:
+            case vk::Format::eBc1RgbSrgbBlock:
+                model = modelBc1a;
+                samples = {{0, 63, 0}};
+                break;
+            case vk::Format::eBc3UnormBlock:
+            case vk::Format::eBc3SrgbBlock:
+                model = modelBc3;
+                samples = {{0, 63, channelAlpha}, {64, 63, 0}};
+                break;
+            case vk::Format::eBc5UnormBlock:
+                model = modelBc5;
+                samples = {{0, 63, 0}, {64, 63, 1}};
+                break;
+            default:
+                model = modelBc7;
+                samples = {{0, 127, 0}};
+                break;
+            }
+
+            const FormatBlock block = formatBlock(format);
+            const bool srgb = isSrgb(format);
+            const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+            // total size, then the block: khronos basic descriptor version 1.3, bt709 primaries with an srgb
+            // or linear transfer, the texel block dimensions minus one and the bytes in plane 0
+            std::vector<uint32_t> words;
+            words.push_back(4 + blockSize);
+            words.push_back(0);
+            words.push_back(2 | blockSize << 16);
+            words.push_back(model | 1 << 8 | (srgb ? 2 : 1) << 16);
+            words.push_back((block.extent - 1) | (block.extent - 1) << 8);
+            words.push_back(block.bytes);
+            words.push_back(0);
+            for (const auto &[bitOffset, bitLength, channel] : samples)
+            {
+                uint32_t channelType = channel;
+                // alpha is never srgb encoded
+                if (srgb && channel == channelAlpha)
+                {
+                    channelType |= qualifierLinear;
+                }
+                // position 0 and the full range of the bits
+                words.push_back(bitOffset | bitLength << 16 | channelType << 24);
+                words.push_back(0);
+                words.push_back(0);
+                words.push_back(bitLength < 31 ? (1u << (bitLength + 1)) - 1 : UINT32_MAX);
+            }
+            return words;
+        }
+
+        inline size_t align(const size_t &offset, const size_t &alignment)
+        {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+    }; // namespace ktx2
+
+    // a parsed file, the levels point into the mapping and stay valid as long as file does
+    struct Ktx2Image
+    {
+        vk::Format format = vk::Format::eUndefined;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // offset and size in file of each level, level 0 first
+        std::vector<std::pair<size_t, size_t>> levels;
+        std::shared_ptr<const MappedFile> file;
+    };
+
+    // mmap and validate the header and level index, the level data is only touched when it is copied
+    inline Ktx2Image readKtx2(const std::filesystem::path &path)
+    {
+        auto file = std::make_shared<const MappedFile>(path);
+        std::span<const uint8_t> bytes = file->bytes();
+        assertThrow(bytes.size() >= sizeof(ktx2::Header), "ktx2 file is truncated: " + path.string());
+
+        ktx2::Header header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        assertThrow(header.identifier == ktx2::identifier, "not a ktx2 file: " + path.string());
+        assertThrow(header.supercompressionScheme == 0, "supercompressed ktx2 is not supported: " + path.string());
+        assertThrow(header.pixelDepth == 0 && header.layerCount <= 1 && header.faceCount == 1,
+                    "only single 2d ktx2 images are supported: " + path.string());
+
+        Ktx2Image image;
+        image.format = static_cast<vk::Format>(header.vkFormat);
+        image.width = header.pixelWidth;
+        image.height = std::max(header.pixelHeight, 1u);
+        assertThrow(image.width > 0, "ktx2 image has no width: " + path.string());
+        // 0 asks the loader to generate the chain, the one level there is level 0. a full chain ends at 1x1,
+        // which also keeps the shifts below in range
+        const uint32_t levelCount = std::max(header.levelCount, 1u);
+        assertThrow(levelCount <= static_cast<uint32_t>(std::bit_width(std::max(image.width, image.height))),
+                    std::format("ktx2 has {} levels, more than a {}x{} image can: {}", levelCount, image.width,
+                                image.height, path.string()));
+        assertThrow(bytes.size() >= sizeof(header) + levelCount * sizeof(ktx2::LevelIndex),
+                    "ktx2 level index is truncated: " + path.string());
+
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            ktx2::LevelIndex index;
+            std::memcpy(&index, bytes.data() + sizeof(header) + level * sizeof(index), sizeof(index));
+            const size_t expected = levelSize(image.format, std::max(image.width >> level, 1u),
+                                              std::max(image.height >> level, 1u));
+            assertThrow(index.byteLength == expected && index.byteOffset <= bytes.size() &&
+                            index.byteLength <= bytes.size() - index.byteOffset,
+                        std::format("ktx2 level {} is out of bounds: {}", level, path.string()));
+            image.levels.push_back({static_cast<size_t>(index.byteOffset), static_cast<size_t>(index.byteLength)});
+        }
+        image.file = std::move(file);
+        return image;
+    }
+
+    // levels (level 0 first, tightly packed) to path. written next to it and renamed over it so
+    // concurrent writers and readers never see half a file
+    inline void writeKtx2(const std::filesystem::path &path, const vk::Format &format, const uint32_t &width,
+                          const uint32_t &height, const std::vector<std::span<const uint8_t>> &levels)
+    {
+        const FormatBlock block = formatBlock(format);
+        const std::vector<uint32_t> dfd = ktx2::dataFormatDescriptor(format);
+
+        ktx2::Header header{};
+        header.identifier = ktx2::identifier;
+        header.vkFormat = static_cast<uint32_t>(format);
+        header.typeSize = 1;
+        header.pixelWidth = width;
+        header.pixelHeight = height;
+        header.faceCount = 1;
+        header.levelCount = static_cast<uint32_t>(levels.size());
+        header.dfdByteOffset = static_cast<uint32_t>(sizeof(header) + levels.size() * sizeof(ktx2::LevelIndex));
+        header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+        // the spec stores the smallest level first so a streamer can show something before the rest arrives
+        std::vector<ktx2::LevelIndex> index(levels.size());
+        size_t offset = header.dfdByteOffset + header.dfdByteLength;
+        for (size_t level = levels.size(); level-- > 0;)
+        {
+            offset = ktx2::align(offset, std::lcm<size_t>(block.bytes, 4));
+            index[level] = {offset, levels[level].size(), levels[level].size()};
+            offset += levels[level].size();
+        }
+
+        std::vector<uint8_t> bytes(offset, 0);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::memcpy(bytes.data() + sizeof(header), index.data(), index.size() * sizeof(ktx2::LevelIndex));
+        std::memcpy(bytes.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+        for (size_t level = 0; level < levels.size(); level++)
+        {
+            std::memcpy(bytes.data() + index[level].byteOffset, levels[level].data(), levels[level].size());
+        }
+
+        writeFileAtomically(path, bytes);
+    }
+}; // namespace letc
+
+#endif // LETC_KTX2_HH
@@ -0,0 +1,98 @@
+#pragma once
+
+#ifndef LETC_LAYOUT_HH
+#define LETC_LAYOUT_HH
+
+#include "pch.hh"
+
+#include <cstddef>
+
+namespace letc::gpu
+{
+    // the GLSL names the shared header is written in
+    using uint = uint32_t;
+    using vec2 = glm::vec2;
+    using vec4 = glm::vec4;
+    using uvec4 = glm::uvec4;
+    using mat4 = glm::mat4;
+
+#include "../resources/layout.h"
+
+    // base alignment of a member under std140/std430, only the types layout.h is allowed to use
+    template <typename T> constexpr size_t baseAlignment()
+    {
+        if constexpr (std::is_same_v<T, float> || std::is_same_v<T, uint> || std::is_same_v<T, int32_t>)
+        {
+            return 4;
+        }
+        else if constexpr (std::is_same_v<T, vec2>)
+        {
+            return 8;
+        }
+        else if constexpr (std::is_same_v<T, vec4> || std::is_same_v<T, uvec4> || std::is_same_v<T, mat4>)
+        {
+            return 16;
+        }
+        else
+        {
+            static_assert(sizeof(T) == 0, "type has no agreed GLSL layout, see resources/layout.h");
+            return 0;
+        }
+    }
+}; // namespace letc::gpu
+
+// member sits where GLSL expects it
+#define LETC_LAYOUT_MEMBER(Type, member)                                                                               \
+    static_assert(offsetof(letc::gpu::Type, member) %                                                                  \
+                          letc::gpu::baseAlignment<decltype(letc::gpu::Type::member)>() ==                             \
+                      0,                                                                                               \
+                  #Type "::" #member " is not aligned the way GLSL lays it out")
+
+// structs in uniform blocks are rounded up to 16 bytes
+#define LETC_LAYOUT_STD140(Type)                                                                                       \
+    static_assert(sizeof(letc::gpu::Type) % 16 == 0, #Type " size is not a multiple of 16 as std140 requires")
+
+// structs in storage buffers and push constants are rounded to their largest member
+#define LETC_LAYOUT_STD430(Type, largestAlignment)                                                                     \
+    static_assert(sizeof(letc::gpu::Type) % largestAlignment == 0, #Type " size breaks std430 array stride")
+
+LETC_LAYOUT_STD140(GlobalUniforms);
+LETC_LAYOUT_MEMBER(GlobalUniforms, time);
+LETC_LAYOUT_MEMBER(GlobalUniforms, frame);
+
+LETC_LAYOUT_STD140(CameraUniforms);
+LETC_LAYOUT_MEMBER(CameraUniforms, view);
+LETC_LAYOUT_MEMBER(CameraUniforms, proj);
+
+LETC_LAYOUT_STD430(Light, 16);
+LETC_LAYOUT_MEMBER(Light, position);
+LETC_LAYOUT_MEMBER(Light, color);
+
+LETC_LAYOUT_STD430(InstanceData, 16);
+LETC_LAYOUT_MEMBER(InstanceData, model);
+LETC_LAYOUT_MEMBER(InstanceData, modelInvTranspose);
+
+LETC_LAYOUT_STD430(DrawRecord, 4);
+LETC_LAYOUT_MEMBER(DrawRecord, transformIndex);
+LETC_LAYOUT_MEMBER(DrawRecord, materialIndex);
+static_assert(sizeof(letc::gpu::DrawRecord) <= 128, "DrawRecord outgrew the guaranteed push constant size");
+
+LETC_LAYOUT_STD430(Meshlet, 16);
+LETC_LAYOUT_MEMBER(Meshlet, bounds);
+LETC_LAYOUT_MEMBER(Meshlet, cone);
+LETC_LAYOUT_MEMBER(Meshlet, vertexOffset);
+LETC_LAYOUT_MEMBER(Meshlet, triangleCount);
+
+LETC_LAYOUT_STD430(DrawIndexedCommand, 4);
+static_assert(sizeof(letc::gpu::DrawIndexedCommand) == sizeof(VkDrawIndexedIndirectCommand),
+              "DrawIndexedCommand must match what drawIndexedIndirect reads");
+
+LETC_LAYOUT_STD430(MeshletCullRecord, 16);
+LETC_LAYOUT_MEMBER(MeshletCullRecord, viewProj);
+LETC_LAYOUT_MEMBER(MeshletCullRecord, eye);
+LETC_LAYOUT_MEMBER(MeshletCullRecord, transformIndex);
+LETC_LAYOUT_MEMBER(MeshletCullRecord, flags);
+static_assert(sizeof(letc::gpu::MeshletCullRecord) <= 128,
+              "MeshletCullRecord outgrew the guaranteed push constant size");
+
+#endif // LETC_LAYOUT_HH
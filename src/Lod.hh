@@ -0,0 +1,528 @@
+#pragma once
+
+#ifndef LETC_LOD_HH
+#define LETC_LOD_HH
+
+#include "pch.hh"
+
+#include <limits>
+#include <numeric>
+#include <span>
+
+#include "Camera.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // one level of a mesh's chain, a range of the shared index buffer drawn against the same vertices
+    struct MeshLod
+    {
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        // furthest (in model space) a vertex of the level sits from the planes of the full mesh's faces it
+        // stands in for
+        float error = 0.0f;
+        // the level's triangles again as meshlets, see buildMeshlets()
+        uint32_t firstMeshlet = 0;
+        uint32_t meshletCount = 0;
+    };
+
+    // center of the bounding box and the distance to the vertex furthest from it, xyz center and w radius
+    inline glm::vec4 boundingSphere(const std::span<const glm::vec4> &positions)
+    {
+        if (positions.empty())
+        {
+            return glm::vec4(0.0f);
+        }
+        glm::vec3 low(positions[0]);
+        glm::vec3 high(positions[0]);
+        for (const glm::vec4 &position : positions)
+        {
+            low = glm::min(low, glm::vec3(position));
+            high = glm::max(high, glm::vec3(position));
+        }
+        const glm::vec3 center = (low + high) * 0.5f;
+        float radius2 = 0.0f;
+        for (const glm::vec4 &position : positions)
+        {
+            const glm::vec3 offset = glm::vec3(position) - center;
+            radius2 = std::max(radius2, glm::dot(offset, offset));
+        }
+        return glm::vec4(center, std::sqrt(radius2));
+    }
+
+    // squared distance to the planes of the faces around a vertex, weighted by their area. only orders the
+    // collapses, the error a level reports is the unweighted furthest distance, see Simplifier::faces
+    struct Quadric
+    {
+        double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+        double b2 = 0.0, bc = 0.0, bd = 0.0;
+        double c2 = 0.0, cd = 0.0;
+        double d2 = 0.0;
+        double weight = 0.0;
+
+        static Quadric plane(const glm::dvec3 &normal, const double &d, const double &weight)
+        {
+            const double a = normal.x;
+            const double b = normal.y;
+            const double c = normal.z;
+            return {a * a * weight, a * b * weight, a * c * weight, a * d * weight, b * b * weight,
+                    b * c * weight, b * d * weight, c * c * weight, c * d * weight, d * d * weight, weight};
+        }
+
+        Quadric &operator+=(const Quadric &other)
+        {
+            a2 += other.a2, ab += other.ab, ac += other.ac, ad += other.ad;
+            b2 += other.b2, bc += other.bc, bd += other.bd;
+            c2 += other.c2, cd += other.cd;
+            d2 += other.d2;
+            weight += other.weight;
+            return *this;
+        }
+
+        // mean squared distance of p to the planes
+        double error(const glm::dvec3 &p) const
+        {
+            const double e = a2 * p.x * p.x + 2.0 * ab * p.x * p.y + 2.0 * ac * p.x * p.z + 2.0 * ad * p.x +
+                             b2 * p.y * p.y + 2.0 * bc * p.y * p.z + 2.0 * bd * p.y + c2 * p.z * p.z +
+                             2.0 * cd * p.z + d2;
+            return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+        }
+    };
+
+    // quadric error edge collapse over an indexed triangle list. vertices are only ever collapsed onto other
+    // existing vertices, so every level it produces indexes the original vertex buffer.
+    //
+    // vertices sharing a position (uv or normal seams) are welded for topology and error. a seam vertex only
+    // moves onto another seam vertex so the seam keeps its shape, and each of its copies picks the copy at the
+    // destination with the closest uv and normal. open borders and non-manifold edges are never moved
+    struct Simplifier
+    {
+        std::vector<unsigned> index;
+        // furthest any collapse so far moved a vertex from the planes of the original faces it took over, as a
+        // model space distance
+        float error = 0.0f;
+
+        Simplifier(std::vector<unsigned> index, const std::span<const glm::vec4> &position,
+                   const std::span<const glm::vec2> &uv = {}, const std::span<const glm::vec4> &normal = {})
+            : index(std::move(index)), position(position), uv(uv), normal(normal)
+        {
+            LETC_ZONE("Simplifier::Simplifier");
+            weld();
+            classify();
+            computeQuadrics();
+        }
+
+        // collapse edges until at most targetIndexCount indices are left or every remaining collapse would
+        // move the surface further than maxError. false when nothing could be collapsed
+        bool simplify(const size_t &targetIndexCount,
+                      const float &maxError = std::numeric_limits<float>::max())
+        {
+            LETC_ZONE("Simplifier::simplify");
+            const size_t start = index.size();
+            while (index.size() > targetIndexCount && collapsePass(targetIndexCount, maxError))
+            {
+            }
+            return index.size() < start;
+        }
+
+      private:
+        enum class Kind : uint8_t
+        {
+            Interior, // one vertex at this position, free to move anywhere
+            Seam,     // several vertices share the position, moves along other seam vertices
+            Locked    // on a border or a non-manifold edge
+        };
+
+        struct Collapse
+        {
+            unsigned from;
+            unsigned to;
+            double cost;
+        };
+
+        std::span<const glm::vec4> position;
+        std::span<const glm::vec2> uv;
+        std::span<const glm::vec4> normal;
+
+        // per vertex, the lowest vertex at the same position and the next one in the ring of those vertices
+        std::vector<unsigned> canonical;
+        std::vector<unsigned> nextWedge;
+        // per canonical vertex
+        std::vector<Kind> kind;
+        std::vector<Quadric> quadrics;
+        // original faces a canonical vertex stands in for, sorted, and the plane of every original face. a
+        // collapse hands from's faces to to, so the furthest plane from to is a real bound rather than a mean
+        std::vector<std::vector<unsigned>> faces;
+        std::vector<glm::dvec4> planes;
+
+        glm::dvec3 point(const unsigned &vertex) const
+        {
+            return glm::dvec3(position[vertex]);
+        }
+
+        void weld()
+        {
+            const size_t count = position.size();
+            std::vector<unsigned> order(count);
+            std::iota(order.begin(), order.end(), 0u);
+            auto key = [this](const unsigned &v) { return std::tie(position[v].x, position[v].y, position[v].z); };
+            std::sort(order.begin(), order.end(),
+                      [&](const unsigned &a, const unsigned &b) { return key(a) < key(b); });
+
+            canonical.resize(count);
+            nextWedge.resize(count);
+            for (size_t begin = 0; begin < count;)
+            {
+                size_t end = begin + 1;
+                while (end < count && key(order[end]) == key(order[begin]))
+                {
+                    end++;
+                }
+                const unsigned first = *std::min_element(order.begin() + begin, order.begin() + end);
+                for (size_t i = begin; i < end; i++)
+                {
+                    canonical[order[i]] = first;
+                    nextWedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+                }
+                begin = end;
+            }
+        }
+
+        void classify()
+        {
+            kind.assign(position.size(), Kind::Interior);
+            // every undirected edge of a closed manifold is shared by exactly two triangles
+            std::unordered_map<uint64_t, uint32_t> edgeUses;
+            std::vector<uint8_t> referenced(position.size(), 0);
+            for (size_t i = 0; i < index.size(); i += 3)
+            {
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    const unsigned a = canonical[index[i + corner]];
+                    const unsigned b = canonical[index[i + (corner + 1) % 3]];
+                    edgeUses[(uint64_t(std::min(a, b)) << 32) | std::max(a, b)]++;
+                    referenced[index[i + corner]] = 1;
+                }
+            }
+            for (unsigned v = 0; v < position.size(); v++)
+            {
+                if (referenced[v] && canonical[v] != v)
+                {
+                    kind[canonical[v]] = Kind::Seam;
+                }
+            }
+            for (const auto &[edge, uses] : edgeUses)
+            {
+                if (uses != 2)
+                {
+                    kind[edge >> 32] = Kind::Locked;
+                    kind[edge & 0xffffffffu] = Kind::Locked;
+                }
+            }
+        }
+
+        void computeQuadrics()
+        {
+            quadrics.assign(position.size(), Quadric{});
+            faces.assign(position.size(), {});
+            planes.assign(index.size() / 3, glm::dvec4(0.0));
+            for (size_t i = 0; i < index.size(); i += 3)
+            {
+                const unsigned a = canonical[index[i]];
+                const unsigned b = canonical[index[i + 1]];
+                const unsigned c = canonical[index[i + 2]];
+                glm::dvec3 n = glm::cross(point(b) - point(a), point(c) - point(a));
+                const double area2 = glm::length(n);
+                if (area2 <= 0.0)
+                {
+                    continue;
+                }
+                n /= area2;
+                const Quadric q = Quadric::plane(n, -glm::dot(n, point(a)), area2 * 0.5);
+                quadrics[a] += q;
+                quadrics[b] += q;
+                quadrics[c] += q;
+                const unsigned face = static_cast<unsigned>(i / 3);
+                planes[face] = glm::dvec4(n, -glm::dot(n, point(a)));
+                faces[a].push_back(face);
+                faces[b].push_back(face);
+                faces[c].push_back(face);
+            }
+        }
+
+        // furthest plane of the faces from stands in for, from to's position. to itself doesn't move, so its own
+        // faces are already covered by error
+        double distance(const Collapse &collapse) const
+        {
+            const glm::dvec3 p = point(collapse.to);
+            double furthest = 0.0;
+            for (const unsigned &face : faces[collapse.from])
+            {
+                furthest = std::max(furthest, std::abs(glm::dot(glm::dvec3(planes[face]), p) + planes[face].w));
+            }
+            return furthest;
+        }
+
+        bool canMove(const unsigned &from, const unsigned &to) const
+        {
+            return kind[from] == Kind::Interior || (kind[from] == Kind::Seam && kind[to] != Kind::Interior);
+        }
+
+        // the copy of to's position whose attributes are closest to vertex's
+        unsigned wedgeFor(const unsigned &vertex, const unsigned &to) const
+        {
+            unsigned best = to;
+            float bestDistance = std::numeric_limits<float>::max();
+            unsigned wedge = to;
+            do
+            {
+                float distance = 0.0f;
+                if (!uv.empty())
+                {
+                    const glm::vec2 offset = uv[wedge] - uv[vertex];
+                    distance += glm::dot(offset, offset);
+                }
+                if (!normal.empty())
+                {
+                    const glm::vec3 offset = glm::vec3(normal[wedge]) - glm::vec3(normal[vertex]);
+                    distance += glm::dot(offset, offset);
+                }
+                if (distance < bestDistance)
+                {
+                    best = wedge;
+                    bestDistance = distance;
+                }
+                wedge = nextWedge[wedge];
+            } while (wedge != to);
+            return best;
+        }
+
+        // true when moving from onto to turns one of from's remaining triangles over
+        bool flips(const Collapse &collapse, const std::span<const unsigned> &triangles) const
+        {
+            for (const unsigned &triangle : triangles)
+            {
+                unsigned corners[3];
+                bool degenerate = false;
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    corners[corner] = canonical[index[triangle * 3 + corner]];
+                    degenerate |= corners[corner] == collapse.to;
+                }
+                if (degenerate)
+                {
+                    continue;
+                }
+                const glm::dvec3 before =
+                    glm::cross(point(corners[1]) - point(corners[0]), point(corners[2]) - point(corners[0]));
+                for (unsigned &corner : corners)
+                {
+                    corner = corner == collapse.from ? collapse.to : corner;
+                }
+                const glm::dvec3 after =
+                    glm::cross(point(corners[1]) - point(corners[0]), point(corners[2]) - point(corners[0]));
+                if (glm::dot(before, after) <= 0.25 * glm::length(before) * glm::length(after))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // the cheapest independent collapses, applied together. each one locks the vertices of the triangles
+        // around it for the rest of the pass so the flip checks of later ones see up to date triangles
+        bool collapsePass(const size_t &targetIndexCount, const float &maxError)
+        {
+            const size_t triangleCount = index.size() / 3;
+
+            // triangles around each canonical vertex
+            std::vector<unsigned> offsets(position.size() + 1, 0);
+            for (const unsigned &vertex : index)
+            {
+                offsets[canonical[vertex] + 1]++;
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            std::vector<unsigned> adjacency(index.size());
+            std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < index.size(); i++)
+            {
+                adjacency[fill[canonical[index[i]]]++] = static_cast<unsigned>(i / 3);
+            }
+            auto around = [&](const unsigned &vertex)
+            {
+                return std::span<const unsigned>(adjacency.data() + offsets[vertex],
+                                                 offsets[vertex + 1] - offsets[vertex]);
+            };
+
+            // each interior edge shows up once in each direction, only the a < b one is taken
+            std::vector<Collapse> collapses;
+            for (size_t triangle = 0; triangle < triangleCount; triangle++)
+            {
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    const unsigned a = canonical[index[triangle * 3 + corner]];
+                    const unsigned b = canonical[index[triangle * 3 + (corner + 1) % 3]];
+                    if (a >= b)
+                    {
+                        continue;
+                    }
+                    Quadric merged = quadrics[a];
+                    merged += quadrics[b];
+                    const double towardsB = canMove(a, b) ? merged.error(point(b)) : -1.0;
+                    const double towardsA = canMove(b, a) ? merged.error(point(a)) : -1.0;
+                    if (towardsB >= 0.0 && (towardsA < 0.0 || towardsB <= towardsA))
+                    {
+                        collapses.push_back({a, b, towardsB});
+                    }
+                    else if (towardsA >= 0.0)
+                    {
+                        collapses.push_back({b, a, towardsA});
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(),
+                      [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+            const double maxCost = static_cast<double>(maxError) * maxError;
+            const size_t trianglesToRemove = (index.size() - targetIndexCount + 2) / 3;
+            std::vector<unsigned> collapseTo(position.size(), ~0u);
+            std::vector<uint8_t> touched(position.size(), 0);
+            size_t removed = 0;
+            size_t applied = 0;
+            for (const Collapse &collapse : collapses)
+            {
+                if (collapse.cost > maxCost || removed >= trianglesToRemove)
+                {
+                    break;
+                }
+                if (touched[collapse.from] || touched[collapse.to] || flips(collapse, around(collapse.from)))
+                {
+                    continue;
+                }
+                // the cost is a mean, so a collapse under it can still move some face further than maxError
+                const double moved = distance(collapse);
+                if (moved > maxError)
+                {
+                    continue;
+                }
+                collapseTo[collapse.from] = collapse.to;
+                quadrics[collapse.to] += quadrics[collapse.from];
+                std::vector<unsigned> &into = faces[collapse.to];
+                const size_t middle = into.size();
+                into.insert(into.end(), faces[collapse.from].begin(), faces[collapse.from].end());
+                std::inplace_merge(into.begin(), into.begin() + middle, into.end());
+                into.erase(std::unique(into.begin(), into.end()), into.end());
+                faces[collapse.from] = {};
+                error = std::max(error, static_cast<float>(moved));
+                for (const unsigned &triangle : around(collapse.from))
+                {
+                    bool shared = false;
+                    for (size_t corner = 0; corner < 3; corner++)
+                    {
+                        const unsigned vertex = canonical[index[triangle * 3 + corner]];
+                        touched[vertex] = 1;
+                        shared |= vertex == collapse.to;
+                    }
+                    removed += shared;
+                }
+                applied++;
+            }
+            if (applied == 0)
+            {
+                return false;
+            }
+
+            // move every copy of a collapsed vertex and drop the triangles that lost an edge
+            size_t write = 0;
+            for (size_t i = 0; i < index.size(); i += 3)
+            {
+                unsigned triangle[3];
+                for (size_t corner = 0; corner < 3; corner++)
+                {
+                    const unsigned vertex = index[i + corner];
+                    const unsigned to = collapseTo[canonical[vertex]];
+                    triangle[corner] = to == ~0u ? vertex : wedgeFor(vertex, to);
+                }
+                if (canonical[triangle[0]] == canonical[triangle[1]] ||
+                    canonical[triangle[1]] == canonical[triangle[2]] ||
+                    canonical[triangle[2]] == canonical[triangle[0]])
+                {
+                    continue;
+                }
+                index[write++] = triangle[0];
+                index[write++] = triangle[1];
+                index[write++] = triangle[2];
+            }
+            index.resize(write);
+            return true;
+        }
+    };
+
+    // levels past 0 are simplified from the one before to half its triangles, so the error only grows along
+    // the chain. it ends at maxLodCount levels, below minLodTriangles, or when a level can't get under 85% of
+    // the one before (everything left is locked or would flip). index is rewritten to every level back to back
+    constexpr uint32_t maxLodCount = 8;
+    constexpr size_t minLodTriangles = 32;
+
+    inline std::vector<MeshLod> buildLodChain(std::vector<unsigned> &index, const std::span<const glm::vec4> &position,
+                                              const std::span<const glm::vec2> &uv = {},
+                                              const std::span<const glm::vec4> &normal = {})
+    {
+        LETC_ZONE("buildLodChain");
+        std::vector<MeshLod> lods{{0, static_cast<uint32_t>(index.size()), 0.0f}};
+        Simplifier simplifier(index, position, uv, normal);
+        while (lods.size() < maxLodCount && simplifier.index.size() / 3 > minLodTriangles)
+        {
+            const size_t previous = simplifier.index.size();
+            simplifier.simplify(std::max(previous / 2 / 3 * 3, minLodTriangles * 3));
+            if (simplifier.index.size() > previous * 85 / 100)
+            {
+                break;
+            }
+            lods.push_back({static_cast<uint32_t>(index.size()), static_cast<uint32_t>(simplifier.index.size()),
+                            std::max(simplifier.error, lods.back().error)});
+            index.insert(index.end(), simplifier.index.begin(), simplifier.index.end());
+        }
+        return lods;
+    }
+
+    // pixels one model space unit covers on screen at the mesh's bounding sphere, from the camera's vertical
+    // fov and a viewport viewportHeight pixels tall. closer than the near plane counts as at it
+    inline float lodPixelsPerUnit(const glm::vec4 &bounds, const glm::mat4 &world, const Camera &camera,
+                                  const float &viewportHeight)
+    {
+        const glm::vec3 center(world * glm::vec4(glm::vec3(bounds), 1.0f));
+        const float scale = std::sqrt(std::max({glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+                                                glm::dot(glm::vec3(world[1]), glm::vec3(world[1])),
+                                                glm::dot(glm::vec3(world[2]), glm::vec3(world[2]))}));
+        const float distance =
+            std::max(glm::distance(center, glm::vec3(camera.eye)) - bounds.w * scale, camera.near);
+        return scale * viewportHeight / (2.0f * distance * std::tan(glm::radians(camera.fovy) * 0.5f));
+    }
+
+    // the coarsest level whose error covers at most threshold pixels. a level is only left for a coarser one
+    // once that one is under threshold * (1 - hysteresis), and for a finer one once its own error is over
+    // threshold * (1 + hysteresis), so a mesh sitting at a switching distance doesn't pop back and forth
+    inline uint32_t selectLod(const std::span<const MeshLod> &lods, const float &pixelsPerUnit,
+                              const uint32_t &previous, const float &threshold = 1.0f,
+                              const float &hysteresis = 0.25f)
+    {
+        if (lods.empty())
+        {
+            return 0;
+        }
+        uint32_t lod = std::min(previous, static_cast<uint32_t>(lods.size() - 1));
+        while (lod > 0 && lods[lod].error * pixelsPerUnit > threshold * (1.0f + hysteresis))
+        {
+            lod--;
+        }
+        while (lod + 1 < lods.size() && lods[lod + 1].error * pixelsPerUnit <= threshold * (1.0f - hysteresis))
+        {
+            lod++;
+        }
+        return lod;
+    }
+}; // namespace letc
+
+#endif // LETC_LOD_HH
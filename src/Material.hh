@@ -13,6 +13,9 @@
 #include "Descriptor.hh"
 #include "Device.hh"
 #include "Pipeline.hh"
+#include "Stats.hh"
+#include "Texture.hh"
+#include "Zones.hh"
 
 namespace letc
 {
@@ -27,6 +30,11 @@ namespace letc
 
         // bufferInfo[set][binding] = {bufferInfo, descriptorType}
         std::map<uint32_t, std::map<uint32_t, std::pair<vk::DescriptorBufferInfo, vk::DescriptorType>>> bufferInfos;
+        // imageInfos[set][binding] = {imageInfo, descriptorType}, sampler and image bindings
+        std::map<uint32_t, std::map<uint32_t, std::pair<vk::DescriptorImageInfo, vk::DescriptorType>>> imageInfos;
+
+        // rewrites the sets when the defragmenter moves a buffer they point at
+        uint64_t relocationListener;
 
         // makes all the descriptor sets based on the layout provided
         Material(const Device &device, const Allocator &allocator, const DescriptorLayout &descriptorLayout)
@@ -42,12 +50,22 @@ namespace letc
             {
                 for (const auto &bindingPair : setBindings.second)
                 {
-                    bufferInfos[setBindings.first][bindingPair.first] = {vk::DescriptorBufferInfo{},
-                                                                         bindingPair.second.descriptorType};
+                    const vk::DescriptorType &type = bindingPair.second.descriptorType;
+                    if (isImageDescriptor(type))
+                    {
+                        imageInfos[setBindings.first][bindingPair.first] = {vk::DescriptorImageInfo{}, type};
+                    }
+                    else
+                    {
+                        bufferInfos[setBindings.first][bindingPair.first] = {vk::DescriptorBufferInfo{}, type};
+                    }
                 }
             }
 
             dynamicOffsets.resize(descriptorSets.size(), std::nullopt);
+
+            relocationListener = allocator.addRelocationListener(
+                [this](const vk::Buffer &oldBuffer, const vk::Buffer &newBuffer) { relocate(oldBuffer, newBuffer); });
         }
 
         // set the buffer info to the corrisponding set, nothing has been updated yet
@@ -68,9 +86,25 @@ namespace letc
             bufferInfos[set][binding].first.setRange(range);
         }
 
-        // update the sets to point at the buffers in bufferInfos
+        // set the image info to the corrisponding set, nothing has been updated yet
+        void updateDescriptorImageInfo(const uint32_t &set, const uint32_t &binding, const vk::ImageView &view,
+                                       const vk::Sampler &sampler,
+                                       const vk::ImageLayout &layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+        {
+            imageInfos[set][binding].first = vk::DescriptorImageInfo{sampler, view, layout};
+        }
+
+        // set the texture to the corrisponding set, nothing has been updated yet
+        void updateDescriptorImageInfo(const uint32_t &set, const uint32_t &binding, const Texture &texture,
+                                       const vk::Sampler &sampler)
+        {
+            imageInfos[set][binding].first = texture.descriptorInfo(sampler);
+        }
+
+        // update the sets to point at the buffers in bufferInfos and the images in imageInfos
         void updateDescriptorSets()
         {
+            LETC_ZONE("Material::updateDescriptorSets");
             std::vector<vk::WriteDescriptorSet> descriptorWrites;
             uint32_t index = 0;
             for (const auto &ds : descriptorSets)
@@ -79,6 +113,11 @@ namespace letc
                 {
                     const auto &bufferInfo = bindingPair.second.first;
                     const auto &descriptorType = bindingPair.second.second;
+                    // bindings a material never uses (another material's set) are left unwritten
+                    if (!bufferInfo.buffer)
+                    {
+                        continue;
+                    }
                     auto write = vk::WriteDescriptorSet{}
                                      .setDstSet(ds)
                                      .setDstBinding(bindingPair.first)
@@ -87,9 +126,11 @@ namespace letc
                                      .setPBufferInfo(&bufferInfo);
                     descriptorWrites.push_back(write);
                 }
+                appendImageWrites(index, descriptorWrites);
                 ++index;
             }
             device.device.updateDescriptorSets(descriptorWrites, {});
+            addStat(Stat::DescriptorWrites, descriptorWrites.size());
         }
 
         // update a set using the bufferinfos
@@ -100,6 +141,10 @@ namespace letc
             {
                 const auto &bufferInfo = bindingPair.second.first;
                 const auto &descriptorType = bindingPair.second.second;
+                if (!bufferInfo.buffer)
+                {
+                    continue;
+                }
                 auto write = vk::WriteDescriptorSet{}
                                  .setDstSet(descriptorSets[set])
                                  .setDstBinding(bindingPair.first)
@@ -108,7 +153,9 @@ namespace letc
                                  .setPBufferInfo(&bufferInfo);
                 descriptorWrites.push_back(write);
             }
+            appendImageWrites(set, descriptorWrites);
             device.device.updateDescriptorSets(descriptorWrites, {});
+            addStat(Stat::DescriptorWrites, descriptorWrites.size());
         }
 
         // update a binding only using the bufferInfos
@@ -121,6 +168,10 @@ namespace letc
                 {
                     const auto &bufferInfo = bindingPair.second.first;
                     const auto &descriptorType = bindingPair.second.second;
+                    if (!bufferInfo.buffer)
+                    {
+                        continue;
+                    }
                     auto write = vk::WriteDescriptorSet{}
                                      .setDstSet(descriptorSets[set])
                                      .setDstBinding(bindingPair.first)
@@ -130,7 +181,30 @@ namespace letc
                     descriptorWrites.push_back(write);
                 }
             }
+            appendImageWrites(set, descriptorWrites, binding);
             device.device.updateDescriptorSets(descriptorWrites, {});
+            addStat(Stat::DescriptorWrites, descriptorWrites.size());
+        }
+
+        // point every binding using oldBuffer at newBuffer and rewrite the sets
+        void relocate(const vk::Buffer &oldBuffer, const vk::Buffer &newBuffer)
+        {
+            bool changed = false;
+            for (auto &[set, bindings] : bufferInfos)
+            {
+                for (auto &[binding, info] : bindings)
+                {
+                    if (info.first.buffer == oldBuffer)
+                    {
+                        info.first.setBuffer(newBuffer);
+                        changed = true;
+                    }
+                }
+            }
+            if (changed)
+            {
+                updateDescriptorSets();
+            }
         }
 
         // change the dynamic offset of a set
@@ -154,6 +228,7 @@ namespace letc
             commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.layout, 0,
                                              descriptorSets.size(), descriptorSets.data(), offsets.size(),
                                              offsets.data());
+            addStat(Stat::DescriptorBinds, descriptorSets.size());
         }
 
         // bind only one set, use this maybe when u change the dynamic offset
@@ -167,11 +242,61 @@ namespace letc
 
             commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.layout, set, 1,
                                              &descriptorSets[set], offsets.size(), offsets.data());
+            addStat(Stat::DescriptorBinds);
+        }
+
+        // bind one set at the compute bind point
+        void bind(const vk::CommandBuffer &commandBuffer, const ComputePipeline &pipeline, const uint32_t &set)
+        {
+            std::vector<uint32_t> offsets;
+            if (dynamicOffsets[set].has_value())
+            {
+                offsets.push_back(dynamicOffsets[set].value());
+            }
+
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.layout, set, 1,
+                                             &descriptorSets[set], offsets.size(), offsets.data());
+            addStat(Stat::DescriptorBinds);
         }
 
         ~Material()
         {
-            device.device.freeDescriptorSets(allocator.descriptorPool, descriptorSets);
+            allocator.removeRelocationListener(relocationListener);
+            device.defer([device = device.device, pool = allocator.descriptorPool, sets = descriptorSets]
+                         { device.freeDescriptorSets(pool, sets); });
+        }
+
+      private:
+        static bool isImageDescriptor(const vk::DescriptorType &type)
+        {
+            return type == vk::DescriptorType::eCombinedImageSampler || type == vk::DescriptorType::eSampledImage ||
+                   type == vk::DescriptorType::eStorageImage || type == vk::DescriptorType::eSampler;
+        }
+
+        // writes for the set's image bindings that have been set, or just one of them
+        void appendImageWrites(const uint32_t &set, std::vector<vk::WriteDescriptorSet> &descriptorWrites,
+                               const std::optional<uint32_t> &binding = std::nullopt)
+        {
+            for (const auto &bindingPair : imageInfos[set])
+            {
+                if (binding && bindingPair.first != *binding)
+                {
+                    continue;
+                }
+                const auto &imageInfo = bindingPair.second.first;
+                const auto &descriptorType = bindingPair.second.second;
+                // unset images can't be written as null the way buffers can
+                if (!imageInfo.imageView && !imageInfo.sampler)
+                {
+                    continue;
+                }
+                descriptorWrites.push_back(vk::WriteDescriptorSet{}
+                                               .setDstSet(descriptorSets[set])
+                                               .setDstBinding(bindingPair.first)
+                                               .setDescriptorCount(1)
+                                               .setDescriptorType(descriptorType)
+                                               .setPImageInfo(&imageInfo));
+            }
         }
     };
 
@@ -0,0 +1,432 @@
+#pragma once
+
+#ifndef LETC_MESHOPTIMIZER_HH
+#define LETC_MESHOPTIMIZER_HH
+
+#include "pch.hh"
+
+#include <limits>
+#include <numeric>
+#include <span>
+
+#include "Zones.hh"
+
+namespace letc
+{
+    // entries of the fifo post-transform cache the passes below optimise for and measure with, small enough
+    // that the orders hold up on hardware whose real cache behaves differently
+    constexpr uint32_t vertexCacheSize = 16;
+
+    // average cache misses per triangle (acmr, 0.5 is the limit for a regular grid, 3 a miss on every
+    // corner) and per referenced vertex (atvr, 1 is every vertex shaded once)
+    struct VertexCacheStats
+    {
+        float acmr = 0.0f;
+        float atvr = 0.0f;
+    };
+
+    // fifo cache that is simply pushed into, an entry is a hit while fewer than size misses came after it
+    struct VertexCacheSimulation
+    {
+        std::vector<uint32_t> timestamp;
+        uint32_t misses = 0;
+        uint32_t size;
+
+        VertexCacheSimulation(const size_t &vertexCount, const uint32_t &size = vertexCacheSize)
+            : timestamp(vertexCount, 0), size(size)
+        {
+        }
+
+        // true on a miss
+        bool access(const uint32_t &vertex)
+        {
+            if (timestamp[vertex] && misses - timestamp[vertex] < size)
+            {
+                return false;
+            }
+            timestamp[vertex] = ++misses;
+            return true;
+        }
+
+        void reset()
+        {
+            std::fill(timestamp.begin(), timestamp.end(), 0);
+        }
+    };
+
+    inline VertexCacheStats analyzeVertexCache(const std::span<const unsigned> &index, const size_t &vertexCount,
+                                               const uint32_t &cacheSize = vertexCacheSize)
+    {
+        if (index.empty())
+        {
+            return {};
+        }
+        VertexCacheSimulation cache(vertexCount, cacheSize);
+        std::vector<bool> referenced(vertexCount, false);
+        size_t referencedCount = 0;
+        for (const unsigned &vertex : index)
+        {
+            cache.access(vertex);
+            referencedCount += !referenced[vertex];
+            referenced[vertex] = true;
+        }
+        return {static_cast<float>(cache.misses) / static_cast<float>(index.size() / 3),
+                static_cast<float>(cache.misses) / static_cast<float>(referencedCount)};
+    }
+
+    // remap[v] for vertices that are byte for byte equal across every non empty stream points at one copy,
+    // the copies are numbered in the order they first appear. returns how many are left
+    template <typename... Streams>
+    uint32_t weldRemap(std::vector<uint32_t> &remap, const size_t &vertexCount, const Streams &...streams)
+    {
+        LETC_ZONE("weldRemap");
+        auto hashVertex = [&](const size_t &vertex)
+        {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            auto add = [&](const auto &stream)
+            {
+                if (stream.empty())
+                {
+                    return;
+                }
+                const auto *bytes = reinterpret_cast<const uint8_t *>(&stream[vertex]);
+                for (size_t i = 0; i < sizeof(stream[vertex]); i++)
+                {
+                    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+                }
+            };
+            (add(streams), ...);
+            return hash;
+        };
+        auto equal = [&](const size_t &a, const size_t &b)
+        {
+            return ((streams.empty() || std::memcmp(&streams[a], &streams[b], sizeof(streams[a])) == 0) && ...);
+        };
+
+        std::vector<uint64_t> hashes(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            hashes[v] = hashVertex(v);
+        }
+        std::vector<uint32_t> order(vertexCount);
+        std::iota(order.begin(), order.end(), 0u);
+        std::sort(order.begin(), order.end(),
+                  [&](const uint32_t &a, const uint32_t &b)
+                  { return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : a < b; });
+
+        // the lowest vertex of each group of equal ones, runs of a hash are compared in full so a collision
+        // never merges different vertices
+        std::vector<uint32_t> canonical(vertexCount);
+        for (size_t run = 0; run < vertexCount;)
+        {
+            size_t end = run + 1;
+            while (end < vertexCount && hashes[order[end]] == hashes[order[run]])
+            {
+                end++;
+            }
+            for (size_t i = run; i < end; i++)
+            {
+                canonical[order[i]] = order[i];
+                for (size_t j = run; j < i; j++)
+                {
+                    if (canonical[order[j]] == order[j] && equal(order[i], order[j]))
+                    {
+                        canonical[order[i]] = order[j];
+                        break;
+                    }
+                }
+            }
+            run = end;
+        }
+
+        remap.assign(vertexCount, 0);
+        uint32_t count = 0;
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            remap[v] = canonical[v] == v ? count++ : remap[canonical[v]];
+        }
+        return count;
+    }
+
+    // rewrite stream in the order remap gives, vertices remapped to ~0u are dropped
+    template <typename T>
+    void remapVertexStream(std::vector<T> &stream, const std::vector<uint32_t> &remap, const uint32_t &count)
+    {
+        if (stream.empty())
+        {
+            return;
+        }
+        std::vector<T> remapped(count);
+        for (size_t v = 0; v < stream.size(); v++)
+        {
+            if (remap[v] != ~0u)
+            {
+                remapped[remap[v]] = stream[v];
+            }
+        }
+        stream.swap(remapped);
+    }
+
+    inline void remapIndices(const std::span<unsigned> &index, const std::vector<uint32_t> &remap)
+    {
+        for (unsigned &vertex : index)
+        {
+            vertex = remap[vertex];
+        }
+    }
+
+    // tipsify (sander, nehab and barczak, "fast triangle reordering for vertex locality and reduced overdraw").
+    // fans around one vertex at a time and moves on to the fan's vertex that will still be in the cache once
+    // its remaining triangles are emitted, or back through recently used vertices at a dead end. linear in
+    // the triangle count, the result is written back into index
+    inline void optimizeVertexCache(const std::span<unsigned> &index, const size_t &vertexCount,
+                                    const uint32_t &cacheSize = vertexCacheSize)
+    {
+        LETC_ZONE("optimizeVertexCache");
+        const size_t triangleCount = index.size() / 3;
+        if (triangleCount == 0)
+        {
+            return;
+        }
+
+        // triangles around each vertex, compressed rows. live counts the ones not emitted yet
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (const unsigned &vertex : index)
+        {
+            adjacencyOffsets[vertex + 1]++;
+        }
+        std::vector<uint32_t> live(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            live[v] = adjacencyOffsets[v + 1];
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        std::vector<uint32_t> adjacency(index.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < index.size(); i++)
+            {
+                adjacency[fill[index[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        uint32_t time = cacheSize + 1;
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> candidates;
+        std::vector<unsigned> output;
+        output.reserve(index.size());
+        size_t cursor = 0;
+
+        auto skipDeadEnd = [&]() -> int64_t
+        {
+            while (!deadEnd.empty())
+            {
+                const uint32_t vertex = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[vertex] > 0)
+                {
+                    return vertex;
+                }
+            }
+            for (; cursor < vertexCount; cursor++)
+            {
+                if (live[cursor] > 0)
+                {
+                    return static_cast<int64_t>(cursor);
+                }
+            }
+            return -1;
+        };
+
+        int64_t fan = skipDeadEnd();
+        while (fan >= 0)
+        {
+            candidates.clear();
+            for (uint32_t a = adjacencyOffsets[fan]; a < adjacencyOffsets[fan + 1]; a++)
+            {
+                const uint32_t triangle = adjacency[a];
+                if (emitted[triangle])
+                {
+                    continue;
+                }
+                for (size_t k = 0; k < 3; k++)
+                {
+                    const unsigned vertex = index[triangle * 3 + k];
+                    output.push_back(vertex);
+                    deadEnd.push_back(vertex);
+                    candidates.push_back(vertex);
+                    live[vertex]--;
+                    if (time - cacheTime[vertex] > cacheSize)
+                    {
+                        cacheTime[vertex] = time++;
+                    }
+                }
+                emitted[triangle] = true;
+            }
+
+            // the candidate furthest into the cache that stays there through its own fan, else the oldest
+            int64_t next = -1;
+            int64_t bestPriority = -1;
+            for (const uint32_t &vertex : candidates)
+            {
+                if (live[vertex] == 0)
+                {
+                    continue;
+                }
+                int64_t priority = 0;
+                if (time - cacheTime[vertex] + 2 * live[vertex] <= cacheSize)
+                {
+                    priority = time - cacheTime[vertex];
+                }
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    next = vertex;
+                }
+            }
+            fan = next >= 0 ? next : skipDeadEnd();
+        }
+        std::copy(output.begin(), output.end(), index.begin());
+    }
+
+    // reorder runs of triangles (clusters) of a cache optimised index so those facing away from the mesh's
+    // centroid are drawn first, they tend to occlude the rest from any direction. clusters start where the
+    // cache went cold and are split further wherever starting over keeps the acmr within threshold of what
+    // the cluster had, so the cache order survives
+    inline void optimizeOverdraw(const std::span<unsigned> &index, const std::span<const glm::vec4> &position,
+                                 const float &threshold = 1.05f, const uint32_t &cacheSize = vertexCacheSize)
+    {
+        LETC_ZONE("optimizeOverdraw");
+        const size_t triangleCount = index.size() / 3;
+        if (triangleCount < 2)
+        {
+            return;
+        }
+
+        VertexCacheSimulation cache(position.size(), cacheSize);
+        auto triangleMisses = [&](const size_t &triangle)
+        {
+            uint32_t misses = 0;
+            for (size_t k = 0; k < 3; k++)
+            {
+                misses += cache.access(index[triangle * 3 + k]);
+            }
+            return misses;
+        };
+
+        // hard boundaries, every corner missed
+        std::vector<uint32_t> hard;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            if (triangleMisses(t) == 3)
+            {
+                hard.push_back(static_cast<uint32_t>(t));
+            }
+        }
+        hard.push_back(static_cast<uint32_t>(triangleCount));
+
+        std::vector<uint32_t> clusters;
+        for (size_t h = 0; h + 1 < hard.size(); h++)
+        {
+            const uint32_t begin = hard[h];
+            const uint32_t end = hard[h + 1];
+            cache.reset();
+            uint32_t clusterMisses = 0;
+            for (uint32_t t = begin; t < end; t++)
+            {
+                clusterMisses += triangleMisses(t);
+            }
+            const float clusterAcmr = static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+            cache.reset();
+            uint32_t start = begin;
+            uint32_t misses = 0;
+            clusters.push_back(begin);
+            for (uint32_t t = begin; t < end; t++)
+            {
+                misses += triangleMisses(t);
+                if (t + 1 < end &&
+                    static_cast<float>(misses) / static_cast<float>(t - start + 1) <= clusterAcmr * threshold)
+                {
+                    clusters.push_back(t + 1);
+                    start = t + 1;
+                    misses = 0;
+                    cache.reset();
+                }
+            }
+        }
+        clusters.push_back(static_cast<uint32_t>(triangleCount));
+
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        struct Cluster
+        {
+            uint32_t begin, end;
+            glm::vec3 centroid;
+            glm::vec3 normal;
+            float sort;
+        };
+        std::vector<Cluster> sorted(clusters.size() - 1);
+        for (size_t i = 0; i + 1 < clusters.size(); i++)
+        {
+            Cluster &cluster = sorted[i];
+            cluster = {clusters[i], clusters[i + 1], glm::vec3(0.0f), glm::vec3(0.0f), 0.0f};
+            float area = 0.0f;
+            for (uint32_t t = cluster.begin; t < cluster.end; t++)
+            {
+                const glm::vec3 a(position[index[t * 3]]);
+                const glm::vec3 b(position[index[t * 3 + 1]]);
+                const glm::vec3 c(position[index[t * 3 + 2]]);
+                const glm::vec3 normal = glm::cross(b - a, c - a);
+                const float triangleArea = glm::length(normal);
+                cluster.centroid += (a + b + c) * (triangleArea / 3.0f);
+                cluster.normal += normal;
+                area += triangleArea;
+            }
+            meshCentroid += cluster.centroid;
+            meshArea += area;
+            cluster.centroid = area > 0.0f ? cluster.centroid / area : glm::vec3(position[index[cluster.begin * 3]]);
+        }
+        if (meshArea <= 0.0f)
+        {
+            return;
+        }
+        meshCentroid = meshCentroid / meshArea;
+        for (Cluster &cluster : sorted)
+        {
+            const float length = glm::length(cluster.normal);
+            cluster.sort = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](const Cluster &a, const Cluster &b) { return a.sort > b.sort; });
+
+        std::vector<unsigned> output;
+        output.reserve(index.size());
+        for (const Cluster &cluster : sorted)
+        {
+            output.insert(output.end(), index.begin() + cluster.begin * 3, index.begin() + cluster.end * 3);
+        }
+        std::copy(output.begin(), output.end(), index.begin());
+    }
+
+    // number vertices in the order index first uses them so fetches walk memory forwards, unreferenced ones
+    // map to ~0u. returns how many are referenced
+    inline uint32_t vertexFetchRemap(std::vector<uint32_t> &remap, const std::span<const unsigned> &index,
+                                     const size_t &vertexCount)
+    {
+        remap.assign(vertexCount, ~0u);
+        uint32_t count = 0;
+        for (const unsigned &vertex : index)
+        {
+            if (remap[vertex] == ~0u)
+            {
+                remap[vertex] = count++;
+            }
+        }
+        return count;
+    }
+}; // namespace letc
+
+#endif // LETC_MESHOPTIMIZER_HH
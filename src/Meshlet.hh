@@ -0,0 +1,230 @@
+#pragma once
+
+#ifndef LETC_MESHLET_HH
+#define LETC_MESHLET_HH
+
+#include "pch.hh"
+
+#include <limits>
+#include <span>
+
+#include "Layout.hh"
+#include "Lod.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // local indices are a byte each, so a meshlet can't address more than 256 vertices
+    static_assert(LETC_MESHLET_MAX_VERTICES <= 256 && LETC_MESHLET_MAX_TRIANGLES <= 256);
+
+    inline uint32_t packMeshletTriangle(const uint32_t &a, const uint32_t &b, const uint32_t &c)
+    {
+        return a | (b << 8) | (c << 16);
+    }
+
+    // sphere around the meshlet's vertices and the cone its face normals fall in, a cone wider than a
+    // hemisphere (or degenerate triangles only) gets a cutoff of 1 so it is never culled
+    inline void meshletBounds(gpu::Meshlet &meshlet, const std::span<const uint32_t> &vertices,
+                              const std::span<const uint32_t> &triangles, const std::span<const glm::vec4> &position)
+    {
+        std::array<glm::vec4, LETC_MESHLET_MAX_VERTICES> local;
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            local[i] = position[vertices[i]];
+        }
+        meshlet.bounds = boundingSphere(std::span<const glm::vec4>(local.data(), vertices.size()));
+
+        std::array<glm::vec3, LETC_MESHLET_MAX_TRIANGLES> normals;
+        size_t normalCount = 0;
+        glm::vec3 sum(0.0f);
+        for (const uint32_t &triangle : triangles)
+        {
+            const glm::vec3 a(local[triangle & 0xff]);
+            const glm::vec3 b(local[(triangle >> 8) & 0xff]);
+            const glm::vec3 c(local[(triangle >> 16) & 0xff]);
+            // twice the area long, so the sum is area weighted
+            const glm::vec3 normal = glm::cross(b - a, c - a);
+            const float length = glm::length(normal);
+            if (length > 0.0f)
+            {
+                sum += normal;
+                normals[normalCount++] = normal / length;
+            }
+        }
+
+        meshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        const float sumLength = glm::length(sum);
+        if (normalCount == 0 || sumLength <= 0.0f)
+        {
+            return;
+        }
+        const glm::vec3 axis = sum / sumLength;
+        float minDot = 1.0f;
+        for (size_t i = 0; i < normalCount; i++)
+        {
+            minDot = std::min(minDot, glm::dot(normals[i], axis));
+        }
+        meshlet.cone = glm::vec4(axis, minDot <= 0.0f ? 1.0f : std::sqrt(1.0f - minDot * minDot));
+    }
+
+    // split index (a triangle list) into meshlets appended to meshlets, meshletVertices and meshletTriangles.
+    // each one starts at the first unused triangle and grows through its neighbours, taking the one that adds
+    // the fewest new vertices and then the closest to what is already in, so meshlets stay compact enough
+    // for their bounds and cones to cull something
+    inline void appendMeshlets(const std::span<const unsigned> &index, const std::span<const glm::vec4> &position,
+                               std::vector<gpu::Meshlet> &meshlets, std::vector<uint32_t> &meshletVertices,
+                               std::vector<uint32_t> &meshletTriangles)
+    {
+        const size_t triangleCount = index.size() / 3;
+        const size_t vertexCount = position.size();
+
+        // triangles around each vertex, compressed rows
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (const unsigned &vertex : index)
+        {
+            adjacencyOffsets[vertex + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        std::vector<uint32_t> adjacency(index.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < index.size(); i++)
+            {
+                adjacency[fill[index[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        std::vector<bool> used(triangleCount, false);
+        // local index of a vertex in the meshlet being built, 0xff when it isn't in it
+        std::vector<uint8_t> local(vertexCount, 0xff);
+        std::vector<uint32_t> candidates;
+        size_t cursor = 0;
+
+        while (true)
+        {
+            while (cursor < triangleCount && used[cursor])
+            {
+                cursor++;
+            }
+            if (cursor == triangleCount)
+            {
+                break;
+            }
+
+            gpu::Meshlet meshlet{};
+            meshlet.vertexOffset = static_cast<uint32_t>(meshletVertices.size());
+            meshlet.triangleOffset = static_cast<uint32_t>(meshletTriangles.size());
+            glm::vec3 centroidSum(0.0f);
+            candidates.clear();
+
+            auto newVertices = [&](const size_t &triangle)
+            {
+                uint32_t count = 0;
+                for (size_t k = 0; k < 3; k++)
+                {
+                    count += local[index[triangle * 3 + k]] == 0xff;
+                }
+                return count;
+            };
+            auto centroid = [&](const size_t &triangle)
+            {
+                return (glm::vec3(position[index[triangle * 3]]) + glm::vec3(position[index[triangle * 3 + 1]]) +
+                        glm::vec3(position[index[triangle * 3 + 2]])) /
+                       3.0f;
+            };
+            auto add = [&](const size_t &triangle)
+            {
+                std::array<uint32_t, 3> corners;
+                for (size_t k = 0; k < 3; k++)
+                {
+                    const unsigned vertex = index[triangle * 3 + k];
+                    if (local[vertex] == 0xff)
+                    {
+                        local[vertex] = static_cast<uint8_t>(meshlet.vertexCount++);
+                        meshletVertices.push_back(vertex);
+                    }
+                    corners[k] = local[vertex];
+                    for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+                    {
+                        if (!used[adjacency[a]])
+                        {
+                            candidates.push_back(adjacency[a]);
+                        }
+                    }
+                }
+                meshletTriangles.push_back(packMeshletTriangle(corners[0], corners[1], corners[2]));
+                meshlet.triangleCount++;
+                used[triangle] = true;
+                centroidSum += centroid(triangle);
+            };
+
+            add(cursor);
+            while (meshlet.triangleCount < LETC_MESHLET_MAX_TRIANGLES)
+            {
+                const glm::vec3 center = centroidSum / static_cast<float>(meshlet.triangleCount);
+                size_t best = triangleCount;
+                uint32_t bestNew = 4;
+                float bestDistance = std::numeric_limits<float>::max();
+                size_t kept = 0;
+                for (const uint32_t &candidate : candidates)
+                {
+                    if (used[candidate])
+                    {
+                        continue;
+                    }
+                    candidates[kept++] = candidate;
+                    const uint32_t extra = newVertices(candidate);
+                    if (meshlet.vertexCount + extra > LETC_MESHLET_MAX_VERTICES || extra > bestNew)
+                    {
+                        continue;
+                    }
+                    const glm::vec3 offset = centroid(candidate) - center;
+                    const float distance = glm::dot(offset, offset);
+                    if (extra < bestNew || distance < bestDistance)
+                    {
+                        best = candidate;
+                        bestNew = extra;
+                        bestDistance = distance;
+                    }
+                }
+                candidates.resize(kept);
+                if (best == triangleCount)
+                {
+                    break;
+                }
+                add(best);
+            }
+
+            for (uint32_t i = meshlet.vertexOffset; i < meshletVertices.size(); i++)
+            {
+                local[meshletVertices[i]] = 0xff;
+            }
+            meshletBounds(meshlet,
+                          std::span<const uint32_t>(meshletVertices).subspan(meshlet.vertexOffset, meshlet.vertexCount),
+                          std::span<const uint32_t>(meshletTriangles)
+                              .subspan(meshlet.triangleOffset, meshlet.triangleCount),
+                          position);
+            meshlets.push_back(meshlet);
+        }
+    }
+
+    // meshlets for every level of the chain, each level's range is written back into its MeshLod
+    inline void buildMeshlets(std::vector<MeshLod> &lods, const std::span<const unsigned> &index,
+                              const std::span<const glm::vec4> &position, std::vector<gpu::Meshlet> &meshlets,
+                              std::vector<uint32_t> &meshletVertices, std::vector<uint32_t> &meshletTriangles)
+    {
+        LETC_ZONE("buildMeshlets");
+        for (MeshLod &lod : lods)
+        {
+            lod.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+            appendMeshlets(index.subspan(lod.firstIndex, lod.indexCount), position, meshlets, meshletVertices,
+                           meshletTriangles);
+            lod.meshletCount = static_cast<uint32_t>(meshlets.size()) - lod.firstMeshlet;
+        }
+    }
+}; // namespace letc
+
+#endif // LETC_MESHLET_HH
@@ -0,0 +1,219 @@
+#pragma once
+
+#ifndef LETC_MESHLETCULLER_HH
+#define LETC_MESHLETCULLER_HH
+
+#include "pch.hh"
+
+#include <optional>
+#include <unordered_map>
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Camera.hh"
+#include "Descriptor.hh"
+#include "Device.hh"
+#include "Layout.hh"
+#include "Material.hh"
+#include "Model.hh"
+#include "Pipeline.hh"
+#include "Stats.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // per frame meshlet culling. every add()ed draw reserves its level's full index count in one shared index
+    // buffer, a compute dispatch over the level's meshlets appends the triangles of those that survive the
+    // frustum and normal cone tests and counts them into the draw's indirect command, draw() then draws
+    // whatever was written. meant for one frame in flight, the buffers are reused every frame.
+    //
+    // not done yet: there is no occlusion test against a hi-z pyramid of the last frame's depth, and the
+    // surviving triangles still go through the index buffer instead of a VK_EXT_mesh_shader task/mesh pair
+    struct MeshletCuller
+    {
+        const Device &device;
+        const Allocator &allocator;
+
+        // set 0 is shared by the frame (instances, output indices, commands), set 1 is a model's meshlets
+        std::unique_ptr<DescriptorLayout> layout;
+        std::unique_ptr<ComputePipeline> pipeline;
+        std::unique_ptr<Material> frameMaterial;
+        std::unordered_map<const Model *, std::unique_ptr<Material>> modelMaterials;
+
+        std::unique_ptr<Buffer> indexBuffer;
+        std::unique_ptr<Buffer> commandsBuffer;
+        uint32_t indexCapacity;
+        uint32_t commandCapacity;
+
+        // triangles the last recorded frame kept, read back in begin() once the gpu is done with it
+        uint64_t survivingTriangles = 0;
+        uint64_t submittedTriangles = 0;
+
+        MeshletCuller(const Device &device, const Allocator &allocator, const std::vector<char> &code,
+                      const Buffer &instances, const vk::DeviceSize &instancesSize,
+                      const uint32_t &indexCapacity = 1u << 22, const uint32_t &commandCapacity = 4096)
+            : device(device), allocator(allocator), indexCapacity(indexCapacity), commandCapacity(commandCapacity)
+        {
+            LETC_ZONE("MeshletCuller::MeshletCuller");
+            layout = std::make_unique<DescriptorLayout>(device);
+            for (uint32_t set = 0; set < 2; set++)
+            {
+                for (uint32_t binding = 0; binding < 3; binding++)
+                {
+                    layout->addBinding(set, binding, vk::DescriptorType::eStorageBuffer,
+                                       vk::ShaderStageFlagBits::eCompute, 1);
+                }
+            }
+            layout->generateLayouts();
+            pipeline = std::make_unique<ComputePipeline>(device, code, *layout, sizeof(gpu::MeshletCullRecord));
+
+            indexBuffer = std::make_unique<Buffer>(
+                allocator, vk::DeviceSize(indexCapacity) * sizeof(uint32_t),
+                vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndexBuffer,
+                VMA_MEMORY_USAGE_GPU_ONLY);
+            commandsBuffer = std::make_unique<Buffer>(
+                allocator, vk::DeviceSize(commandCapacity) * sizeof(gpu::DrawIndexedCommand),
+                vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+                VMA_MEMORY_USAGE_CPU_TO_GPU);
+            commandsBuffer->map();
+
+            frameMaterial = std::make_unique<Material>(device, allocator, *layout);
+            frameMaterial->updateDescriptorBufferInfo(0, 0, instances, 0, instancesSize);
+            frameMaterial->updateDescriptorBufferInfo(0, 1, *indexBuffer, 0, VK_WHOLE_SIZE);
+            frameMaterial->updateDescriptorBufferInfo(0, 2, *commandsBuffer, 0, VK_WHOLE_SIZE);
+            frameMaterial->updateDescriptorSet(0);
+        }
+
+        MeshletCuller(const MeshletCuller &) = delete;
+        MeshletCuller &operator=(const MeshletCuller &) = delete;
+
+        // start the frame's draw list, the previous frame has to have finished on the gpu
+        void begin()
+        {
+            if (!dispatches.empty())
+            {
+                vmaInvalidateAllocation(allocator.allocator, commandsBuffer->allocation, 0, VK_WHOLE_SIZE);
+                const auto *commands = static_cast<const gpu::DrawIndexedCommand *>(commandsBuffer->mapped);
+                survivingTriangles = 0;
+                for (size_t i = 0; i < dispatches.size(); i++)
+                {
+                    survivingTriangles += commands[i].indexCount / 3;
+                }
+                // counted a frame late, the gpu only knows once the frame ran
+                addStat(Stat::Triangles, survivingTriangles);
+            }
+            dispatches.clear();
+            reservedIndices = 0;
+            submittedTriangles = 0;
+        }
+
+        // the command to draw() level lod of model with, culled against the instance at transformIndex. empty
+        // when the level has no meshlets or the frame is out of room, draw it with Model::draw() instead
+        std::optional<uint32_t> add(const Model &model, const uint32_t &lod, const uint32_t &transformIndex)
+        {
+            if (!model.hasMeshlets(lod))
+            {
+                return std::nullopt;
+            }
+            const MeshLod &level = model.lods[std::min<size_t>(lod, model.lods.size() - 1)];
+            if (dispatches.size() == commandCapacity || reservedIndices + level.indexCount > indexCapacity)
+            {
+                return std::nullopt;
+            }
+
+            const uint32_t command = static_cast<uint32_t>(dispatches.size());
+            static_cast<gpu::DrawIndexedCommand *>(commandsBuffer->mapped)[command] = {0, 1, reservedIndices, 0, 0};
+            dispatches.push_back({&model, level.firstMeshlet, level.meshletCount, transformIndex});
+            reservedIndices += level.indexCount;
+            submittedTriangles += level.indexCount / 3;
+            return command;
+        }
+
+        // cull everything added since begin(), before the rendering that draws it. flags are LETC_CULL_* bits
+        void record(const vk::CommandBuffer &commandBuffer, const Camera &camera, const uint32_t &flags)
+        {
+            if (dispatches.empty())
+            {
+                return;
+            }
+            LETC_ZONE("MeshletCuller::record");
+            commandsBuffer->flush(0, dispatches.size() * sizeof(gpu::DrawIndexedCommand));
+
+            pipeline->bind(commandBuffer);
+            frameMaterial->bind(commandBuffer, *pipeline, 0);
+            gpu::MeshletCullRecord record{};
+            record.viewProj = camera.uniform.proj * camera.uniform.view;
+            record.eye = camera.eye;
+            record.flags = flags;
+            const Model *boundModel = nullptr;
+            for (uint32_t i = 0; i < dispatches.size(); i++)
+            {
+                const Dispatch &dispatch = dispatches[i];
+                if (dispatch.model != boundModel)
+                {
+                    modelMaterial(*dispatch.model).bind(commandBuffer, *pipeline, 1);
+                    boundModel = dispatch.model;
+                }
+                record.transformIndex = dispatch.transformIndex;
+                record.firstMeshlet = dispatch.firstMeshlet;
+                record.meshletCount = dispatch.meshletCount;
+                record.drawIndex = i;
+                pipeline->push(commandBuffer, record);
+                commandBuffer.dispatch((dispatch.meshletCount + 63) / 64, 1, 1);
+            }
+
+            // the counts are read back by begin() next frame as well as by the draws
+            commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(
+                vk::MemoryBarrier2{}
+                    .setSrcStageMask(vk::PipelineStageFlagBits2::eComputeShader)
+                    .setSrcAccessMask(vk::AccessFlagBits2::eShaderStorageWrite)
+                    .setDstStageMask(vk::PipelineStageFlagBits2::eDrawIndirect |
+                                     vk::PipelineStageFlagBits2::eIndexInput | vk::PipelineStageFlagBits2::eHost)
+                    .setDstAccessMask(vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eIndexRead |
+                                      vk::AccessFlagBits2::eHostRead)));
+        }
+
+        // draw the triangles command kept, inside rendering with the model's pipeline and sets bound
+        void draw(const vk::CommandBuffer &commandBuffer, const Model &model, const uint32_t &command) const
+        {
+            model.bindVertexBuffers(commandBuffer);
+            commandBuffer.bindIndexBuffer(indexBuffer->buffer, 0, vk::IndexType::eUint32);
+            commandBuffer.drawIndexedIndirect(commandsBuffer->buffer, command * sizeof(gpu::DrawIndexedCommand), 1,
+                                              sizeof(gpu::DrawIndexedCommand));
+            addStat(Stat::DrawCalls);
+        }
+
+        // drop the sets pointing at model's meshlets, call before it is destroyed
+        void forget(const Model &model)
+        {
+            modelMaterials.erase(&model);
+        }
+
+      private:
+        struct Dispatch
+        {
+            const Model *model;
+            uint32_t firstMeshlet;
+            uint32_t meshletCount;
+            uint32_t transformIndex;
+        };
+        std::vector<Dispatch> dispatches;
+        uint32_t reservedIndices = 0;
+
+        Material &modelMaterial(const Model &model)
+        {
+            auto &material = modelMaterials[&model];
+            if (!material)
+            {
+                material = std::make_unique<Material>(device, allocator, *layout);
+                material->updateDescriptorBufferInfo(1, 0, *model.meshletBuffer, 0, VK_WHOLE_SIZE);
+                material->updateDescriptorBufferInfo(1, 1, *model.meshletVertexBuffer, 0, VK_WHOLE_SIZE);
+                material->updateDescriptorBufferInfo(1, 2, *model.meshletTriangleBuffer, 0, VK_WHOLE_SIZE);
+                material->updateDescriptorSet(1);
+            }
+            return *material;
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_MESHLETCULLER_HH
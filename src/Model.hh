@@ -11,11 +11,440 @@
 #include "pch.hh"
 
 #include "Buffer.hh"
+#include "Layout.hh"
+#include "Lod.hh"
+#include "MeshOptimizer.hh"
+#include "Meshlet.hh"
+#include "Stats.hh"
+#include "Texture.hh"
+#include "Zones.hh"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define LETC_MODEL_SSE 1
+#endif
 
 namespace letc
 {
+    static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "conversion expects single precision assimp");
+    static_assert(sizeof(aiColor4D) == sizeof(glm::vec4));
+
+    // xyz -> xyzw with a constant w, four vertices (three loads) per iteration
+    inline void widenVec3(const aiVector3D *source, const size_t &count, const float &w, glm::vec4 *destination)
+    {
+        size_t i = 0;
+#ifdef LETC_MODEL_SSE
+        const float *in = &source[0].x;
+        float *out = &destination[0].x;
+        __m128 ww = _mm_set1_ps(w);
+        for (; i + 4 <= count; i += 4, in += 12, out += 16)
+        {
+            __m128 a = _mm_loadu_ps(in);     // x0 y0 z0 x1
+            __m128 b = _mm_loadu_ps(in + 4); // y1 z1 x2 y2
+            __m128 c = _mm_loadu_ps(in + 8); // z2 x3 y3 z3
+
+            __m128 zw0 = _mm_shuffle_ps(a, ww, _MM_SHUFFLE(0, 0, 2, 2));
+            __m128 xy1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 3, 3));
+            __m128 zw1 = _mm_shuffle_ps(b, ww, _MM_SHUFFLE(0, 0, 1, 1));
+            __m128 zw2 = _mm_shuffle_ps(c, ww, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 zw3 = _mm_shuffle_ps(c, ww, _MM_SHUFFLE(0, 0, 3, 3));
+
+            _mm_storeu_ps(out, _mm_shuffle_ps(a, zw0, _MM_SHUFFLE(2, 0, 1, 0)));
+            _mm_storeu_ps(out + 4, _mm_shuffle_ps(xy1, zw1, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(out + 8, _mm_shuffle_ps(b, zw2, _MM_SHUFFLE(2, 0, 3, 2)));
+            _mm_storeu_ps(out + 12, _mm_shuffle_ps(c, zw3, _MM_SHUFFLE(2, 0, 2, 1)));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            destination[i] = {source[i].x, source[i].y, source[i].z, w};
+        }
+    }
+
+    // xyz -> xy, four vertices per iteration
+    inline void narrowVec3(const aiVector3D *source, const size_t &count, glm::vec2 *destination)
+    {
+        size_t i = 0;
+#ifdef LETC_MODEL_SSE
+        const float *in = &source[0].x;
+        float *out = &destination[0].x;
+        for (; i + 4 <= count; i += 4, in += 12, out += 8)
+        {
+            __m128 a = _mm_loadu_ps(in);
+            __m128 b = _mm_loadu_ps(in + 4);
+            __m128 c = _mm_loadu_ps(in + 8);
+
+            __m128 xy1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 3, 3));
+            _mm_storeu_ps(out, _mm_shuffle_ps(a, xy1, _MM_SHUFFLE(2, 0, 1, 0)));
+            _mm_storeu_ps(out + 4, _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2)));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            destination[i] = {source[i].x, source[i].y};
+        }
+    }
+
+    // everything a model needs from its file, produced without touching vulkan so it can be
+    // imported on any thread
+    struct MeshData
+    {
+        std::vector<unsigned> index;
+        std::vector<glm::vec4> position;
+        std::vector<glm::vec4> normal;
+        std::vector<glm::vec4> tangent;
+        std::vector<glm::vec2> uv;
+        std::vector<glm::vec4> color;
+        uint32_t attributeMask = 0;
+        std::optional<TextureData> baseColor;
+        // ranges of index, level 0 first. empty for a single level covering all of it
+        std::vector<MeshLod> lods;
+        glm::vec4 bounds{0.0f};
+        // every level split into meshlets, ranges are in lods
+        std::vector<gpu::Meshlet> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint32_t> meshletTriangles;
+        // post-transform cache of the index buffer as imported and of level 0 once optimized, and the vertex
+        // count before welding. left zero when there was nothing to optimize
+        VertexCacheStats cacheBefore;
+        VertexCacheStats cacheAfter;
+        uint32_t verticesBefore = 0;
+    };
+
+    // rewrite every vertex stream and the index buffer to the numbering remap gives
+    inline void remapMesh(MeshData &mesh, const std::vector<uint32_t> &remap, const uint32_t &count)
+    {
+        remapIndices(mesh.index, remap);
+        remapVertexStream(mesh.position, remap, count);
+        remapVertexStream(mesh.normal, remap, count);
+        remapVertexStream(mesh.tangent, remap, count);
+        remapVertexStream(mesh.uv, remap, count);
+        remapVertexStream(mesh.color, remap, count);
+    }
+
+    // one copy of vertices that agree on every attribute, assimp hands out a vertex per face corner for
+    // formats that don't index their vertices
+    inline void weldMesh(MeshData &mesh)
+    {
+        std::vector<uint32_t> remap;
+        const uint32_t count =
+            weldRemap(remap, mesh.position.size(), mesh.position, mesh.normal, mesh.tangent, mesh.uv, mesh.color);
+        if (count < mesh.position.size())
+        {
+            remapMesh(mesh, remap, count);
+        }
+    }
+
+    // vertices numbered in the order the (already cache ordered) index buffer first uses them
+    inline void optimizeVertexFetch(MeshData &mesh)
+    {
+        LETC_ZONE("optimizeVertexFetch");
+        std::vector<uint32_t> remap;
+        const uint32_t count = vertexFetchRemap(remap, mesh.index, mesh.position.size());
+        remapMesh(mesh, remap, count);
+    }
+
+    // bump when parseMesh()'s output or the cache layout changes so stale entries are not picked up
+    constexpr uint32_t meshCacheVersion = 6;
+
+    // a parsed MeshData as it is laid out in memory, so loading it again is a map and a copy per stream.
+    // the texture is referenced by the path of its ktx2 file rather than stored again
+    namespace meshcache
+    {
+        constexpr std::array<char, 8> magic = {'L', 'E', 'T', 'C', 'M', 'E', 'S', 'H'};
+        constexpr size_t streamCount = 10;
+
+        struct Header
+        {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t attributeMask;
+            glm::vec4 bounds;
+            VertexCacheStats cacheBefore;
+            VertexCacheStats cacheAfter;
+            uint32_t verticesBefore;
+            // elements in index, position, normal, tangent, uv, color, lods, meshlets, meshletVertices and
+            // meshletTriangles, stored in that order
+            std::array<uint64_t, streamCount> counts;
+            uint64_t texturePathSize;
+        };
+
+        inline size_t align(const size_t &offset)
+        {
+            return (offset + 15) & ~size_t(15);
+        }
+
+        template <typename Mesh, typename F> void forEachStream(Mesh &mesh, const F &function)
+        {
+            function(mesh.index);
+            function(mesh.position);
+            function(mesh.normal);
+            function(mesh.tangent);
+            function(mesh.uv);
+            function(mesh.color);
+            function(mesh.lods);
+            function(mesh.meshlets);
+            function(mesh.meshletVertices);
+            function(mesh.meshletTriangles);
+        }
+    }; // namespace meshcache
+
+    // keyed by the file's path, size and modification time, empty without a cache directory
+    inline std::filesystem::path meshCachePath(const std::filesystem::path &modelPath, const TextureCookConfig &cook)
+    {
+        std::error_code error;
+        const std::filesystem::path absolute = std::filesystem::absolute(modelPath, error);
+        const uintmax_t size = std::filesystem::file_size(modelPath, error);
+        const auto modified = std::filesystem::last_write_time(modelPath, error);
+        if (cook.cacheDirectory.empty() || error)
+        {
+            return {};
+        }
+        const std::string key = absolute.string();
+        uint64_t hash = hashBytes({reinterpret_cast<const uint8_t *>(key.data()), key.size()});
+        const uint64_t options[] = {meshCacheVersion, textureCookVersion, cook.preferBC7, size,
+                                    static_cast<uint64_t>(modified.time_since_epoch().count())};
+        hash = hashBytes({reinterpret_cast<const uint8_t *>(options), sizeof(options)}, hash);
+        return cook.cacheDirectory / std::format("{:016x}.mesh", hash);
+    }
+
+    // false when the mesh can't be cached, a texture that only exists in memory has nothing to point at
+    inline bool writeMeshCache(const std::filesystem::path &path, const MeshData &mesh)
+    {
+        if (mesh.baseColor && mesh.baseColor->source.empty())
+        {
+            return false;
+        }
+        const std::string texturePath =
+            mesh.baseColor ? std::filesystem::absolute(mesh.baseColor->source).string() : std::string();
+
+        meshcache::Header header{};
+        header.magic = meshcache::magic;
+        header.version = meshCacheVersion;
+        header.attributeMask = mesh.attributeMask;
+        header.bounds = mesh.bounds;
+        header.cacheBefore = mesh.cacheBefore;
+        header.cacheAfter = mesh.cacheAfter;
+        header.verticesBefore = mesh.verticesBefore;
+        header.texturePathSize = texturePath.size();
+        size_t size = meshcache::align(sizeof(header) + texturePath.size());
+        size_t stream = 0;
+        meshcache::forEachStream(mesh,
+                                 [&](const auto &elements)
+                                 {
+                                     header.counts[stream++] = elements.size();
+                                     size = meshcache::align(size + elements.size() * sizeof(elements[0]));
+                                 });
+
+        std::vector<uint8_t> bytes(size, 0);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::memcpy(bytes.data() + sizeof(header), texturePath.data(), texturePath.size());
+        size_t offset = meshcache::align(sizeof(header) + texturePath.size());
+        meshcache::forEachStream(mesh,
+                                 [&](const auto &elements)
+                                 {
+                                     std::memcpy(bytes.data() + offset, elements.data(),
+                                                 elements.size() * sizeof(elements[0]));
+                                     offset = meshcache::align(offset + elements.size() * sizeof(elements[0]));
+                                 });
+
+        std::filesystem::create_directories(path.parent_path());
+        writeFileAtomically(path, bytes);
+        return true;
+    }
+
+    // every stream is copied out of the mapping into storage sized up front, the texture is mapped from its ktx2
+    inline MeshData readMeshCache(const std::filesystem::path &path, const TextureCookConfig &cook = {})
+    {
+        LETC_ZONE("readMeshCache");
+        MappedFile file(path);
+        meshcache::Header header;
+        assertThrow(file.size >= sizeof(header), "mesh cache entry is truncated: " + path.string());
+        std::memcpy(&header, file.data, sizeof(header));
+        assertThrow(header.magic == meshcache::magic && header.version == meshCacheVersion,
+                    "stale mesh cache entry: " + path.string());
+        assertThrow(file.size >= sizeof(header) + header.texturePathSize,
+                    "mesh cache entry is truncated: " + path.string());
+
+        MeshData mesh;
+        mesh.attributeMask = header.attributeMask;
+        mesh.bounds = header.bounds;
+        mesh.cacheBefore = header.cacheBefore;
+        mesh.cacheAfter = header.cacheAfter;
+        mesh.verticesBefore = header.verticesBefore;
+        size_t offset = meshcache::align(sizeof(header) + header.texturePathSize);
+        size_t stream = 0;
+        meshcache::forEachStream(mesh,
+                                 [&](auto &elements)
+                                 {
+                                     const size_t count = header.counts[stream++];
+                                     const size_t bytes = count * sizeof(elements[0]);
+                                     assertThrow(offset + bytes <= file.size,
+                                                 "mesh cache entry is truncated: " + path.string());
+                                     elements.resize(count);
+                                     std::memcpy(elements.data(), file.data + offset, bytes);
+                                     offset = meshcache::align(offset + bytes);
+                                 });
+        if (header.texturePathSize)
+        {
+            const std::string texturePath(reinterpret_cast<const char *>(file.data) + sizeof(header),
+                                          header.texturePathSize);
+            mesh.baseColor = fitToDevice(loadKtx2(texturePath), cook);
+        }
+        return mesh;
+    }
+
+    // parse a single mesh file, each call uses its own importer. textures are cooked as cook says
+    inline MeshData parseMesh(const std::filesystem::path &modelPath, const TextureCookConfig &cook = {})
+    {
+        LETC_ZONE("parseMesh");
+        Assimp::Importer importer;
+
+        // vertices are welded and both buffers reordered below, so assimp's own passes for that are left off
+        const aiScene *scene = importer.ReadFile(modelPath.string(), aiProcess_Triangulate | aiProcess_GenNormals |
+                                                                         aiProcess_GenUVCoords | aiProcess_FlipUVs);
+
+        assertThrow(scene, "failed to load model: " + modelPath.string());
+        assertThrow(scene->mNumMeshes == 1, "model should only have one mesh");
+        aiMesh *mesh = scene->mMeshes[0];
+
+        // every attribute is written into storage sized up front, no push_back growth
+        MeshData data;
+        const size_t vertexCount = mesh->mNumVertices;
+        if (mesh->HasFaces())
+        {
+            // each face owns a separate index allocation so this is a gather, kept to one tight loop
+            data.index.resize(static_cast<size_t>(mesh->mNumFaces) * 3);
+            unsigned *out = data.index.data();
+            for (const aiFace &face : std::span(mesh->mFaces, mesh->mNumFaces))
+            {
+                assertThrow(face.mNumIndices == 3, "model has non triangle faces: " + modelPath.string());
+                out[0] = face.mIndices[0];
+                out[1] = face.mIndices[1];
+                out[2] = face.mIndices[2];
+                out += 3;
+            }
+        }
+
+        if (mesh->HasPositions())
+        {
+            data.position.resize(vertexCount);
+            widenVec3(mesh->mVertices, vertexCount, 1.0f, data.position.data());
+            data.attributeMask |= LETC_ATTRIBUTE_POSITION;
+        }
+
+        if (!data.position.empty())
+        {
+            data.bounds = boundingSphere(data.position);
+        }
+
+        if (mesh->HasNormals())
+        {
+            data.normal.resize(vertexCount);
+            widenVec3(mesh->mNormals, vertexCount, 1.0f, data.normal.data());
+            data.attributeMask |= LETC_ATTRIBUTE_NORMAL;
+        }
+
+        if (mesh->HasTangentsAndBitangents())
+        {
+            data.tangent.resize(vertexCount);
+            widenVec3(mesh->mTangents, vertexCount, 1.0f, data.tangent.data());
+            data.attributeMask |= LETC_ATTRIBUTE_TANGENT;
+        }
+
+        if (mesh->HasTextureCoords(0))
+        {
+            data.uv.resize(vertexCount);
+            narrowVec3(mesh->mTextureCoords[0], vertexCount, data.uv.data());
+            data.attributeMask |= LETC_ATTRIBUTE_UV;
+        }
+
+        if (mesh->HasVertexColors(0))
+        {
+            data.color.resize(vertexCount);
+            std::memcpy(data.color.data(), mesh->mColors[0], vertexCount * sizeof(glm::vec4));
+        }
+
+        // every level shares the vertex streams, only the index buffer grows. each level is ordered for the
+        // post-transform cache and then overdraw, the vertices last for fetching in that order
+        if (!data.index.empty() && !data.position.empty())
+        {
+            LETC_ZONE("optimizeMesh");
+            data.cacheBefore = analyzeVertexCache(data.index, data.position.size());
+            data.verticesBefore = static_cast<uint32_t>(data.position.size());
+            weldMesh(data);
+            optimizeVertexCache(data.index, data.position.size());
+            optimizeOverdraw(data.index, data.position);
+
+            data.lods = buildLodChain(data.index, data.position, data.uv, data.normal);
+            for (size_t lod = 1; lod < data.lods.size(); lod++)
+            {
+                const std::span<unsigned> level =
+                    std::span(data.index).subspan(data.lods[lod].firstIndex, data.lods[lod].indexCount);
+                optimizeVertexCache(level, data.position.size());
+                optimizeOverdraw(level, data.position);
+            }
+            optimizeVertexFetch(data);
+
+            data.cacheAfter = analyzeVertexCache(
+                std::span<const unsigned>(data.index).first(data.lods[0].indexCount), data.position.size());
+
+            buildMeshlets(data.lods, data.index, data.position, data.meshlets, data.meshletVertices,
+                          data.meshletTriangles);
+        }
+
+        // gltf base color lands in both slots, older formats only fill diffuse
+        if (scene->HasMaterials())
+        {
+            const aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+            const std::filesystem::path directory = modelPath.parent_path();
+            data.baseColor = importTexture(scene, material, aiTextureType_BASE_COLOR, directory, true, cook);
+            if (!data.baseColor)
+            {
+                data.baseColor = importTexture(scene, material, aiTextureType_DIFFUSE, directory, true, cook);
+            }
+        }
+        return data;
+    }
+
+    // parseMesh() the first time a file is seen, with a cache directory later imports (and meshes streamed
+    // back in after an eviction) are read from the cached copy instead
+    inline MeshData importMesh(const std::filesystem::path &modelPath, const TextureCookConfig &cook = {})
+    {
+        LETC_ZONE("importMesh");
+        const std::filesystem::path cachePath = meshCachePath(modelPath, cook);
+        if (!cachePath.empty() && std::filesystem::exists(cachePath))
+        {
+            try
+            {
+                return readMeshCache(cachePath, cook);
+            }
+            catch (const std::exception &e)
+            {
+                // parsed again below and the entry replaced
+                std::cerr << "ignoring cached mesh: " << e.what() << std::endl;
+            }
+        }
+
+        MeshData data = parseMesh(modelPath, cook);
+        if (!cachePath.empty())
+        {
+            try
+            {
+                writeMeshCache(cachePath, data);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "failed to cache mesh: " << e.what() << std::endl;
+            }
+        }
+        return data;
+    }
+
     struct Model
     {
+        const Allocator &allocator;
+
         std::vector<unsigned> index;
         std::vector<glm::vec4> position;
         std::vector<glm::vec4> normal;
@@ -24,6 +453,9 @@ namespace letc
         std::vector<glm::vec4> color;
         std::vector<std::array<unsigned, 4>> joints;
         std::vector<glm::vec4> weights;
+        std::vector<gpu::Meshlet> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint32_t> meshletTriangles;
 
         std::unique_ptr<Buffer> indexBuffer;
         std::unique_ptr<Buffer> positionBuffer;
@@ -33,149 +465,303 @@ namespace letc
         std::unique_ptr<Buffer> colorBuffer;
         std::unique_ptr<Buffer> jointsBuffer;
         std::unique_ptr<Buffer> weightsBuffer;
+        // storage buffers the culling pass reads, only there when the mesh was split into meshlets
+        std::unique_ptr<Buffer> meshletBuffer;
+        std::unique_ptr<Buffer> meshletVertexBuffer;
+        std::unique_ptr<Buffer> meshletTriangleBuffer;
 
-        struct UniformBuffer
-        {
-            glm::mat4 model = glm::mat4(1.0f);
-            glm::mat4 modelInvTranspose = glm::mat4(1.0f);
-            glm::vec4 attributeFlags1 = glm::vec4(0.0f);
-            glm::vec4 attributeFlags2 = glm::vec4(0.0f);
-            char padding[32] = {0};
-        };
-        UniformBuffer uniform;
-
-        std::vector<vk::Buffer> validBuffers;
+        // only created for staged (GPU_ONLY) models, the pixels are dropped once recordUpload() copied them
+        std::optional<TextureData> baseColorData;
+        std::unique_ptr<Texture> baseColor;
 
-        Model(const Allocator &allocator, const std::filesystem::path &modelPath)
-        {
-            Assimp::Importer importer;
+        gpu::InstanceData instance = {glm::mat4(1.0f), glm::mat4(1.0f)};
 
-            // const aiScene *scene = importer.ReadFile(
-            //     modelPath.string(), aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices |
-            //                             aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_ValidateDataStructure |
-            //                             aiProcess_ImproveCacheLocality | aiProcess_GenUVCoords | aiProcess_FlipUVs);
+        // what draw() needs once the cpu copies above are released, indexCount covers every level
+        uint32_t indexCount = 0;
+        uint32_t vertexCount = 0;
+        std::vector<MeshLod> lods;
+        glm::vec4 bounds;
 
-            const aiScene *scene = importer.ReadFile(
-                modelPath.string(),
-                aiProcess_Triangulate | aiProcess_GenNormals | 
-                    aiProcess_ImproveCacheLocality | aiProcess_GenUVCoords | aiProcess_FlipUVs);
+        // indexed by vertex input binding, absent streams point at zeroBuffer
+        std::array<vk::Buffer, LETC_ATTRIBUTE_COUNT> vertexBuffers{};
+        uint32_t attributeMask = 0;
+        std::unique_ptr<Buffer> zeroBuffer;
+        uint64_t relocationListener;
 
-            assertThrow(scene, "failed to load model: " + modelPath.string());
-            assertThrow(scene->mNumMeshes == 1, "model should only have one mesh");
-            aiMesh *mesh = scene->mMeshes[0];
+        Model(const Allocator &allocator, const std::filesystem::path &modelPath)
+            : Model(allocator, importMesh(modelPath))
+        {
+        }
 
-            if (mesh->HasFaces())
+        // host visible buffers are filled with cpyAttributes(), device local ones (GPU_ONLY) and the
+        // base color texture through a staging buffer with recordUpload()
+        Model(const Allocator &allocator, MeshData &&mesh,
+              const VmaMemoryUsage &memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU)
+            : allocator(allocator), index(std::move(mesh.index)), position(std::move(mesh.position)),
+              normal(std::move(mesh.normal)), tangent(std::move(mesh.tangent)), uv(std::move(mesh.uv)),
+              color(std::move(mesh.color)), meshlets(std::move(mesh.meshlets)),
+              meshletVertices(std::move(mesh.meshletVertices)), meshletTriangles(std::move(mesh.meshletTriangles)),
+              indexCount(static_cast<uint32_t>(index.size())),
+              vertexCount(static_cast<uint32_t>(position.size())), lods(std::move(mesh.lods)), bounds(mesh.bounds),
+              attributeMask(mesh.attributeMask)
+        {
+            LETC_ZONE("Model::Model");
+            if (lods.empty())
             {
-                for (size_t i = 0; i < mesh->mNumFaces; i++)
-                {
-                    index.push_back(mesh->mFaces[i].mIndices[0]);
-                    index.push_back(mesh->mFaces[i].mIndices[1]);
-                    index.push_back(mesh->mFaces[i].mIndices[2]);
-                }
-                indexBuffer = std::make_unique<Buffer>(allocator, index.size() * sizeof(unsigned), vk::BufferUsageFlagBits::eIndexBuffer,
-                                                       VMA_MEMORY_USAGE_CPU_TO_GPU);
+                lods.push_back({0, indexCount, 0.0f});
             }
-
-            if (mesh->HasPositions())
+            if (mesh.baseColor && memoryUsage == VMA_MEMORY_USAGE_GPU_ONLY)
             {
-                for (size_t i = 0; i < mesh->mNumVertices; i++)
-                {
-                    position.push_back({mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f});
-                }
-                positionBuffer =
-                    std::make_unique<Buffer>(allocator, position.size() * sizeof(glm::vec4), vk::BufferUsageFlagBits::eVertexBuffer,
-                                             VMA_MEMORY_USAGE_CPU_TO_GPU);
-                validBuffers.push_back(positionBuffer->buffer);
+                baseColorData = std::move(mesh.baseColor);
+                baseColor = std::make_unique<Texture>(allocator, *baseColorData);
+            }
+            if (!index.empty())
+            {
+                indexBuffer = std::make_unique<Buffer>(allocator, index.size() * sizeof(unsigned),
+                                                       vk::BufferUsageFlagBits::eIndexBuffer, memoryUsage);
+            }
+            if (!position.empty())
+            {
+                positionBuffer = std::make_unique<Buffer>(allocator, position.size() * sizeof(glm::vec4),
+                                                          vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+                vertexBuffers[0] = positionBuffer->buffer;
+            }
+            if (!normal.empty())
+            {
+                normalBuffer = std::make_unique<Buffer>(allocator, normal.size() * sizeof(glm::vec4),
+                                                        vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+                vertexBuffers[1] = normalBuffer->buffer;
+            }
+            if (!tangent.empty())
+            {
+                tangentBuffer = std::make_unique<Buffer>(allocator, tangent.size() * sizeof(glm::vec4),
+                                                         vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+                vertexBuffers[2] = tangentBuffer->buffer;
+            }
+            if (!uv.empty())
+            {
+                uvBuffer = std::make_unique<Buffer>(allocator, uv.size() * sizeof(glm::vec2),
+                                                    vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+                vertexBuffers[3] = uvBuffer->buffer;
+            }
+            if (!color.empty())
+            {
+                colorBuffer = std::make_unique<Buffer>(allocator, color.size() * sizeof(glm::vec4),
+                                                       vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+            }
+            if (!meshlets.empty())
+            {
+                meshletBuffer = std::make_unique<Buffer>(allocator, meshlets.size() * sizeof(gpu::Meshlet),
+                                                         vk::BufferUsageFlagBits::eStorageBuffer, memoryUsage);
+                meshletVertexBuffer = std::make_unique<Buffer>(allocator, meshletVertices.size() * sizeof(uint32_t),
+                                                               vk::BufferUsageFlagBits::eStorageBuffer, memoryUsage);
+                meshletTriangleBuffer =
+                    std::make_unique<Buffer>(allocator, meshletTriangles.size() * sizeof(uint32_t),
+                                             vk::BufferUsageFlagBits::eStorageBuffer, memoryUsage);
             }
 
-            if (mesh->HasNormals())
+            if (attributeMask != (1u << LETC_ATTRIBUTE_COUNT) - 1)
             {
-                for (size_t i = 0; i < mesh->mNumVertices; i++)
+                zeroBuffer = std::make_unique<Buffer>(allocator, sizeof(glm::vec4),
+                                                      vk::BufferUsageFlagBits::eVertexBuffer, memoryUsage);
+                for (auto &vertexBuffer : vertexBuffers)
                 {
-                    normal.push_back({mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 1.0f});
+                    if (!vertexBuffer)
+                    {
+                        vertexBuffer = zeroBuffer->buffer;
+                    }
                 }
-                normalBuffer =
-                    std::make_unique<Buffer>(allocator, normal.size() * sizeof(glm::vec4), vk::BufferUsageFlagBits::eVertexBuffer,
-                                             VMA_MEMORY_USAGE_CPU_TO_GPU);
-                validBuffers.push_back(normalBuffer->buffer);
             }
 
-            if (mesh->HasTangentsAndBitangents())
+            // the bound vertex streams are cached handles, follow them when the defragmenter moves one
+            relocationListener = allocator.addRelocationListener(
+                [this](const vk::Buffer &oldBuffer, const vk::Buffer &newBuffer)
+                { std::replace(vertexBuffers.begin(), vertexBuffers.end(), oldBuffer, newBuffer); });
+        }
+
+        Model(const Model &) = delete;
+        Model &operator=(const Model &) = delete;
+
+        ~Model()
+        {
+            allocator.removeRelocationListener(relocationListener);
+        }
+
+        // host visible buffers are written directly, the cpu copies are released after
+        void cpyAttributes()
+        {
+            forEachStream([](Buffer &buffer, const void *data, const vk::DeviceSize &size) { buffer.cpy(data, size); });
+            releaseCpuData();
+        }
+
+        // the streams are only kept on the gpu from here on, a model that needs them again is imported again
+        void releaseCpuData()
+        {
+            auto release = [](auto &elements) { std::decay_t<decltype(elements)>().swap(elements); };
+            release(index);
+            release(position);
+            release(normal);
+            release(tangent);
+            release(uv);
+            release(color);
+            release(joints);
+            release(weights);
+            release(meshlets);
+            release(meshletVertices);
+            release(meshletTriangles);
+        }
+
+        // device memory held by the streams and the texture
+        vk::DeviceSize residentBytes() const
+        {
+            vk::DeviceSize bytes = 0;
+            auto add = [&](const VmaAllocation &allocation)
             {
-                for (size_t i = 0; i < mesh->mNumVertices; i++)
+                VmaAllocationInfo info;
+                vmaGetAllocationInfo(allocator.allocator, allocation, &info);
+                bytes += info.size;
+            };
+            for (const Buffer *buffer : {indexBuffer.get(), positionBuffer.get(), normalBuffer.get(),
+                                         tangentBuffer.get(), uvBuffer.get(), colorBuffer.get(), jointsBuffer.get(),
+                                         weightsBuffer.get(), meshletBuffer.get(), meshletVertexBuffer.get(),
+                                         meshletTriangleBuffer.get(), zeroBuffer.get()})
+            {
+                if (buffer)
                 {
-                    tangent.push_back({mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z, 1.0f});
+                    add(buffer->allocation);
                 }
-                tangentBuffer =
-                    std::make_unique<Buffer>(allocator, tangent.size() * sizeof(glm::vec4), vk::BufferUsageFlagBits::eVertexBuffer,
-                                             VMA_MEMORY_USAGE_CPU_TO_GPU);
-                validBuffers.push_back(tangentBuffer->buffer);
             }
+            if (baseColor)
+            {
+                add(baseColor->image.allocation);
+            }
+            return bytes;
+        }
 
-            if (mesh->HasTextureCoords(0))
+        // bytes recordUpload() needs in its staging buffer
+        vk::DeviceSize stagingSize() const
+        {
+            vk::DeviceSize size = 0;
+            forEachStream([&size](Buffer &, const void *, const vk::DeviceSize &bytes) { size += bytes; });
+            if (baseColorData)
             {
-                for (size_t i = 0; i < mesh->mNumVertices; i++)
+                size = alignTexture(size) + baseColor->stagingSize();
+            }
+            return size;
+        }
+
+        // write every stream into the mapped staging buffer at offset and record the copies into the
+        // device local buffers, returns the buffers written so the caller can hand them to another queue.
+        // the texture's levels are copied last, the rest of its chain is left to baseColor->recordMips()
+        // on graphics. the cpu copies are released once they are in staging
+        std::vector<vk::Buffer> recordUpload(const vk::CommandBuffer &commandBuffer, Buffer &staging,
+                                             vk::DeviceSize offset = 0)
+        {
+            std::vector<vk::Buffer> written;
+            char *mapped = static_cast<char *>(staging.map());
+            forEachStream(
+                [&](Buffer &buffer, const void *data, const vk::DeviceSize &size)
                 {
-                    uv.push_back({mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y});
-                }
-                uvBuffer = std::make_unique<Buffer>(allocator, uv.size() * sizeof(glm::vec2), vk::BufferUsageFlagBits::eVertexBuffer,
-                                                    VMA_MEMORY_USAGE_CPU_TO_GPU);
-                validBuffers.push_back(uvBuffer->buffer);
+                    std::memcpy(mapped + offset, data, size);
+                    commandBuffer.copyBuffer(staging.buffer, buffer.buffer, vk::BufferCopy{offset, 0, size});
+                    written.push_back(buffer.buffer);
+                    offset += size;
+                });
+            addStat(Stat::BytesUploaded, stagingSize());
+            if (baseColorData)
+            {
+                offset = alignTexture(offset);
+                baseColor->stage(mapped + offset, *baseColorData);
+                baseColor->recordCopy(commandBuffer, staging, offset);
+                baseColorData.reset();
             }
+            staging.flush();
+            releaseCpuData();
+            return written;
+        }
+
+        // the level to draw at world, seen by camera over a viewport viewportHeight pixels tall. previous is the
+        // level drawn last frame, see selectLod()
+        uint32_t selectLod(const glm::mat4 &world, const Camera &camera, const float &viewportHeight,
+                           const uint32_t &previous) const
+        {
+            return letc::selectLod(lods, lodPixelsPerUnit(bounds, world, camera, viewportHeight), previous);
+        }
 
-            if (mesh->HasVertexColors(0))
+        // true when the level can go through the meshlet culling pass instead of draw()
+        bool hasMeshlets(const uint32_t &lod) const
+        {
+            return meshletBuffer && lods[std::min<size_t>(lod, lods.size() - 1)].meshletCount > 0;
+        }
+
+        void bindVertexBuffers(const vk::CommandBuffer &commandBuffer) const
+        {
+            std::array<vk::DeviceSize, LETC_ATTRIBUTE_COUNT> offsets{};
+            commandBuffer.bindVertexBuffers(0, vertexBuffers.size(), vertexBuffers.data(), offsets.data());
+        }
+
+        void draw(const vk::CommandBuffer &commandBuffer, const uint32_t &lod = 0)
+        {
+            bindVertexBuffers(commandBuffer);
+            if (indexBuffer)
             {
-                for (size_t i = 0; i < mesh->mNumVertices; i++)
-                {
-                    color.push_back(
-                        {mesh->mColors[0][i].r, mesh->mColors[0][i].g, mesh->mColors[0][i].b, mesh->mColors[0][i].a});
-                }
-                colorBuffer = std::make_unique<Buffer>(allocator, color.size() * sizeof(glm::vec4), vk::BufferUsageFlagBits::eVertexBuffer,
-                                                       VMA_MEMORY_USAGE_CPU_TO_GPU);
-                validBuffers.push_back(colorBuffer->buffer);
+                const MeshLod &level = lods[std::min<size_t>(lod, lods.size() - 1)];
+                commandBuffer.bindIndexBuffer(indexBuffer->buffer, 0, vk::IndexType::eUint32);
+                commandBuffer.drawIndexed(level.indexCount, 1, level.firstIndex, 0, 0);
+                addStat(Stat::Triangles, level.indexCount / 3);
+            }
+            else
+            {
+                commandBuffer.draw(vertexCount, 1, 0, 0);
+                addStat(Stat::Triangles, vertexCount / 3);
             }
+            addStat(Stat::DrawCalls);
         }
 
-        void cpyAttributes()
+      private:
+        // copyBufferToImage offsets are a multiple of the texel block, 16 bytes for the largest bc block
+        static vk::DeviceSize alignTexture(const vk::DeviceSize &offset)
+        {
+            return (offset + 15) & ~vk::DeviceSize(15);
+        }
+
+        template <typename F> void forEachStream(const F &function) const
         {
+            static const glm::vec4 zero(0.0f);
             if (indexBuffer)
             {
-                indexBuffer->cpy(index.data(), index.size() * sizeof(unsigned));
+                function(*indexBuffer, index.data(), index.size() * sizeof(unsigned));
             }
             if (positionBuffer)
             {
-                positionBuffer->cpy(position.data(), position.size() * sizeof(glm::vec4));
+                function(*positionBuffer, position.data(), position.size() * sizeof(glm::vec4));
             }
             if (normalBuffer)
             {
-                normalBuffer->cpy(normal.data(), normal.size() * sizeof(glm::vec4));
+                function(*normalBuffer, normal.data(), normal.size() * sizeof(glm::vec4));
             }
             if (tangentBuffer)
             {
-                tangentBuffer->cpy(tangent.data(), tangent.size() * sizeof(glm::vec4));
+                function(*tangentBuffer, tangent.data(), tangent.size() * sizeof(glm::vec4));
             }
             if (uvBuffer)
             {
-                uvBuffer->cpy(uv.data(), uv.size() * sizeof(glm::vec2));
+                function(*uvBuffer, uv.data(), uv.size() * sizeof(glm::vec2));
             }
             if (colorBuffer)
             {
-                colorBuffer->cpy(color.data(), color.size() * sizeof(glm::vec4));
+                function(*colorBuffer, color.data(), color.size() * sizeof(glm::vec4));
             }
-        }
-
-        void draw(const vk::CommandBuffer &commandBuffer)
-        {
-            if (indexBuffer)
+            if (meshletBuffer)
             {
-                commandBuffer.bindIndexBuffer(indexBuffer->buffer, 0, vk::IndexType::eUint32);
-                commandBuffer.bindVertexBuffers(0, validBuffers.size(), validBuffers.data(),
-                                                std::vector<vk::DeviceSize>(validBuffers.size(), 0).data());
-                commandBuffer.drawIndexed(index.size(), 1, 0, 0, 0);
+                function(*meshletBuffer, meshlets.data(), meshlets.size() * sizeof(gpu::Meshlet));
+                function(*meshletVertexBuffer, meshletVertices.data(), meshletVertices.size() * sizeof(uint32_t));
+                function(*meshletTriangleBuffer, meshletTriangles.data(),
+                         meshletTriangles.size() * sizeof(uint32_t));
             }
-            else
+            if (zeroBuffer)
             {
-                commandBuffer.draw(position.size(), 1, 0, 0);
+                function(*zeroBuffer, &zero, sizeof(glm::vec4));
             }
         }
     };
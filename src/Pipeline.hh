@@ -11,10 +11,34 @@
 #include "Buffer.hh"
 #include "Descriptor.hh"
 #include "Device.hh"
-#include "Swapchain.hh"
+#include "Stats.hh"
+#include "Zones.hh"
 
 namespace letc
 {
+    // state that is set while recording instead of being baked into the pipeline,
+    // whatever the backend can't make dynamic is ignored and comes from the builder
+    struct RenderState
+    {
+        vk::Viewport viewport{0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+        vk::Rect2D scissor{};
+
+        vk::CullModeFlags cullMode = vk::CullModeFlagBits::eBack;
+        vk::FrontFace frontFace = vk::FrontFace::eCounterClockwise;
+        vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+        vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+        bool depthTest = true;
+        bool depthWrite = true;
+        vk::CompareOp depthCompareOp = vk::CompareOp::eLess;
+
+        RenderState &setExtent(const vk::Extent2D &extent)
+        {
+            viewport.setWidth(static_cast<float>(extent.width)).setHeight(static_cast<float>(extent.height));
+            scissor.setOffset({0, 0}).setExtent(extent);
+            return *this;
+        }
+    };
+
     struct GraphicsPipelineBuilder
     {
         vk::GraphicsPipelineCreateInfo createInfo;
@@ -24,6 +48,15 @@ namespace letc
         std::vector<std::vector<char>> shaderNames;
         std::vector<vk::PipelineShaderStageCreateInfo> shaderStageInfos;
 
+        // specialization constants, one entry per shader stage
+        struct Specialization
+        {
+            std::vector<vk::SpecializationMapEntry> entries;
+            std::vector<char> data;
+            vk::SpecializationInfo info;
+        };
+        std::vector<Specialization> specializations;
+
         vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
         std::vector<vk::VertexInputBindingDescription> vertexInputBindings;
         std::vector<vk::VertexInputAttributeDescription> vertexInputAttributes;
@@ -59,6 +92,37 @@ namespace letc
             shaderStageInfo.setStage(stage);
             shaderStageInfo.setPName(shaderNames.back().data());
             shaderStageInfos.push_back(shaderStageInfo);
+            specializations.emplace_back();
+
+            return *this;
+        }
+
+        // set constant_id to value for every added stage matching stages, replaces an earlier value
+        GraphicsPipelineBuilder &setSpecializationConstant(const vk::ShaderStageFlags &stages,
+                                                           const uint32_t &constantId, const uint32_t &value)
+        {
+            for (size_t i = 0; i < shaderStageInfos.size(); i++)
+            {
+                if (!(stages & shaderStageInfos[i].stage))
+                {
+                    continue;
+                }
+
+                Specialization &specialization = specializations[i];
+                auto existing = std::find_if(specialization.entries.begin(), specialization.entries.end(),
+                                             [&constantId](const vk::SpecializationMapEntry &entry)
+                                             { return entry.constantID == constantId; });
+                if (existing != specialization.entries.end())
+                {
+                    std::memcpy(specialization.data.data() + existing->offset, &value, sizeof(uint32_t));
+                    continue;
+                }
+
+                uint32_t offset = static_cast<uint32_t>(specialization.data.size());
+                specialization.entries.push_back(vk::SpecializationMapEntry{constantId, offset, sizeof(uint32_t)});
+                specialization.data.resize(offset + sizeof(uint32_t));
+                std::memcpy(specialization.data.data() + offset, &value, sizeof(uint32_t));
+            }
 
             return *this;
         }
@@ -166,6 +230,48 @@ namespace letc
             return *this;
         }
 
+        // move raster and depth state to record time, one pipeline then covers every
+        // cull/depth (and polygon mode where supported) combination
+        bool dynamicRenderState = false;
+        bool dynamicPolygonMode = false;
+        GraphicsPipelineBuilder &setDynamicRenderState(const Device &device)
+        {
+            dynamicRenderState = device.capabilities.extendedDynamicState;
+            if (!dynamicRenderState)
+            {
+                return *this;
+            }
+
+            std::erase(dynamicStates, vk::DynamicState::eViewport);
+            std::erase(dynamicStates, vk::DynamicState::eScissor);
+            dynamicStates.push_back(vk::DynamicState::eViewportWithCount);
+            dynamicStates.push_back(vk::DynamicState::eScissorWithCount);
+            dynamicStates.push_back(vk::DynamicState::eCullMode);
+            dynamicStates.push_back(vk::DynamicState::eFrontFace);
+            dynamicStates.push_back(vk::DynamicState::ePrimitiveTopology);
+            dynamicStates.push_back(vk::DynamicState::eDepthTestEnable);
+            dynamicStates.push_back(vk::DynamicState::eDepthWriteEnable);
+            dynamicStates.push_back(vk::DynamicState::eDepthCompareOp);
+            viewportInfo.setViewportCount(0);
+            viewportInfo.setScissorCount(0);
+
+            dynamicPolygonMode = device.capabilities.dynamicPolygonMode;
+            if (dynamicPolygonMode)
+            {
+                dynamicStates.push_back(vk::DynamicState::ePolygonModeEXT);
+            }
+            return *this;
+        }
+
+        // build linked VK_EXT_shader_object shaders instead of a pipeline when the device has them,
+        // every piece of state is then set at record time
+        bool shaderObjects = false;
+        GraphicsPipelineBuilder &setShaderObjects(const bool &enable)
+        {
+            shaderObjects = enable;
+            return *this;
+        }
+
         GraphicsPipelineBuilder()
         {
             inputAssemblyInfo.setTopology(vk::PrimitiveTopology::eTriangleList);
@@ -209,15 +315,179 @@ namespace letc
     struct GraphicsPipeline
     {
         const Device &device;
-        const Swapchain &swapchain;
         GraphicsPipelineBuilder builder;
         std::vector<vk::ShaderModule> shaders;
         vk::PipelineLayout layout;
         vk::Pipeline pipeline;
 
-        GraphicsPipeline(const Device &device, const Swapchain &swapchain,
-                  const GraphicsPipelineBuilder &graphicsPipelineBuilder)
-            : device(device), swapchain(swapchain), builder(graphicsPipelineBuilder)
+        // shader object backend, used instead of pipeline when builder.shaderObjects is honoured
+        std::vector<vk::ShaderEXT> shaderObjects;
+        std::vector<vk::ShaderStageFlagBits> shaderObjectStages;
+
+        // attachment formats come from the builder's renderingInfo, so no swapchain is needed
+        GraphicsPipeline(const Device &device, const GraphicsPipelineBuilder &graphicsPipelineBuilder)
+            : device(device), builder(graphicsPipelineBuilder)
+        {
+            LETC_ZONE("GraphicsPipeline::GraphicsPipeline");
+            for (size_t i = 0; i < builder.shaderStageInfos.size(); i++)
+            {
+                // point back into our own copy of the builder, not the one we were built from
+                builder.shaderStageInfos[i].setPName(builder.shaderNames[i].data());
+
+                auto &specialization = builder.specializations[i];
+                if (!specialization.entries.empty())
+                {
+                    specialization.info.setMapEntries(specialization.entries);
+                    specialization.info.setDataSize(specialization.data.size());
+                    specialization.info.setPData(specialization.data.data());
+                    builder.shaderStageInfos[i].setPSpecializationInfo(&specialization.info);
+                }
+            }
+
+            vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.setSetLayouts(builder.descriptorLayout->descriptorSetLayouts);
+            pipelineLayoutInfo.setPushConstantRanges(builder.pushConstantRanges);
+            layout = device.device.createPipelineLayout(pipelineLayoutInfo);
+
+            if (usesShaderObjects())
+            {
+                createShaderObjects();
+            }
+            else
+            {
+                createPipeline();
+            }
+        }
+
+        bool usesShaderObjects() const
+        {
+            return builder.shaderObjects && device.capabilities.shaderObject;
+        }
+
+        void bind(const vk::CommandBuffer &commandBuffer)
+        {
+            addStat(Stat::PipelineBinds);
+            if (!usesShaderObjects())
+            {
+                commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+                return;
+            }
+
+            commandBuffer.bindShadersEXT(shaderObjectStages, shaderObjects);
+
+            // nothing is baked with shader objects, so the builder's fixed state goes in here
+            std::vector<vk::VertexInputBindingDescription2EXT> bindings;
+            for (const auto &binding : builder.vertexInputBindings)
+            {
+                bindings.push_back(vk::VertexInputBindingDescription2EXT{}
+                                       .setBinding(binding.binding)
+                                       .setStride(binding.stride)
+                                       .setInputRate(binding.inputRate)
+                                       .setDivisor(1));
+            }
+            std::vector<vk::VertexInputAttributeDescription2EXT> attributes;
+            for (const auto &attribute : builder.vertexInputAttributes)
+            {
+                attributes.push_back(vk::VertexInputAttributeDescription2EXT{}
+                                         .setLocation(attribute.location)
+                                         .setBinding(attribute.binding)
+                                         .setFormat(attribute.format)
+                                         .setOffset(attribute.offset));
+            }
+            commandBuffer.setVertexInputEXT(bindings, attributes);
+
+            commandBuffer.setRasterizerDiscardEnable(builder.rasterizationInfo.rasterizerDiscardEnable);
+            commandBuffer.setPrimitiveRestartEnable(builder.inputAssemblyInfo.primitiveRestartEnable);
+            commandBuffer.setDepthBiasEnable(builder.rasterizationInfo.depthBiasEnable);
+            // read whenever a draw rasterizes lines, which the wireframe polygon mode does too
+            commandBuffer.setLineWidth(builder.rasterizationInfo.lineWidth);
+            commandBuffer.setDepthBoundsTestEnable(builder.depthStencilInfo.depthBoundsTestEnable);
+            commandBuffer.setStencilTestEnable(builder.depthStencilInfo.stencilTestEnable);
+            commandBuffer.setRasterizationSamplesEXT(builder.multisampleInfo.rasterizationSamples);
+            vk::SampleMask sampleMask = ~0u;
+            commandBuffer.setSampleMaskEXT(builder.multisampleInfo.rasterizationSamples, sampleMask);
+            commandBuffer.setAlphaToCoverageEnableEXT(builder.multisampleInfo.alphaToCoverageEnable);
+
+            std::vector<vk::Bool32> blendEnables;
+            std::vector<vk::ColorComponentFlags> writeMasks;
+            std::vector<vk::ColorBlendEquationEXT> blendEquations;
+            for (const auto &attachment : builder.colorBlendAttachments)
+            {
+                blendEnables.push_back(attachment.blendEnable);
+                writeMasks.push_back(attachment.colorWriteMask);
+                blendEquations.push_back(vk::ColorBlendEquationEXT{}
+                                             .setSrcColorBlendFactor(attachment.srcColorBlendFactor)
+                                             .setDstColorBlendFactor(attachment.dstColorBlendFactor)
+                                             .setColorBlendOp(attachment.colorBlendOp)
+                                             .setSrcAlphaBlendFactor(attachment.srcAlphaBlendFactor)
+                                             .setDstAlphaBlendFactor(attachment.dstAlphaBlendFactor)
+                                             .setAlphaBlendOp(attachment.alphaBlendOp));
+            }
+            if (!blendEnables.empty())
+            {
+                commandBuffer.setColorBlendEnableEXT(0, blendEnables);
+                commandBuffer.setColorWriteMaskEXT(0, writeMasks);
+                commandBuffer.setColorBlendEquationEXT(0, blendEquations);
+            }
+        }
+
+        // apply whatever part of state this backend treats as dynamic, call after bind()
+        void setRenderState(const vk::CommandBuffer &commandBuffer, const RenderState &state) const
+        {
+            bool fullyDynamic = usesShaderObjects();
+            if (!fullyDynamic && !builder.dynamicRenderState)
+            {
+                commandBuffer.setViewport(0, state.viewport);
+                commandBuffer.setScissor(0, state.scissor);
+                return;
+            }
+
+            commandBuffer.setViewportWithCount(state.viewport);
+            commandBuffer.setScissorWithCount(state.scissor);
+            commandBuffer.setCullMode(state.cullMode);
+            commandBuffer.setFrontFace(state.frontFace);
+            commandBuffer.setPrimitiveTopology(state.topology);
+            commandBuffer.setDepthTestEnable(state.depthTest);
+            commandBuffer.setDepthWriteEnable(state.depthWrite);
+            commandBuffer.setDepthCompareOp(state.depthCompareOp);
+            if (fullyDynamic || builder.dynamicPolygonMode)
+            {
+                commandBuffer.setPolygonModeEXT(state.polygonMode);
+            }
+        }
+
+        // write a per draw record into the first push constant range
+        template <typename T> void push(const vk::CommandBuffer &commandBuffer, const T &data) const
+        {
+            const vk::PushConstantRange &range = builder.pushConstantRanges.at(0);
+            assertThrow(sizeof(T) <= range.size, "push constant data larger than its range");
+            commandBuffer.pushConstants(layout, range.stageFlags, range.offset, sizeof(T), &data);
+        }
+
+        ~GraphicsPipeline()
+        {
+            // modules are only needed for creation, the rest may still be in flight
+            for (auto &shader : shaders)
+            {
+                device.device.destroyShaderModule(shader);
+            }
+            device.defer(
+                [device = device.device, shaderObjects = shaderObjects, pipeline = pipeline, layout = layout]
+                {
+                    for (auto &shaderObject : shaderObjects)
+                    {
+                        device.destroyShaderEXT(shaderObject);
+                    }
+                    if (pipeline)
+                    {
+                        device.destroyPipeline(pipeline);
+                    }
+                    device.destroyPipelineLayout(layout);
+                });
+        }
+
+      private:
+        void createPipeline()
         {
             for (auto &code : builder.shaderCode)
             {
@@ -252,28 +522,107 @@ namespace letc
             builder.dynamicStateInfo.setDynamicStates(builder.dynamicStates);
             builder.createInfo.setPDynamicState(&builder.dynamicStateInfo);
 
-            vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
-            pipelineLayoutInfo.setSetLayouts(builder.descriptorLayout->descriptorSetLayouts);
-            pipelineLayoutInfo.setPushConstantRanges(builder.pushConstantRanges);
-            layout = device.device.createPipelineLayout(pipelineLayoutInfo);
             builder.createInfo.setLayout(layout);
 
             pipeline = device.device.createGraphicsPipeline(VK_NULL_HANDLE, builder.createInfo).value;
         }
 
-        void bind(const vk::CommandBuffer &commandBuffer)
+        void createShaderObjects()
         {
-            commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            std::vector<vk::ShaderCreateInfoEXT> createInfos;
+            for (size_t i = 0; i < builder.shaderStageInfos.size(); i++)
+            {
+                const auto &stageInfo = builder.shaderStageInfos[i];
+                vk::ShaderStageFlags nextStage{};
+                if (i + 1 < builder.shaderStageInfos.size())
+                {
+                    nextStage = builder.shaderStageInfos[i + 1].stage;
+                }
+
+                createInfos.push_back(
+                    vk::ShaderCreateInfoEXT{}
+                        .setFlags(builder.shaderStageInfos.size() > 1 ? vk::ShaderCreateFlagBitsEXT::eLinkStage
+                                                                      : vk::ShaderCreateFlagsEXT{})
+                        .setStage(stageInfo.stage)
+                        .setNextStage(nextStage)
+                        .setCodeType(vk::ShaderCodeTypeEXT::eSpirv)
+                        .setCodeSize(builder.shaderCode[i].size())
+                        .setPCode(builder.shaderCode[i].data())
+                        .setPName(stageInfo.pName)
+                        .setSetLayouts(builder.descriptorLayout->descriptorSetLayouts)
+                        .setPushConstantRanges(builder.pushConstantRanges)
+                        .setPSpecializationInfo(stageInfo.pSpecializationInfo));
+                shaderObjectStages.push_back(stageInfo.stage);
+            }
+
+            shaderObjects.resize(createInfos.size());
+            assertThrow(VULKAN_HPP_DEFAULT_DISPATCHER.vkCreateShadersEXT(
+                            device.device, static_cast<uint32_t>(createInfos.size()),
+                            reinterpret_cast<const VkShaderCreateInfoEXT *>(createInfos.data()), nullptr,
+                            reinterpret_cast<VkShaderEXT *>(shaderObjects.data())) == VK_SUCCESS,
+                        "failed to create shader objects");
         }
+    };
 
-        ~GraphicsPipeline()
+    // a single compute stage with the set layouts of a DescriptorLayout and one push constant range
+    struct ComputePipeline
+    {
+        const Device &device;
+        vk::ShaderModule shader;
+        vk::PipelineLayout layout;
+        vk::Pipeline pipeline;
+        vk::PushConstantRange pushConstantRange;
+
+        ComputePipeline(const Device &device, const std::vector<char> &code, const DescriptorLayout &descriptorLayout,
+                        const uint32_t &pushConstantSize = 0, const std::string &entryPoint = "main")
+            : device(device), pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, pushConstantSize)
         {
-            device.device.destroyPipeline(pipeline);
-            device.device.destroyPipelineLayout(layout);
-            for (auto &shader : shaders)
+            LETC_ZONE("ComputePipeline::ComputePipeline");
+            shader = device.device.createShaderModule(vk::ShaderModuleCreateInfo{}
+                                                          .setCodeSize(code.size())
+                                                          .setPCode(reinterpret_cast<const uint32_t *>(code.data())));
+
+            vk::PipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.setSetLayouts(descriptorLayout.descriptorSetLayouts);
+            if (pushConstantSize)
             {
-                device.device.destroyShaderModule(shader);
+                pipelineLayoutInfo.setPushConstantRanges(pushConstantRange);
             }
+            layout = device.device.createPipelineLayout(pipelineLayoutInfo);
+
+            vk::ComputePipelineCreateInfo createInfo{};
+            createInfo.setStage(vk::PipelineShaderStageCreateInfo{}
+                                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                                    .setModule(shader)
+                                    .setPName(entryPoint.c_str()));
+            createInfo.setLayout(layout);
+            pipeline = device.device.createComputePipeline(VK_NULL_HANDLE, createInfo).value;
+        }
+
+        ComputePipeline(const ComputePipeline &) = delete;
+        ComputePipeline &operator=(const ComputePipeline &) = delete;
+
+        void bind(const vk::CommandBuffer &commandBuffer) const
+        {
+            addStat(Stat::PipelineBinds);
+            commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        }
+
+        template <typename T> void push(const vk::CommandBuffer &commandBuffer, const T &data) const
+        {
+            assertThrow(sizeof(T) <= pushConstantRange.size, "push constant data larger than its range");
+            commandBuffer.pushConstants(layout, pushConstantRange.stageFlags, 0, sizeof(T), &data);
+        }
+
+        ~ComputePipeline()
+        {
+            device.device.destroyShaderModule(shader);
+            device.defer(
+                [device = device.device, pipeline = pipeline, layout = layout]
+                {
+                    device.destroyPipeline(pipeline);
+                    device.destroyPipelineLayout(layout);
+                });
         }
     };
 }; // namespace letc
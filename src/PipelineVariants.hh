@@ -0,0 +1,198 @@
+#pragma once
+
+#ifndef LETC_PIPELINEVARIANTS_HH
+#define LETC_PIPELINEVARIANTS_HH
+
+#include "pch.hh"
+
+#include <chrono>
+#include <future>
+#include <mutex>
+
+#include "Device.hh"
+#include "JobSystem.hh"
+#include "Layout.hh"
+#include "Pipeline.hh"
+
+namespace letc
+{
+    // everything a shader would otherwise branch on at runtime
+    struct PipelinePermutation
+    {
+        uint32_t attributeMask = LETC_ATTRIBUTE_POSITION;
+        uint32_t maxLights = 0;
+        uint32_t features = LETC_FEATURE_LIGHTING;
+
+        bool operator==(const PipelinePermutation &other) const = default;
+    };
+}; // namespace letc
+
+namespace std
+{
+    template <> struct hash<letc::PipelinePermutation>
+    {
+        std::size_t operator()(const letc::PipelinePermutation &permutation) const noexcept
+        {
+            std::size_t seed = std::hash<uint32_t>{}(permutation.attributeMask);
+            seed ^= std::hash<uint32_t>{}(permutation.maxLights) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            seed ^= std::hash<uint32_t>{}(permutation.features) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+}; // namespace std
+
+namespace letc
+{
+    // lazily built pipelines for one shader set, keyed by permutation and shared by every
+    // material drawn with those shaders. compiles run outside the lock, looking up a finished
+    // variant never waits on one that is still being built
+    struct PipelineVariants
+    {
+        // in the map from the moment it is first asked for, ready once its pipeline is compiled
+        struct Variant
+        {
+            std::promise<GraphicsPipeline *> promise;
+            std::shared_future<GraphicsPipeline *> ready;
+            std::unique_ptr<GraphicsPipeline> pipeline;
+            // set under the lock when the compile threw, the variant is never tried again
+            bool failed = false;
+        };
+
+        const Device &device;
+        GraphicsPipelineBuilder base;
+        // where find() compiles missing variants, inline when null
+        JobSystem *jobs;
+
+        std::mutex mutex;
+        std::unordered_map<PipelinePermutation, Variant> variants;
+        JobCounter building;
+
+        PipelineVariants(const Device &device, const GraphicsPipelineBuilder &base, JobSystem *jobs = nullptr)
+            : device(device), base(base), jobs(jobs)
+        {
+        }
+
+        ~PipelineVariants()
+        {
+            if (jobs)
+            {
+                jobs->wait(building);
+            }
+        }
+
+        PipelineVariants(const PipelineVariants &) = delete;
+        PipelineVariants &operator=(const PipelineVariants &) = delete;
+
+        // the variant, compiled on the calling thread when nobody has started it yet and waited
+        // for when another thread is compiling it. throws the compile's exception for a failed one
+        GraphicsPipeline &get(const PipelinePermutation &permutation)
+        {
+            Variant *claimed = nullptr;
+            std::shared_future<GraphicsPipeline *> ready;
+            {
+                std::lock_guard lock(mutex);
+                auto [found, inserted] = claim(permutation);
+                claimed = inserted ? &found->second : nullptr;
+                ready = found->second.ready;
+            }
+            if (claimed)
+            {
+                build(permutation, *claimed);
+            }
+            return *ready.get();
+        }
+
+        // the variant if it is compiled, null otherwise. a permutation nobody asked for yet is
+        // queued on jobs, the caller draws with another variant until it is ready, or for good when
+        // its compile failed. without jobs it is the same as get()
+        GraphicsPipeline *find(const PipelinePermutation &permutation)
+        {
+            if (!jobs)
+            {
+                return &get(permutation);
+            }
+
+            Variant *claimed = nullptr;
+            {
+                std::lock_guard lock(mutex);
+                auto [found, inserted] = claim(permutation);
+                if (!inserted)
+                {
+                    if (found->second.failed)
+                    {
+                        return nullptr;
+                    }
+                    const auto &ready = found->second.ready;
+                    return ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready ? ready.get()
+                                                                                                : nullptr;
+                }
+                claimed = &found->second;
+            }
+            jobs->submit([this, permutation, claimed] { build(permutation, *claimed); }, &building);
+            return nullptr;
+        }
+
+      private:
+        // under the lock, the new entry has to be built by whoever inserted it
+        std::pair<std::unordered_map<PipelinePermutation, Variant>::iterator, bool> claim(
+            const PipelinePermutation &permutation)
+        {
+            auto result = variants.try_emplace(permutation);
+            if (result.second)
+            {
+                result.first->second.ready = result.first->second.promise.get_future().share();
+            }
+            return result;
+        }
+
+        void build(const PipelinePermutation &permutation, Variant &variant)
+        {
+            try
+            {
+                GraphicsPipelineBuilder builder = base;
+                const vk::ShaderStageFlags allStages = vk::ShaderStageFlagBits::eAllGraphics;
+                builder.setSpecializationConstant(allStages, LETC_SPEC_ATTRIBUTE_MASK, permutation.attributeMask);
+                builder.setSpecializationConstant(allStages, LETC_SPEC_MAX_LIGHTS, permutation.maxLights);
+                builder.setSpecializationConstant(allStages, LETC_SPEC_FEATURES, permutation.features);
+
+                // absent streams read a single zeroed element, the shader never looks at it so the
+                // driver drops the fetch once the constants fold
+                for (auto &binding : builder.vertexInputBindings)
+                {
+                    if (binding.binding < LETC_ATTRIBUTE_COUNT &&
+                        !(permutation.attributeMask & (1u << binding.binding)))
+                    {
+                        binding.setStride(0);
+                    }
+                }
+
+                variant.pipeline = std::make_unique<GraphicsPipeline>(device, builder);
+            }
+            catch (const std::exception &e)
+            {
+                fail(variant, e.what());
+                return;
+            }
+            catch (...)
+            {
+                fail(variant, "unknown exception");
+                return;
+            }
+            variant.promise.set_value(variant.pipeline.get());
+        }
+
+        // reported once and kept, get() rethrows it and find() keeps returning null so the caller's
+        // fallback is drawn instead of the variant being queued again every frame
+        void fail(Variant &variant, const char *what)
+        {
+            std::cerr << "pipeline variant failed to compile: " << what << std::endl;
+            {
+                std::lock_guard lock(mutex);
+                variant.failed = true;
+            }
+            variant.promise.set_exception(std::current_exception());
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_PIPELINEVARIANTS_HH
@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef LETC_SCENEBUFFER_HH
+#define LETC_SCENEBUFFER_HH
+
+#include "pch.hh"
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Stats.hh"
+
+namespace letc
+{
+    // array of T that lives in device local memory, the cpu copy is edited freely and
+    // only the ranges marked dirty are copied over on upload()
+    template <typename T> struct SceneBuffer
+    {
+        const Allocator &allocator;
+
+        std::vector<T> data;
+        std::unique_ptr<Buffer> deviceBuffer;
+        std::unique_ptr<Buffer> stagingBuffer;
+
+        // dirty element ranges [first, last), coalesced on upload
+        std::vector<std::pair<uint32_t, uint32_t>> dirtyRanges;
+        // ranges closer than this many elements are merged into one copy
+        uint32_t mergeGap = 4;
+
+        // who reads the buffer after the copy lands
+        vk::PipelineStageFlags dstStages;
+        vk::AccessFlags dstAccess;
+
+        vk::DeviceSize bytesUploaded = 0;      // last upload() only
+        vk::DeviceSize totalBytesUploaded = 0; // since creation
+
+        SceneBuffer(const Allocator &allocator, const std::vector<T> &initial, const vk::BufferUsageFlags &usage,
+                    const vk::PipelineStageFlags &dstStages, const vk::AccessFlags &dstAccess)
+            : allocator(allocator), data(initial), dstStages(dstStages), dstAccess(dstAccess)
+        {
+            assertThrow(!data.empty(), "scene buffer needs at least one element");
+
+            deviceBuffer = std::make_unique<Buffer>(allocator, sizeBytes(), usage | vk::BufferUsageFlagBits::eTransferDst,
+                                                    VMA_MEMORY_USAGE_GPU_ONLY);
+            stagingBuffer = std::make_unique<Buffer>(allocator, sizeBytes(), vk::BufferUsageFlagBits::eTransferSrc,
+                                                     VMA_MEMORY_USAGE_CPU_ONLY);
+            stagingBuffer->map();
+
+            markDirty(0, static_cast<uint32_t>(data.size()));
+        }
+
+        size_t size() const
+        {
+            return data.size();
+        }
+
+        vk::DeviceSize sizeBytes() const
+        {
+            return data.size() * sizeof(T);
+        }
+
+        operator const vk::Buffer &() const
+        {
+            return deviceBuffer->buffer;
+        }
+
+        void markDirty(const uint32_t &first, const uint32_t &count = 1)
+        {
+            assertThrow(first + count <= data.size(), "scene buffer range out of bounds");
+            dirtyRanges.push_back({first, first + count});
+        }
+
+        void set(const uint32_t &index, const T &value)
+        {
+            data[index] = value;
+            markDirty(index);
+        }
+
+        // sort and merge the dirty ranges, exposed so callers can inspect what will be sent
+        void coalesce()
+        {
+            if (dirtyRanges.size() < 2)
+            {
+                return;
+            }
+
+            std::sort(dirtyRanges.begin(), dirtyRanges.end());
+            size_t out = 0;
+            for (size_t i = 1; i < dirtyRanges.size(); i++)
+            {
+                if (dirtyRanges[i].first <= dirtyRanges[out].second + mergeGap)
+                {
+                    dirtyRanges[out].second = std::max(dirtyRanges[out].second, dirtyRanges[i].second);
+                }
+                else
+                {
+                    dirtyRanges[++out] = dirtyRanges[i];
+                }
+            }
+            dirtyRanges.resize(out + 1);
+        }
+
+        // record staging -> device copies for the dirty ranges, must be outside of rendering
+        void upload(const vk::CommandBuffer &commandBuffer)
+        {
+            bytesUploaded = 0;
+            if (dirtyRanges.empty())
+            {
+                return;
+            }
+
+            coalesce();
+
+            std::vector<vk::BufferCopy> regions;
+            regions.reserve(dirtyRanges.size());
+            char *staging = static_cast<char *>(stagingBuffer->mapped);
+            for (const auto &[first, last] : dirtyRanges)
+            {
+                vk::DeviceSize offset = first * sizeof(T);
+                vk::DeviceSize size = (last - first) * sizeof(T);
+                std::memcpy(staging + offset, data.data() + first, size);
+                regions.push_back(vk::BufferCopy{offset, offset, size});
+                bytesUploaded += size;
+            }
+            stagingBuffer->flush();
+            dirtyRanges.clear();
+
+            commandBuffer.copyBuffer(stagingBuffer->buffer, deviceBuffer->buffer, regions);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dstStages, {},
+                                          vk::MemoryBarrier{}
+                                              .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                                              .setDstAccessMask(dstAccess),
+                                          {}, {});
+
+            totalBytesUploaded += bytesUploaded;
+            addStat(Stat::BytesUploaded, bytesUploaded);
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_SCENEBUFFER_HH
@@ -0,0 +1,335 @@
+#pragma once
+
+#ifndef LETC_STATICBATCHER_HH
+#define LETC_STATICBATCHER_HH
+
+#include "pch.hh"
+
+#include <functional>
+#include <limits>
+#include <memory>
+
+#include "Allocator.hh"
+#include "Buffer.hh"
+#include "Meshlet.hh"
+#include "Model.hh"
+#include "Texture.hh"
+#include "Transform.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // meshes that never move merged into one Model per batch key, base color texture, vertex layout and grid
+    // cell. vertices are moved to world space when a batch is built, so a batch is drawn with an identity
+    // instance and one draw call however many objects it holds, and the cells keep batches small enough to
+    // cull. an object that starts moving is unbatch()ed and drawn on its own again, its cell is rebuilt
+    // without it. a texture is uploaded once and referenced by every batch drawn with it
+    struct StaticBatcher
+    {
+        using ObjectId = uint32_t;
+        // caller's batch key (material, pipeline) + texture, see textureKey() + attribute mask + cell
+        using BatchKey = std::tuple<uint64_t, uint64_t, uint32_t, int32_t, int32_t, int32_t>;
+
+        struct Object
+        {
+            std::shared_ptr<const MeshData> mesh;
+            glm::mat4 world;
+            uint64_t key;
+            bool batched;
+        };
+
+        struct Batch
+        {
+            std::vector<ObjectId> members;
+            // empty until the first build() and for a cell every member left
+            std::unique_ptr<Model> model;
+            // one of textures, null when the members have no base color
+            const Texture *texture = nullptr;
+            bool dirty = true;
+        };
+
+        const Allocator &allocator;
+        // edge of the cubic cells objects are grouped by, from the center of their bounds
+        float cellSize;
+        std::vector<Object> objects;
+        std::map<BatchKey, Batch> batches;
+        // by textureKey(), created by the first build() that needs one and kept as long as the batcher
+        std::map<uint64_t, std::unique_ptr<Texture>> textures;
+
+        // called with a batch's model before a rebuild replaces or drops it, for whatever was made for it
+        std::function<void(const Model &)> onReleased;
+
+        StaticBatcher(const Allocator &allocator, const float &cellSize = 32.0f)
+            : allocator(allocator), cellSize(cellSize)
+        {
+        }
+
+        StaticBatcher(const StaticBatcher &) = delete;
+        StaticBatcher &operator=(const StaticBatcher &) = delete;
+
+        // mesh at world, only merged with objects with the same key. the mesh has to keep its cpu streams and
+        // can be shared between any number of objects
+        ObjectId add(const std::shared_ptr<const MeshData> &mesh, const glm::mat4 &world, const uint64_t &key)
+        {
+            const ObjectId id = static_cast<ObjectId>(objects.size());
+            objects.push_back({mesh, world, key, false});
+            rebatch(id, world);
+            return id;
+        }
+
+        // take the object out of its batch, the caller draws it on its own from here on
+        void unbatch(const ObjectId &id)
+        {
+            Object &object = objects.at(id);
+            if (!object.batched)
+            {
+                return;
+            }
+            Batch &batch = batches.at(batchKey(object));
+            std::erase(batch.members, id);
+            batch.dirty = true;
+            object.batched = false;
+        }
+
+        // back into a batch at world, once the object has stopped moving
+        void rebatch(const ObjectId &id, const glm::mat4 &world)
+        {
+            unbatch(id);
+            Object &object = objects.at(id);
+            object.world = world;
+            object.batched = true;
+            Batch &batch = batches[batchKey(object)];
+            batch.members.push_back(id);
+            batch.dirty = true;
+        }
+
+        // rebuild every batch that changed, the copies are recorded into commandBuffer (graphics, outside
+        // rendering) and made visible to vertex input and compute. call once a frame before drawing the
+        // batches, staging from the previous call is only released here once that frame was submitted
+        void build(const vk::CommandBuffer &commandBuffer)
+        {
+            staging.clear();
+            bool recorded = false;
+            for (auto it = batches.begin(); it != batches.end();)
+            {
+                Batch &batch = it->second;
+                if (!batch.dirty)
+                {
+                    ++it;
+                    continue;
+                }
+                LETC_ZONE("StaticBatcher::build");
+                if (batch.model && onReleased)
+                {
+                    onReleased(*batch.model);
+                }
+                batch.model.reset();
+                batch.dirty = false;
+                if (batch.members.empty())
+                {
+                    it = batches.erase(it);
+                    continue;
+                }
+
+                batch.model = std::make_unique<Model>(allocator, merge(batch.members), VMA_MEMORY_USAGE_GPU_ONLY);
+                staging.push_back(std::make_unique<Buffer>(allocator, batch.model->stagingSize(),
+                                                           vk::BufferUsageFlagBits::eTransferSrc,
+                                                           VMA_MEMORY_USAGE_CPU_ONLY));
+                batch.model->recordUpload(commandBuffer, *staging.back());
+                batch.texture = texture(commandBuffer, std::get<1>(it->first), *objects[batch.members.front()].mesh);
+                recorded = true;
+                ++it;
+            }
+
+            if (recorded)
+            {
+                commandBuffer.pipelineBarrier2(vk::DependencyInfo{}.setMemoryBarriers(
+                    vk::MemoryBarrier2{}
+                        .setSrcStageMask(vk::PipelineStageFlagBits2::eTransfer)
+                        .setSrcAccessMask(vk::AccessFlagBits2::eTransferWrite)
+                        .setDstStageMask(vk::PipelineStageFlagBits2::eVertexAttributeInput |
+                                         vk::PipelineStageFlagBits2::eIndexInput |
+                                         vk::PipelineStageFlagBits2::eComputeShader)
+                        .setDstAccessMask(vk::AccessFlagBits2::eVertexAttributeRead |
+                                          vk::AccessFlagBits2::eIndexRead |
+                                          vk::AccessFlagBits2::eShaderStorageRead)));
+            }
+        }
+
+        // the model and texture (null without one) of every built batch made for the caller's key
+        template <typename F> void forEachBatch(const uint64_t &key, const F &function)
+        {
+            constexpr int32_t lowest = std::numeric_limits<int32_t>::min();
+            for (auto it = batches.lower_bound({key, 0, 0, lowest, lowest, lowest});
+                 it != batches.end() && std::get<0>(it->first) == key; ++it)
+            {
+                if (it->second.model)
+                {
+                    function(*it->second.model, it->second.texture);
+                }
+            }
+        }
+
+        size_t batchCount() const
+        {
+            return batches.size();
+        }
+
+        size_t batchedCount() const
+        {
+            return std::count_if(objects.begin(), objects.end(), [](const Object &object) { return object.batched; });
+        }
+
+      private:
+        std::vector<std::unique_ptr<Buffer>> staging;
+
+        BatchKey batchKey(const Object &object) const
+        {
+            const glm::vec3 center(object.world * glm::vec4(glm::vec3(object.mesh->bounds), 1.0f));
+            const glm::vec3 cell = glm::floor(center / cellSize);
+            return {object.key, textureKey(*object.mesh), object.mesh->attributeMask, static_cast<int32_t>(cell.x),
+                    static_cast<int32_t>(cell.y), static_cast<int32_t>(cell.z)};
+        }
+
+        // the ktx2 path of the mesh's base color, or the mesh itself for a texture that only exists in memory.
+        // 0 without one
+        static uint64_t textureKey(const MeshData &mesh)
+        {
+            if (!mesh.baseColor)
+            {
+                return 0;
+            }
+            if (mesh.baseColor->source.empty())
+            {
+                return reinterpret_cast<uintptr_t>(&mesh);
+            }
+            const std::string source = mesh.baseColor->source.string();
+            return hashBytes({reinterpret_cast<const uint8_t *>(source.data()), source.size()});
+        }
+
+        // the texture for key, its upload and mip chain recorded into commandBuffer the first time it is asked for
+        const Texture *texture(const vk::CommandBuffer &commandBuffer, const uint64_t &key, const MeshData &mesh)
+        {
+            if (key == 0)
+            {
+                return nullptr;
+            }
+            std::unique_ptr<Texture> &texture = textures[key];
+            if (!texture)
+            {
+                texture = std::make_unique<Texture>(allocator, *mesh.baseColor);
+                staging.push_back(std::make_unique<Buffer>(allocator, texture->stagingSize(),
+                                                           vk::BufferUsageFlagBits::eTransferSrc,
+                                                           VMA_MEMORY_USAGE_CPU_ONLY));
+                texture->stage(staging.back()->map(), *mesh.baseColor);
+                staging.back()->flush();
+                texture->recordCopy(commandBuffer, *staging.back());
+                texture->recordMips(commandBuffer);
+            }
+            return texture.get();
+        }
+
+        // every member in world space, level by level: level n of the batch is level n of each member (or its
+        // coarsest, for shorter chains) back to back, with the largest of their errors scaled to world space.
+        // members share an attribute mask so every stream either exists for all of them or for none. the
+        // texture is left out, batches reference the shared one from texture()
+        MeshData merge(const std::vector<ObjectId> &members) const
+        {
+            MeshData merged;
+            const MeshData &first = *objects[members.front()].mesh;
+            merged.attributeMask = first.attributeMask;
+
+            auto level = [](const MeshData &mesh, const size_t &lod)
+            {
+                return mesh.lods.empty() ? MeshLod{0, static_cast<uint32_t>(mesh.index.size()), 0.0f}
+                                         : mesh.lods[std::min(lod, mesh.lods.size() - 1)];
+            };
+
+            size_t vertexCount = 0;
+            size_t lodCount = 1;
+            for (const ObjectId &id : members)
+            {
+                const MeshData &mesh = *objects[id].mesh;
+                vertexCount += mesh.position.size();
+                lodCount = std::max(lodCount, mesh.lods.size());
+            }
+            size_t indexCount = 0;
+            for (size_t lod = 0; lod < lodCount; lod++)
+            {
+                for (const ObjectId &id : members)
+                {
+                    indexCount += level(*objects[id].mesh, lod).indexCount;
+                }
+            }
+            merged.index.reserve(indexCount);
+            merged.position.reserve(vertexCount);
+            merged.normal.reserve(first.normal.empty() ? 0 : vertexCount);
+            merged.tangent.reserve(first.tangent.empty() ? 0 : vertexCount);
+            merged.uv.reserve(first.uv.empty() ? 0 : vertexCount);
+            merged.color.reserve(first.color.empty() ? 0 : vertexCount);
+
+            std::vector<unsigned> bases;
+            std::vector<float> scales;
+            for (const ObjectId &id : members)
+            {
+                const Object &object = objects[id];
+                const MeshData &mesh = *object.mesh;
+                const glm::mat4 normalMatrix = inverseTransposeAffine(object.world);
+                bases.push_back(static_cast<unsigned>(merged.position.size()));
+                // largest axis scale, a model space error is at most this much longer in world space
+                const glm::mat3 axes(object.world);
+                scales.push_back(std::sqrt(std::max(
+                    {glm::dot(axes[0], axes[0]), glm::dot(axes[1], axes[1]), glm::dot(axes[2], axes[2])})));
+
+                for (const glm::vec4 &position : mesh.position)
+                {
+                    merged.position.push_back(object.world * glm::vec4(glm::vec3(position), 1.0f));
+                }
+                for (const glm::vec4 &normal : mesh.normal)
+                {
+                    merged.normal.push_back(
+                        glm::vec4(glm::normalize(glm::vec3(normalMatrix * glm::vec4(glm::vec3(normal), 0.0f))),
+                                  normal.w));
+                }
+                for (const glm::vec4 &tangent : mesh.tangent)
+                {
+                    merged.tangent.push_back(glm::vec4(
+                        glm::normalize(glm::vec3(object.world * glm::vec4(glm::vec3(tangent), 0.0f))), tangent.w));
+                }
+                merged.uv.insert(merged.uv.end(), mesh.uv.begin(), mesh.uv.end());
+                merged.color.insert(merged.color.end(), mesh.color.begin(), mesh.color.end());
+            }
+
+            for (size_t lod = 0; lod < lodCount; lod++)
+            {
+                MeshLod &mergedLevel = merged.lods.emplace_back();
+                mergedLevel.firstIndex = static_cast<uint32_t>(merged.index.size());
+                for (size_t member = 0; member < members.size(); member++)
+                {
+                    const Object &object = objects[members[member]];
+                    const MeshData &mesh = *object.mesh;
+                    const MeshLod range = level(mesh, lod);
+                    mergedLevel.error = std::max(mergedLevel.error, range.error * scales[member]);
+
+                    // a mirroring transform turns the winding around, swapped back so front faces stay front faces
+                    const bool mirrored = glm::determinant(glm::mat3(object.world)) < 0.0f;
+                    const unsigned base = bases[member];
+                    for (uint32_t i = range.firstIndex; i + 2 < range.firstIndex + range.indexCount; i += 3)
+                    {
+                        merged.index.push_back(base + mesh.index[i]);
+                        merged.index.push_back(base + mesh.index[i + (mirrored ? 2 : 1)]);
+                        merged.index.push_back(base + mesh.index[i + (mirrored ? 1 : 2)]);
+                    }
+                }
+                mergedLevel.indexCount = static_cast<uint32_t>(merged.index.size()) - mergedLevel.firstIndex;
+            }
+
+            merged.bounds = boundingSphere(merged.position);
+            buildMeshlets(merged.lods, merged.index, merged.position, merged.meshlets, merged.meshletVertices,
+                          merged.meshletTriangles);
+            return merged;
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_STATICBATCHER_HH
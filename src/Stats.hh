@@ -0,0 +1,208 @@
+#pragma once
+
+#ifndef LETC_STATS_HH
+#define LETC_STATS_HH
+
+#include "pch.hh"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace letc
+{
+    enum class Stat : uint32_t
+    {
+        DrawCalls,
+        Triangles,
+        PipelineBinds,
+        DescriptorBinds,  // sets bound
+        DescriptorWrites, // individual descriptors written
+        BytesUploaded,    // host writes into gpu visible memory, direct or through staging
+        Allocations,      // vma buffers/images created
+        Frees,            // vma buffers/images handed to the deletion queue
+        FenceWaitUs,      // cpu blocked on a timeline value, what the per frame fences used to cost
+        AcquireWaitUs,    // cpu blocked in vkAcquireNextImageKHR
+        Count
+    };
+
+    constexpr size_t statCount = static_cast<size_t>(Stat::Count);
+
+    // names used in the dump header and summary, same order as Stat
+    constexpr std::array<const char *, statCount> statNames = {
+        "draw_calls",     "triangles",   "pipeline_binds", "descriptor_binds", "descriptor_writes",
+        "bytes_uploaded", "allocations", "frees",          "fence_wait_us",    "acquire_wait_us"};
+
+    using StatValues = std::array<uint64_t, statCount>;
+
+    // one thread's running totals. only the owner writes, with a plain load + store so there is no
+    // locked instruction on the hot path, the registry reads them and keeps what it saw last frame
+    struct StatCounters
+    {
+        std::array<std::atomic<uint64_t>, statCount> values{};
+        StatValues merged{}; // registry side, under its mutex
+
+        void add(const Stat &stat, const uint64_t &amount)
+        {
+            std::atomic<uint64_t> &value = values[static_cast<size_t>(stat)];
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+    };
+
+    // per frame and cumulative counters for the whole engine, threads register on first use and
+    // endFrame() folds everything counted since the last call into the frame values
+    struct StatsRegistry
+    {
+        mutable std::mutex mutex;
+        std::vector<std::shared_ptr<StatCounters>> counters;
+
+        StatValues lastFrame{};
+        StatValues cumulative{};
+        uint64_t frames = 0;
+
+        // periodic dump, one csv row averaging every dumpInterval frames
+        std::ofstream dumpFile;
+        uint32_t dumpInterval = 0;
+        StatValues sinceDump{};
+        uint32_t framesSinceDump = 0;
+
+        static StatsRegistry &get()
+        {
+            static StatsRegistry registry;
+            return registry;
+        }
+
+        // the calling thread's counters, registered on first use
+        static StatCounters &local()
+        {
+            static thread_local std::shared_ptr<StatCounters> threadCounters = []
+            {
+                StatsRegistry &registry = get();
+                std::lock_guard lock(registry.mutex);
+                auto created = std::make_shared<StatCounters>();
+                registry.counters.push_back(created);
+                return created;
+            }();
+            return *threadCounters;
+        }
+
+        // call once per frame from the thread that owns the frame loop
+        void endFrame()
+        {
+            std::lock_guard lock(mutex);
+            lastFrame.fill(0);
+            for (const auto &threadCounters : counters)
+            {
+                for (size_t i = 0; i < statCount; i++)
+                {
+                    uint64_t value = threadCounters->values[i].load(std::memory_order_relaxed);
+                    lastFrame[i] += value - threadCounters->merged[i];
+                    threadCounters->merged[i] = value;
+                }
+            }
+            for (size_t i = 0; i < statCount; i++)
+            {
+                cumulative[i] += lastFrame[i];
+                sinceDump[i] += lastFrame[i];
+            }
+            frames++;
+
+            if (dumpFile.is_open() && ++framesSinceDump >= dumpInterval)
+            {
+                dumpFile << frames;
+                for (size_t i = 0; i < statCount; i++)
+                {
+                    dumpFile << std::format(",{:.1f}", static_cast<double>(sinceDump[i]) / framesSinceDump);
+                }
+                dumpFile << "\n";
+                dumpFile.flush();
+                sinceDump.fill(0);
+                framesSinceDump = 0;
+            }
+        }
+
+        // value counted during the last finished frame
+        uint64_t frame(const Stat &stat) const
+        {
+            std::lock_guard lock(mutex);
+            return lastFrame[static_cast<size_t>(stat)];
+        }
+
+        // value counted over every finished frame
+        uint64_t total(const Stat &stat) const
+        {
+            std::lock_guard lock(mutex);
+            return cumulative[static_cast<size_t>(stat)];
+        }
+
+        uint64_t frameCount() const
+        {
+            std::lock_guard lock(mutex);
+            return frames;
+        }
+
+        // append per frame averages to a csv every interval frames, an empty path stops dumping
+        void dumpTo(const std::filesystem::path &path, const uint32_t &interval = 60)
+        {
+            std::lock_guard lock(mutex);
+            dumpFile = std::ofstream();
+            sinceDump.fill(0);
+            framesSinceDump = 0;
+            if (path.empty())
+            {
+                return;
+            }
+
+            dumpFile.open(path);
+            assertThrow(dumpFile.is_open(), "failed to open stats file: " + path.string());
+            dumpInterval = std::max(1u, interval);
+            dumpFile << "frame";
+            for (const char *name : statNames)
+            {
+                dumpFile << "," << name;
+            }
+            dumpFile << "\n";
+        }
+
+        // last frame next to the average over every frame so far
+        std::string summary() const
+        {
+            std::lock_guard lock(mutex);
+            std::string text =
+                std::format("{:<24} {:>14} {:>14} {:>18}\n", "stat", "last frame", "avg frame", "total");
+            for (size_t i = 0; i < statCount; i++)
+            {
+                text += std::format("{:<24} {:>14} {:>14.1f} {:>18}\n", statNames[i], lastFrame[i],
+                                    frames ? static_cast<double>(cumulative[i]) / frames : 0.0, cumulative[i]);
+            }
+            return text;
+        }
+    };
+
+    inline void addStat(const Stat &stat, const uint64_t &amount = 1)
+    {
+        StatsRegistry::local().add(stat, amount);
+    }
+
+    // adds the microseconds it was alive for to stat
+    struct StatTimer
+    {
+        Stat stat;
+        std::chrono::steady_clock::time_point begin;
+
+        StatTimer(const Stat &stat) : stat(stat), begin(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~StatTimer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - begin;
+            addStat(stat, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        }
+
+        StatTimer(const StatTimer &) = delete;
+        StatTimer &operator=(const StatTimer &) = delete;
+    };
+}; // namespace letc
+
+#endif // LETC_STATS_HH
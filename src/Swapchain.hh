@@ -5,12 +5,14 @@
 
 #include "pch.hh"
 
+#include "Device.hh"
+
 namespace letc
 {
     struct Swapchain
     {
         const vk::SurfaceKHR &surface;
-        const vk::Device &device;
+        const Device &device;
 
         vk::SurfaceCapabilitiesKHR capabilities;
         vk::SurfaceFormatKHR format;
@@ -24,10 +26,11 @@ namespace letc
             return swapchain;
         }
 
-        Swapchain(const vkfw::Window &window, const vk::SurfaceKHR &surface, const vk::PhysicalDevice &physicalDevice,
-                  const vk::Device &device)
+        Swapchain(const vkfw::Window &window, const vk::SurfaceKHR &surface, const Device &device)
             : surface(surface), device(device)
         {
+            const vk::PhysicalDevice &physicalDevice = device.physicalDevice;
+
             /*
                 Surface -> Swapchain values
             */
@@ -61,12 +64,12 @@ namespace letc
             swapchainCreateInfo.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
             swapchainCreateInfo.setPresentMode(presentMode);
             swapchainCreateInfo.setClipped(VK_TRUE);
-            swapchain = device.createSwapchainKHR(swapchainCreateInfo);
+            swapchain = device.device.createSwapchainKHR(swapchainCreateInfo);
 
             /*
                 Swapchain Images & Views
             */
-            images = device.getSwapchainImagesKHR(swapchain);
+            images = device.device.getSwapchainImagesKHR(swapchain);
             imageViews.reserve(images.size());
             for (const vk::Image &image : images)
             {
@@ -84,17 +87,22 @@ namespace letc
                 imageSubresourceRange.setLayerCount(1);
                 imageViewCreateInfo.setSubresourceRange(imageSubresourceRange);
 
-                imageViews.push_back(device.createImageView(imageViewCreateInfo));
+                imageViews.push_back(device.device.createImageView(imageViewCreateInfo));
             }
         }
 
         ~Swapchain()
         {
-            for (const vk::ImageView &imageView : imageViews)
-            {
-                device.destroyImageView(imageView);
-            }
-            device.destroySwapchainKHR(swapchain);
+            // presentation may still be reading the images
+            device.defer(
+                [device = device.device, imageViews = imageViews, swapchain = swapchain]
+                {
+                    for (const vk::ImageView &imageView : imageViews)
+                    {
+                        device.destroyImageView(imageView);
+                    }
+                    device.destroySwapchainKHR(swapchain);
+                });
         }
     };
 }; // namespace letc
@@ -0,0 +1,709 @@
+#pragma once
+
+#ifndef LETC_TEXTURE_HH
+#define LETC_TEXTURE_HH
+
+#include "pch.hh"
+
+#include <bit>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <set>
+
+#include "Allocator.hh"
+#include "BlockCompression.hh"
+#include "Buffer.hh"
+#include "Device.hh"
+#include "Image.hh"
+#include "Ktx2.hh"
+#include "Stats.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // texels as decoded or loaded from a file, no gpu objects so it can be produced on any thread.
+    // either rgba8 level 0 straight from an image decoder, or a cooked texture with every level in its gpu format
+    struct TextureData
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> pixels;
+        bool srgb = true; // color data, false for normal/roughness style maps
+        // eUndefined for rgba8, which of the two is picked by srgb
+        vk::Format format = vk::Format::eUndefined;
+        // offset and size of each level in bytes(), empty when there is only level 0 and it is all of them
+        std::vector<std::pair<size_t, size_t>> levels;
+        // set instead of pixels when the levels are read straight out of a mapped ktx2 file
+        std::shared_ptr<const MappedFile> file;
+        // the ktx2 file the texture can be loaded from again, empty when it only exists in memory
+        std::filesystem::path source;
+
+        vk::Format vkFormat() const
+        {
+            if (format != vk::Format::eUndefined)
+            {
+                return format;
+            }
+            return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+        }
+
+        std::span<const uint8_t> bytes() const
+        {
+            return file ? file->bytes() : std::span<const uint8_t>(pixels);
+        }
+
+        uint32_t levelCount() const
+        {
+            return levels.empty() ? 1 : static_cast<uint32_t>(levels.size());
+        }
+
+        std::span<const uint8_t> level(const uint32_t &index) const
+        {
+            return levels.empty() ? bytes() : bytes().subspan(levels[index].first, levels[index].second);
+        }
+    };
+
+    // png, jpeg, tga... through stb_image, lives in impl.cc with the rest of the single header libraries
+    TextureData decodeImage(const void *data, const size_t &size);
+
+    // a single texel, for draws without a texture of their own
+    inline TextureData solidTextureData(const uint8_t &r, const uint8_t &g, const uint8_t &b, const uint8_t &a = 255)
+    {
+        return TextureData{1, 1, {r, g, b, a}, false};
+    }
+
+    // levels down to 1x1
+    inline uint32_t mipLevelCount(const uint32_t &width, const uint32_t &height)
+    {
+        return static_cast<uint32_t>(std::bit_width(std::max(width, height)));
+    }
+
+    // how imported textures are cooked, set up once on the main thread and only read by the import workers
+    struct TextureCookConfig
+    {
+        // cooked .ktx2 files keyed by a hash of the source image, empty leaves textures as decoded rgba8
+        std::filesystem::path cacheDirectory;
+        // bc7 instead of bc1/bc3 for color, better gradients at twice bc1's size for opaque textures
+        bool preferBC7 = false;
+        // formats the device samples with linear filtering, empty when unknown. cooked textures in any
+        // other format are decompressed to rgba8 on load
+        std::vector<vk::Format> sampleable;
+
+        bool canSample(const vk::Format &format) const
+        {
+            return sampleable.empty() || std::find(sampleable.begin(), sampleable.end(), format) != sampleable.end();
+        }
+
+        static TextureCookConfig forDevice(const Device &device, const std::filesystem::path &cacheDirectory)
+        {
+            TextureCookConfig config;
+            config.cacheDirectory = cacheDirectory;
+            const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eSampledImage |
+                                                    vk::FormatFeatureFlagBits::eSampledImageFilterLinear |
+                                                    vk::FormatFeatureFlagBits::eTransferDst;
+            for (const vk::Format &format :
+                 {vk::Format::eR8G8B8A8Unorm, vk::Format::eR8G8B8A8Srgb, vk::Format::eBc1RgbUnormBlock,
+                  vk::Format::eBc1RgbSrgbBlock, vk::Format::eBc3UnormBlock, vk::Format::eBc3SrgbBlock,
+                  vk::Format::eBc5UnormBlock, vk::Format::eBc7UnormBlock, vk::Format::eBc7SrgbBlock})
+            {
+                // the bc formats also need the feature, which the device only turns on when it is there
+                if (formatBlock(format).extent > 1 && !device.capabilities.textureCompressionBC)
+                {
+                    continue;
+                }
+                vk::FormatProperties properties = device.physicalDevice.getFormatProperties(format);
+                if ((properties.optimalTilingFeatures & required) == required)
+                {
+                    config.sampleable.push_back(format);
+                }
+            }
+            return config;
+        }
+    };
+
+    inline vk::Format blockVkFormat(const BlockFormat &format, const bool &srgb)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1:
+            return srgb ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eBc1RgbUnormBlock;
+        case BlockFormat::BC3:
+            return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+        case BlockFormat::BC5:
+            return vk::Format::eBc5UnormBlock;
+        default:
+            return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+        }
+    }
+
+    inline std::optional<BlockFormat> blockFormatOf(const vk::Format &format)
+    {
+        switch (format)
+        {
+        case vk::Format::eBc1RgbUnormBlock:
+        case vk::Format::eBc1RgbSrgbBlock:
+            return BlockFormat::BC1;
+        case vk::Format::eBc3UnormBlock:
+        case vk::Format::eBc3SrgbBlock:
+            return BlockFormat::BC3;
+        case vk::Format::eBc5UnormBlock:
+            return BlockFormat::BC5;
+        case vk::Format::eBc7UnormBlock:
+        case vk::Format::eBc7SrgbBlock:
+            return BlockFormat::BC7;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    // by the channels the texels actually use: two channel linear data to bc5, opaque color to bc1,
+    // anything with alpha to bc3, and bc7 for both kinds of color when asked for. bc5 reads back blue
+    // as 0 and nothing reconstructs it, so only textures whose blue is 0 everywhere may drop it
+    inline BlockFormat chooseBlockFormat(const TextureData &rgba, const bool &preferBC7)
+    {
+        bool opaque = true;
+        bool blueUsed = false;
+        for (size_t i = 0; i < rgba.pixels.size(); i += 4)
+        {
+            opaque &= rgba.pixels[i + 3] == 255;
+            blueUsed |= rgba.pixels[i + 2] != 0;
+        }
+        if (!rgba.srgb && opaque && !blueUsed)
+        {
+            return BlockFormat::BC5;
+        }
+        if (preferBC7)
+        {
+            return BlockFormat::BC7;
+        }
+        return opaque ? BlockFormat::BC1 : BlockFormat::BC3;
+    }
+
+    // 2x2 box filter down to the next level, averaged in linear space for srgb so mips don't darken
+    inline std::vector<uint8_t> downsample(const std::vector<uint8_t> &rgba, const uint32_t &width,
+                                           const uint32_t &height, const bool &srgb)
+    {
+        static const std::array<float, 256> toLinear = []
+        {
+            std::array<float, 256> table;
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return table;
+        }();
+
+        const uint32_t nextWidth = std::max(width / 2, 1u);
+        const uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<uint8_t> next(static_cast<size_t>(nextWidth) * nextHeight * 4);
+        for (uint32_t y = 0; y < nextHeight; y++)
+        {
+            for (uint32_t x = 0; x < nextWidth; x++)
+            {
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    const bool linear = srgb && c < 3;
+                    float sum = 0.0f;
+                    for (uint32_t i = 0; i < 4; i++)
+                    {
+                        uint32_t sx = std::min(x * 2 + i % 2, width - 1);
+                        uint32_t sy = std::min(y * 2 + i / 2, height - 1);
+                        uint8_t value = rgba[(static_cast<size_t>(sy) * width + sx) * 4 + c];
+                        sum += linear ? toLinear[value] : value / 255.0f;
+                    }
+                    float average = sum / 4.0f;
+                    if (linear)
+                    {
+                        average = average <= 0.0031308f ? average * 12.92f
+                                                         : 1.055f * std::pow(average, 1.0f / 2.4f) - 0.055f;
+                    }
+                    next[(static_cast<size_t>(y) * nextWidth + x) * 4 + c] =
+                        static_cast<uint8_t>(std::lround(std::clamp(average, 0.0f, 1.0f) * 255.0f));
+                }
+            }
+        }
+        return next;
+    }
+
+    // rgba8 level 0 to the full chain in format, each level filtered on the cpu from the one above
+    inline TextureData cookTexture(const TextureData &rgba, const BlockFormat &format)
+    {
+        LETC_ZONE("cookTexture");
+        TextureData cooked{rgba.width, rgba.height, {}, rgba.srgb, blockVkFormat(format, rgba.srgb)};
+        std::vector<uint8_t> level = rgba.pixels;
+        uint32_t width = rgba.width;
+        uint32_t height = rgba.height;
+        const uint32_t levelCount = mipLevelCount(width, height);
+        for (uint32_t i = 0; i < levelCount; i++)
+        {
+            std::vector<uint8_t> blocks = compressImage(level.data(), width, height, format);
+            cooked.levels.push_back({cooked.pixels.size(), blocks.size()});
+            cooked.pixels.insert(cooked.pixels.end(), blocks.begin(), blocks.end());
+            if (i + 1 < levelCount)
+            {
+                level = downsample(level, width, height, rgba.srgb);
+                width = std::max(width / 2, 1u);
+                height = std::max(height / 2, 1u);
+            }
+        }
+        return cooked;
+    }
+
+    // every level back to rgba8, the fallback for devices without the block format
+    inline TextureData decompressTexture(const TextureData &data)
+    {
+        LETC_ZONE("decompressTexture");
+        std::optional<BlockFormat> format = blockFormatOf(data.format);
+        assertThrow(format, "can't decompress texture format: " + vk::to_string(data.format));
+        TextureData rgba{data.width, data.height, {}, isSrgb(data.format)};
+        for (uint32_t i = 0; i < data.levelCount(); i++)
+        {
+            std::vector<uint8_t> level = decompressImage(data.level(i).data(), std::max(data.width >> i, 1u),
+                                                         std::max(data.height >> i, 1u), *format);
+            rgba.levels.push_back({rgba.pixels.size(), level.size()});
+            rgba.pixels.insert(rgba.pixels.end(), level.begin(), level.end());
+        }
+        return rgba;
+    }
+
+    // the levels stay in the mapping until they are copied to staging
+    inline TextureData loadKtx2(const std::filesystem::path &path)
+    {
+        Ktx2Image image = readKtx2(path);
+        TextureData data{image.width, image.height, {}, isSrgb(image.format), image.format};
+        data.levels = std::move(image.levels);
+        data.file = std::move(image.file);
+        data.source = path;
+        return data;
+    }
+
+    // block compressed data the device can't sample is decoded to rgba8. what the fallback decoder can't read
+    // either (bc7 blocks from other encoders, formats that aren't bc) is left out and the mesh draws without
+    // it, reported once per file
+    inline std::optional<TextureData> fitToDevice(TextureData &&data, const TextureCookConfig &config)
+    {
+        if (data.format == vk::Format::eUndefined || config.canSample(data.format))
+        {
+            return std::move(data);
+        }
+        try
+        {
+            TextureData rgba = decompressTexture(data);
+            rgba.source = data.source;
+            return rgba;
+        }
+        catch (const std::exception &e)
+        {
+            static std::mutex mutex;
+            static std::set<std::filesystem::path> reported;
+            std::lock_guard lock(mutex);
+            if (reported.insert(data.source).second)
+            {
+                std::cerr << "drawing without texture " << data.source << ": " << e.what() << std::endl;
+            }
+            return std::nullopt;
+        }
+    }
+
+    // fnv-1a, only needs to tell source images apart
+    inline uint64_t hashBytes(const std::span<const uint8_t> &bytes, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        for (const uint8_t &byte : bytes)
+        {
+            hash = (hash ^ byte) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // bump when the cooker's output changes so stale cache entries are not picked up
+    constexpr uint32_t textureCookVersion = 2;
+
+    // the material's first texture of type, embedded in the file (glb "*0" paths) or next to it.
+    // .ktx2 files are used as they are, anything else is decoded and, with a cache directory, cooked to
+    // block compressed ktx2 the first time it is seen and loaded from there afterwards
+    inline std::optional<TextureData> importTexture(const aiScene *scene, const aiMaterial *material,
+                                                    const aiTextureType &type,
+                                                    const std::filesystem::path &directory, const bool &srgb,
+                                                    const TextureCookConfig &cook = {})
+    {
+        aiString path;
+        if (!material || material->GetTexture(type, 0, &path) != AI_SUCCESS)
+        {
+            return std::nullopt;
+        }
+
+        const aiTexture *embedded = scene->GetEmbeddedTexture(path.C_Str());
+        const std::filesystem::path filePath = directory / path.C_Str();
+        if (!embedded && filePath.extension() == ".ktx2")
+        {
+            return fitToDevice(loadKtx2(filePath), cook);
+        }
+
+        // still compressed embedded images have an mHeight of 0 and mWidth is their size in bytes
+        std::vector<char> file;
+        std::span<const uint8_t> source;
+        if (embedded)
+        {
+            size_t size = embedded->mHeight == 0 ? embedded->mWidth
+                                                 : sizeof(aiTexel) * embedded->mWidth * embedded->mHeight;
+            source = {reinterpret_cast<const uint8_t *>(embedded->pcData), size};
+        }
+        else
+        {
+            file = readFile(filePath);
+            source = {reinterpret_cast<const uint8_t *>(file.data()), file.size()};
+        }
+
+        std::filesystem::path cookedPath;
+        if (!cook.cacheDirectory.empty())
+        {
+            uint64_t hash = hashBytes(source);
+            const uint32_t options[] = {textureCookVersion, srgb, cook.preferBC7};
+            hash = hashBytes({reinterpret_cast<const uint8_t *>(options), sizeof(options)}, hash);
+            cookedPath = cook.cacheDirectory / std::format("{:016x}.ktx2", hash);
+            if (std::filesystem::exists(cookedPath))
+            {
+                try
+                {
+                    return fitToDevice(loadKtx2(cookedPath), cook);
+                }
+                catch (const std::exception &e)
+                {
+                    // cooked again below and the entry replaced
+                    std::cerr << "ignoring cooked texture: " << e.what() << std::endl;
+                }
+            }
+        }
+
+        TextureData data;
+        if (embedded && embedded->mHeight != 0)
+        {
+            data.width = embedded->mWidth;
+            data.height = embedded->mHeight;
+            data.pixels.resize(static_cast<size_t>(data.width) * data.height * 4);
+            for (size_t i = 0; i < static_cast<size_t>(data.width) * data.height; i++)
+            {
+                const aiTexel &texel = embedded->pcData[i];
+                data.pixels[i * 4 + 0] = texel.r;
+                data.pixels[i * 4 + 1] = texel.g;
+                data.pixels[i * 4 + 2] = texel.b;
+                data.pixels[i * 4 + 3] = texel.a;
+            }
+        }
+        else
+        {
+            data = decodeImage(source.data(), source.size());
+        }
+        data.srgb = srgb;
+        if (cookedPath.empty())
+        {
+            return data;
+        }
+
+        TextureData cooked = cookTexture(data, chooseBlockFormat(data, cook.preferBC7));
+        try
+        {
+            std::vector<std::span<const uint8_t>> levels;
+            for (uint32_t i = 0; i < cooked.levelCount(); i++)
+            {
+                levels.push_back(cooked.level(i));
+            }
+            std::filesystem::create_directories(cook.cacheDirectory);
+            writeKtx2(cookedPath, cooked.format, cooked.width, cooked.height, levels);
+            cooked.source = cookedPath;
+        }
+        catch (const std::exception &e)
+        {
+            // still usable from memory, it is just cooked again next run
+            std::cerr << "failed to cache cooked texture: " << e.what() << std::endl;
+        }
+        return fitToDevice(std::move(cooked), cook);
+    }
+
+    struct SamplerState
+    {
+        vk::Filter filter = vk::Filter::eLinear;
+        vk::SamplerMipmapMode mipmapMode = vk::SamplerMipmapMode::eLinear;
+        vk::SamplerAddressMode addressMode = vk::SamplerAddressMode::eRepeat;
+        float maxAnisotropy = 8.0f; // clamped to the device limit, 1 turns it off
+
+        bool operator==(const SamplerState &other) const = default;
+    };
+}; // namespace letc
+
+namespace std
+{
+    template <> struct hash<letc::SamplerState>
+    {
+        std::size_t operator()(const letc::SamplerState &state) const noexcept
+        {
+            std::size_t seed = std::hash<uint32_t>{}(static_cast<uint32_t>(state.filter));
+            seed ^= std::hash<uint32_t>{}(static_cast<uint32_t>(state.mipmapMode)) + 0x9e3779b9 + (seed << 6) +
+                    (seed >> 2);
+            seed ^= std::hash<uint32_t>{}(static_cast<uint32_t>(state.addressMode)) + 0x9e3779b9 + (seed << 6) +
+                    (seed >> 2);
+            seed ^= std::hash<float>{}(state.maxAnisotropy) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+}; // namespace std
+
+namespace letc
+{
+    // one vk::Sampler per distinct state, shared by every texture that asks for it
+    struct SamplerCache
+    {
+        const Device &device;
+
+        std::mutex mutex;
+        std::unordered_map<SamplerState, vk::Sampler> samplers;
+
+        SamplerCache(const Device &device) : device(device)
+        {
+        }
+
+        SamplerCache(const SamplerCache &) = delete;
+        SamplerCache &operator=(const SamplerCache &) = delete;
+
+        vk::Sampler get(const SamplerState &state = {})
+        {
+            std::lock_guard lock(mutex);
+            auto found = samplers.find(state);
+            if (found != samplers.end())
+            {
+                return found->second;
+            }
+
+            float maxAnisotropy = 1.0f;
+            if (device.capabilities.samplerAnisotropy)
+            {
+                maxAnisotropy = std::min(state.maxAnisotropy,
+                                         device.physicalDevice.getProperties().limits.maxSamplerAnisotropy);
+            }
+
+            // no lod clamp, minified lookups land on whichever level fits the footprint
+            vk::Sampler sampler = device.device.createSampler(vk::SamplerCreateInfo{}
+                                                                  .setMagFilter(state.filter)
+                                                                  .setMinFilter(state.filter)
+                                                                  .setMipmapMode(state.mipmapMode)
+                                                                  .setAddressModeU(state.addressMode)
+                                                                  .setAddressModeV(state.addressMode)
+                                                                  .setAddressModeW(state.addressMode)
+                                                                  .setAnisotropyEnable(maxAnisotropy > 1.0f)
+                                                                  .setMaxAnisotropy(maxAnisotropy)
+                                                                  .setMinLod(0.0f)
+                                                                  .setMaxLod(VK_LOD_CLAMP_NONE));
+            samplers.emplace(state, sampler);
+            return sampler;
+        }
+
+        ~SamplerCache()
+        {
+            for (const auto &[state, sampler] : samplers)
+            {
+                device.device.destroySampler(sampler);
+            }
+        }
+    };
+
+    // sampled image in device local, optimal tiled memory with a full mip chain, on top of Image so its
+    // barriers come from the tracked state of each level. recordCopy() fills the levels the data came with
+    // from a staging buffer on any queue, recordMips() blits the rest of the chain down on the graphics queue
+    // and leaves every level in eShaderReadOnlyOptimal
+    struct Texture
+    {
+        Image image;
+        // levels recordCopy() fills, 1 for rgba8 data whose chain is blitted, all of them for cooked textures
+        uint32_t copiedLevels = 1;
+
+        Texture(const Allocator &allocator, const uint32_t &width, const uint32_t &height, const vk::Format &format,
+                const bool &mipmapped = true)
+            : Texture(allocator, width, height, format, blitLevels(allocator.device, width, height, format, mipmapped),
+                      1)
+        {
+        }
+
+        Texture(const Allocator &allocator, const TextureData &data, const bool &mipmapped = true)
+            : Texture(allocator, data.width, data.height, data.vkFormat(),
+                      data.levelCount() > 1
+                          ? data.levelCount()
+                          : blitLevels(allocator.device, data.width, data.height, data.vkFormat(), mipmapped),
+                      data.levelCount())
+        {
+        }
+
+        Texture(const Texture &) = delete;
+        Texture &operator=(const Texture &) = delete;
+
+        // bytes of the copied levels in the staging buffer, back to back
+        vk::DeviceSize stagingSize() const
+        {
+            vk::DeviceSize size = 0;
+            for (uint32_t level = 0; level < copiedLevels; level++)
+            {
+                size += levelSize(image.desc.format, levelExtent(level).width, levelExtent(level).height);
+            }
+            return size;
+        }
+
+        // the data's levels into mapped staging memory in the layout recordCopy() reads
+        void stage(void *mapped, const TextureData &data) const
+        {
+            assertThrow(data.levelCount() == copiedLevels && data.vkFormat() == image.desc.format,
+                        "texture data does not match the texture");
+            uint8_t *out = static_cast<uint8_t *>(mapped);
+            for (uint32_t level = 0; level < copiedLevels; level++)
+            {
+                std::span<const uint8_t> bytes = data.level(level);
+                assertThrow(bytes.size() ==
+                                levelSize(image.desc.format, levelExtent(level).width, levelExtent(level).height),
+                            "texture data does not match the texture size");
+                std::memcpy(out, bytes.data(), bytes.size());
+                out += bytes.size();
+            }
+        }
+
+        // every level to eTransferDstOptimal and the copied levels from staging at offset, a multiple of the
+        // format's block size (16 covers all of them)
+        void recordCopy(const vk::CommandBuffer &commandBuffer, const Buffer &staging, vk::DeviceSize offset = 0)
+        {
+            image.transition(commandBuffer, ImageState::transferDst(), std::nullopt, true);
+            std::vector<vk::BufferImageCopy> regions;
+            for (uint32_t level = 0; level < copiedLevels; level++)
+            {
+                vk::Extent2D size = levelExtent(level);
+                regions.push_back(
+                    vk::BufferImageCopy{}
+                        .setBufferOffset(offset)
+                        .setImageSubresource(vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1})
+                        .setImageExtent(vk::Extent3D{size.width, size.height, 1}));
+                offset += levelSize(image.desc.format, size.width, size.height);
+            }
+            commandBuffer.copyBufferToImage(staging.buffer, image.image, vk::ImageLayout::eTransferDstOptimal,
+                                            regions);
+        }
+
+        // queue family transfer of the whole image after recordCopy(), the layout stays the one it left.
+        // record with the src stage/access set on the releasing queue and the dst ones on the acquiring queue
+        vk::ImageMemoryBarrier2 ownershipBarrier(const uint32_t &srcFamily, const uint32_t &dstFamily) const
+        {
+            return vk::ImageMemoryBarrier2{}
+                .setOldLayout(image.state().layout)
+                .setNewLayout(image.state().layout)
+                .setSrcQueueFamilyIndex(srcFamily)
+                .setDstQueueFamilyIndex(dstFamily)
+                .setImage(image.image)
+                .setSubresourceRange(image.fullRange());
+        }
+
+        // each level past the copied ones is a linear downsample of the one above, every level ends up
+        // shader readable. copied levels other than the last one only change layout
+        void recordMips(const vk::CommandBuffer &commandBuffer)
+        {
+            if (copiedLevels > 1)
+            {
+                image.transition(commandBuffer, ImageState::shaderRead(), levels(0, copiedLevels - 1));
+            }
+
+            vk::Extent2D top = levelExtent(copiedLevels - 1);
+            vk::Offset3D size{static_cast<int32_t>(top.width), static_cast<int32_t>(top.height), 1};
+            for (uint32_t level = copiedLevels; level < image.desc.mipLevels; level++)
+            {
+                image.transition(commandBuffer, ImageState::transferSrc(), levels(level - 1, 1));
+
+                vk::Offset3D next{std::max(size.x / 2, 1), std::max(size.y / 2, 1), 1};
+                commandBuffer.blitImage(
+                    image.image, vk::ImageLayout::eTransferSrcOptimal, image.image,
+                    vk::ImageLayout::eTransferDstOptimal,
+                    vk::ImageBlit{}
+                        .setSrcSubresource(vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level - 1, 0, 1})
+                        .setSrcOffsets({vk::Offset3D{0, 0, 0}, size})
+                        .setDstSubresource(vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, level, 0, 1})
+                        .setDstOffsets({vk::Offset3D{0, 0, 0}, next}),
+                    vk::Filter::eLinear);
+                size = next;
+
+                image.transition(commandBuffer, ImageState::shaderRead(), levels(level - 1, 1));
+            }
+
+            image.transition(commandBuffer, ImageState::shaderRead(), levels(image.desc.mipLevels - 1, 1));
+        }
+
+        // blocking copy + mips on the graphics queue, for the odd small texture made at startup
+        void uploadNow(const TextureData &data)
+        {
+            const Device &device = image.allocator.device;
+            Buffer staging(image.allocator, stagingSize(), vk::BufferUsageFlagBits::eTransferSrc,
+                           VMA_MEMORY_USAGE_CPU_ONLY);
+            stage(staging.map(), data);
+            staging.flush();
+
+            vk::CommandPool commandPool = device.device.createCommandPool(
+                vk::CommandPoolCreateInfo{}
+                    .setQueueFamilyIndex(device.graphicsQueueFamilyIndex)
+                    .setFlags(vk::CommandPoolCreateFlagBits::eTransient));
+            vk::CommandBuffer commandBuffer =
+                device.device
+                    .allocateCommandBuffers(vk::CommandBufferAllocateInfo{}
+                                                .setCommandPool(commandPool)
+                                                .setCommandBufferCount(1)
+                                                .setLevel(vk::CommandBufferLevel::ePrimary))
+                    .at(0);
+            commandBuffer.begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            recordCopy(commandBuffer, staging);
+            recordMips(commandBuffer);
+            commandBuffer.end();
+            device.graphicsTimeline->waitUntil(device.graphicsTimeline->submit({commandBuffer}));
+            device.device.destroyCommandPool(commandPool);
+        }
+
+        vk::DescriptorImageInfo descriptorInfo(const vk::Sampler &sampler) const
+        {
+            return vk::DescriptorImageInfo{sampler, image.view, vk::ImageLayout::eShaderReadOnlyOptimal};
+        }
+
+      private:
+        Texture(const Allocator &allocator, const uint32_t &width, const uint32_t &height, const vk::Format &format,
+                const uint32_t &mipLevels, const uint32_t &copiedLevels)
+            : image(allocator, textureDesc(width, height, format, mipLevels)), copiedLevels(copiedLevels)
+        {
+        }
+
+        static ImageDesc textureDesc(const uint32_t &width, const uint32_t &height, const vk::Format &format,
+                                     const uint32_t &mipLevels)
+        {
+            ImageDesc desc;
+            desc.extent = vk::Extent2D{width, height};
+            desc.format = format;
+            desc.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst |
+                         vk::ImageUsageFlagBits::eTransferSrc;
+            desc.mipLevels = mipLevels;
+            return desc;
+        }
+
+        // the blit chain needs blits and linear filtering on the format, without them only level 0 exists
+        static uint32_t blitLevels(const Device &device, const uint32_t &width, const uint32_t &height,
+                                   const vk::Format &format, const bool &mipmapped)
+        {
+            const vk::FormatFeatureFlags blitFeatures = vk::FormatFeatureFlagBits::eBlitSrc |
+                                                        vk::FormatFeatureFlagBits::eBlitDst |
+                                                        vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+            vk::FormatFeatureFlags features = device.physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+            return mipmapped && (features & blitFeatures) == blitFeatures ? mipLevelCount(width, height) : 1;
+        }
+
+        vk::Extent2D levelExtent(const uint32_t &level) const
+        {
+            return {std::max(image.desc.extent.width >> level, 1u), std::max(image.desc.extent.height >> level, 1u)};
+        }
+
+        static vk::ImageSubresourceRange levels(const uint32_t &baseLevel, const uint32_t &levelCount)
+        {
+            return {vk::ImageAspectFlagBits::eColor, baseLevel, levelCount, 0, 1};
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_TEXTURE_HH
@@ -0,0 +1,144 @@
+#pragma once
+
+#ifndef LETC_TIMELINE_HH
+#define LETC_TIMELINE_HH
+
+#include "pch.hh"
+
+#include <atomic>
+#include <mutex>
+
+#include "Stats.hh"
+#include "Zones.hh"
+
+namespace letc
+{
+    // a point some submission has to reach before another one (or the cpu) may continue,
+    // binary semaphores from the swapchain use value 0
+    struct SemaphoreWait
+    {
+        vk::Semaphore semaphore;
+        uint64_t value = 0;
+        vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eAllCommands;
+    };
+
+    // one monotonically increasing timeline semaphore per queue, every submit through it signals
+    // the next value so "is X done" is just a comparison against completed()
+    struct Timeline
+    {
+        vk::Device device;
+        vk::Queue queue;
+        uint32_t queueFamilyIndex;
+        vk::Semaphore semaphore;
+
+        // last value handed out by submit(), the gpu reaches it some time later
+        std::atomic<uint64_t> submitted = 0;
+
+        // vkQueueSubmit needs the queue externally synchronized
+        std::mutex submitMutex;
+
+        Timeline(const vk::Device &device, const vk::Queue &queue, const uint32_t &queueFamilyIndex)
+            : device(device), queue(queue), queueFamilyIndex(queueFamilyIndex)
+        {
+            vk::SemaphoreTypeCreateInfo typeInfo{};
+            typeInfo.setSemaphoreType(vk::SemaphoreType::eTimeline);
+            typeInfo.setInitialValue(0);
+            semaphore = device.createSemaphore(vk::SemaphoreCreateInfo{}.setPNext(&typeInfo));
+        }
+
+        Timeline(const Timeline &) = delete;
+        Timeline &operator=(const Timeline &) = delete;
+
+        // wait for this timeline from a submission on another queue
+        SemaphoreWait at(const uint64_t &value,
+                         const vk::PipelineStageFlags2 &stages = vk::PipelineStageFlagBits2::eAllCommands) const
+        {
+            return SemaphoreWait{semaphore, value, stages};
+        }
+
+        uint64_t completed() const
+        {
+            return device.getSemaphoreCounterValue(semaphore);
+        }
+
+        bool reached(const uint64_t &value) const
+        {
+            return completed() >= value;
+        }
+
+        // block the calling thread until the gpu has passed value
+        void waitUntil(const uint64_t &value, const uint64_t &timeout = 5000000000) const
+        {
+            if (value == 0)
+            {
+                return;
+            }
+            LETC_ZONE("Timeline::waitUntil");
+            StatTimer waitTimer(Stat::FenceWaitUs);
+            vk::SemaphoreWaitInfo waitInfo{};
+            waitInfo.setSemaphores(semaphore);
+            waitInfo.setValues(value);
+            assertThrow(device.waitSemaphores(waitInfo, timeout) == vk::Result::eSuccess,
+                        "timed out waiting for timeline value " + std::to_string(value));
+        }
+
+        // wait for everything submitted so far
+        void waitIdle() const
+        {
+            waitUntil(submitted.load());
+        }
+
+        // submit command buffers after the given waits, signals (and returns) the next value on this
+        // timeline plus any binary semaphores, e.g. the one presentation waits on
+        uint64_t submit(const std::vector<vk::CommandBuffer> &commandBuffers,
+                        const std::vector<SemaphoreWait> &waits = {},
+                        const std::vector<vk::Semaphore> &binarySignals = {},
+                        const vk::PipelineStageFlags2 &signalStages = vk::PipelineStageFlagBits2::eAllCommands)
+        {
+            std::vector<vk::CommandBufferSubmitInfo> commandInfos;
+            commandInfos.reserve(commandBuffers.size());
+            for (const auto &commandBuffer : commandBuffers)
+            {
+                commandInfos.push_back(vk::CommandBufferSubmitInfo{}.setCommandBuffer(commandBuffer));
+            }
+
+            std::vector<vk::SemaphoreSubmitInfo> waitInfos;
+            waitInfos.reserve(waits.size());
+            for (const auto &wait : waits)
+            {
+                waitInfos.push_back(vk::SemaphoreSubmitInfo{}
+                                        .setSemaphore(wait.semaphore)
+                                        .setValue(wait.value)
+                                        .setStageMask(wait.stages));
+            }
+
+            std::lock_guard lock(submitMutex);
+
+            // values must reach the queue in order, so they are handed out under the lock
+            uint64_t value = submitted.load() + 1;
+            std::vector<vk::SemaphoreSubmitInfo> signalInfos;
+            signalInfos.push_back(
+                vk::SemaphoreSubmitInfo{}.setSemaphore(semaphore).setValue(value).setStageMask(signalStages));
+            for (const auto &binary : binarySignals)
+            {
+                signalInfos.push_back(vk::SemaphoreSubmitInfo{}.setSemaphore(binary).setStageMask(signalStages));
+            }
+
+            vk::SubmitInfo2 submitInfo{};
+            submitInfo.setCommandBufferInfos(commandInfos);
+            submitInfo.setWaitSemaphoreInfos(waitInfos);
+            submitInfo.setSignalSemaphoreInfos(signalInfos);
+            queue.submit2(submitInfo);
+
+            submitted.store(value);
+            return value;
+        }
+
+        ~Timeline()
+        {
+            device.destroySemaphore(semaphore);
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_TIMELINE_HH
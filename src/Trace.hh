@@ -0,0 +1,95 @@
+#pragma once
+
+#ifndef LETC_TRACE_HH
+#define LETC_TRACE_HH
+
+#include "pch.hh"
+
+#include <chrono>
+
+namespace letc
+{
+    // microseconds since the first call, the clock every trace event is expressed in
+    inline double traceNowUs()
+    {
+        static const auto epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // one complete ("ph":"X") event in the chrome://tracing / Perfetto json format
+    struct TraceEvent
+    {
+        std::string name;
+        std::string category;
+        uint32_t pid = 0; // process lane, cpu and gpu get their own
+        uint32_t tid = 0;
+        double beginUs = 0.0;
+        double durationUs = 0.0;
+        std::vector<std::pair<std::string, uint64_t>> args;
+    };
+
+    inline std::string escapeJson(const std::string &text)
+    {
+        std::string escaped;
+        escaped.reserve(text.size());
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped.push_back('\\');
+            }
+            escaped.push_back(c);
+        }
+        return escaped;
+    }
+
+    using TraceThreadNames = std::map<std::pair<uint32_t, uint32_t>, std::string>; // {pid, tid} -> name
+
+    // lanes are named through metadata events so the viewer shows "CPU"/"GPU" instead of pids
+    inline void writeChromeTrace(const std::filesystem::path &path, const std::vector<TraceEvent> &events,
+                                 const std::map<uint32_t, std::string> &processNames = {},
+                                 const TraceThreadNames &threadNames = {})
+    {
+        std::ofstream file(path);
+        assertThrow(file, "failed to open trace file: " + path.string());
+
+        file << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto &[pid, name] : processNames)
+        {
+            file << (first ? "" : ",\n")
+                 << std::format(R"({{"name":"process_name","ph":"M","pid":{},"args":{{"name":"{}"}}}})", pid,
+                                escapeJson(name));
+            first = false;
+        }
+        for (const auto &[lane, name] : threadNames)
+        {
+            file << (first ? "" : ",\n")
+                 << std::format(R"({{"name":"thread_name","ph":"M","pid":{},"tid":{},"args":{{"name":"{}"}}}})",
+                                lane.first, lane.second, escapeJson(name));
+            first = false;
+        }
+        for (const auto &event : events)
+        {
+            file << (first ? "" : ",\n")
+                 << std::format(R"({{"name":"{}","cat":"{}","ph":"X","pid":{},"tid":{},"ts":{:.3f},"dur":{:.3f})",
+                                escapeJson(event.name), escapeJson(event.category), event.pid, event.tid,
+                                event.beginUs, event.durationUs);
+            if (!event.args.empty())
+            {
+                file << ",\"args\":{";
+                for (size_t i = 0; i < event.args.size(); i++)
+                {
+                    file << std::format(R"({}"{}":{})", i ? "," : "", escapeJson(event.args[i].first),
+                                        event.args[i].second);
+                }
+                file << "}";
+            }
+            file << "}";
+            first = false;
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    }
+}; // namespace letc
+
+#endif // LETC_TRACE_HH
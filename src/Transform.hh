@@ -0,0 +1,224 @@
+#pragma once
+
+#ifndef LETC_TRANSFORM_HH
+#define LETC_TRANSFORM_HH
+
+#include "pch.hh"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define LETC_TRANSFORM_SSE 1
+#endif
+
+namespace letc
+{
+    // out = a * b for column major matrices, out may alias either input
+    inline void multiplyMat4(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out)
+    {
+#ifdef LETC_TRANSFORM_SSE
+        __m128 a0 = _mm_loadu_ps(&a[0][0]);
+        __m128 a1 = _mm_loadu_ps(&a[1][0]);
+        __m128 a2 = _mm_loadu_ps(&a[2][0]);
+        __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+        __m128 result[4];
+        for (int j = 0; j < 4; j++)
+        {
+            __m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[j][0]));
+            column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[j][1])));
+            column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[j][2])));
+            column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[j][3])));
+            result[j] = column;
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            _mm_storeu_ps(&out[j][0], result[j]);
+        }
+#else
+        out = a * b;
+#endif
+    }
+
+    // inverse transpose of an affine matrix through the cofactors of the upper 3x3,
+    // only the xyz of the result matters for normals but the full matrix is kept correct
+    inline glm::mat4 inverseTransposeAffine(const glm::mat4 &m)
+    {
+        glm::vec3 a0 = glm::vec3(m[0]);
+        glm::vec3 a1 = glm::vec3(m[1]);
+        glm::vec3 a2 = glm::vec3(m[2]);
+        glm::vec3 t = glm::vec3(m[3]);
+
+        glm::vec3 c0 = glm::cross(a1, a2);
+        glm::vec3 c1 = glm::cross(a2, a0);
+        glm::vec3 c2 = glm::cross(a0, a1);
+        float det = glm::dot(a0, c0);
+        float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+        c0 *= invDet;
+        c1 *= invDet;
+        c2 *= invDet;
+
+        return glm::mat4(glm::vec4(c0, -glm::dot(c0, t)), glm::vec4(c1, -glm::dot(c1, t)),
+                         glm::vec4(c2, -glm::dot(c2, t)), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    }
+
+    struct TransformHierarchy
+    {
+        static constexpr uint32_t None = UINT32_MAX;
+
+        // structure of arrays, one entry per node, a parent always has a lower index than its children
+        std::vector<uint32_t> parent;
+        std::vector<uint32_t> firstChild;
+        std::vector<uint32_t> nextSibling;
+        std::vector<glm::vec3> translation;
+        std::vector<glm::quat> rotation;
+        std::vector<glm::vec3> scale;
+        std::vector<glm::mat4> world;
+        std::vector<glm::mat4> worldInvTranspose;
+        std::vector<uint32_t> slot; // index into the gpu side array, None for grouping nodes
+        std::vector<uint8_t> dirty;
+
+        // nodes whose local transform changed since the last update, their subtrees are implied
+        std::vector<uint32_t> dirtyRoots;
+        // nodes recomputed by the last update(), this is all write() touches
+        std::vector<uint32_t> changed;
+
+        uint32_t add(const uint32_t &parentNode = None, const uint32_t &gpuSlot = None,
+                     const glm::vec3 &t = glm::vec3(0.0f), const glm::quat &r = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+                     const glm::vec3 &s = glm::vec3(1.0f))
+        {
+            uint32_t node = static_cast<uint32_t>(parent.size());
+            assertThrow(parentNode == None || parentNode < node, "transform parent must already exist");
+
+            parent.push_back(parentNode);
+            firstChild.push_back(None);
+            nextSibling.push_back(None);
+            translation.push_back(t);
+            rotation.push_back(r);
+            scale.push_back(s);
+            world.push_back(glm::mat4(1.0f));
+            worldInvTranspose.push_back(glm::mat4(1.0f));
+            slot.push_back(gpuSlot);
+            dirty.push_back(0);
+
+            if (parentNode != None)
+            {
+                nextSibling[node] = firstChild[parentNode];
+                firstChild[parentNode] = node;
+            }
+
+            markDirty(node);
+            return node;
+        }
+
+        size_t size() const
+        {
+            return parent.size();
+        }
+
+        void markDirty(const uint32_t &node)
+        {
+            if (!dirty[node])
+            {
+                dirty[node] = 1;
+                dirtyRoots.push_back(node);
+            }
+        }
+
+        void setTranslation(const uint32_t &node, const glm::vec3 &t)
+        {
+            translation[node] = t;
+            markDirty(node);
+        }
+
+        void setRotation(const uint32_t &node, const glm::quat &r)
+        {
+            rotation[node] = r;
+            markDirty(node);
+        }
+
+        void setScale(const uint32_t &node, const glm::vec3 &s)
+        {
+            scale[node] = s;
+            markDirty(node);
+        }
+
+        glm::mat4 local(const uint32_t &node) const
+        {
+            glm::mat3 r = glm::mat3_cast(rotation[node]);
+            const glm::vec3 &s = scale[node];
+            return glm::mat4(glm::vec4(r[0] * s.x, 0.0f), glm::vec4(r[1] * s.y, 0.0f), glm::vec4(r[2] * s.z, 0.0f),
+                             glm::vec4(translation[node], 1.0f));
+        }
+
+        // recompute world matrices for every dirty subtree, untouched nodes cost nothing
+        void update()
+        {
+            changed.clear();
+            if (dirtyRoots.empty())
+            {
+                return;
+            }
+
+            // ancestors have lower indices so sorting guarantees they are handled first,
+            // a root that was already swept up by an ancestor's subtree is skipped
+            std::sort(dirtyRoots.begin(), dirtyRoots.end());
+
+            std::vector<uint32_t> stack;
+            for (const uint32_t &root : dirtyRoots)
+            {
+                if (!dirty[root])
+                {
+                    continue;
+                }
+
+                stack.push_back(root);
+                while (!stack.empty())
+                {
+                    uint32_t node = stack.back();
+                    stack.pop_back();
+
+                    if (parent[node] == None)
+                    {
+                        world[node] = local(node);
+                    }
+                    else
+                    {
+                        multiplyMat4(world[parent[node]], local(node), world[node]);
+                    }
+                    worldInvTranspose[node] = inverseTransposeAffine(world[node]);
+                    dirty[node] = 0;
+                    changed.push_back(node);
+
+                    for (uint32_t child = firstChild[node]; child != None; child = nextSibling[child])
+                    {
+                        stack.push_back(child);
+                    }
+                }
+            }
+            dirtyRoots.clear();
+        }
+
+        // copy changed[begin, end) into their gpu slots, T needs model and modelInvTranspose members,
+        // split across threads freely since every node owns its own slot
+        template <typename T> void write(std::span<T> slots, const size_t &begin, const size_t &end) const
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                uint32_t node = changed[i];
+                if (slot[node] == None)
+                {
+                    continue;
+                }
+                slots[slot[node]].model = world[node];
+                slots[slot[node]].modelInvTranspose = worldInvTranspose[node];
+            }
+        }
+
+        template <typename T> void write(std::span<T> slots) const
+        {
+            write(slots, 0, changed.size());
+        }
+    };
+}; // namespace letc
+
+#endif // LETC_TRANSFORM_HH
@@ -0,0 +1,190 @@
+#pragma once
+
+#ifndef LETC_ZONES_HH
+#define LETC_ZONES_HH
+
+#include "pch.hh"
+
+#include <atomic>
+#include <mutex>
+
+#include "Trace.hh"
+
+namespace letc
+{
+    // one completed zone, names are string literals so nothing is copied on the hot path
+    struct ZoneRecord
+    {
+        const char *name;
+        double beginUs;
+        double endUs;
+        uint32_t depth;
+    };
+
+    // single producer ring owned by one thread, the oldest records are overwritten once it wraps.
+    // readers only look at it once the owner is quiet (exit, between frames), the release store on
+    // head is what makes the records before it visible to them.
+    struct ZoneRing
+    {
+        static constexpr size_t capacity = 1 << 14;
+
+        uint32_t id;
+        std::string threadName;
+        std::array<ZoneRecord, capacity> records;
+        std::atomic<uint64_t> head = 0;
+        uint32_t depth = 0;
+
+        void push(const ZoneRecord &record)
+        {
+            uint64_t index = head.load(std::memory_order_relaxed);
+            records[index % capacity] = record;
+            head.store(index + 1, std::memory_order_release);
+        }
+
+        template <typename F> void forEach(F &&function) const
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end > capacity ? end - capacity : 0;
+            for (uint64_t i = begin; i < end; i++)
+            {
+                function(records[i % capacity]);
+            }
+        }
+    };
+
+    // every ring ever created, rings outlive their threads so a dump still sees finished workers
+    struct ZoneRegistry
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ZoneRing>> rings;
+
+        static ZoneRegistry &get()
+        {
+            static ZoneRegistry registry;
+            return registry;
+        }
+
+        // the calling thread's ring, registered on first use
+        static ZoneRing &local()
+        {
+            static thread_local std::shared_ptr<ZoneRing> ring = []
+            {
+                ZoneRegistry &registry = get();
+                std::lock_guard lock(registry.mutex);
+                auto created = std::make_shared<ZoneRing>();
+                created->id = static_cast<uint32_t>(registry.rings.size());
+                created->threadName = std::format("thread {}", created->id);
+                registry.rings.push_back(created);
+                return created;
+            }();
+            return *ring;
+        }
+
+        std::vector<TraceEvent> traceEvents()
+        {
+            std::lock_guard lock(mutex);
+            std::vector<TraceEvent> events;
+            for (const auto &ring : rings)
+            {
+                ring->forEach(
+                    [&](const ZoneRecord &record)
+                    {
+                        events.push_back(TraceEvent{record.name, "zone", 0, ring->id + 1, record.beginUs,
+                                                    record.endUs - record.beginUs, {}});
+                    });
+            }
+            return events;
+        }
+
+        // lanes match the tids used by traceEvents()
+        TraceThreadNames threadNames()
+        {
+            std::lock_guard lock(mutex);
+            TraceThreadNames names;
+            for (const auto &ring : rings)
+            {
+                names[{0, ring->id + 1}] = ring->threadName;
+            }
+            return names;
+        }
+
+        // count, total and worst case per zone name across all threads
+        std::string summary()
+        {
+            struct Totals
+            {
+                uint64_t count = 0;
+                double totalUs = 0.0;
+                double maxUs = 0.0;
+            };
+            std::map<std::string, Totals> totals;
+            {
+                std::lock_guard lock(mutex);
+                for (const auto &ring : rings)
+                {
+                    ring->forEach(
+                        [&](const ZoneRecord &record)
+                        {
+                            Totals &zone = totals[record.name];
+                            double us = record.endUs - record.beginUs;
+                            zone.count++;
+                            zone.totalUs += us;
+                            zone.maxUs = std::max(zone.maxUs, us);
+                        });
+                }
+            }
+
+            std::string text = std::format("{:<32} {:>8} {:>12} {:>10} {:>10}\n", "cpu zone", "count", "total ms",
+                                           "avg us", "max us");
+            for (const auto &[name, zone] : totals)
+            {
+                text += std::format("{:<32} {:>8} {:>12.3f} {:>10.1f} {:>10.1f}\n", name, zone.count,
+                                    zone.totalUs / 1000.0, zone.totalUs / zone.count, zone.maxUs);
+            }
+            return text;
+        }
+    };
+
+    // times its own lifetime into the calling thread's ring, see LETC_ZONE
+    struct ZoneScope
+    {
+        ZoneRing &ring;
+        const char *name;
+        double beginUs;
+
+        ZoneScope(const char *name) : ring(ZoneRegistry::local()), name(name), beginUs(traceNowUs())
+        {
+            ring.depth++;
+        }
+
+        ~ZoneScope()
+        {
+            ring.depth--;
+            ring.push(ZoneRecord{name, beginUs, traceNowUs(), ring.depth});
+        }
+
+        ZoneScope(const ZoneScope &) = delete;
+        ZoneScope &operator=(const ZoneScope &) = delete;
+    };
+
+    inline void setZoneThreadName(const std::string &name)
+    {
+        ZoneRing &ring = ZoneRegistry::local();
+        std::lock_guard lock(ZoneRegistry::get().mutex);
+        ring.threadName = name;
+    }
+}; // namespace letc
+
+#define LETC_ZONE_CONCAT_(a, b) a##b
+#define LETC_ZONE_CONCAT(a, b) LETC_ZONE_CONCAT_(a, b)
+
+// zones cost nothing unless the build defines LETC_ENABLE_ZONES (cmake -DLETC_ENABLE_ZONES=ON)
+#ifdef LETC_ENABLE_ZONES
+#define LETC_ZONE(name) letc::ZoneScope LETC_ZONE_CONCAT(letcZone, __LINE__)(name)
+#define LETC_ZONE_THREAD(name) letc::setZoneThreadName(name)
+#else
+#define LETC_ZONE(name) ((void)0)
+#define LETC_ZONE_THREAD(name) ((void)0)
+#endif
+
+#endif // LETC_ZONES_HH
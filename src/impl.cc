@@ -1,4 +1,30 @@
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
 
-VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
\ No newline at end of file
+VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
+
+// assimp builds its own copy, keep ours internal to this translation unit
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "Texture.hh"
+
+namespace letc
+{
+    TextureData decodeImage(const void *data, const size_t &size)
+    {
+        int width, height, channels;
+        stbi_uc *pixels =
+            stbi_load_from_memory(static_cast<const stbi_uc *>(data), static_cast<int>(size), &width, &height,
+                                  &channels, STBI_rgb_alpha);
+        assertThrow(pixels, std::string("failed to decode image: ") + stbi_failure_reason());
+
+        TextureData decoded;
+        decoded.width = static_cast<uint32_t>(width);
+        decoded.height = static_cast<uint32_t>(height);
+        decoded.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+        return decoded;
+    }
+}; // namespace letc
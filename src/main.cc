@@ -2,29 +2,33 @@
 #include "pch.hh"
 
 #include "Allocator.hh"
+#include "AssetStreamer.hh"
+#include "AsyncCompute.hh"
 #include "Buffer.hh"
 #include "Camera.hh"
+#include "Defragmenter.hh"
 #include "Descriptor.hh"
 #include "Device.hh"
+#include "GpuProfiler.hh"
+#include "Image.hh"
+#include "JobSystem.hh"
+#include "Layout.hh"
 #include "Material.hh"
+#include "MeshletCuller.hh"
 #include "Model.hh"
 #include "Pipeline.hh"
+#include "PipelineVariants.hh"
+#include "SceneBuffer.hh"
+#include "Stats.hh"
 #include "Swapchain.hh"
+#include "Texture.hh"
+#include "Transform.hh"
 #include "Window.hh"
+#include "Zones.hh"
 
 std::filesystem::path resourcePath = "../../resources/";
-
-struct GlobalUniforms
-{
-    float time;
-    float frame;
-};
-
-struct Light
-{
-    glm::vec4 position = {0.0f, 0.0f, 0.0f, 1.0f};
-    glm::vec4 color = {1.0f, 1.0f, 1.0f, 1.0f};
-};
+// set by cmake, where glslc compiled the shaders in the build tree
+std::filesystem::path shaderPath = LETC_SHADER_DIR;
 
 struct App
 {
@@ -32,45 +36,78 @@ struct App
     XrInstance xrInstance = nullptr;
     XrSystemId xrSystemId = XR_NULL_SYSTEM_ID;
 
+    std::unique_ptr<letc::JobSystem> jobs;
+
     std::unique_ptr<letc::Instance> instance;
     vkfw::UniqueWindow window;
     vk::UniqueSurfaceKHR surface;
 
     std::unique_ptr<letc::Device> device;
     std::unique_ptr<letc::Allocator> allocator;
-    vk::Queue queue;
     std::unique_ptr<letc::Swapchain> swapchain;
 
     vk::UniqueCommandPool commandPool;
     vk::UniqueCommandBuffer commandBuffer;
     uint32_t m_currentImageIndex = 0;
-    vk::UniqueFence imageFence;
-    vk::UniqueFence commandFence;
+    // acquire -> submit -> present ordering, the cpu itself only waits on the graphics timeline
+    vk::UniqueSemaphore imageAvailable;
+    std::vector<vk::UniqueSemaphore> renderFinished; // one per swapchain image
+    uint64_t frameTimelineValue = 0;
+
+    // culling, light binning, skinning... recorded on the compute queue ahead of each frame, a pass
+    // writes the copy of its outputs for asyncCompute->slot() and release()s whatever graphics reads
+    std::unique_ptr<letc::AsyncCompute> asyncCompute;
+
+    std::unique_ptr<letc::GpuProfiler> gpuProfiler;
+    // compacts the geometry pool in the background once it has fragmented enough
+    std::unique_ptr<letc::Defragmenter> defragmenter;
+    std::vector<std::function<void(letc::AsyncCompute &, const vk::CommandBuffer &)>> computePasses;
 
-    GlobalUniforms globalUniforms;
+    letc::gpu::GlobalUniforms globalUniforms;
     std::unique_ptr<letc::Buffer> globalUniformsBuffer;
 
-    std::vector<Light> lights;
-    std::unique_ptr<letc::Buffer> lightsBuffer;
+    std::unique_ptr<letc::SceneBuffer<letc::gpu::Light>> lights;
 
     std::unique_ptr<letc::Camera> camera;
 
-    std::vector<letc::Model> models;
-    std::vector<letc::Model::UniformBuffer> modelUniforms{};
-    std::unique_ptr<letc::Buffer> modelUniformsBuffer;
+    // models load in the background and draw a placeholder until resident, nearest first
+    std::unique_ptr<letc::AssetStreamer> streamer;
+    std::vector<letc::MeshHandle> meshes;
+    // level each mesh was drawn at last frame, the hysteresis in selectLod() works from it
+    std::vector<uint32_t> meshLods;
+    std::unique_ptr<letc::SceneBuffer<letc::gpu::InstanceData>> instances;
+
+    letc::TransformHierarchy transforms;
+    std::vector<uint32_t> modelTransforms;
 
     std::unique_ptr<letc::DescriptorLayout> pbrLayout;
+    // untextured models sample a white texel so set 1 is always valid
+    std::unique_ptr<letc::SamplerCache> samplers;
+    std::unique_ptr<letc::Texture> whiteTexture;
     std::unique_ptr<letc::Material> pbrMaterial;
-    std::unique_ptr<letc::GraphicsPipeline> pbrPipeline;
-
-    std::unique_ptr<letc::ImageBuffer<float>> depthBuffer;
-    vk::UniqueImageView depthImageView;
+    // set 1 for each textured model, made the first time it is drawn
+    std::unordered_map<const letc::Model *, std::unique_ptr<letc::Material>> textureMaterials;
+    std::unique_ptr<letc::PipelineVariants> pbrVariants;
+    // positions only, drawn with while a model's own variant is still compiling. every other
+    // stream has stride 0 so it reads nothing past what any model binds
+    letc::GraphicsPipeline *pbrFallback = nullptr;
+    uint32_t pbrFeatures = LETC_FEATURE_LIGHTING;
+    // raster state set at record time, shared by every pbr variant
+    letc::RenderState pbrState;
+    // meshes with meshlets are culled per cluster and drawn indirect
+    std::unique_ptr<letc::MeshletCuller> meshletCuller;
+
+    std::unique_ptr<letc::Image> depthBuffer;
 
     double lastMouseX, lastMouseY;
 
     size_t currentFrame = 0;
     App()
     {
+        LETC_ZONE_THREAD("main");
+        LETC_ZONE("App::App");
+        jobs = std::make_unique<letc::JobSystem>();
+
         // setup debug messenger
         XrDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerInfo = {XR_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT};
         debugUtilsMessengerInfo.next = nullptr;
@@ -131,9 +168,8 @@ struct App
         // allocator initialization
         allocator = std::make_unique<letc::Allocator>(*instance, *device);
 
-        // swapchain + queue initialization
-        swapchain = std::make_unique<letc::Swapchain>(*window, *surface, *device, *device);
-        queue = device->device.getQueue(device->graphicsQueueFamilyIndex, 0);
+        // swapchain initialization
+        swapchain = std::make_unique<letc::Swapchain>(*window, *surface, *device);
 
         // command buffer initialization
         commandPool =
@@ -147,38 +183,79 @@ struct App
                                                                         .setLevel(vk::CommandBufferLevel::ePrimary))
                                       .at(0));
 
-        // fence initialization
-        imageFence = device->device.createFenceUnique(vk::FenceCreateInfo{});
-        commandFence = device->device.createFenceUnique(vk::FenceCreateInfo{});
+        asyncCompute = std::make_unique<letc::AsyncCompute>(*device);
+        gpuProfiler = std::make_unique<letc::GpuProfiler>(*device, *device->graphicsTimeline);
+        defragmenter = std::make_unique<letc::Defragmenter>(*device, *allocator);
+
+        // semaphore initialization
+        imageAvailable = device->device.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+        for (size_t i = 0; i < swapchain->images.size(); i++)
+        {
+            renderFinished.push_back(device->device.createSemaphoreUnique(vk::SemaphoreCreateInfo{}));
+        }
 
         // data initialization
-        globalUniforms = {0.0f, 0.0f};
+        globalUniforms = {0.0f, 0.0f, 0.0f, 0.0f};
         globalUniformsBuffer = std::make_unique<letc::Buffer>(
-            *allocator, sizeof(GlobalUniforms), vk::BufferUsageFlagBits::eUniformBuffer, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
-        lights.push_back({{0.0f, 0.0f, 2.0f, 1.0f}, {1.0f, 0.0f, 0.0f, 1.0f}});
-        lights.push_back({{2.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}});
-        lights.push_back({{0.0f, 2.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f, 1.0f}});
-        lights.push_back({{0.0f, 0.0f, -2.0f, 1.0f}, {1.0f, 1.0f, 1.0f, 1.0f}});
-        lightsBuffer =
-            std::make_unique<letc::Buffer>(*allocator, sizeof(Light) * lights.size(),
-                                           vk::BufferUsageFlagBits::eStorageBuffer, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            *allocator, sizeof(letc::gpu::GlobalUniforms), vk::BufferUsageFlagBits::eUniformBuffer,
+            VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        std::vector<letc::gpu::Light> initialLights;
+        initialLights.push_back({{0.0f, 0.0f, 2.0f, 1.0f}, {1.0f, 0.0f, 0.0f, 1.0f}});
+        initialLights.push_back({{2.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}});
+        initialLights.push_back({{0.0f, 2.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f, 1.0f}});
+        initialLights.push_back({{0.0f, 0.0f, -2.0f, 1.0f}, {1.0f, 1.0f, 1.0f, 1.0f}});
+        lights = std::make_unique<letc::SceneBuffer<letc::gpu::Light>>(*allocator, initialLights,
+                                                                      vk::BufferUsageFlagBits::eStorageBuffer,
+                                                                      vk::PipelineStageFlagBits::eFragmentShader,
+                                                                      vk::AccessFlagBits::eShaderRead);
 
         camera = std::make_unique<letc::Camera>(*allocator, glm::vec4{0.0f, 0.0f, 2.0f, 1.0f},
                                                 glm::vec4{0.0f, 0.0f, 0.0f, 1.0f}, glm::vec4{0.0f, 1.0f, 0.0f, 1.0f},
                                                 60.0f, (float)window->getWidth() / (float)window->getHeight());
 
-        models.emplace_back(*allocator, resourcePath / "Avocado.glb");
-        models.emplace_back(*allocator, resourcePath / "platform.glb");
-        std::for_each(models.begin(), models.end(), [](letc::Model &m)
-                      { m.cpyAttributes(); });
+        // handles come back right away, the files are parsed on workers and uploaded over the next frames
+        streamer = std::make_unique<letc::AssetStreamer>(*device, *allocator, *jobs);
+        // textures are cooked to bc on first load and read back from the cache afterwards
+        const char *textureCache = std::getenv("LETC_TEXTURE_CACHE");
+        streamer->textureCooking = letc::TextureCookConfig::forDevice(
+            *device, textureCache ? std::filesystem::path(textureCache) : resourcePath / "cooked");
+        // LETC_RESIDENCY_BUDGET=<MiB> caps the streamed geometry and textures, least recently drawn go first
+        if (const char *budget = std::getenv("LETC_RESIDENCY_BUDGET"))
+        {
+            streamer->residencyBudget = std::stoull(budget) << 20;
+        }
+        streamer->onEvicted = [this](const letc::Model &model)
+        {
+            textureMaterials.erase(&model);
+            meshletCuller->forget(model);
+        };
+        // a heap past 90% of its budget evicts down to it even when the streamer is within its own
+        allocator->addPressureCallback(0.9f,
+                                       [this](uint32_t, const VmaBudget &budget)
+                                       {
+                                           if (streamer)
+                                           {
+                                               streamer->relieve(budget.usage - budget.budget * 9 / 10);
+                                           }
+                                       });
+        for (const auto &path : {resourcePath / "Avocado.glb", resourcePath / "platform.glb"})
+        {
+            meshes.push_back(streamer->request(path));
+        }
+        meshLods.resize(meshes.size(), 0);
+
+        std::vector<letc::gpu::InstanceData> initialInstances(meshes.size(), {glm::mat4(1.0f), glm::mat4(1.0f)});
+        instances = std::make_unique<letc::SceneBuffer<letc::gpu::InstanceData>>(
+            *allocator, initialInstances, vk::BufferUsageFlagBits::eStorageBuffer,
+            vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eShaderRead);
 
-        std::for_each(models.begin(), models.end(),
-                      [this](const letc::Model &m)
-                      { modelUniforms.push_back(m.uniform); });
-        modelUniformsBuffer =
-            std::make_unique<letc::Buffer>(*allocator, sizeof(letc::Model::UniformBuffer) * models.size(),
-                                           vk::BufferUsageFlagBits::eUniformBuffer, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        // one root node per model, slot i is the model's instance
+        for (uint32_t i = 0; i < meshes.size(); i++)
+        {
+            modelTransforms.push_back(transforms.add(letc::TransformHierarchy::None, i));
+        }
 
         // descriptor layout and material initialization
         pbrLayout = std::make_unique<letc::DescriptorLayout>(*device);
@@ -186,23 +263,31 @@ struct App
                               vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 1);
         pbrLayout->addBinding(0, 1, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eFragment, 1);
         pbrLayout->addBinding(0, 2, vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eVertex, 1);
-        pbrLayout->addBinding(1, 0, vk::DescriptorType::eUniformBufferDynamic,
-                              vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 1);
+        pbrLayout->addBinding(0, 3, vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eVertex, 1);
+        pbrLayout->addBinding(1, 0, vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eFragment, 1);
         pbrLayout->generateLayouts();
 
+        samplers = std::make_unique<letc::SamplerCache>(*device);
+        letc::TextureData white = letc::solidTextureData(255, 255, 255);
+        whiteTexture = std::make_unique<letc::Texture>(*allocator, white, false);
+        whiteTexture->uploadNow(white);
+
         pbrMaterial = std::make_unique<letc::Material>(*device, *allocator, *pbrLayout);
-        pbrMaterial->updateDescriptorBufferInfo(0, 0, globalUniformsBuffer->buffer, 0, sizeof(GlobalUniforms));
-        pbrMaterial->updateDescriptorBufferInfo(0, 1, lightsBuffer->buffer, 0, sizeof(Light) * lights.size());
+        pbrMaterial->updateDescriptorBufferInfo(0, 0, globalUniformsBuffer->buffer, 0,
+                                                sizeof(letc::gpu::GlobalUniforms));
+        pbrMaterial->updateDescriptorBufferInfo(0, 1, *lights, 0, lights->sizeBytes());
         pbrMaterial->updateDescriptorBufferInfo(0, 2, *camera->buffer, 0, sizeof(letc::Camera::Uniform));
-        pbrMaterial->updateDescriptorBufferInfo(1, 0, modelUniformsBuffer->buffer, 0,
-                                                sizeof(letc::Model::UniformBuffer));
+        pbrMaterial->updateDescriptorBufferInfo(0, 3, *instances, 0, instances->sizeBytes());
+        pbrMaterial->updateDescriptorImageInfo(1, 0, *whiteTexture, samplers->get());
         pbrMaterial->updateDescriptorSets();
-        pbrMaterial->updateDynamicOffset(1, 0);
 
         // pipeline initialization
         letc::GraphicsPipelineBuilder gpb;
-        gpb.addShaderStage(readFile(resourcePath / "pbr.vert.spv"), vk::ShaderStageFlagBits::eVertex);
-        gpb.addShaderStage(readFile(resourcePath / "pbr.frag.spv"), vk::ShaderStageFlagBits::eFragment);
+        {
+            LETC_ZONE("readFile shaders");
+            gpb.addShaderStage(readFile(shaderPath / "pbr.vert.spv"), vk::ShaderStageFlagBits::eVertex);
+            gpb.addShaderStage(readFile(shaderPath / "pbr.frag.spv"), vk::ShaderStageFlagBits::eFragment);
+        }
         gpb.addVertexInputBinding(0, sizeof(glm::vec4), vk::VertexInputRate::eVertex); // Position
         gpb.addVertexInputAttribute(0, 0, vk::Format::eR32G32B32A32Sfloat, 0);
         gpb.addVertexInputBinding(1, sizeof(glm::vec4), vk::VertexInputRate::eVertex); // Normal
@@ -212,39 +297,89 @@ struct App
         gpb.addVertexInputBinding(3, sizeof(glm::vec2), vk::VertexInputRate::eVertex); // UV
         gpb.addVertexInputAttribute(3, 3, vk::Format::eR32G32Sfloat, 0);
         gpb.setLayout(pbrLayout.get());
+        gpb.addPushConstantRange(
+            vk::PushConstantRange{}
+                .setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment)
+                .setOffset(0)
+                .setSize(sizeof(letc::gpu::DrawRecord)));
         gpb.renderingInfo.setColorAttachmentCount(1);
         gpb.renderingInfo.setPColorAttachmentFormats(&swapchain->format.format);
-        gpb.setRasterization(gpb.rasterizationInfo.setCullMode(vk::CullModeFlagBits::eNone));
-        pbrPipeline = std::make_unique<letc::GraphicsPipeline>(*device, *swapchain, gpb);
+        gpb.setRasterization(gpb.rasterizationInfo.setCullMode(vk::CullModeFlagBits::eBack));
+        gpb.setDynamicRenderState(*device);
+        gpb.setShaderObjects(device->capabilities.shaderObject);
+        pbrVariants = std::make_unique<letc::PipelineVariants>(*device, gpb, jobs.get());
+
+        // variants are built on the import worker instead of stalling the first draw of each mesh,
+        // anything the render loop still finds missing is queued on the jobs and drawn with the fallback
+        pbrFallback = &pbrVariants->get(pbrPermutation(LETC_ATTRIBUTE_POSITION));
+        pbrVariants->get(pbrPermutation(streamer->placeholder->attributeMask));
+        streamer->onImported = [this](const letc::MeshData &mesh)
+        { pbrVariants->get(pbrPermutation(mesh.attributeMask)); };
+
+        meshletCuller =
+            std::make_unique<letc::MeshletCuller>(*device, *allocator, readFile(shaderPath / "cull.comp.spv"),
+                                                  *instances->deviceBuffer, instances->sizeBytes());
 
         // depth buffer initialization
-        depthBuffer = std::make_unique<letc::ImageBuffer<float>>(
-            allocator->allocator, static_cast<uint32_t>(window->getWidth()), static_cast<uint32_t>(window->getHeight()),
-            vk::Format::eD32Sfloat, std::vector<float>(window->getWidth() * window->getHeight(), 0.0f),
-            vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::ImageTiling::eOptimal);
-
-        depthImageView = device->device.createImageViewUnique(
-            vk::ImageViewCreateInfo{}
-                .setImage(depthBuffer->m_gpuImage)
-                .setViewType(vk::ImageViewType::e2D)
-                .setFormat(vk::Format::eD32Sfloat)
-                .setSubresourceRange(vk::ImageSubresourceRange{}
-                                         .setAspectMask(vk::ImageAspectFlagBits::eDepth)
-                                         .setBaseMipLevel(0)
-                                         .setLevelCount(1)
-                                         .setBaseArrayLayer(0)
-                                         .setLayerCount(1)));
+        letc::ImageDesc depthDesc;
+        depthDesc.extent = vk::Extent2D{static_cast<uint32_t>(window->getWidth()),
+                                        static_cast<uint32_t>(window->getHeight())};
+        depthDesc.format = vk::Format::eD32Sfloat;
+        depthDesc.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+        depthBuffer = std::make_unique<letc::Image>(*allocator, depthDesc);
 
         std::tie(lastMouseX, lastMouseY) = window->getCursorPos();
         window->callbacks()->on_scroll = [this](vkfw::Window const &, double x, double y)
         {
             camera->zoom(static_cast<float>(y));
         };
+
+        pbrState.cullMode = vk::CullModeFlagBits::eBack;
+        window->callbacks()->on_key = [this](vkfw::Window const &, vkfw::Key key, int32_t, vkfw::KeyAction action,
+                                             vkfw::ModifierKeyFlags)
+        {
+            // wireframe is only a state change when polygon mode is dynamic, never a new pipeline
+            bool dynamicPolygonMode = device->capabilities.shaderObject || device->capabilities.dynamicPolygonMode;
+            if (key == vkfw::Key::eW && action == vkfw::KeyAction::ePress && dynamicPolygonMode)
+            {
+                pbrState.polygonMode =
+                    pbrState.polygonMode == vk::PolygonMode::eFill ? vk::PolygonMode::eLine : vk::PolygonMode::eFill;
+            }
+            // same for back face culling, which also turns the meshlet cone test on and off with it
+            bool dynamicCullMode = device->capabilities.shaderObject || device->capabilities.extendedDynamicState;
+            if (key == vkfw::Key::eC && action == vkfw::KeyAction::ePress && dynamicCullMode)
+            {
+                pbrState.cullMode = pbrState.cullMode & vk::CullModeFlagBits::eBack ? vk::CullModeFlagBits::eNone
+                                                                                     : vk::CullModeFlagBits::eBack;
+            }
+            if (key == vkfw::Key::eM && action == vkfw::KeyAction::ePress)
+            {
+                allocator->dumpStats("letc_memory.json");
+                std::cout << allocator->summary();
+            }
+        };
+
+        // LETC_STATS=stats.csv appends per frame counter averages once a second (at 60 fps)
+        if (const char *statsPath = std::getenv("LETC_STATS"))
+        {
+            letc::StatsRegistry::get().dumpTo(statsPath, 60);
+        }
+    }
+
+    letc::PipelinePermutation pbrPermutation(const uint32_t &attributeMask) const
+    {
+        letc::PipelinePermutation permutation{};
+        permutation.attributeMask = attributeMask;
+        permutation.maxLights = static_cast<uint32_t>(lights->size());
+        permutation.features = pbrFeatures;
+        return permutation;
     }
 
     void beginFrame()
     {
+        LETC_ZONE("App::beginFrame");
         vkfw::pollEvents();
+        jobs->pumpMainThread();
 
         if (window->getKey(vkfw::Key::eQ))
         {
@@ -267,39 +402,113 @@ struct App
         globalUniforms.time = static_cast<float>(vkfw::getTime());
         globalUniforms.frame = static_cast<float>(currentFrame++);
 
-        models.at(0).uniform.model = glm::rotate(models.at(0).uniform.model, 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+        uint32_t spinning = modelTransforms.at(0);
+        transforms.setRotation(spinning,
+                               transforms.rotation[spinning] * glm::angleAxis(0.01f, glm::vec3(0.0f, 1.0f, 0.0f)));
 
-        globalUniformsBuffer->cpy(&globalUniforms, sizeof(GlobalUniforms));
-        lightsBuffer->cpy(lights.data(), sizeof(Light) * lights.size());
+        // this frame's compute goes out before waiting on the last frame so the two can overlap
+        if (!computePasses.empty())
+        {
+            LETC_ZONE("async compute");
+            const vk::CommandBuffer &computeCommandBuffer = asyncCompute->begin();
+            for (auto &pass : computePasses)
+            {
+                pass(*asyncCompute, computeCommandBuffer);
+            }
+            std::vector<letc::SemaphoreWait> computeWaits;
+            if (auto relocated = defragmenter->handoff())
+            {
+                computeWaits.push_back(*relocated);
+            }
+            asyncCompute->submit(computeWaits);
+        }
+
+        // the previous frame still reads the host visible uniforms and owns the command buffer,
+        // everything above this point overlaps with it on the gpu
+        device->graphicsTimeline->waitUntil(frameTimelineValue);
+        if (currentFrame % 600 == 0 && defragmenter->fragmentation() > 0.25)
+        {
+            defragmenter->start();
+        }
+        defragmenter->step();
+        device->collectGarbage();
+        allocator->checkBudget(static_cast<uint32_t>(currentFrame));
+
+        // whatever is closest to the camera is imported and uploaded first
+        for (uint32_t i = 0; i < meshes.size(); i++)
+        {
+            glm::vec3 position(transforms.world[modelTransforms[i]][3]);
+            streamer->setPriority(meshes[i], -glm::distance(position, glm::vec3(camera->eye)));
+        }
+        streamer->update();
+
+        globalUniformsBuffer->cpy(&globalUniforms, sizeof(letc::gpu::GlobalUniforms));
         camera->cpy();
 
-        for (size_t i = 0; i < models.size(); ++i)
+        // only nodes that moved (and their children) get recomputed, written and uploaded
         {
-            modelUniforms[i].model = models[i].uniform.model;
+            LETC_ZONE("transforms");
+            transforms.update();
+            std::span<letc::gpu::InstanceData> instanceSlots(instances->data);
+            jobs->parallelFor(transforms.changed.size(), 256,
+                              [this, instanceSlots](size_t begin, size_t end)
+                              { transforms.write(instanceSlots, begin, end); });
+            for (const uint32_t &node : transforms.changed)
+            {
+                if (transforms.slot[node] != letc::TransformHierarchy::None)
+                {
+                    instances->markDirty(transforms.slot[node]);
+                }
+            }
         }
-        modelUniformsBuffer->cpy(modelUniforms.data(), sizeof(letc::Model::UniformBuffer) * models.size());
 
         pbrMaterial->updateDescriptorSets();
 
-        auto [result, imageIndex] =
-            device->device.acquireNextImageKHR(*swapchain, 5000000000, nullptr, imageFence.get());
-        assertThrow(result == vk::Result::eSuccess, "failed to acquire next image: " + vk::to_string(result));
-        m_currentImageIndex = imageIndex;
+        {
+            LETC_ZONE("acquire");
+            letc::StatTimer acquireTimer(letc::Stat::AcquireWaitUs);
+            auto [result, imageIndex] =
+                device->device.acquireNextImageKHR(*swapchain, 5000000000, imageAvailable.get(), nullptr);
+            assertThrow(result == vk::Result::eSuccess, "failed to acquire next image: " + vk::to_string(result));
+            m_currentImageIndex = imageIndex;
+        }
 
+        LETC_ZONE("record and submit");
         commandBuffer->reset(vk::CommandBufferResetFlagBits::eReleaseResources);
         commandBuffer->begin(vk::CommandBufferBeginInfo{}.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
-        commandBuffer->setScissor(
-            0, 1,
-            &vk::Rect2D{}.setOffset({0, 0}).setExtent(
-                {static_cast<uint32_t>(window->getWidth()), static_cast<uint32_t>(window->getHeight())}));
-        commandBuffer->setViewport(0, 1,
-                                   &vk::Viewport{}
-                                        .setX(0.0f)
-                                        .setY(0.0f)
-                                        .setWidth(static_cast<float>(window->getWidth()))
-                                        .setHeight(static_cast<float>(window->getHeight()))
-                                        .setMinDepth(0.0f)
-                                        .setMaxDepth(1.0f));
+        asyncCompute->acquire(*commandBuffer);
+        streamer->acquire(*commandBuffer);
+        gpuProfiler->beginFrame(*commandBuffer);
+
+        // scene data stays resident, only the dirty ranges are copied in
+        {
+            LETC_GPU_ZONE(*gpuProfiler, *commandBuffer, "upload");
+            lights->upload(*commandBuffer);
+            instances->upload(*commandBuffer);
+        }
+        pbrState.setExtent({static_cast<uint32_t>(window->getWidth()), static_cast<uint32_t>(window->getHeight())});
+
+        // levels are picked and meshlets culled before rendering starts, a draw without meshlets stays direct
+        std::vector<letc::Model *> frameModels(meshes.size());
+        std::vector<std::optional<uint32_t>> culledDraws(meshes.size());
+        meshletCuller->begin();
+        for (uint32_t i = 0; i < meshes.size(); ++i)
+        {
+            frameModels[i] = &streamer->resolve(meshes[i]);
+            meshLods[i] = frameModels[i]->selectLod(transforms.world[modelTransforms[i]], *camera,
+                                                    static_cast<float>(window->getHeight()), meshLods[i]);
+            culledDraws[i] = meshletCuller->add(*frameModels[i], meshLods[i], i);
+        }
+        {
+            LETC_GPU_ZONE(*gpuProfiler, *commandBuffer, "cull");
+            // the cone test assumes back faces would be dropped by the rasterizer anyway
+            uint32_t cullFlags = LETC_CULL_FRUSTUM;
+            if (pbrState.cullMode & vk::CullModeFlagBits::eBack)
+            {
+                cullFlags |= LETC_CULL_CONE;
+            }
+            meshletCuller->record(*commandBuffer, *camera, cullFlags);
+        }
 
         vk::ImageMemoryBarrier colorBarrier{};
         colorBarrier.setSrcAccessMask(vk::AccessFlags{});
@@ -316,25 +525,8 @@ struct App
                                              .setBaseArrayLayer(0)
                                              .setLayerCount(1));
 
-        vk::ImageMemoryBarrier depthBarrier{};
-        depthBarrier.setSrcAccessMask(vk::AccessFlags{});
-        depthBarrier.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentRead |
-                                      vk::AccessFlagBits::eDepthStencilAttachmentWrite);
-        depthBarrier.setOldLayout(vk::ImageLayout::eUndefined);
-        depthBarrier.setNewLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
-        depthBarrier.setSrcQueueFamilyIndex(vk::QueueFamilyIgnored);
-        depthBarrier.setDstQueueFamilyIndex(vk::QueueFamilyIgnored);
-        depthBarrier.setImage(depthBuffer->m_gpuImage);
-        depthBarrier.setSubresourceRange(vk::ImageSubresourceRange{}
-                                             .setAspectMask(vk::ImageAspectFlagBits::eDepth)
-                                             .setBaseMipLevel(0)
-                                             .setLevelCount(1)
-                                             .setBaseArrayLayer(0)
-                                             .setLayerCount(1));
-
-        commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
-                                       vk::PipelineStageFlagBits::eEarlyFragmentTests, {}, 0, nullptr, 0, nullptr, 1,
-                                       &depthBarrier);
+        // last frame's depth is never read, so the old contents are discarded
+        depthBuffer->transition(*commandBuffer, letc::ImageState::depthAttachment(), std::nullopt, true);
         commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
                                        vk::PipelineStageFlagBits::eColorAttachmentOutput, {}, 0, nullptr, 0, nullptr, 1,
                                        &colorBarrier);
@@ -353,7 +545,7 @@ struct App
             vk::ClearValue{}.setColor(vk::ClearColorValue{}.setFloat32({0.1176f, 0.1176f, 0.1804f, 1.0f})));
 
         vk::RenderingAttachmentInfo depthAttachment{};
-        depthAttachment.setImageView(*depthImageView);
+        depthAttachment.setImageView(depthBuffer->view);
         depthAttachment.setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
         depthAttachment.setLoadOp(vk::AttachmentLoadOp::eClear);
         depthAttachment.setStoreOp(vk::AttachmentStoreOp::eDontCare);
@@ -363,22 +555,56 @@ struct App
         renderingInfo.setPColorAttachments(&colorAttachment);
         renderingInfo.setPDepthAttachment(&depthAttachment);
 
-        commandBuffer->beginRendering(renderingInfo);
-
-        pbrPipeline->bind(commandBuffer.get());
-        pbrMaterial->bind(commandBuffer.get(), *pbrPipeline);
-
-        for (uint32_t i = 0; i < models.size(); ++i)
         {
-            uint32_t dynamicOffset = i * sizeof(letc::Model::UniformBuffer);
-            pbrMaterial->updateDynamicOffset(1, dynamicOffset);
-            pbrMaterial->bind(*commandBuffer, *pbrPipeline, 1);
-
-            models[i].draw(*commandBuffer);
+            LETC_GPU_ZONE_STATS(*gpuProfiler, *commandBuffer, "pbr");
+            commandBuffer->beginRendering(renderingInfo);
+
+            // every variant shares the same set layouts and push range, so the sets bound
+            // with the first one stay valid across pipeline switches
+            letc::GraphicsPipeline *boundPipeline = nullptr;
+            letc::Material *boundTextures = pbrMaterial.get();
+
+            // sets are bound once, each draw only pushes its record
+            for (uint32_t i = 0; i < meshes.size(); ++i)
+            {
+                letc::Model &model = *frameModels[i];
+                letc::GraphicsPipeline *variant = pbrVariants->find(pbrPermutation(model.attributeMask));
+                letc::GraphicsPipeline &pipeline = variant ? *variant : *pbrFallback;
+                if (&pipeline != boundPipeline)
+                {
+                    pipeline.bind(*commandBuffer);
+                    pipeline.setRenderState(*commandBuffer, pbrState);
+                    if (!boundPipeline)
+                    {
+                        pbrMaterial->bind(*commandBuffer, pipeline);
+                    }
+                    boundPipeline = &pipeline;
+                }
+                letc::Material &textures = model.baseColor ? textureMaterial(model) : *pbrMaterial;
+                if (&textures != boundTextures)
+                {
+                    textures.bind(*commandBuffer, pipeline, 1);
+                    boundTextures = &textures;
+                }
+
+                letc::gpu::DrawRecord draw{};
+                draw.transformIndex = i;
+                draw.materialIndex = 0;
+                pipeline.push(*commandBuffer, draw);
+
+                if (culledDraws[i])
+                {
+                    meshletCuller->draw(*commandBuffer, model, *culledDraws[i]);
+                }
+                else
+                {
+                    model.draw(*commandBuffer, meshLods[i]);
+                }
+            }
+
+            commandBuffer->endRendering();
         }
 
-        commandBuffer->endRendering();
-
         commandBuffer->pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput,
                                        vk::PipelineStageFlagBits::eBottomOfPipe, {}, 0, nullptr, 0, nullptr, 1,
                                        &vk::ImageMemoryBarrier{}
@@ -398,34 +624,67 @@ struct App
 
         commandBuffer->end();
 
-        assertThrow(device->device.resetFences(1, &commandFence.get()) == vk::Result::eSuccess,
-                    "failed to reset command fence");
-
-        queue.submit(vk::SubmitInfo{}.setCommandBufferCount(1).setPCommandBuffers(&commandBuffer.get()),
-                     commandFence.get());
-
-        assertThrow(device->device.waitForFences(1, &commandFence.get(), VK_TRUE, 5000000000) == vk::Result::eSuccess,
-                    "failed to wait for command fence");
-
-        assertThrow(device->device.waitForFences(1, &imageFence.get(), VK_TRUE, 5000000000) == vk::Result::eSuccess,
-                    "failed to wait for image fence");
-
-        assertThrow(queue.presentKHR(vk::PresentInfoKHR{}
-                                         .setWaitSemaphoreCount(0)
-                                         .setPWaitSemaphores(nullptr)
-                                         .setSwapchainCount(1)
-                                         .setPSwapchains(&swapchain->swapchain)
-                                         .setPImageIndices(&m_currentImageIndex)
-                                         .setPNext(nullptr)) == vk::Result::eSuccess,
+        std::vector<letc::SemaphoreWait> waits{
+            letc::SemaphoreWait{imageAvailable.get(), 0, vk::PipelineStageFlagBits2::eColorAttachmentOutput}};
+        if (auto computeDone = asyncCompute->handoff())
+        {
+            waits.push_back(*computeDone);
+        }
+        if (auto uploadsDone = streamer->handoff())
+        {
+            waits.push_back(*uploadsDone);
+        }
+        frameTimelineValue =
+            device->graphicsTimeline->submit({commandBuffer.get()}, waits, {renderFinished[m_currentImageIndex].get()});
+        asyncCompute->consumed(frameTimelineValue);
+        gpuProfiler->endFrame(frameTimelineValue);
+
+        assertThrow(device->graphicsQueue.presentKHR(vk::PresentInfoKHR{}
+                                                         .setWaitSemaphores(renderFinished[m_currentImageIndex].get())
+                                                         .setSwapchainCount(1)
+                                                         .setPSwapchains(&swapchain->swapchain)
+                                                         .setPImageIndices(&m_currentImageIndex)) ==
+                        vk::Result::eSuccess,
                     "failed to present image");
 
-        assertThrow(device->device.resetFences(1, &imageFence.get()) == vk::Result::eSuccess,
-                    "failed to reset image fence");
+        letc::StatsRegistry::get().endFrame();
+    }
+
+    // only set 1 of these is ever bound, set 0 stays the one from pbrMaterial
+    letc::Material &textureMaterial(const letc::Model &model)
+    {
+        auto &material = textureMaterials[&model];
+        if (!material)
+        {
+            material = std::make_unique<letc::Material>(*device, *allocator, *pbrLayout);
+            material->updateDescriptorImageInfo(1, 0, *model.baseColor, samplers->get());
+            material->updateDescriptorSet(1);
+        }
+        return *material;
     }
 
     ~App()
     {
+        device->graphicsTimeline->waitIdle();
         device->device.waitIdle();
+
+        gpuProfiler->resolveAll();
+        std::cout << gpuProfiler->summary();
+        std::cout << asyncCompute->summary();
+        std::cout << letc::StatsRegistry::get().summary();
+        std::cout << allocator->summary();
+        std::cout << defragmenter->summary();
+        std::cout << streamer->summary();
+        // imports still running call into pbrVariants
+        streamer.reset();
+#ifdef LETC_ENABLE_ZONES
+        std::cout << letc::ZoneRegistry::get().summary();
+#endif
+        if (const char *tracePath = std::getenv("LETC_TRACE"))
+        {
+            gpuProfiler->writeChromeTrace(tracePath, letc::ZoneRegistry::get().traceEvents(),
+                                          letc::ZoneRegistry::get().threadNames());
+        }
     }
 };
 